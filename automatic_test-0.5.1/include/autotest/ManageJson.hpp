@@ -104,7 +104,8 @@ int modifyJSON(std::string filePath,
     return SUCCESS;
 }
 
-int checkJson(flexiv::Robot* robotPtr, std::string filePath, std::string jsonFileName, flexiv::Log* logPtr){
+int checkJson(flexiv::Robot* robotPtr, std::string filePath, std::string jsonFileName, flexiv::Log* logPtr,
+              PlanProfiler* profilerPtr = nullptr){
     int result;
     g_realPlanList = robotPtr->getPlanNameList();
     for (std::string eachPlan : g_goalPlanList)
@@ -117,7 +118,7 @@ int checkJson(flexiv::Robot* robotPtr, std::string filePath, std::string jsonFil
             //execute the existed plan
             logPtr->info("Plan: "+eachPlan+" does exist");
             result = modifyJSON(filePath, jsonFileName, eachPlan, "Yes", "No", logPtr);
-            result = executeRobotPlan(robotPtr, eachPlan, logPtr);
+            result = executeRobotPlan(robotPtr, eachPlan, logPtr, profilerPtr);
             if (result==SUCCESS){
                 result = modifyJSON(filePath, jsonFileName, eachPlan, "Yes", "Yes", logPtr);
             }
@@ -0,0 +1,183 @@
+/**
+ * @file PlanProfiler.hpp
+ * @copyright Copyright (C) 2016-2022 Flexiv Ltd. All Rights Reserved.
+ */
+
+#ifndef FLEXIVRDK_PLANPROFILER_HPP_
+#define FLEXIVRDK_PLANPROFILER_HPP_
+// autotest headers
+#include <autotest/SystemParams.h>
+
+// The time of a plan in one of its nodes over all runs, in logarithmic buckets from 1 ms
+struct NodeProfile
+{
+    std::string name;
+    std::string path;
+    std::vector<int> buckets = std::vector<int>(g_profileBuckets, 0);
+    int runs = 0;
+    double minMs = 0;
+    double maxMs = 0;
+    double sumMs = 0;
+    double lastMs = -1;
+};
+
+// The nodes of a plan in the order it first entered them, and its cycle times
+struct PlanProfile
+{
+    std::vector<NodeProfile> nodes;
+    std::vector<double> cycleMs;
+};
+
+// Records when each plan entered and left its nodes, see executeRobotPlan
+class PlanProfiler
+{
+public:
+    // Start recording a run of a plan
+    void begin(std::string planName){
+        m_planName = planName;
+        m_node = -1;
+        m_runMs.clear();
+        m_begin = now();
+        m_enter = m_begin;
+    }
+
+    // The plan is in this node now, an empty name for none. A node name that repeats in
+    // several sub plans is a node of its own under every path.
+    void enter(std::string nodeName, std::string nodePath){
+        PlanProfile& plan = m_plans[m_planName];
+        if (m_node >= 0 && plan.nodes[m_node].name == nodeName && plan.nodes[m_node].path == nodePath){
+            return;
+        }
+        double time = now();
+        leave(time);
+        if (nodeName.empty()){
+            return;
+        }
+        m_node = -1;
+        for (size_t i = 0; i < plan.nodes.size(); i++){
+            if (plan.nodes[i].name == nodeName && plan.nodes[i].path == nodePath){
+                m_node = static_cast<int>(i);
+            }
+        }
+        if (m_node < 0){
+            NodeProfile node;
+            node.name = nodeName;
+            node.path = nodePath;
+            plan.nodes.push_back(node);
+            m_node = static_cast<int>(plan.nodes.size()) - 1;
+        }
+        m_enter = time;
+    }
+
+    // The plan ended, add the time of the run in each node to the profile
+    void end(){
+        PlanProfile& plan = m_plans[m_planName];
+        leave(now());
+        for (size_t i = 0; i < plan.nodes.size(); i++){
+            NodeProfile& node = plan.nodes[i];
+            node.lastMs = m_runMs.count(i) ? m_runMs[i] : -1;
+            if (node.lastMs < 0){
+                continue;
+            }
+            node.buckets[bucket(node.lastMs)]++;
+            node.minMs = node.runs == 0 ? node.lastMs : std::min(node.minMs, node.lastMs);
+            node.maxMs = std::max(node.maxMs, node.lastMs);
+            node.sumMs += node.lastMs;
+            node.runs++;
+        }
+        plan.cycleMs.push_back(now() - m_begin);
+    }
+
+    // Write per plan its cycle times and per node the runs, range, mean, p50 and p90 and the
+    // buckets [upper edge ms, count] that are not empty
+    int writeReport(std::string fileName, flexiv::Log* logPtr){
+        Json::Value report;
+        for (auto it = m_plans.begin(); it != m_plans.end(); it++){
+            Json::Value plan;
+            for (double cycle : it->second.cycleMs){
+                plan["cycle_ms"].append(cycle);
+            }
+            for (NodeProfile& node : it->second.nodes){
+                Json::Value nodeValue;
+                nodeValue["node"] = node.name;
+                nodeValue["path"] = node.path;
+                nodeValue["runs"] = node.runs;
+                nodeValue["min_ms"] = node.minMs;
+                nodeValue["max_ms"] = node.maxMs;
+                nodeValue["mean_ms"] = node.runs > 0 ? node.sumMs / node.runs : 0;
+                nodeValue["p50_ms"] = percentile(node, 0.5);
+                nodeValue["p90_ms"] = percentile(node, 0.9);
+                nodeValue["last_ms"] = node.lastMs;
+                for (int i = 0; i < g_profileBuckets; i++){
+                    if (node.buckets[i] > 0){
+                        Json::Value bucketValue;
+                        bucketValue.append(upperEdge(i));
+                        bucketValue.append(node.buckets[i]);
+                        nodeValue["buckets"].append(bucketValue);
+                    }
+                }
+                plan["nodes"].append(nodeValue);
+            }
+            report[it->first] = plan;
+        }
+        std::ofstream reportFile(fileName);
+        if (reportFile.fail())
+        {
+            logPtr->error("Failed to create plan profile: " + fileName);
+            return JSON;
+        }
+        Json::StyledWriter sw;
+        std::string answer = sw.write(report);
+        reportFile.write(answer.c_str(), answer.size());
+        reportFile.close();
+        return SUCCESS;
+    }
+
+private:
+    std::map<std::string, PlanProfile> m_plans;
+    std::string m_planName;
+    // the node the plan is in, -1 for none, entered at m_enter
+    int m_node = -1;
+    double m_begin = 0;
+    double m_enter = 0;
+    // the time of the running plan in each node, all visits summed
+    std::map<size_t, double> m_runMs;
+
+    static double now(){
+        return std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void leave(double time){
+        if (m_node >= 0){
+            m_runMs[m_node] += time - m_enter;
+            m_node = -1;
+        }
+    }
+
+    static int bucket(double ms){
+        if (ms < 1){
+            return 0;
+        }
+        int index = static_cast<int>(std::floor(std::log2(ms) * g_profileBucketsPerOctave)) + 1;
+        return std::min(index, g_profileBuckets - 1);
+    }
+
+    static double upperEdge(int bucket){
+        return std::exp2(static_cast<double>(bucket) / g_profileBucketsPerOctave);
+    }
+
+    // the upper edge of the bucket of a share of the runs, never above the longest run
+    static double percentile(const NodeProfile& node, double share){
+        int rank = std::max(1, static_cast<int>(std::ceil(share * node.runs)));
+        int seen = 0;
+        for (int i = 0; i < g_profileBuckets; i++){
+            seen += node.buckets[i];
+            if (seen >= rank){
+                return std::min(upperEdge(i), node.maxMs);
+            }
+        }
+        return node.maxMs;
+    }
+};
+#endif /* FLEXIVRDK_PLANPROFILER_HPP_ */
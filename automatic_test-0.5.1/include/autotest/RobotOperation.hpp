@@ -7,21 +7,35 @@
 #define FLEXIVRDK_ROBOTOPERATIONS_HPP_
 // autotest headers
 #include <autotest/SystemParams.h>
+#include <autotest/PlanProfiler.hpp>
 
-// This function make robot execute the plan and wait for it to finish
-int executeRobotPlan(flexiv::Robot* robot, std::string planName, flexiv::Log* logPtr){
+// This function make robot execute the plan and wait for it to finish,
+// the nodes it runs through are recorded by the profiler if one is given
+int executeRobotPlan(flexiv::Robot* robot, std::string planName, flexiv::Log* logPtr,
+                     PlanProfiler* profilerPtr = nullptr){
     flexiv::SystemStatus systemStatus;
+    flexiv::PlanInfo planInfo;
     robot->executePlanByName(planName);
     while (systemStatus.m_programRunning == false)
     {
         std::this_thread::sleep_for(std::chrono::milliseconds(1));
         robot->getSystemStatus(&systemStatus);
     }
+    if (profilerPtr != nullptr){
+        profilerPtr->begin(planName);
+    }
     while (systemStatus.m_programRunning == true)
     {
+        if (profilerPtr != nullptr){
+            robot->getPlanInfo(&planInfo);
+            profilerPtr->enter(planInfo.m_nodeName, planInfo.m_nodePath);
+        }
         std::this_thread::sleep_for(std::chrono::milliseconds(1));
         robot->getSystemStatus(&systemStatus);
     }
+    if (profilerPtr != nullptr){
+        profilerPtr->end();
+    }
     
     logPtr->info("Robot has executed plan: " + planName);
     return SUCCESS;
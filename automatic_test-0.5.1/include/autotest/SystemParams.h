@@ -20,9 +20,13 @@
 #include <thread>
 #include <chrono>
 #include <algorithm>
+#include <map>
 std::vector<std::string> g_goalPlanList;
 std::vector<std::string> g_realPlanList;
 enum Status{SUCCESS, ROBOT, CSV, JSON, UNKNOWN};
 std::string robotIP = "127.0.0.1"; // IP of the robot server
 std::string localIP = "127.0.0.1"; // IP of the workstation PC running this program
+// Node durations of the plan profile, in buckets per doubling from below 1 ms to above a minute
+const int g_profileBucketsPerOctave = 4;
+const int g_profileBuckets = g_profileBucketsPerOctave * 16 + 2;
 #endif /* FLEXIVRDK_SYSTEMPARAMS_HPP_ */
\ No newline at end of file
@@ -65,9 +65,12 @@ int main()
         std::string filePath = "/home/ae/flexiv_rdk_versions/flexiv_rdk_autotest/test/";
         std::string csvFileName = "list.csv";
         std::string jsonFileName = "list1.json";
+        // how long each plan spends in its nodes
+        PlanProfiler profiler;
         result = generateJSON(filePath, csvFileName, jsonFileName, &log);
-        result = checkJson(&robot, filePath, jsonFileName, &log);
+        result = checkJson(&robot, filePath, jsonFileName, &log, &profiler);
         result = readJSON(&robot, filePath, jsonFileName, &log);
+        result = profiler.writeReport(filePath + "plan_profile.json", &log);
         robot.setMode(flexiv::MODE_IDLE);
     } catch (const flexiv::Exception& e) {
         log.error(e.what());
@@ -0,0 +1,538 @@
+/*
+ * @file AsyncFileWriter.hpp
+ * @copyright Copyright (C) 2016-2022 Flexiv Ltd. All Rights Reserved.
+ */
+#ifndef FLEXIVRDK_ASYNCFILEWRITER_HPP_
+#define FLEXIVRDK_ASYNCFILEWRITER_HPP_
+
+// Kostal header files
+#include <kostal/SystemParams.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define KOSTAL_HAS_IO_URING
+#endif
+
+namespace kostal {
+
+    /**
+     * @brief Get the next number of a result file, the files of this process are numbered in
+     * the order they are started, so two results of one task in the same second keep apart
+     */
+    inline uint64_t nextResultSequence()
+    {
+        static std::atomic<uint64_t> sequence = {0};
+        return ++sequence;
+    }
+
+    /**
+     * @struct WriteBlock
+     * @brief A block of a file that is written asynchronously
+     */
+    struct WriteBlock
+    {
+        std::vector<char> data;
+        size_t size = 0;
+        // where the block goes in the file and how much of it is written
+        uint64_t offset = 0;
+        size_t written = 0;
+        struct iovec vector = {};
+    };
+
+    /**
+     * @class WriteQueue
+     * @brief Writes blocks to a file in the background, completions come back in any order
+     */
+    class WriteQueue
+    {
+    public:
+        virtual ~WriteQueue() = default;
+
+        /**
+         * @brief Start writing the part of a block from block->written on
+         * @return whether the write was queued
+         */
+        virtual bool submit(int fd, WriteBlock* block) = 0;
+
+        /**
+         * @brief Wait for one submitted write to complete
+         * @param[out] result the bytes written or -errno
+         * @return the block of the write
+         */
+        virtual WriteBlock* wait(int64_t* result) = 0;
+
+        virtual const char* name() const = 0;
+    };
+
+    /**
+     * @class PwriteQueue
+     * @brief A thread that writes the queued blocks with pwrite one after the other
+     */
+    class PwriteQueue : public WriteQueue
+    {
+    private:
+        std::mutex m_mutex;
+        std::condition_variable m_changed;
+        std::deque<std::pair<int, WriteBlock*>> m_pending;
+        std::deque<std::pair<WriteBlock*, int64_t>> m_done;
+        bool m_stopping = false;
+        std::thread m_thread;
+
+        void run()
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            while (true){
+                m_changed.wait(lock, [this]{ return m_stopping || !m_pending.empty(); });
+                if (m_pending.empty()){
+                    return;
+                }
+                auto job = m_pending.front();
+                m_pending.pop_front();
+                lock.unlock();
+                WriteBlock* block = job.second;
+                ssize_t result = pwrite(job.first, block->data.data() + block->written, block->size - block->written,
+                                        block->offset + block->written);
+                lock.lock();
+                m_done.emplace_back(block, result < 0 ? -errno : result);
+                m_changed.notify_all();
+            }
+        }
+
+    public:
+        PwriteQueue()
+        : m_thread([this]{ run(); })
+        {}
+
+        virtual ~PwriteQueue()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stopping = true;
+            }
+            m_changed.notify_all();
+            m_thread.join();
+        }
+
+        bool submit(int fd, WriteBlock* block) override
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_pending.emplace_back(fd, block);
+            }
+            m_changed.notify_all();
+            return true;
+        }
+
+        WriteBlock* wait(int64_t* result) override
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_changed.wait(lock, [this]{ return !m_done.empty(); });
+            auto done = m_done.front();
+            m_done.pop_front();
+            *result = done.second;
+            return done.first;
+        }
+
+        const char* name() const override{
+            return "pwrite thread";
+        }
+    };
+
+#ifdef KOSTAL_HAS_IO_URING
+    /**
+     * @class IoUringQueue
+     * @brief Writes the blocks through an io_uring of the kernel, set up with the raw system
+     * calls so no library is needed. The writes are IORING_OP_WRITEV, which every kernel with
+     * io_uring supports.
+     */
+    class IoUringQueue : public WriteQueue
+    {
+    private:
+        int m_ring = -1;
+        io_uring_params m_params = {};
+        void* m_sqRing = MAP_FAILED;
+        void* m_cqRing = MAP_FAILED;
+        size_t m_sqRingBytes = 0;
+        size_t m_cqRingBytes = 0;
+        io_uring_sqe* m_sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+        size_t m_sqesBytes = 0;
+
+        template <class T>
+        T* at(void* ring, uint32_t offset) const{
+            return reinterpret_cast<T*>(static_cast<char*>(ring) + offset);
+        }
+
+        int enter(unsigned submit, unsigned complete, unsigned flags)
+        {
+            return static_cast<int>(syscall(__NR_io_uring_enter, m_ring, submit, complete, flags, nullptr, 0));
+        }
+
+    public:
+        /**
+         * @param[in] entries the writes that can be in flight at once
+         */
+        explicit IoUringQueue(unsigned entries)
+        {
+            m_ring = static_cast<int>(syscall(__NR_io_uring_setup, entries, &m_params));
+            if (m_ring < 0){
+                return;
+            }
+            m_sqRingBytes = m_params.sq_off.array + m_params.sq_entries * sizeof(uint32_t);
+            m_cqRingBytes = m_params.cq_off.cqes + m_params.cq_entries * sizeof(io_uring_cqe);
+            m_sqesBytes = m_params.sq_entries * sizeof(io_uring_sqe);
+            m_sqRing = mmap(nullptr, m_sqRingBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring, IORING_OFF_SQ_RING);
+            m_cqRing = mmap(nullptr, m_cqRingBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring, IORING_OFF_CQ_RING);
+            m_sqes = static_cast<io_uring_sqe*>(mmap(nullptr, m_sqesBytes, PROT_READ | PROT_WRITE,
+                                                     MAP_SHARED | MAP_POPULATE, m_ring, IORING_OFF_SQES));
+        }
+
+        virtual ~IoUringQueue()
+        {
+            if (m_sqes != MAP_FAILED){
+                munmap(m_sqes, m_sqesBytes);
+            }
+            if (m_cqRing != MAP_FAILED){
+                munmap(m_cqRing, m_cqRingBytes);
+            }
+            if (m_sqRing != MAP_FAILED){
+                munmap(m_sqRing, m_sqRingBytes);
+            }
+            if (m_ring >= 0){
+                close(m_ring);
+            }
+        }
+
+        /**
+         * @brief Whether the kernel set the ring up, it may not have io_uring or forbid it
+         */
+        bool ready() const{
+            return m_ring >= 0 && m_sqRing != MAP_FAILED && m_cqRing != MAP_FAILED && m_sqes != MAP_FAILED;
+        }
+
+        bool submit(int fd, WriteBlock* block) override
+        {
+            uint32_t tail = __atomic_load_n(at<uint32_t>(m_sqRing, m_params.sq_off.tail), __ATOMIC_ACQUIRE);
+            uint32_t index = tail & *at<uint32_t>(m_sqRing, m_params.sq_off.ring_mask);
+            io_uring_sqe* sqe = &m_sqes[index];
+            std::memset(sqe, 0, sizeof(*sqe));
+            block->vector.iov_base = block->data.data() + block->written;
+            block->vector.iov_len = block->size - block->written;
+            sqe->opcode = IORING_OP_WRITEV;
+            sqe->fd = fd;
+            sqe->addr = reinterpret_cast<uint64_t>(&block->vector);
+            sqe->len = 1;
+            sqe->off = block->offset + block->written;
+            sqe->user_data = reinterpret_cast<uint64_t>(block);
+            at<uint32_t>(m_sqRing, m_params.sq_off.array)[index] = index;
+            __atomic_store_n(at<uint32_t>(m_sqRing, m_params.sq_off.tail), tail + 1, __ATOMIC_RELEASE);
+            // the entry is in flight once the kernel consumed it, until then it may not be recycled
+            int consumed;
+            do{
+                consumed = enter(1, 0, 0);
+            }while (consumed < 0 && (errno == EINTR || errno == EAGAIN));
+            // without a poll thread only io_uring_enter consumes entries, one it left can be taken back
+            if (consumed > 0 || __atomic_load_n(at<uint32_t>(m_sqRing, m_params.sq_off.head), __ATOMIC_ACQUIRE) != tail){
+                return true;
+            }
+            __atomic_store_n(at<uint32_t>(m_sqRing, m_params.sq_off.tail), tail, __ATOMIC_RELEASE);
+            return false;
+        }
+
+        WriteBlock* wait(int64_t* result) override
+        {
+            uint32_t* head = at<uint32_t>(m_cqRing, m_params.cq_off.head);
+            while (*head == __atomic_load_n(at<uint32_t>(m_cqRing, m_params.cq_off.tail), __ATOMIC_ACQUIRE)){
+                if (enter(0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR){
+                    *result = -errno;
+                    return nullptr;
+                }
+            }
+            uint32_t index = *head & *at<uint32_t>(m_cqRing, m_params.cq_off.ring_mask);
+            io_uring_cqe* cqe = &at<io_uring_cqe>(m_cqRing, m_params.cq_off.cqes)[index];
+            *result = cqe->res;
+            WriteBlock* block = reinterpret_cast<WriteBlock*>(cqe->user_data);
+            __atomic_store_n(head, *head + 1, __ATOMIC_RELEASE);
+            return block;
+        }
+
+        const char* name() const override{
+            return "io_uring";
+        }
+    };
+#endif
+
+    /**
+     * @class AsyncFileWriter
+     * @brief Writes a file under a temporary name next to its final one, in blocks of
+     * g_asyncWriteBytes that are written in the background while the next block fills, through
+     * io_uring where the kernel allows it and a pwrite thread otherwise. Only publish() gives the
+     * file its name, after everything is written and synced to the disk, so a crash leaves at
+     * most a hidden .part file and never a cut result under a final name.
+     */
+    class AsyncFileWriter
+    {
+    private:
+        int m_fd = -1;
+        std::string m_path;
+        std::string m_tempPath;
+        std::unique_ptr<WriteQueue> m_queue;
+        std::vector<std::unique_ptr<WriteBlock>> m_blocks;
+        std::vector<WriteBlock*> m_freeBlocks;
+        WriteBlock* m_current = nullptr;
+        size_t m_inFlight = 0;
+        uint64_t m_offset = 0;
+        // the first error of a write, 0 if none failed
+        int m_error = 0;
+
+        static std::unique_ptr<WriteQueue> makeQueue()
+        {
+#ifdef KOSTAL_HAS_IO_URING
+            if (g_ioUring){
+                auto ring = std::make_unique<IoUringQueue>(static_cast<unsigned>(g_asyncWriteBlocks));
+                if (ring->ready()){
+                    return ring;
+                }
+            }
+#endif
+            return std::make_unique<PwriteQueue>();
+        }
+
+        /** Wait for one write, a short one is submitted again for the rest */
+        void reap()
+        {
+            int64_t result = 0;
+            WriteBlock* block = m_queue->wait(&result);
+            if (block == nullptr){
+                // the queue lost its writes, the file is failed and every block is given back
+                m_error = m_error != 0 ? m_error : (result < 0 ? static_cast<int>(-result) : EIO);
+                m_freeBlocks.clear();
+                for (auto& owned : m_blocks){
+                    if (owned.get() != m_current){
+                        m_freeBlocks.push_back(owned.get());
+                    }
+                }
+                m_inFlight = 0;
+                return;
+            }
+            if (result < 0 || (result == 0 && block->written < block->size)){
+                m_error = m_error != 0 ? m_error : (result < 0 ? static_cast<int>(-result) : EIO);
+            }else{
+                block->written += result;
+                if (block->written < block->size){
+                    if (m_queue->submit(m_fd, block)){
+                        return;
+                    }
+                    m_error = m_error != 0 ? m_error : EIO;
+                }
+            }
+            m_inFlight--;
+            m_freeBlocks.push_back(block);
+        }
+
+        void submitCurrent()
+        {
+            if (m_current == nullptr || m_current->size == 0){
+                return;
+            }
+            if (m_error != 0){
+                // nothing more is written to a failed file
+                m_freeBlocks.push_back(m_current);
+                m_current = nullptr;
+                return;
+            }
+            m_current->offset = m_offset;
+            m_current->written = 0;
+            m_offset += m_current->size;
+            if (m_queue->submit(m_fd, m_current)){
+                m_inFlight++;
+            }else{
+                m_error = m_error != 0 ? m_error : EIO;
+                m_freeBlocks.push_back(m_current);
+            }
+            m_current = nullptr;
+        }
+
+        void waitAll()
+        {
+            submitCurrent();
+            while (m_inFlight > 0){
+                reap();
+            }
+        }
+
+    public:
+        AsyncFileWriter() = default;
+        virtual ~AsyncFileWriter()
+        {
+            abort();
+        }
+        AsyncFileWriter(const AsyncFileWriter&) = delete;
+        AsyncFileWriter& operator=(const AsyncFileWriter&) = delete;
+
+        /**
+         * @brief Get the temporary name of a file, hidden in the directory of its final name
+         */
+        static std::string tempPath(const std::string& path)
+        {
+            size_t slash = path.rfind('/');
+            size_t name = slash == std::string::npos ? 0 : slash + 1;
+            return path.substr(0, name) + "." + path.substr(name) + ".part";
+        }
+
+        /**
+         * @brief Create the temporary file of a result
+         * @param[in] path the name the file gets when it is published
+         * @return whether the file was created
+         */
+        bool open(const std::string& path)
+        {
+            abort();
+            m_path = path;
+            m_tempPath = tempPath(path);
+            m_fd = ::open(m_tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (m_fd < 0){
+                return false;
+            }
+            if (!m_queue){
+                m_queue = makeQueue();
+                for (size_t i=0; i<g_asyncWriteBlocks; i++){
+                    m_blocks.push_back(std::make_unique<WriteBlock>());
+                    m_blocks.back()->data.resize(g_asyncWriteBytes);
+                }
+            }
+            m_freeBlocks.clear();
+            for (auto& block : m_blocks){
+                m_freeBlocks.push_back(block.get());
+            }
+            m_current = nullptr;
+            m_inFlight = 0;
+            m_offset = 0;
+            m_error = 0;
+            return true;
+        }
+
+        bool is_open() const{
+            return m_fd >= 0;
+        }
+
+        /**
+         * @brief Append bytes to the file, only waits when every block is being written.
+         * Once a write failed nothing more is appended.
+         * @return whether no write failed so far
+         */
+        bool write(const char* data, size_t bytes)
+        {
+            while (bytes > 0 && m_fd >= 0 && m_error == 0){
+                if (m_current == nullptr){
+                    while (m_freeBlocks.empty() && m_error == 0){
+                        reap();
+                    }
+                    if (m_error != 0){
+                        break;
+                    }
+                    m_current = m_freeBlocks.back();
+                    m_freeBlocks.pop_back();
+                    m_current->size = 0;
+                }
+                size_t count = std::min(bytes, m_current->data.size() - m_current->size);
+                std::memcpy(m_current->data.data() + m_current->size, data, count);
+                m_current->size += count;
+                data += count;
+                bytes -= count;
+                if (m_current->size == m_current->data.size()){
+                    submitCurrent();
+                }
+            }
+            return m_error == 0;
+        }
+
+        /**
+         * @brief Start writing what is buffered without waiting for it
+         */
+        void flush()
+        {
+            submitCurrent();
+        }
+
+        /**
+         * @brief Wait until everything is written, sync the file and give it its final name.
+         * The name is only taken if no other file has it, an existing file is never replaced.
+         * @param[out] error why the file is not published, empty if it is
+         * @return whether the file is published
+         */
+        bool publish(std::string* error)
+        {
+            if (m_fd < 0){
+                *error = "the file is not open";
+                return false;
+            }
+            waitAll();
+            if (m_error == 0 && fsync(m_fd) != 0){
+                m_error = errno;
+            }
+            ::close(m_fd);
+            m_fd = -1;
+            if (m_error == 0 && link(m_tempPath.c_str(), m_path.c_str()) != 0){
+                m_error = errno;
+                // file systems without hard links can only rename, which would replace a file
+                if ((m_error == EPERM || m_error == EOPNOTSUPP || m_error == ENOSYS) && access(m_path.c_str(), F_OK) != 0){
+                    m_error = std::rename(m_tempPath.c_str(), m_path.c_str()) == 0 ? 0 : errno;
+                }
+            }
+            unlink(m_tempPath.c_str());
+            if (m_error != 0){
+                *error = std::strerror(m_error);
+                return false;
+            }
+            // the new name is only durable when the directory is synced too
+            size_t slash = m_path.rfind('/');
+            int directory = ::open(slash == std::string::npos ? "." : m_path.substr(0, slash + 1).c_str(), O_RDONLY | O_CLOEXEC);
+            if (directory >= 0){
+                fsync(directory);
+                ::close(directory);
+            }
+            error->clear();
+            return true;
+        }
+
+        /**
+         * @brief Drop the file, the temporary file is removed and nothing is published
+         */
+        void abort()
+        {
+            if (m_fd < 0){
+                return;
+            }
+            waitAll();
+            ::close(m_fd);
+            m_fd = -1;
+            unlink(m_tempPath.c_str());
+        }
+
+        /**
+         * @brief Get how the blocks are written, io_uring or pwrite thread
+         */
+        const char* queueName() const{
+            return m_queue ? m_queue->name() : "none";
+        }
+
+        /**
+         * @brief Get the bytes appended so far
+         */
+        uint64_t size() const{
+            return m_offset + (m_current != nullptr ? m_current->size : 0);
+        }
+    };
+
+} /* namespace kostal */
+
+#endif /* FLEXIVRDK_ASYNCFILEWRITER_HPP_ */
@@ -0,0 +1,130 @@
+/*
+ * @file CSVFormatter.hpp
+ * @copyright Copyright (C) 2016-2022 Flexiv Ltd. All Rights Reserved.
+ */
+#ifndef FLEXIVRDK_CSVFORMATTER_HPP_
+#define FLEXIVRDK_CSVFORMATTER_HPP_
+
+// Kostal header files
+#include <kostal/SystemParams.h>
+
+#include <charconv>
+
+namespace kostal {
+
+    /**
+     * @class CSVFormatter
+     * @brief Formats csv fields into a reusable character buffer that is written to the
+     * stream in blocks of g_csvBlockBytes. Doubles are written with std::to_chars in the
+     * shortest form that reads back to the same value, so no digit of a pose or force is
+     * lost, and no stream state carries over from one field to the next.
+     * Every field is followed by a comma, as in the result files.
+     */
+    class CSVFormatter
+    {
+    private:
+        // longest field of a number, shortest round trip doubles take at most 24 characters
+        static constexpr size_t maxNumberChars = 32;
+
+        std::vector<char> m_buffer;
+        size_t m_size = 0;
+
+        char* reserve(size_t chars)
+        {
+            if (m_size + chars > m_buffer.size()){
+                m_buffer.resize(std::max(m_buffer.size() * 2, m_size + chars));
+            }
+            return m_buffer.data() + m_size;
+        }
+
+    public:
+        CSVFormatter()
+        : m_buffer(g_csvBlockBytes + 4096)
+        {}
+        virtual ~CSVFormatter() = default;
+
+        /** Write a double, shortest round trip */
+        void field(double value)
+        {
+            char* first = reserve(maxNumberChars + 1);
+            char* last = std::to_chars(first, first + maxNumberChars, value).ptr;
+            *last++ = ',';
+            m_size = last - m_buffer.data();
+        }
+
+        /** Write an integer */
+        void field(int64_t value)
+        {
+            char* first = reserve(maxNumberChars + 1);
+            char* last = std::to_chars(first, first + maxNumberChars, value).ptr;
+            *last++ = ',';
+            m_size = last - m_buffer.data();
+        }
+
+        void field(uint64_t value)
+        {
+            char* first = reserve(maxNumberChars + 1);
+            char* last = std::to_chars(first, first + maxNumberChars, value).ptr;
+            *last++ = ',';
+            m_size = last - m_buffer.data();
+        }
+
+        /** Write a byte as two lower case hex digits */
+        void hexField(uint8_t value)
+        {
+            static const char digits[] = "0123456789abcdef";
+            char* out = reserve(3);
+            out[0] = digits[value >> 4];
+            out[1] = digits[value & 15];
+            out[2] = ',';
+            m_size += 3;
+        }
+
+        /** Write a text as it is, it must not hold commas or line breaks */
+        void field(std::string_view text)
+        {
+            char* out = reserve(text.size() + 1);
+            std::memcpy(out, text.data(), text.size());
+            out[text.size()] = ',';
+            m_size += text.size() + 1;
+        }
+
+        /** Write an empty field */
+        void empty(size_t fields = 1)
+        {
+            std::memset(reserve(fields), ',', fields);
+            m_size += fields;
+        }
+
+        /**
+         * @brief Finish a row, the buffer is written to the stream once it holds a block
+         */
+        void endRow(std::ostream& out)
+        {
+            *reserve(1) = '\n';
+            m_size++;
+            if (m_size >= g_csvBlockBytes){
+                flush(out);
+            }
+        }
+
+        /**
+         * @brief Write what is buffered to the stream
+         */
+        void flush(std::ostream& out)
+        {
+            out.write(m_buffer.data(), static_cast<std::streamsize>(m_size));
+            m_size = 0;
+        }
+
+        /**
+         * @brief Get the characters buffered and not written yet
+         */
+        std::string_view buffered() const{
+            return std::string_view(m_buffer.data(), m_size);
+        }
+    };
+
+} /* namespace kostal */
+
+#endif /* FLEXIVRDK_CSVFORMATTER_HPP_ */
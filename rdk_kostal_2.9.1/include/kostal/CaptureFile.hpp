@@ -0,0 +1,610 @@
+/*
+ * @file CaptureFile.hpp
+ * @copyright Copyright (C) 2016-2022 Flexiv Ltd. All Rights Reserved.
+ */
+#ifndef FLEXIVRDK_CAPTUREFILE_HPP_
+#define FLEXIVRDK_CAPTUREFILE_HPP_
+
+// Kostal header files
+#include <kostal/SystemParams.h>
+#include <kostal/CaptureStore.hpp>
+#include <kostal/SPISource.hpp>
+#include <kostal/WriteExcel.hpp>
+#include <kostal/ResultCompression.hpp>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace kostal {
+
+    /**
+     * The binary capture file, little endian as the hosts it is written on:
+     *
+     *   CaptureFileHeader   magic, version, row counts, station and spi bus settings
+     *   metadata            task type, task name, spi source and node names, each a
+     *                       uint32 length followed by the characters
+     *   column schema       one CaptureColumnSchema per column
+     *   column blocks       the rows of one column each, g_captureFileAlignment aligned
+     *   block index         one CaptureBlockEntry per block
+     *   CaptureFileFooter   where the index starts, magic
+     *
+     * A column holds `width` values of its type per row, the rows of a column are in one
+     * block, so a reader maps the file and uses every column in place.
+     */
+    namespace capture_file {
+
+        const char g_headerMagic[8] = {'K', 'O', 'S', 'T', 'A', 'L', 'C', 'P'};
+        const char g_footerMagic[8] = {'K', 'C', 'P', 'I', 'N', 'D', 'E', 'X'};
+        const uint32_t g_version = 1;
+
+        /** The columns of a capture file */
+        enum Column : uint32_t
+        {
+            TCPPOSE, FLANGEPOSE, RAWFORCE, TIMESTAMP, NODEID, SPIFRAME, SPITIMESTAMP, SPISEQUENCE, COLUMNCOUNT
+        };
+
+        /** The types of the values in a column */
+        enum ValueType : uint32_t
+        {
+            FLOAT64, INT64, UINT64, UINT32, UINT8
+        };
+
+        struct CaptureFileHeader
+        {
+            char magic[8];
+            uint32_t version;
+            // bytes of the metadata that follows the header
+            uint32_t metadataBytes;
+            uint64_t samples;
+            uint64_t frames;
+            int32_t stationId;
+            int32_t CPHA;
+            int32_t CPOL;
+            int32_t LSB;
+            int32_t SelPol;
+            uint32_t nodeCount;
+            uint32_t columnCount;
+            uint32_t reserved;
+        };
+
+        struct CaptureColumnSchema
+        {
+            uint32_t column;
+            uint32_t type;
+            // values per row
+            uint32_t width;
+            // the rows come from the samples (0) or the spi frames (1)
+            uint32_t table;
+            char name[24];
+        };
+
+        struct CaptureBlockEntry
+        {
+            uint32_t column;
+            uint32_t reserved;
+            uint64_t rows;
+            uint64_t offset;
+            uint64_t bytes;
+        };
+
+        struct CaptureFileFooter
+        {
+            uint64_t indexOffset;
+            uint32_t blockCount;
+            uint32_t reserved;
+            char magic[8];
+        };
+
+        /** The schema every file of this version is written with */
+        const CaptureColumnSchema g_schema[COLUMNCOUNT] = {
+            {TCPPOSE, FLOAT64, 7, 0, "tcp_pose"},
+            {FLANGEPOSE, FLOAT64, 7, 0, "flange_pose"},
+            {RAWFORCE, FLOAT64, 6, 0, "raw_force"},
+            {TIMESTAMP, INT64, 1, 0, "timestamp_ns"},
+            {NODEID, UINT32, 1, 0, "node_id"},
+            {SPIFRAME, UINT8, 16, 1, "spi_frame"},
+            {SPITIMESTAMP, INT64, 1, 1, "spi_timestamp_ns"},
+            {SPISEQUENCE, UINT64, 1, 1, "spi_sequence"},
+        };
+
+        inline size_t valueBytes(uint32_t type)
+        {
+            static const size_t bytes[] = {8, 8, 8, 4, 1};
+            return type < 5 ? bytes[type] : 0;
+        }
+
+    } /* namespace capture_file */
+
+    /**
+     * @struct CaptureFileInfo
+     * @brief What a capture file records besides the samples and frames
+     */
+    struct CaptureFileInfo
+    {
+        std::string taskType;
+        std::string taskName;
+        int stationId = 0;
+        SPIConfig spiConfig;
+    };
+
+    /**
+     * @struct ColumnSpan
+     * @brief The rows of one column inside a mapped capture file, width values per row
+     */
+    template <class T>
+    struct ColumnSpan
+    {
+        const T* data = nullptr;
+        size_t rows = 0;
+        size_t width = 1;
+
+        /** Get the first value of a row */
+        const T* operator[](size_t row) const{
+            return data + row * width;
+        }
+
+        size_t size() const{
+            return rows;
+        }
+
+        bool empty() const{
+            return rows == 0;
+        }
+    };
+
+    /**
+     * @class CaptureFileWriter
+     * @brief Writes the samples and spi frames of a plan as a binary capture file, each column
+     * copied from the chunks of the stores as it is. A sample takes 172 bytes and a frame 32,
+     * about a fifth of the csv row they become.
+     */
+    class CaptureFileWriter
+    {
+    public:
+        CaptureFileWriter() = default;
+        virtual ~CaptureFileWriter() = default;
+
+        /**
+         * @brief Get the path of a new capture file under the upload address
+         * @param[in] taskType the type of the task, the directory of the file
+         * @param[in] taskName the name of the task, followed by the current time
+         */
+        static std::string capturePath(const std::string& taskType, const std::string& taskName)
+        {
+            return UPLOADADDRESS + taskType + "/" + taskName + getResultStamp() + ".kcap";
+        }
+
+        /**
+         * @brief Write a capture file
+         * @param[in] fileName the path of the file
+         * @param[in] info the task, station and spi settings of the capture
+         * @param[in] capture the captured robot samples
+         * @param[in] spiFrames the captured spi frames
+         * @param[in] logPtr robot's log pointer
+         * @param[in] compression how the file is compressed, a compressed file has to be
+         * decompressed before CaptureFileReader maps it
+         * @return Status code, CSV if the file could not be written
+         */
+        Status write(const std::string& fileName, const CaptureFileInfo& info, const CaptureStore& capture,
+                     const SPIFrameStore& spiFrames, flexiv::Log* logPtr,
+                     const ResultCompression& compression = ResultCompression())
+        {
+            using namespace capture_file;
+            CompressedFile file;
+            file.open(fileName, compression);
+            if (!file.is_open()){
+                logPtr->error("The capture file is not created correctly");
+                return CSV;
+            }
+
+            std::string metadata;
+            auto addString = [&metadata](const std::string& text){
+                uint32_t length = static_cast<uint32_t>(text.size());
+                metadata.append(reinterpret_cast<const char*>(&length), sizeof(length));
+                metadata.append(text);
+            };
+            addString(info.taskType);
+            addString(info.taskName);
+            addString(info.spiConfig.source);
+            for (const std::string& name : capture.nodeNames()){
+                addString(name);
+            }
+
+            CaptureFileHeader header = {};
+            std::memcpy(header.magic, g_headerMagic, sizeof(header.magic));
+            header.version = g_version;
+            header.metadataBytes = static_cast<uint32_t>(metadata.size());
+            header.samples = capture.size();
+            header.frames = spiFrames.size();
+            header.stationId = info.stationId;
+            header.CPHA = info.spiConfig.CPHA;
+            header.CPOL = info.spiConfig.CPOL;
+            header.LSB = info.spiConfig.LSB;
+            header.SelPol = info.spiConfig.SelPol;
+            header.nodeCount = static_cast<uint32_t>(capture.nodeNames().size());
+            header.columnCount = COLUMNCOUNT;
+            uint64_t offset = 0;
+            put(file, &header, sizeof(header), &offset);
+            put(file, metadata.data(), metadata.size(), &offset);
+            put(file, g_schema, sizeof(g_schema), &offset);
+
+            std::vector<CaptureBlockEntry> index;
+            for (const CaptureColumnSchema& schema : g_schema){
+                pad(file, &offset);
+                CaptureBlockEntry block = {};
+                block.column = schema.column;
+                block.rows = schema.table == 0 ? capture.size() : spiFrames.size();
+                block.offset = offset;
+                block.bytes = block.rows * schema.width * valueBytes(schema.type);
+                writeColumn(file, static_cast<Column>(schema.column), capture, spiFrames, &offset);
+                index.push_back(block);
+            }
+
+            pad(file, &offset);
+            CaptureFileFooter footer = {};
+            footer.indexOffset = offset;
+            footer.blockCount = static_cast<uint32_t>(index.size());
+            std::memcpy(footer.magic, g_footerMagic, sizeof(footer.magic));
+            put(file, index.data(), index.size() * sizeof(CaptureBlockEntry), &offset);
+            put(file, &footer, sizeof(footer), &offset);
+            file.close();
+            if (file.fail()){
+                logPtr->error("The capture file is not written correctly");
+                return CSV;
+            }
+            return SUCCESS;
+        }
+
+    private:
+        static void put(std::ostream& file, const void* data, size_t bytes, uint64_t* offset)
+        {
+            file.write(static_cast<const char*>(data), static_cast<std::streamsize>(bytes));
+            *offset += bytes;
+        }
+
+        static void pad(std::ostream& file, uint64_t* offset)
+        {
+            static const char zeros[g_captureFileAlignment] = {};
+            put(file, zeros, (g_captureFileAlignment - *offset % g_captureFileAlignment) % g_captureFileAlignment, offset);
+        }
+
+        /**
+         * @brief Write the rows of a column, the rows of one chunk at a time
+         */
+        static void writeColumn(std::ostream& file, capture_file::Column column, const CaptureStore& capture,
+                                const SPIFrameStore& spiFrames, uint64_t* offset)
+        {
+            using namespace capture_file;
+            if (column == NODEID){
+                std::vector<uint32_t> nodeIds;
+                nodeIds.reserve(g_captureChunkSamples);
+                const std::vector<NodeSegment>& segments = capture.segments();
+                size_t segment = 0;
+                for (size_t i=0; i<capture.size(); i++){
+                    while (segment + 1 < segments.size() && segments[segment + 1].firstSample <= i){
+                        segment++;
+                    }
+                    nodeIds.push_back(segments[segment].nodeId);
+                    if (nodeIds.size() == g_captureChunkSamples || i + 1 == capture.size()){
+                        put(file, nodeIds.data(), nodeIds.size() * sizeof(uint32_t), offset);
+                        nodeIds.clear();
+                    }
+                }
+                return;
+            }
+            size_t rows = g_schema[column].table == 0 ? capture.size() : spiFrames.size();
+            size_t rowBytes = g_schema[column].width * valueBytes(g_schema[column].type);
+            for (size_t i=0; i<rows; i+=g_captureChunkSamples){
+                size_t count = std::min(rows - i, g_captureChunkSamples);
+                const void* first = nullptr;
+                switch (column){
+                    case TCPPOSE: first = capture.tcpPose(i); break;
+                    case FLANGEPOSE: first = capture.flangePose(i); break;
+                    case RAWFORCE: first = capture.rawForce(i); break;
+                    case TIMESTAMP: first = capture.timestampColumn(i); break;
+                    case SPIFRAME: first = spiFrames.frame(i); break;
+                    case SPITIMESTAMP: first = spiFrames.timestampColumn(i); break;
+                    case SPISEQUENCE: first = spiFrames.sequenceColumn(i); break;
+                    default: break;
+                }
+                put(file, first, count * rowBytes, offset);
+            }
+        }
+    };
+
+    /**
+     * @class CaptureFileReader
+     * @brief Maps a capture file into memory and gives its columns as spans into the mapping,
+     * nothing is copied. The spans are valid until the reader is closed or destroyed.
+     */
+    class CaptureFileReader
+    {
+    private:
+        const char* m_data = nullptr;
+        size_t m_bytes = 0;
+        CaptureFileInfo m_info;
+        std::vector<std::string> m_nodeNames;
+        size_t m_samples = 0;
+        size_t m_frames = 0;
+        // the first byte of every column in the mapping
+        std::array<const char*, capture_file::COLUMNCOUNT> m_columns = {};
+
+    public:
+        CaptureFileReader() = default;
+        virtual ~CaptureFileReader()
+        {
+            close();
+        }
+        CaptureFileReader(const CaptureFileReader&) = delete;
+        CaptureFileReader& operator=(const CaptureFileReader&) = delete;
+
+        /**
+         * @brief Map a capture file and check its header, schema and block index
+         * @param[in] fileName the path of the file
+         * @param[in] logPtr robot's log pointer
+         * @return Status code, CSV if the file can not be read or is not a capture file
+         */
+        Status open(const std::string& fileName, flexiv::Log* logPtr)
+        {
+            using namespace capture_file;
+            close();
+            int fd = ::open(fileName.c_str(), O_RDONLY);
+            if (fd < 0){
+                logPtr->error("The capture file " + fileName + " can not be opened");
+                return CSV;
+            }
+            struct stat status;
+            if (fstat(fd, &status) != 0 || status.st_size < static_cast<off_t>(sizeof(CaptureFileHeader) + sizeof(CaptureFileFooter))){
+                ::close(fd);
+                logPtr->error("The capture file " + fileName + " is too short");
+                return CSV;
+            }
+            void* mapping = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+            if (mapping == MAP_FAILED){
+                logPtr->error("The capture file " + fileName + " can not be mapped");
+                return CSV;
+            }
+            m_data = static_cast<const char*>(mapping);
+            m_bytes = status.st_size;
+            std::string error = parse();
+            if (!error.empty()){
+                close();
+                logPtr->error("The capture file " + fileName + " is broken: " + error);
+                return CSV;
+            }
+            return SUCCESS;
+        }
+
+        /**
+         * @brief Unmap the file, the spans taken from it are invalid afterwards
+         */
+        void close()
+        {
+            if (m_data != nullptr){
+                munmap(const_cast<char*>(m_data), m_bytes);
+            }
+            m_data = nullptr;
+            m_bytes = 0;
+            m_samples = 0;
+            m_frames = 0;
+            m_nodeNames.clear();
+            m_columns.fill(nullptr);
+        }
+
+        const CaptureFileInfo& info() const{
+            return m_info;
+        }
+
+        const std::vector<std::string>& nodeNames() const{
+            return m_nodeNames;
+        }
+
+        size_t samples() const{
+            return m_samples;
+        }
+
+        size_t frames() const{
+            return m_frames;
+        }
+
+        ColumnSpan<double> tcpPose() const{
+            return span<double>(capture_file::TCPPOSE);
+        }
+
+        ColumnSpan<double> flangePose() const{
+            return span<double>(capture_file::FLANGEPOSE);
+        }
+
+        ColumnSpan<double> rawForce() const{
+            return span<double>(capture_file::RAWFORCE);
+        }
+
+        ColumnSpan<int64_t> timestamp() const{
+            return span<int64_t>(capture_file::TIMESTAMP);
+        }
+
+        ColumnSpan<uint32_t> nodeId() const{
+            return span<uint32_t>(capture_file::NODEID);
+        }
+
+        ColumnSpan<uint8_t> spiFrame() const{
+            return span<uint8_t>(capture_file::SPIFRAME);
+        }
+
+        ColumnSpan<int64_t> spiTimestamp() const{
+            return span<int64_t>(capture_file::SPITIMESTAMP);
+        }
+
+        ColumnSpan<uint64_t> spiSequence() const{
+            return span<uint64_t>(capture_file::SPISEQUENCE);
+        }
+
+        /**
+         * @brief Copy the samples and frames into stores, e.g. to write them as csv
+         * @param[out] capture the store the samples are appended to
+         * @param[out] spiFrames the store the frames are appended to
+         */
+        void load(CaptureStore* capture, SPIFrameStore* spiFrames) const
+        {
+            capture->reserve(capture->size() + m_samples);
+            spiFrames->reserve(spiFrames->size() + m_frames);
+            auto tcp = tcpPose(), flange = flangePose(), force = rawForce();
+            auto time = timestamp();
+            auto node = nodeId();
+            std::vector<uint32_t> ids;
+            for (const std::string& name : m_nodeNames){
+                ids.push_back(capture->internNode(name));
+            }
+            for (size_t i=0; i<m_samples; i++){
+                capture->append(tcp[i], flange[i], force[i], ids[*node[i]], *time[i]);
+            }
+            auto frame = spiFrame();
+            auto frameTime = spiTimestamp();
+            auto sequence = spiSequence();
+            for (size_t i=0; i<m_frames; i++){
+                spiFrames->append(frame[i], *frameTime[i], *sequence[i]);
+            }
+        }
+
+    private:
+        template <class T>
+        ColumnSpan<T> span(capture_file::Column column) const
+        {
+            ColumnSpan<T> span;
+            span.data = reinterpret_cast<const T*>(m_columns[column]);
+            span.rows = capture_file::g_schema[column].table == 0 ? m_samples : m_frames;
+            span.width = capture_file::g_schema[column].width;
+            return span;
+        }
+
+        /**
+         * @brief Check the mapped file and find its columns
+         * @return why the file can not be used, empty if it can
+         */
+        std::string parse()
+        {
+            using namespace capture_file;
+            CaptureFileHeader header;
+            std::memcpy(&header, m_data, sizeof(header));
+            if (std::memcmp(header.magic, g_headerMagic, sizeof(header.magic)) != 0){
+                return "not a capture file";
+            }
+            if (header.version != g_version){
+                return "version " + std::to_string(header.version) + " is not supported";
+            }
+            CaptureFileFooter footer;
+            std::memcpy(&footer, m_data + m_bytes - sizeof(footer), sizeof(footer));
+            if (std::memcmp(footer.magic, g_footerMagic, sizeof(footer.magic)) != 0){
+                return "the block index is missing, the file was not finished";
+            }
+            m_samples = header.samples;
+            m_frames = header.frames;
+            m_info.stationId = header.stationId;
+            m_info.spiConfig.CPHA = header.CPHA;
+            m_info.spiConfig.CPOL = header.CPOL;
+            m_info.spiConfig.LSB = header.LSB;
+            m_info.spiConfig.SelPol = header.SelPol;
+
+            size_t position = sizeof(header);
+            size_t metadataEnd = position + header.metadataBytes;
+            if (metadataEnd > m_bytes){
+                return "the metadata is cut off";
+            }
+            auto readString = [&](std::string* text){
+                uint32_t length;
+                if (position + sizeof(length) > metadataEnd){
+                    return false;
+                }
+                std::memcpy(&length, m_data + position, sizeof(length));
+                position += sizeof(length);
+                if (length > metadataEnd - position){
+                    return false;
+                }
+                text->assign(m_data + position, length);
+                position += length;
+                return true;
+            };
+            if (!readString(&m_info.taskType) || !readString(&m_info.taskName) || !readString(&m_info.spiConfig.source)){
+                return "the metadata is cut off";
+            }
+            m_nodeNames.resize(header.nodeCount);
+            for (std::string& name : m_nodeNames){
+                if (!readString(&name)){
+                    return "the node names are cut off";
+                }
+            }
+
+            if (header.columnCount != COLUMNCOUNT || metadataEnd + sizeof(g_schema) > m_bytes
+                || std::memcmp(m_data + metadataEnd, g_schema, sizeof(g_schema)) != 0){
+                return "the column schema differs";
+            }
+            if (footer.indexOffset > m_bytes - sizeof(footer)
+                || footer.blockCount > (m_bytes - sizeof(footer) - footer.indexOffset) / sizeof(CaptureBlockEntry)){
+                return "the block index is out of the file";
+            }
+            for (uint32_t i=0; i<footer.blockCount; i++){
+                CaptureBlockEntry block;
+                std::memcpy(&block, m_data + footer.indexOffset + i * sizeof(block), sizeof(block));
+                if (block.column >= COLUMNCOUNT){
+                    continue;
+                }
+                const CaptureColumnSchema& schema = g_schema[block.column];
+                size_t rows = schema.table == 0 ? m_samples : m_frames;
+                if (block.rows != rows || block.bytes != rows * schema.width * valueBytes(schema.type)
+                    || block.offset % g_captureFileAlignment != 0 || block.offset > footer.indexOffset
+                    || block.bytes > footer.indexOffset - block.offset){
+                    return std::string("the block of ") + schema.name + " does not fit";
+                }
+                m_columns[block.column] = m_data + block.offset;
+            }
+            for (size_t column=0; column<COLUMNCOUNT; column++){
+                if (m_columns[column] == nullptr){
+                    return std::string("the column ") + g_schema[column].name + " is missing";
+                }
+            }
+            for (size_t i=0; i<m_samples; i++){
+                if (*span<uint32_t>(NODEID)[i] >= m_nodeNames.size()){
+                    return "a node id has no name";
+                }
+            }
+            return "";
+        }
+    };
+
+    /**
+     * @brief Write a capture file as a result csv, in the layout writeDataToExcel() writes
+     * @param[in] captureFileName the path of the capture file
+     * @param[in] excelFileName the path of the csv file
+     * @param[in] logPtr robot's log pointer
+     * @return Status code, CSV if either file fails
+     */
+    inline Status convertCaptureToCSV(const std::string& captureFileName, const std::string& excelFileName,
+                                      flexiv::Log* logPtr)
+    {
+        CaptureFileReader reader;
+        Status result = reader.open(captureFileName, logPtr);
+        if (result != SUCCESS){
+            return result;
+        }
+        kostal::CaptureStore capture;
+        kostal::SPIFrameStore spiFrames;
+        reader.load(&capture, &spiFrames);
+        reader.close();
+        std::ofstream excelFile(excelFileName, std::ios::out | std::ios::trunc);
+        if (!excelFile.is_open()){
+            logPtr->error("The associated excel file is not created correctly");
+            return CSV;
+        }
+        ResultRowWriter::writeHeader(excelFile);
+        ResultRowWriter rows(capture, spiFrames);
+        rows.writeRows(excelFile, capture.size());
+        excelFile.close();
+        return excelFile.fail() ? CSV : SUCCESS;
+    }
+
+} /* namespace kostal */
+
+#endif /* FLEXIVRDK_CAPTUREFILE_HPP_ */
@@ -0,0 +1,156 @@
+/*
+ * @file CaptureStats.hpp
+ * @copyright Copyright (C) 2016-2022 Flexiv Ltd. All Rights Reserved.
+ */
+#ifndef FLEXIVRDK_CAPTURESTATS_HPP_
+#define FLEXIVRDK_CAPTURESTATS_HPP_
+
+// Kostal header files
+#include <kostal/SystemParams.h>
+
+#include <cmath>
+#include <limits>
+
+namespace kostal {
+
+    /**
+     * @struct ChannelStats
+     * @brief Count, range, mean and variance of one channel, updated sample by sample with
+     * Welford's method so nothing but the aggregates is kept
+     */
+    struct ChannelStats
+    {
+        uint64_t count = 0;
+        double min = std::numeric_limits<double>::infinity();
+        double max = -std::numeric_limits<double>::infinity();
+        double mean = 0;
+        // sum of squared differences from the mean
+        double m2 = 0;
+
+        void add(double value)
+        {
+            count++;
+            min = std::min(min, value);
+            max = std::max(max, value);
+            double delta = value - mean;
+            mean += delta / count;
+            m2 += delta * (value - mean);
+        }
+
+        /** Combine with the stats of other samples of the same channel */
+        void merge(const ChannelStats& other)
+        {
+            if (other.count == 0){
+                return;
+            }
+            uint64_t total = count + other.count;
+            double delta = other.mean - mean;
+            mean += delta * other.count / total;
+            m2 += other.m2 + delta * delta * count * other.count / total;
+            count = total;
+            min = std::min(min, other.min);
+            max = std::max(max, other.max);
+        }
+
+        double stddev() const{
+            return count > 1 ? std::sqrt(m2 / (count - 1)) : 0;
+        }
+
+        double range() const{
+            return count > 0 ? max - min : 0;
+        }
+    };
+
+    /** The channels kept per node, named like the columns of the result file */
+    enum StatsChannel{TCP_X, TCP_Y, TCP_Z, FLANGE_X, FLANGE_Y, FLANGE_Z,
+                      FORCE_0, FORCE_1, FORCE_2, FORCE_3, FORCE_4, FORCE_5, FORCE_NORM, STATS_CHANNELS};
+    const char* const g_statsChannelNames[STATS_CHANNELS] = {
+        "TCP_x", "TCP_y", "TCP_z", "FLANGE_x", "FLANGE_y", "FLANGE_z",
+        "RowDataSensor0", "RowDataSensor1", "RowDataSensor2", "RowDataSensor3", "RowDataSensor4",
+        "RowDataSensor5", "ForceNorm"};
+
+    /**
+     * @struct NodeStats
+     * @brief The aggregates of the samples of one node segment, or of every segment of a node
+     */
+    struct NodeStats
+    {
+        uint64_t samples = 0;
+        int64_t firstTimestamp = 0;
+        int64_t lastTimestamp = 0;
+        // distance the tcp moved, summed sample to sample [m]
+        double tcpTravel = 0;
+        std::array<ChannelStats, STATS_CHANNELS> channels;
+        double lastTcp[3] = {0, 0, 0};
+
+        /**
+         * @brief Add one sample, a few comparisons and additions per channel
+         */
+        void add(const double* tcpPose, const double* flangePose, const double* rawForce, int64_t timestamp)
+        {
+            if (samples == 0){
+                firstTimestamp = timestamp;
+            }else{
+                double dx = tcpPose[0] - lastTcp[0], dy = tcpPose[1] - lastTcp[1], dz = tcpPose[2] - lastTcp[2];
+                tcpTravel += std::sqrt(dx * dx + dy * dy + dz * dz);
+            }
+            std::copy(tcpPose, tcpPose + 3, lastTcp);
+            samples++;
+            lastTimestamp = timestamp;
+            for (int i=0; i<3; i++){
+                channels[TCP_X + i].add(tcpPose[i]);
+                channels[FLANGE_X + i].add(flangePose[i]);
+            }
+            for (int i=0; i<6; i++){
+                channels[FORCE_0 + i].add(rawForce[i]);
+            }
+            channels[FORCE_NORM].add(std::sqrt(rawForce[0] * rawForce[0] + rawForce[1] * rawForce[1]
+                                               + rawForce[2] * rawForce[2]));
+        }
+
+        /** Combine with the stats of a later segment of the same node */
+        void merge(const NodeStats& other)
+        {
+            if (other.samples == 0){
+                return;
+            }
+            if (samples == 0){
+                firstTimestamp = other.firstTimestamp;
+            }
+            samples += other.samples;
+            lastTimestamp = std::max(lastTimestamp, other.lastTimestamp);
+            tcpTravel += other.tcpTravel;
+            for (int i=0; i<STATS_CHANNELS; i++){
+                channels[i].merge(other.channels[i]);
+            }
+        }
+
+        /**
+         * @brief The stats as json: samples, duration, peak force and tcp travel, and per
+         * channel [min, max, mean, stddev]
+         */
+        Json::Value toJson() const
+        {
+            Json::Value value;
+            value["samples"] = Json::UInt64(samples);
+            value["duration_us"] = Json::Int64((lastTimestamp - firstTimestamp) / 1000);
+            value["peak_force"] = samples > 0 ? channels[FORCE_NORM].max : 0.0;
+            value["tcp_travel"] = tcpTravel;
+            Json::Value channelValues;
+            for (int i=0; i<STATS_CHANNELS; i++){
+                const ChannelStats& channel = channels[i];
+                Json::Value stats(Json::arrayValue);
+                stats.append(channel.count > 0 ? channel.min : 0.0);
+                stats.append(channel.count > 0 ? channel.max : 0.0);
+                stats.append(channel.mean);
+                stats.append(channel.stddev());
+                channelValues[g_statsChannelNames[i]] = stats;
+            }
+            value["channels"] = channelValues;
+            return value;
+        }
+    };
+
+} /* namespace kostal */
+
+#endif /* FLEXIVRDK_CAPTURESTATS_HPP_ */
@@ -0,0 +1,470 @@
+/*
+ * @file CaptureStore.hpp
+ * @copyright Copyright (C) 2016-2022 Flexiv Ltd. All Rights Reserved.
+ */
+#ifndef FLEXIVRDK_CAPTURESTORE_HPP_
+#define FLEXIVRDK_CAPTURESTORE_HPP_
+
+// Kostal header files
+#include <kostal/SystemParams.h>
+#include <kostal/CaptureStats.hpp>
+
+#include <memory>
+
+namespace kostal {
+
+    /**
+     * @brief Get the steady clock time stored with a robot sample or spi frame
+     * @return nanoseconds since the steady clock epoch
+     */
+    inline int64_t captureTime()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    /**
+     * @struct CaptureChunk
+     * @brief A fixed number of robot samples stored column by column, every column is one
+     * plain array so a sample never owns heap memory
+     */
+    struct CaptureChunk
+    {
+        double tcpPose[g_captureChunkSamples][7];
+        double flangePose[g_captureChunkSamples][7];
+        double rawForce[g_captureChunkSamples][6];
+        // steady clock time of the sample in nanoseconds
+        int64_t timestamp[g_captureChunkSamples];
+    };
+
+    /**
+     * @struct SPIFrameChunk
+     * @brief A fixed number of spi frames stored column by column
+     */
+    struct SPIFrameChunk
+    {
+        uint8_t frame[g_captureChunkSamples][16];
+        // number of the frame among all frames the spi device received in the plan
+        uint64_t sequence[g_captureChunkSamples];
+        // steady clock time the frame was read in nanoseconds
+        int64_t timestamp[g_captureChunkSamples];
+    };
+
+    /**
+     * @class ChunkArena
+     * @brief Chunks of columns that only grow. The arena is reserved before a plan starts
+     * and grows one chunk at a time past that. clear() keeps the chunks, so an arena that
+     * is reused for the next plan appends without allocating.
+     */
+    template <class Chunk>
+    class ChunkArena
+    {
+    private:
+        std::vector<std::unique_ptr<Chunk>> m_chunks;
+        size_t m_size = 0;
+
+    public:
+        /** Bytes one row takes in the arena */
+        static constexpr size_t bytesPerRow = sizeof(Chunk) / g_captureChunkSamples;
+
+        /**
+         * @brief Allocate chunks until the arena holds this many rows, the chunks are
+         * zeroed so their pages are mapped before the plan starts
+         * @param[in] rows the number of rows expected
+         */
+        void reserve(size_t rows)
+        {
+            size_t chunks = (rows + g_captureChunkSamples - 1) / g_captureChunkSamples;
+            m_chunks.reserve(std::max(chunks, m_chunks.capacity()));
+            while (m_chunks.size() < chunks){
+                m_chunks.push_back(std::make_unique<Chunk>());
+            }
+        }
+
+        /**
+         * @brief Make room for one more row, only allocates when the reserved chunks are full
+         * @param[out] row the row inside the returned chunk
+         * @return the chunk the new row is written to
+         */
+        Chunk& grow(size_t* row)
+        {
+            *row = m_size % g_captureChunkSamples;
+            if (m_size / g_captureChunkSamples == m_chunks.size()){
+                m_chunks.push_back(std::make_unique<Chunk>());
+            }
+            return *m_chunks[m_size++ / g_captureChunkSamples];
+        }
+
+        const Chunk& chunk(size_t i) const{
+            return *m_chunks[i / g_captureChunkSamples];
+        }
+
+        void clear(){
+            m_size = 0;
+        }
+
+        void swap(ChunkArena& other)
+        {
+            m_chunks.swap(other.m_chunks);
+            std::swap(m_size, other.m_size);
+        }
+
+        size_t size() const{
+            return m_size;
+        }
+
+        /**
+         * @brief Get the number of rows that fit without allocating
+         */
+        size_t capacity() const{
+            return m_chunks.size() * g_captureChunkSamples;
+        }
+    };
+
+    /**
+     * @struct NodeSegment
+     * @brief The samples of one visit of a plan node, from firstSample to the first sample
+     * of the next segment
+     */
+    struct NodeSegment
+    {
+        // index into the node names of the store
+        uint32_t nodeId;
+        size_t firstSample;
+    };
+
+    /**
+     * @class CaptureStore
+     * @brief The robot samples one plan collects, in columns backed by a chunk arena. Node
+     * names are interned once per store and samples do not carry them, a segment is stored
+     * whenever the node of the appended samples changes. The stats of every segment are kept
+     * up to date with each sample, so a summary needs no pass over the samples.
+     * One thread appends, another one may copy the published samples while it does, see
+     * copyPublished(). The appending thread only takes a lock when a chunk, a segment or a
+     * node name is added, the reader takes it while it copies.
+     */
+    class CaptureStore
+    {
+    private:
+        ChunkArena<CaptureChunk> m_arena;
+        std::vector<std::string> m_nodeNames;
+        // the node of the last interned name, samples of one node come in a row
+        uint32_t m_lastNodeId = 0;
+        std::vector<NodeSegment> m_segments;
+        // the stats of each segment
+        std::vector<NodeStats> m_stats;
+        // the samples that are completely written, a reader copies no further
+        std::atomic<size_t> m_published = {0};
+        // held while the chunks, segments or node names change and while a reader copies
+        mutable std::mutex m_layoutMutex;
+
+    public:
+        /** Bytes one sample takes in the arena */
+        static constexpr size_t bytesPerSample = ChunkArena<CaptureChunk>::bytesPerRow;
+
+        CaptureStore() = default;
+        virtual ~CaptureStore() = default;
+        CaptureStore(const CaptureStore&) = delete;
+        CaptureStore& operator=(const CaptureStore&) = delete;
+
+        /**
+         * @brief Allocate chunks until the store holds this many samples
+         * @param[in] samples the number of samples expected
+         */
+        void reserve(size_t samples)
+        {
+            std::lock_guard<std::mutex> lock(m_layoutMutex);
+            m_arena.reserve(samples);
+            m_segments.reserve(g_captureSegments);
+            m_stats.reserve(g_captureSegments);
+        }
+
+        /**
+         * @brief Store one sample, only allocates when the reserved chunks or segments are full
+         * @param[in] tcpPose tcp position and quaternion [7]
+         * @param[in] flangePose flange position and quaternion [7]
+         * @param[in] rawForce raw force sensor data [6]
+         * @param[in] nodeId id returned by internNode()
+         * @param[in] timestamp steady clock time in nanoseconds
+         */
+        void append(const double* tcpPose, const double* flangePose, const double* rawForce,
+                    uint32_t nodeId, int64_t timestamp)
+        {
+            size_t row;
+            CaptureChunk* chunk;
+            if (m_arena.size() == m_arena.capacity()){
+                std::lock_guard<std::mutex> lock(m_layoutMutex);
+                chunk = &m_arena.grow(&row);
+            }else{
+                chunk = &m_arena.grow(&row);
+            }
+            std::memcpy(chunk->tcpPose[row], tcpPose, sizeof(chunk->tcpPose[row]));
+            std::memcpy(chunk->flangePose[row], flangePose, sizeof(chunk->flangePose[row]));
+            std::memcpy(chunk->rawForce[row], rawForce, sizeof(chunk->rawForce[row]));
+            chunk->timestamp[row] = timestamp;
+            if (m_segments.empty() || m_segments.back().nodeId != nodeId){
+                std::lock_guard<std::mutex> lock(m_layoutMutex);
+                m_segments.push_back(NodeSegment{nodeId, m_arena.size() - 1});
+                m_stats.emplace_back();
+            }
+            m_stats.back().add(tcpPose, flangePose, rawForce, timestamp);
+            m_published.store(m_arena.size(), std::memory_order_release);
+        }
+
+        /**
+         * @brief Get the id of a node name, a name seen for the first time is copied once
+         * @param[in] nodeName the name of the plan node
+         * @return the id stored with the samples
+         */
+        uint32_t internNode(std::string_view nodeName)
+        {
+            if (m_lastNodeId < m_nodeNames.size() && m_nodeNames[m_lastNodeId] == nodeName){
+                return m_lastNodeId;
+            }
+            auto it = std::find(m_nodeNames.begin(), m_nodeNames.end(), nodeName);
+            if (it == m_nodeNames.end()){
+                std::lock_guard<std::mutex> lock(m_layoutMutex);
+                it = m_nodeNames.insert(it, std::string(nodeName));
+            }
+            m_lastNodeId = static_cast<uint32_t>(it - m_nodeNames.begin());
+            return m_lastNodeId;
+        }
+
+        /**
+         * @brief Drop all samples, the chunks and node names are kept for the next plan
+         */
+        void clear()
+        {
+            std::lock_guard<std::mutex> lock(m_layoutMutex);
+            m_arena.clear();
+            m_segments.clear();
+            m_stats.clear();
+            m_published = 0;
+        }
+
+        /**
+         * @brief Swap the samples with another store, neither store may be appended to or read
+         * by another thread meanwhile
+         */
+        void swap(CaptureStore& other)
+        {
+            m_published = other.m_published.exchange(m_published);
+            m_arena.swap(other.m_arena);
+            m_segments.swap(other.m_segments);
+            m_stats.swap(other.m_stats);
+            m_nodeNames.swap(other.m_nodeNames);
+            std::swap(m_lastNodeId, other.m_lastNodeId);
+        }
+
+        size_t size() const{
+            return m_arena.size();
+        }
+
+        bool empty() const{
+            return m_arena.size() == 0;
+        }
+
+        /**
+         * @brief Get the number of samples that fit without allocating
+         */
+        size_t capacity() const{
+            return m_arena.capacity();
+        }
+
+        /**
+         * @brief Append the samples from first on that are published by now to another store,
+         * safe while the thread owning this store appends to it. Node names are interned into
+         * the other store, its segments and stats follow.
+         * @param[in] first the first sample to copy, the samples before were copied already
+         * @param[out] to the store the samples are appended to, only used by the calling thread
+         * @return the number of samples copied
+         */
+        size_t copyPublished(size_t first, CaptureStore* to) const
+        {
+            std::lock_guard<std::mutex> lock(m_layoutMutex);
+            size_t last = m_published.load(std::memory_order_acquire);
+            if (first >= last){
+                return 0;
+            }
+            auto segment = std::prev(std::upper_bound(m_segments.begin(), m_segments.end(), first,
+                [](size_t sample, const NodeSegment& segment){ return sample < segment.firstSample; }));
+            for (size_t i=first; i<last; segment++){
+                size_t end = std::next(segment) == m_segments.end() ? last : std::min(std::next(segment)->firstSample, last);
+                uint32_t nodeId = to->internNode(m_nodeNames[segment->nodeId]);
+                for (; i<end; i++){
+                    to->append(tcpPose(i), flangePose(i), rawForce(i), nodeId, timestamp(i));
+                }
+            }
+            return last - first;
+        }
+
+        const double* tcpPose(size_t i) const{
+            return m_arena.chunk(i).tcpPose[i % g_captureChunkSamples];
+        }
+
+        const double* flangePose(size_t i) const{
+            return m_arena.chunk(i).flangePose[i % g_captureChunkSamples];
+        }
+
+        const double* rawForce(size_t i) const{
+            return m_arena.chunk(i).rawForce[i % g_captureChunkSamples];
+        }
+
+        int64_t timestamp(size_t i) const{
+            return m_arena.chunk(i).timestamp[i % g_captureChunkSamples];
+        }
+
+        /**
+         * @brief Get the timestamp of a sample in its column, the samples up to the end of its
+         * chunk follow it
+         */
+        const int64_t* timestampColumn(size_t i) const{
+            return &m_arena.chunk(i).timestamp[i % g_captureChunkSamples];
+        }
+
+        /**
+         * @brief Get the node names interned so far, indexed by node id
+         */
+        const std::vector<std::string>& nodeNames() const{
+            return m_nodeNames;
+        }
+
+        /**
+         * @brief Get the node of a sample, searches the segments
+         */
+        const std::string& nodeName(size_t i) const{
+            auto it = std::upper_bound(m_segments.begin(), m_segments.end(), i,
+                [](size_t sample, const NodeSegment& segment){ return sample < segment.firstSample; });
+            return m_nodeNames[std::prev(it)->nodeId];
+        }
+
+        /**
+         * @brief Get the node segments in sample order
+         */
+        const std::vector<NodeSegment>& segments() const{
+            return m_segments;
+        }
+
+        const std::string& segmentName(const NodeSegment& segment) const{
+            return m_nodeNames[segment.nodeId];
+        }
+
+        /**
+         * @brief Get the stats of the segment with the same index in segments()
+         */
+        const NodeStats& segmentStats(size_t segment) const{
+            return m_stats[segment];
+        }
+
+        /**
+         * @brief Summarize the captured samples: the stats of every segment in order, and of
+         * every node over all its segments
+         * @return {"samples": n, "segments": [{"node", "first_sample", stats...}], "nodes": {name: stats}}
+         */
+        Json::Value summary() const
+        {
+            Json::Value summary;
+            summary["samples"] = Json::UInt64(size());
+            Json::Value segmentValues(Json::arrayValue);
+            std::vector<NodeStats> nodes(m_nodeNames.size());
+            for (size_t i=0; i<m_segments.size(); i++){
+                Json::Value segment = m_stats[i].toJson();
+                segment["node"] = m_nodeNames[m_segments[i].nodeId];
+                segment["first_sample"] = Json::UInt64(m_segments[i].firstSample);
+                segmentValues.append(segment);
+                nodes[m_segments[i].nodeId].merge(m_stats[i]);
+            }
+            summary["segments"] = segmentValues;
+            Json::Value nodeValues(Json::objectValue);
+            for (size_t id=0; id<nodes.size(); id++){
+                if (nodes[id].samples > 0){
+                    nodeValues[m_nodeNames[id]] = nodes[id].toJson();
+                }
+            }
+            summary["nodes"] = nodeValues;
+            return summary;
+        }
+    };
+
+    /**
+     * @class SPIFrameStore
+     * @brief The spi frames one plan receives, each with the time it was read. Filled by the
+     * spi task independent of the robot samples, the two are aligned by time on export.
+     */
+    class SPIFrameStore
+    {
+    private:
+        ChunkArena<SPIFrameChunk> m_arena;
+
+    public:
+        /** Bytes one frame takes in the arena */
+        static constexpr size_t bytesPerFrame = ChunkArena<SPIFrameChunk>::bytesPerRow;
+
+        /**
+         * @brief Allocate chunks until the store holds this many frames
+         * @param[in] frames the number of frames expected
+         */
+        void reserve(size_t frames)
+        {
+            m_arena.reserve(frames);
+        }
+
+        /**
+         * @brief Store one frame, only allocates when the reserved chunks are full
+         * @param[in] frame the spi frame [16]
+         * @param[in] timestamp steady clock time in nanoseconds
+         * @param[in] sequence number of the frame in the plan
+         */
+        void append(const uint8_t* frame, int64_t timestamp, uint64_t sequence)
+        {
+            size_t row;
+            SPIFrameChunk& chunk = m_arena.grow(&row);
+            std::memcpy(chunk.frame[row], frame, sizeof(chunk.frame[row]));
+            chunk.sequence[row] = sequence;
+            chunk.timestamp[row] = timestamp;
+        }
+
+        void clear(){
+            m_arena.clear();
+        }
+
+        void swap(SPIFrameStore& other){
+            m_arena.swap(other.m_arena);
+        }
+
+        size_t size() const{
+            return m_arena.size();
+        }
+
+        bool empty() const{
+            return m_arena.size() == 0;
+        }
+
+        const uint8_t* frame(size_t i) const{
+            return m_arena.chunk(i).frame[i % g_captureChunkSamples];
+        }
+
+        int64_t timestamp(size_t i) const{
+            return m_arena.chunk(i).timestamp[i % g_captureChunkSamples];
+        }
+
+        uint64_t sequence(size_t i) const{
+            return m_arena.chunk(i).sequence[i % g_captureChunkSamples];
+        }
+
+        /**
+         * @brief Get the timestamp and the sequence number of a frame in their columns, the
+         * frames up to the end of its chunk follow it
+         */
+        const int64_t* timestampColumn(size_t i) const{
+            return &m_arena.chunk(i).timestamp[i % g_captureChunkSamples];
+        }
+
+        const uint64_t* sequenceColumn(size_t i) const{
+            return &m_arena.chunk(i).sequence[i % g_captureChunkSamples];
+        }
+    };
+
+} /* namespace kostal */
+
+#endif /* FLEXIVRDK_CAPTURESTORE_HPP_ */
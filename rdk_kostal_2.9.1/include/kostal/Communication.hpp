@@ -14,19 +14,14 @@
 #include <kostal/SPIOperation.hpp>
 #include <kostal/SyncTask.hpp>
 #include <kostal/WriteExcel.hpp>
+#include <kostal/ResultExporter.hpp>
+#include <kostal/ResultStreamer.hpp>
+#include <kostal/StationContext.hpp>
+#include <kostal/StationServer.hpp>
 
 using namespace boost::posix_time;
 
 namespace kostal {
-    
-    // object of robot data
-    kostal::RobotData robotData;
-    // object of spi data
-    kostal::SPIData spiData;
-    // the list to store robot data
-    std::list<kostal::RobotData> g_robotDataList;
-    // the list to store spi data
-    std::list<kostal::SPIData> g_spiDataList; 
 
     /**
      * @class CommHandler
@@ -39,78 +34,80 @@ namespace kostal {
         std::atomic<bool> spiStatus = {false};
         std::atomic<bool> hbSwitch = {false};
         std::atomic<bool> checkStatus = {false};
-        kostal::Server m_service;
+        // the spi device is initialized with the config of the station and can be reused
+        std::atomic<bool> m_spiReady = {false};
+        // station of a single station server, a multi station server passes its own
+        kostal::StationContext m_ownStation;
+        kostal::StationContext* m_station = &m_ownStation;
+        std::shared_ptr<kostal::Server> m_service;
         flexiv::Log f_log;
         std::string m_queryStatus;
         std::string m_taskType;
         std::string m_taskName;
         boost::asio::thread_pool t_pool;
+        // result of the task running on t_pool
+        std::future<Status> m_taskResult;
         // some member variable under kostal namespace
         kostal::Log k_log;
         kostal::JSONMessageHandler m_parser;
+        // the tasks waiting for the robot, drained by executeTasks() on t_pool
+        kostal::TaskQueue m_taskQueue;
+        // only used on the io thread of the server to tell task requests from status polls
+        kostal::JSONMessageHandler m_requestParser;
+        kostal::Log m_requestLog;
         kostal::RobotOperationHandler m_robotHandler;
         kostal::SyncTaskHandler m_stHandler;
         kostal::SPIOperationHandler m_spiHandler;
-        kostal::WriteExcelHandler m_weHandler;
+        // writes the result file while its plan runs, with g_streamExport
+        kostal::ResultStreamer m_streamer;
+        // writes the results while the next task runs, destroyed first as its jobs use the members above
+        kostal::ResultExporter m_exporter;
+        // polls the robot into the flight recorder of the station between plans
+        std::thread m_idleRecorder;
+        std::atomic<bool> m_idleRecording = {false};
 
     public:
         CommHandler() = default;
-        virtual ~CommHandler() = default;
+
+        /**
+         * @brief Create the handler of one station of a StationServer
+         * @param[in] stationPtr the station this handler drives, not owned
+         */
+        explicit CommHandler(kostal::StationContext* stationPtr)
+        : m_station(stationPtr)
+        {}
+
+        virtual ~CommHandler()
+        {
+            stopIdleRecorder();
+        }
         
         /**
          * @brief This function inits the communication between server and client,
-         * the client needs to send SPI message first
+         * the client needs to send SPI message first. Call it again with the same handler
+         * after a session ends, the listener, robot, spi device and worker pool are kept
+         * and only the state of the last session is reset.
          * @param[in] robotPtr Pointer to robot object
          * @return Flexiv status code
          */
-        Status init(flexiv::Robot* robotPtr)
+        Status init(kostal::RobotClient* robotPtr)
         {
-            Status result;
-            
-            // check robot connection and set robot to plan execution mode
-            result = m_robotHandler.buildRobotConnection(robotPtr, &f_log);
-            if (result != SUCCESS) 
-            {
-                
-                k_log.error("The flexiv system failed to initialize the robot!");
-                k_log.error("Please recover the robot and then reboot it");
-                k_log.error("===================================================");
-                flexivStatus=FAULT;
-                seriousError=true;
-            }else{
-                f_log.info("The robot connection is built successfully");
-            }
-
-            // start to initialize the server and get spi config
-            result = m_service.init();
-            if (result != SUCCESS)
-            {
-                k_log.error("The flexiv system fails to initialize the socket server");
-                return result;
+            if (!m_service){
+                m_service = std::make_shared<kostal::Server>();
             }
+            return init(robotPtr, m_service, true);
+        }
 
-            // check spi connection
-            //result = m_spiHandler.buildSPIConnectionDummy();
-            result = m_spiHandler.buildSPIConnectionSocket();
-            
-            if (result != SUCCESS) 
-            {
-                flexivStatus = FAULT;
-                seriousError=true;
-            }else{
-                k_log.info("The spi connection is built successfully");
-            }
-            
-            // If flexiv status has been changed from INIT
-            if (flexivStatus!=INIT)
-            {
-                k_log.error("The flexiv system failed in initialization, please check!");
-                flexivStatus==FAULT;
-                return SYSTEM;
-            }else{
-                f_log.info("The flexiv system is initialized successfully");
-                flexivStatus = IDLE;
-                return SUCCESS;
+        /**
+         * @brief Serve one client of a StationServer until the session ends, the
+         * client has already sent its SPI message in the handshake
+         * @param[in] session the session bound to this station
+         */
+        void serveSession(std::shared_ptr<kostal::Server> session)
+        {
+            Status result = init(m_station->robotPtr, session, false);
+            if (result == SUCCESS || result == SYSTEM){
+                stateMachine(m_station->robotPtr);
             }
         }
 
@@ -122,67 +119,159 @@ namespace kostal {
         Status executeCheck()
         {
             Status result;
-            std::string checkMsg = m_service.getRecvMsg();
-            result = m_parser.parseJSON(&checkMsg, &m_queryStatus, &k_log);
+            result = m_parser.parseJSON(m_service->getRecvView(), &m_queryStatus, &k_log);
             if (result != SUCCESS){
-                flexivStatus = FAULT;
+                enterFault("the task message can not be parsed");
                 f_log.error("The task message is failed to be parsed");   
                 return result;
             }
-            if (m_queryStatus=="true" || 
-                m_queryStatus=="yes" || 
-                m_queryStatus=="True" || 
-                m_queryStatus=="Yes")
-            {
-                checkStatus = true;
-            }else{
-                checkStatus = false;
-            }
+            checkStatus = kostal::JSONMessageHandler::isYes(m_queryStatus);
             return SUCCESS;
         }
 
         /**
-         * @brief This function executes the task after the task message is correctly received and parsed
+         * @brief Queue the tasks of a task message and start the executor if it is idle
          * @param[in] robotPtr Pointer to robot object
-         * @return Flexiv status code
+         * @param[in] taskMsg view of the task message, a single task or a TASKLIST batch
+         * @return Flexiv status code, JSON if the message is no task message and SYSTEM if
+         * the queue has no room for the tasks
          */
-        Status executeTask(flexiv::Robot* robotPtr)
+        Status enqueueTasks(kostal::RobotClient* robotPtr, std::string_view taskMsg)
         {
-            Status result;        
-            std::string taskMsg = m_service.getRecvMsg();        
-            
-            result = m_parser.parseJSON(&taskMsg, &m_queryStatus, &m_taskType, &m_taskName, &k_log);
+            Status result;
+            std::vector<kostal::TaskRequest> tasks;
+            bool enqueue;
+            result = m_parser.parseTasks(taskMsg, &tasks, &enqueue, &k_log);
             if (result != SUCCESS){
-                flexivStatus = FAULT;
                 f_log.error("The task message is failed to be parsed");
-                f_log.error("===================================================");
                 return result;
             }
-            //f_log.info("The task message is parsed successfully");        
+            bool startExecutor;
+            bool queued = m_taskQueue.push(tasks, &startExecutor, [this]{
+                if (flexivStatus != BUSY){
+                    flexivStatus = BUSY;
+                    m_station->flightRecorder.mark("BUSY");
+                    m_service->publishStatus("BUSY");
+                }
+            });
+            if (!queued){
+                k_log.warn("The task queue is full, " + std::to_string(tasks.size()) + " tasks are not queued");
+                return SYSTEM;
+            }
+            k_log.info(std::to_string(tasks.size()) + " tasks are queued");
+            if (startExecutor){
+                // posted in a handler, asio takes the future of a packaged task itself
+                auto task = std::make_shared<std::packaged_task<Status()>>(boost::bind(&CommHandler::executeTasks, this, robotPtr));
+                m_taskResult = task->get_future();
+                boost::asio::post(t_pool, [task]{ (*task)(); });
+            }
+            return SUCCESS;
+        }
+
+        /**
+         * @brief Run the queued tasks back to back until the queue is empty. The station is
+         * IDLE as soon as the robot finished the last task, every result is published when
+         * the exporter has written it. A failed task drops the waiting ones.
+         * @param[in] robotPtr Pointer to robot object
+         * @return Flexiv status code of the last task
+         */
+        Status executeTasks(kostal::RobotClient* robotPtr)
+        {
+            Status result = SUCCESS;
+            kostal::TaskRequest task;
+            while (m_taskQueue.pop(&task, [this]{
+                if (flexivStatus != FAULT){
+                    flexivStatus = IDLE;
+                    m_station->flightRecorder.mark("IDLE");
+                    m_service->publishStatus("IDLE");
+                }
+            }))
+            {
+                result = executeTask(robotPtr, task);
+                if (result != SUCCESS){
+                    size_t dropped = m_taskQueue.clear();
+                    if (dropped > 0){
+                        k_log.error(std::to_string(dropped) + " queued tasks are dropped after the failed task");
+                    }
+                    m_exporter.exportFailure(task, result, [this](const kostal::TaskRequest& failed, Status error, const std::string& resultPath){
+                        publishResult(failed, error, resultPath);
+                    });
+                }
+            }
+            return result;
+        }
+
+        /**
+         * @brief This function executes one task taken from the task queue and hands its
+         * data over to the exporter
+         * @param[in] robotPtr Pointer to robot object
+         * @param[in] task the plan to run
+         * @return Flexiv status code
+         */
+        Status executeTask(kostal::RobotClient* robotPtr, const kostal::TaskRequest& task)
+        {
+            Status result;        
+            m_taskType = task.taskType;
+            m_taskName = task.taskName;
+            f_log.info("The task " + m_taskName + "-" + m_taskType + " is started, "
+                       + std::to_string(m_taskQueue.size()) + " tasks are waiting");
+            // without a result file to stream to, the result is written after the plan. Binary
+            // capture files are written in one go, they take a fraction of the time of a csv file.
+            bool binary = m_service->getSessionConfig().binary;
+            // compressed on the thread that writes the file, never after the plan ended
+            kostal::ResultCompression compression = m_service->getSessionConfig().compression;
+            bool streamed = g_streamExport && !binary && m_streamer.begin(m_station, task, &f_log, compression) == SUCCESS;
             
-            result = m_stHandler.runScheduler(robotPtr, &spiData, &g_spiDataList, &robotData, &g_robotDataList, &f_log, m_taskName + "-" + m_taskType);
+            result = m_stHandler.runScheduler(robotPtr, m_station, &f_log, m_taskName + "-" + m_taskType);
             if (result != SUCCESS){
-                flexivStatus = FAULT;
+                if (streamed){
+                    m_streamer.abort();
+                }
+                enterFault("the plan " + m_taskName + "-" + m_taskType + " failed");
+                m_spiReady = false;
+                {
+                    // the data of a broken plan is not exported
+                    std::lock_guard<std::mutex> lock(m_station->dataMutex);
+                    std::lock_guard<std::mutex> spiLock(m_station->spiMutex);
+                    m_station->capture.clear();
+                    m_station->spiFrames.clear();
+                }
                 f_log.error("The sync task is failed to be executed");
                 f_log.error("===================================================");
                 return result;
             }
-            std::cout<<"spi list size is "<<g_spiDataList.size()<<std::endl;
-            std::cout<<"robot list size is "<<g_robotDataList.size()<<std::endl;
-            
+            std::cout<<"robot sample size is "<<m_station->capture.size()<<std::endl;
+            std::cout<<"spi frame size is "<<m_station->spiFrames.size()<<std::endl;
+            // the node times of the plan are profiled already, the report is written behind the result
+            Json::Value profile = g_planProfiler ? m_station->planProfiler.report() : Json::Value();
             
-            result = m_weHandler.writeDataToExcel(m_taskType, m_taskName, &g_robotDataList, &g_spiDataList, &f_log);
-            if (result != SUCCESS){
-                flexivStatus = FAULT;
-                f_log.error("The excel file is failed to be generated");
-                f_log.error("===================================================");
-                return result;
+            if (streamed){
+                // only the tail of the result is left to write
+                // syncing the file to the disk is left to the export thread
+                std::string resultPath;
+                std::function<Status()> publish;
+                Status written = m_streamer.finish(&resultPath, &f_log, &publish);
+                {
+                    std::lock_guard<std::mutex> lock(m_station->dataMutex);
+                    std::lock_guard<std::mutex> spiLock(m_station->spiMutex);
+                    m_station->capture.clear();
+                    m_station->spiFrames.clear();
+                }
+                m_exporter.exportWritten(task, written, resultPath, [this, publish, profile](const kostal::TaskRequest& done, Status exported, const std::string& path){
+                    Status published = exported == SUCCESS && publish ? publish() : exported;
+                    publishResult(done, published, published == SUCCESS ? path : "");
+                    writeProfile(profile);
+                });
+            }else{
+                // the next task can start while the data of this one is written
+                m_exporter.exportCapture(m_station, task, [this, profile](const kostal::TaskRequest& done, Status exported, const std::string& resultPath){
+                    publishResult(done, exported, resultPath);
+                    writeProfile(profile);
+                }, binary, compression);
             }
-            f_log.info("The excel file is generated successfully");
             f_log.info("****************************************************");
             f_log.info("The task is executed successfully");
             f_log.info("****************************************************");
-            flexivStatus = IDLE;
             return SUCCESS;
         }
 
@@ -191,8 +280,12 @@ namespace kostal {
          * @param[in] robotPtr Pointer to robot object
          * @return Flexiv status code
          */
-        void stateMachine(flexiv::Robot* robotPtr)
+        void stateMachine(kostal::RobotClient* robotPtr)
         {
+            if (m_service->getSessionConfig().notify){
+                notifyStateMachine(robotPtr);
+                return;
+            }
             Status result;
             while (true)
             {
@@ -203,42 +296,46 @@ namespace kostal {
                         result = m_robotHandler.clearTinyFault(robotPtr, &f_log);
                         if (result != SUCCESS)
                         {
-                            flexivStatus = FAULT;
-                            seriousError = true;
+                            enterFault("the robot fault can not be cleared", true);
                             k_log.error("Please recover the robot and then reboot it");
                             break;
                         }
-                        m_service.setReplyMsg("IDLE");
+                        m_service->setReplyMsg("IDLE");
                         k_log.info("The flexiv system is in idle mode, ready to talk...");
                         // Check whether the connection is timeout
-                        result = m_service.monitor();
+                        result = m_service->monitor();
                         if (result != SUCCESS)
                         {
                             k_log.error("The flexiv system is having an error in connection");
                             k_log.error("===================================================");
-                            flexivStatus = FAULT;
+                            enterFault("the connection to the client failed");
                             return;
                         }
                         // Check whether the client ask status
                         result = executeCheck();
                         if (result != SUCCESS)
                         {
-                            flexivStatus = FAULT;
+                            enterFault("the status request can not be checked");
                             k_log.error("The flexiv system is having an error in server status checking");
                             break;
                         }
                         if (checkStatus==true){
-                            m_service.setReplyMsg("BUSY"); // Or you can use other words to show you received task msg
-                            result = m_service.monitor();
+                            std::string taskMsg = m_service->getRecvMsg();
+                            m_service->setReplyMsg("BUSY"); // Or you can use other words to show you received task msg
+                            result = m_service->monitor();
                             if (result != SUCCESS)
                             {
                                 k_log.error("The flexiv system is having an error in connection");
                                 k_log.error("===================================================");
-                                flexivStatus = FAULT;
+                                enterFault("the connection to the client failed");
                                 return;
                             }
-                            flexivStatus = BUSY;
-                            boost::asio::post(t_pool, boost::bind(&CommHandler::executeTask, this, robotPtr));
+                            result = enqueueTasks(robotPtr, taskMsg);
+                            if (result != SUCCESS)
+                            {
+                                enterFault("the task can not be queued");
+                                k_log.error("The flexiv system failed to queue the task");
+                            }
                             break;
                         }else{
                             k_log.warn("*************************************************");
@@ -249,14 +346,26 @@ namespace kostal {
 
                     case BUSY:
                     {
-                        m_service.setReplyMsg("BUSY");
-                        result = m_service.monitor();
+                        // every request is answered here, after a task message in it is queued
+                        result = m_service->monitor([](std::string_view){ return true; });
+                        if (result == SUCCESS)
+                        {
+                            // More tasks can be queued behind the running one, a message that
+                            // can not be queued is rejected and the running tasks go on
+                            std::string reply = "BUSY";
+                            if (m_parser.isEnqueueRequest(m_service->getRecvView())
+                                && enqueueTasks(robotPtr, m_service->getRecvView()) != SUCCESS){
+                                reply = "REJECTED";
+                            }
+                            result = m_service->send(reply);
+                        }
                         if (result != SUCCESS)
                         {
                             k_log.error("The flexiv system is having an error in connection");
                             k_log.error("===================================================");
-                            t_pool.join();
-                            flexivStatus = FAULT;
+                            m_taskQueue.clear();
+                            waitTask();
+                            enterFault("the connection to the client failed while a task ran");
                             return;
                         }
                         //std::this_thread::sleep_for(std::chrono::seconds(2));
@@ -265,11 +374,11 @@ namespace kostal {
 
                     case FAULT:
                     {
-                        m_service.setReplyMsg("FAULT");
+                        m_service->setReplyMsg("FAULT");
                         k_log.error("The flexiv system is in fault mode...");
                         k_log.error("===================================================");
                         
-                        result = m_service.monitor();
+                        result = m_service->monitor();
                         if (result != SUCCESS)
                         {
                             k_log.error("The flexiv system is having an error in connection");
@@ -277,7 +386,7 @@ namespace kostal {
                             flexivStatus = FAULT;
                             return;
                         }
-                        m_service.disconnect();
+                        m_service->disconnect();
                         return;
                     }
                 }
@@ -285,6 +394,64 @@ namespace kostal {
             }
         }    
         
+        /**
+         * @brief The state machine of a client that asked for NOTIFY in its handshake. The
+         * server answers status polls on its io thread with the published status and pushes
+         * every change, this thread only wakes up for new tasks or to report a fault. While
+         * BUSY, task messages with TASKENQUEUE are queued behind the running task.
+         * @param[in] robotPtr Pointer to robot object
+         */
+        void notifyStateMachine(kostal::RobotClient* robotPtr)
+        {
+            Status result;
+            m_service->publishStatus(flexivStatus == FAULT ? "FAULT" : "IDLE");
+            while (true)
+            {
+                result = m_service->monitor([this](std::string_view request){
+                    return flexivStatus == FAULT
+                           || (flexivStatus == IDLE && isTaskRequest(request))
+                           || (flexivStatus == BUSY && m_requestParser.isEnqueueRequest(request));
+                });
+                if (result != SUCCESS)
+                {
+                    k_log.error("The flexiv system is having an error in connection");
+                    k_log.error("===================================================");
+                    m_taskQueue.clear();
+                    waitTask();
+                    enterFault("the connection to the client failed");
+                    return;
+                }
+                if (flexivStatus == IDLE){
+                    result = m_robotHandler.clearTinyFault(robotPtr, &f_log);
+                    if (result != SUCCESS)
+                    {
+                        enterFault("the robot fault can not be cleared", true);
+                        k_log.error("Please recover the robot and then reboot it");
+                    }
+                }
+                if (flexivStatus == FAULT){
+                    k_log.error("The flexiv system is in fault mode...");
+                    k_log.error("===================================================");
+                    m_service->publishStatus("FAULT");
+                    m_service->send("FAULT");
+                    m_service->disconnect();
+                    return;
+                }
+                // a message that can not be queued is rejected, the running tasks go on
+                result = enqueueTasks(robotPtr, m_service->getRecvView());
+                result = m_service->send(result == SUCCESS ? "BUSY" : "REJECTED");
+                if (result != SUCCESS)
+                {
+                    k_log.error("The flexiv system is having an error in connection");
+                    k_log.error("===================================================");
+                    m_taskQueue.clear();
+                    waitTask();
+                    enterFault("the connection to the client failed");
+                    return;
+                }
+            }
+        }
+
         /**
          * @brief Returen whether the flexiv system is currently in fault mode
          * @return true or false
@@ -309,6 +476,237 @@ namespace kostal {
                 return false;
             }
         }
+
+    private:
+        /**
+         * @brief Publish the result of a task together with the current status of the station,
+         * called on the export thread
+         * @param[in] task the finished task
+         * @param[in] result CSV if the result file could not be written, the error of the plan otherwise
+         * @param[in] resultPath the path of the generated csv file, empty if there is none
+         */
+        void publishResult(const kostal::TaskRequest& task, Status result, const std::string& resultPath)
+        {
+            std::string error;
+            if (result == CSV){
+                error = "The excel file is failed to be generated";
+            }else if (result != SUCCESS){
+                error = "The sync task is failed to be executed";
+            }
+            if (error.empty()){
+                k_log.info("The excel file of " + task.taskName + "-" + task.taskType + " is generated successfully");
+            }else{
+                k_log.error(error + ": " + task.taskName + "-" + task.taskType);
+            }
+            // the summary was written next to the result, it is read back only if asked for
+            Json::Value summary;
+            if (error.empty() && m_service->getSessionConfig().summary){
+                std::ifstream summaryFile(kostal::WriteExcelHandler::summaryPath(resultPath));
+                Json::CharReaderBuilder builder;
+                std::string errors;
+                if (!summaryFile.is_open() || !Json::parseFromStream(builder, summaryFile, &summary, &errors)){
+                    k_log.warn("The summary of " + task.taskName + "-" + task.taskType + " is not readable");
+                    summary = Json::Value();
+                }
+            }
+            // under the queue lock the status can not change until the event is posted
+            bool faulted = false;
+            m_taskQueue.report([&](size_t){
+                // a polling client only learns about a lost result from the status
+                if (result == CSV && !m_service->getSessionConfig().notify){
+                    faulted = flexivStatus.exchange(FAULT) != FAULT;
+                }
+                std::string status = (flexivStatus == FAULT) ? "FAULT" : (flexivStatus == BUSY ? "BUSY" : "IDLE");
+                m_service->publishTaskDone(status, task, resultPath, error, summary);
+            });
+            // dumped after the queue lock is released
+            if (faulted){
+                dumpFlight("the result of " + task.taskName + "-" + task.taskType + " is lost");
+            }
+        }
+
+        /**
+         * @brief Put the station into FAULT. When the status or the serious error changes the
+         * flight recorder dumps the last seconds of the station.
+         * @param[in] reason what went wrong, kept with the dump
+         * @param[in] serious whether the robot has to be recovered and rebooted
+         */
+        void enterFault(const std::string& reason, bool serious = false)
+        {
+            m_station->flightRecorder.mark("FAULT: " + reason);
+            bool changed = flexivStatus.exchange(FAULT) != FAULT;
+            if (serious){
+                changed |= !seriousError.exchange(true);
+            }
+            if (changed){
+                dumpFlight(reason);
+            }
+        }
+
+        /**
+         * @brief Write what the flight recorder of the station holds, with g_flightRecorder
+         * @param[in] reason why the station dumps
+         */
+        void dumpFlight(const std::string& reason)
+        {
+            if (g_flightRecorder){
+                m_station->flightRecorder.dump(reason, m_station->stationId, m_station->spiConfig, &f_log);
+            }
+        }
+
+        /**
+         * @brief Write the plan profile report of the station, on the export thread
+         * @param[in] profile the report of the plan profiler, nothing is written if it is null
+         */
+        void writeProfile(const Json::Value& profile)
+        {
+            if (!profile.isNull()){
+                kostal::PlanProfiler::writeReport(kostal::PlanProfiler::reportPath(m_station->stationId), profile, &f_log);
+            }
+        }
+
+        /**
+         * @brief Start polling the robot into the flight recorder between plans, once per
+         * sampling interval, with g_flightRecorder. Keeps running across sessions.
+         * @param[in] robotPtr the robot of the station
+         */
+        void startIdleRecorder(kostal::RobotClient* robotPtr)
+        {
+            if (!g_flightRecorder || m_idleRecording.exchange(true)){
+                return;
+            }
+            m_idleRecorder = std::thread([this, robotPtr]{
+                unsigned int statusCycles = std::max(1u, g_supervisionInterval / g_samplingInterval);
+                auto next = std::chrono::steady_clock::now();
+                for (unsigned int cycle=0; m_idleRecording; cycle++){
+                    // a robot that does not answer is asked again a second later
+                    bool recorded = m_robotHandler.recordIdleState(robotPtr, m_station, cycle % statusCycles == 0) == SUCCESS;
+                    next = recorded ? next + std::chrono::milliseconds(g_samplingInterval)
+                                    : std::chrono::steady_clock::now() + std::chrono::seconds(1);
+                    std::this_thread::sleep_until(next);
+                }
+            });
+        }
+
+        void stopIdleRecorder()
+        {
+            if (m_idleRecording.exchange(false)){
+                m_idleRecorder.join();
+            }
+        }
+
+        /**
+         * @brief Whether a request asks for a new task, called on the io thread of the server
+         * @param[in] request view of the received request
+         */
+        bool isTaskRequest(std::string_view request)
+        {
+            std::string queryStatus;
+            if (m_requestParser.parseJSON(request, &queryStatus, &m_requestLog) != SUCCESS){
+                return false;
+            }
+            return kostal::JSONMessageHandler::isYes(queryStatus);
+        }
+
+        /**
+         * @brief Wait until the task running on the worker pool is finished, the pool
+         * stays usable for the next task
+         */
+        void waitTask()
+        {
+            if (m_taskResult.valid()){
+                m_taskResult.wait();
+            }
+        }
+
+        /**
+         * @brief Forget the state the last client left behind, the results it still waits
+         * for are written before
+         */
+        void resetSession()
+        {
+            waitTask();
+            m_exporter.wait();
+            flexivStatus = INIT;
+            checkStatus = false;
+            m_queryStatus.clear();
+            m_taskType.clear();
+            m_taskName.clear();
+        }
+
+        /**
+         * @brief Check the robot, finish the handshake of a standalone server and
+         * build the SPI connection with the negotiated config
+         * @param[in] robotPtr Pointer to robot object
+         * @param[in] session the talking session
+         * @param[in] acceptClient whether the session still has to accept the client
+         * @return Flexiv status code
+         */
+        Status init(kostal::RobotClient* robotPtr, std::shared_ptr<kostal::Server> session, bool acceptClient)
+        {
+            Status result;
+            // the exporter may still publish to the last session
+            resetSession();
+            m_service = session;
+            m_station->robotPtr = robotPtr;
+            startIdleRecorder(robotPtr);
+            
+            // check robot connection and set robot to plan execution mode,
+            // a robot that is still ready from the last session is left alone
+            result = m_robotHandler.isRobotReady(robotPtr) ? SUCCESS : m_robotHandler.buildRobotConnection(robotPtr, &f_log);
+            if (result != SUCCESS) 
+            {
+                
+                k_log.error("The flexiv system failed to initialize the robot!");
+                k_log.error("Please recover the robot and then reboot it");
+                k_log.error("===================================================");
+                enterFault("the robot can not be initialized", true);
+            }else{
+                f_log.info("The robot connection is built successfully");
+            }
+
+            // start to initialize the server and get spi config
+            if (acceptClient){
+                result = m_service->init();
+                if (result != SUCCESS)
+                {
+                    k_log.error("The flexiv system fails to initialize the socket server");
+                    return result;
+                }
+            }
+            // check spi connection, the device is only scanned and initialized again
+            // when the last task failed or the client asks for another config
+            const CaptureTrigger& trigger = m_service->getSessionConfig().captureTrigger;
+            if (!(trigger == m_station->nodeTracker.trigger())){
+                m_station->nodeTracker.configure(trigger);
+            }
+            SPIConfig spiConfig = m_service->getSessionConfig().spiConfig;
+            if (m_spiReady && spiConfig == m_station->spiConfig){
+                k_log.info("The spi connection is kept from the last session");
+            }else{
+                m_station->spiConfig = spiConfig;
+                result = m_spiHandler.buildSPIConnection(m_station);
+                m_spiReady = (result == SUCCESS);
+                if (result != SUCCESS) 
+                {
+                    enterFault("the spi connection can not be built", true);
+                }else{
+                    k_log.info("The spi connection is built successfully");
+                }
+            }
+            
+            // If flexiv status has been changed from INIT
+            if (flexivStatus!=INIT)
+            {
+                k_log.error("The flexiv system failed in initialization, please check!");
+                flexivStatus==FAULT;
+                return SYSTEM;
+            }else{
+                f_log.info("The flexiv system is initialized successfully");
+                flexivStatus = IDLE;
+                return SUCCESS;
+            }
+        }
     };
 
 } /* namespace kostal */
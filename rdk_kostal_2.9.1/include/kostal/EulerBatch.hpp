@@ -0,0 +1,284 @@
+/*
+ * @file EulerBatch.hpp
+ * @copyright Copyright (C) 2016-2022 Flexiv Ltd. All Rights Reserved.
+ */
+#ifndef FLEXIVRDK_EULERBATCH_HPP_
+#define FLEXIVRDK_EULERBATCH_HPP_
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace kostal {
+
+    /**
+     * Lanes of doubles the euler kernel works on. Each has the same operations, the kernel
+     * is written once against them. Masks are all bits set for true.
+     */
+    namespace euler_lanes {
+
+        /** One double, for the samples left over by the vector lanes */
+        struct Scalar
+        {
+            typedef double V;
+            static constexpr size_t width = 1;
+
+            static V load(const double* p, size_t){ return *p; }
+            static void store(double* p, V v){ *p = v; }
+            static V set(double v){ return v; }
+            static V add(V a, V b){ return a + b; }
+            static V sub(V a, V b){ return a - b; }
+            static V mul(V a, V b){ return a * b; }
+            static V div(V a, V b){ return a / b; }
+            static V sqrt(V a){ return std::sqrt(a); }
+            static V mask(bool m){
+                uint64_t bits = m ? ~uint64_t(0) : 0;
+                double v;
+                std::memcpy(&v, &bits, sizeof(v));
+                return v;
+            }
+            static bool isSet(V m){
+                uint64_t bits;
+                std::memcpy(&bits, &m, sizeof(bits));
+                return bits != 0;
+            }
+            static V gt(V a, V b){ return mask(a > b); }
+            static V lt(V a, V b){ return mask(a < b); }
+            static V eq(V a, V b){ return mask(a == b); }
+            static V andMask(V a, V b){ return mask(isSet(a) && isSet(b)); }
+            static V select(V m, V a, V b){ return isSet(m) ? a : b; }
+            /** a where the sign bit of s is set, b elsewhere, also for -0 */
+            static V selectSign(V s, V a, V b){ return std::signbit(s) ? a : b; }
+            static V abs(V a){ return std::fabs(a); }
+            static V copySign(V magnitude, V sign){ return std::copysign(magnitude, sign); }
+            /** a with the sign bit of s flipped into it */
+            static V xorSign(V a, V s){ return std::signbit(s) ? -a : a; }
+            static V neg(V a){ return -a; }
+        };
+
+#if defined(__SSE2__)
+        /** Two doubles, x86-64 always has them */
+        struct SSE2
+        {
+            typedef __m128d V;
+            static constexpr size_t width = 2;
+
+            static V load(const double* p, size_t stride){ return _mm_set_pd(p[stride], p[0]); }
+            static void store(double* p, V v){ _mm_storel_pd(p, v); _mm_storeh_pd(p + 3, v); }
+            static V set(double v){ return _mm_set1_pd(v); }
+            static V add(V a, V b){ return _mm_add_pd(a, b); }
+            static V sub(V a, V b){ return _mm_sub_pd(a, b); }
+            static V mul(V a, V b){ return _mm_mul_pd(a, b); }
+            static V div(V a, V b){ return _mm_div_pd(a, b); }
+            static V sqrt(V a){ return _mm_sqrt_pd(a); }
+            static V gt(V a, V b){ return _mm_cmpgt_pd(a, b); }
+            static V lt(V a, V b){ return _mm_cmplt_pd(a, b); }
+            static V eq(V a, V b){ return _mm_cmpeq_pd(a, b); }
+            static V andMask(V a, V b){ return _mm_and_pd(a, b); }
+            static V select(V m, V a, V b){ return _mm_or_pd(_mm_and_pd(m, a), _mm_andnot_pd(m, b)); }
+            static V selectSign(V s, V a, V b)
+            {
+                // spread the sign bit over the upper and lower half of each double
+                __m128i sign = _mm_srai_epi32(_mm_castpd_si128(s), 31);
+                return select(_mm_castsi128_pd(_mm_shuffle_epi32(sign, _MM_SHUFFLE(3, 3, 1, 1))), a, b);
+            }
+            static V signMask(){ return _mm_set1_pd(-0.0); }
+            static V abs(V a){ return _mm_andnot_pd(signMask(), a); }
+            static V copySign(V magnitude, V sign){
+                return _mm_or_pd(_mm_andnot_pd(signMask(), magnitude), _mm_and_pd(signMask(), sign));
+            }
+            static V xorSign(V a, V s){ return _mm_xor_pd(a, _mm_and_pd(signMask(), s)); }
+            static V neg(V a){ return _mm_xor_pd(a, signMask()); }
+        };
+#endif
+
+#if defined(__AVX__)
+        /** Four doubles, when the build enables AVX */
+        struct AVX
+        {
+            typedef __m256d V;
+            static constexpr size_t width = 4;
+
+            static V load(const double* p, size_t stride){
+                return _mm256_set_pd(p[3 * stride], p[2 * stride], p[stride], p[0]);
+            }
+            static void store(double* p, V v){
+                double lanes[4];
+                _mm256_storeu_pd(lanes, v);
+                p[0] = lanes[0]; p[3] = lanes[1]; p[6] = lanes[2]; p[9] = lanes[3];
+            }
+            static V set(double v){ return _mm256_set1_pd(v); }
+            static V add(V a, V b){ return _mm256_add_pd(a, b); }
+            static V sub(V a, V b){ return _mm256_sub_pd(a, b); }
+            static V mul(V a, V b){ return _mm256_mul_pd(a, b); }
+            static V div(V a, V b){ return _mm256_div_pd(a, b); }
+            static V sqrt(V a){ return _mm256_sqrt_pd(a); }
+            static V gt(V a, V b){ return _mm256_cmp_pd(a, b, _CMP_GT_OQ); }
+            static V lt(V a, V b){ return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+            static V eq(V a, V b){ return _mm256_cmp_pd(a, b, _CMP_EQ_OQ); }
+            static V andMask(V a, V b){ return _mm256_and_pd(a, b); }
+            static V select(V m, V a, V b){ return _mm256_blendv_pd(b, a, m); }
+            static V selectSign(V s, V a, V b){ return _mm256_blendv_pd(b, a, s); }
+            static V signMask(){ return _mm256_set1_pd(-0.0); }
+            static V abs(V a){ return _mm256_andnot_pd(signMask(), a); }
+            static V copySign(V magnitude, V sign){
+                return _mm256_or_pd(_mm256_andnot_pd(signMask(), magnitude), _mm256_and_pd(signMask(), sign));
+            }
+            static V xorSign(V a, V s){ return _mm256_xor_pd(a, _mm256_and_pd(signMask(), s)); }
+            static V neg(V a){ return _mm256_xor_pd(a, signMask()); }
+        };
+        typedef AVX Widest;
+#elif defined(__SSE2__)
+        typedef SSE2 Widest;
+#else
+        typedef Scalar Widest;
+#endif
+
+        const double g_pi = 3.14159265358979323846;
+        // sin(pi) and cos(pi/2) in doubles, what std::sin and std::cos give for these angles
+        const double g_sinPi = 1.2246467991473532e-16;
+        const double g_cosHalfPi = 6.123233995736766e-17;
+
+        /**
+         * @brief atan of each lane, the rational approximation of the cephes library with its
+         * range reduction, within 2 ulp of std::atan. Keeps the sign of zero.
+         */
+        template <class L>
+        inline typename L::V atan(typename L::V x)
+        {
+            typedef typename L::V V;
+            const V ax = L::abs(x);
+            const V big = L::gt(ax, L::set(2.41421356237309504880));
+            const V mid = L::gt(ax, L::set(0.66));
+            // |x| > tan(3pi/8) is reduced by pi/2, 0.66 < |x| by pi/4
+            V reduced = L::select(mid, L::div(L::sub(ax, L::set(1.0)), L::add(ax, L::set(1.0))), ax);
+            reduced = L::select(big, L::div(L::set(-1.0), ax), reduced);
+            V offset = L::select(mid, L::set(g_pi / 4), L::set(0.0));
+            offset = L::select(big, L::set(g_pi / 2), offset);
+            V moreBits = L::select(mid, L::set(0.5 * 6.123233995736765886130e-17), L::set(0.0));
+            moreBits = L::select(big, L::set(6.123233995736765886130e-17), moreBits);
+
+            const V z = L::mul(reduced, reduced);
+            V p = L::set(-8.750608600031904122785e-1);
+            p = L::add(L::mul(p, z), L::set(-1.615753718733365076637e1));
+            p = L::add(L::mul(p, z), L::set(-7.500855792314704667340e1));
+            p = L::add(L::mul(p, z), L::set(-1.228866684490136173410e2));
+            p = L::add(L::mul(p, z), L::set(-6.485021904942025371773e1));
+            V q = L::add(z, L::set(2.485846490142306297962e1));
+            q = L::add(L::mul(q, z), L::set(1.650270098316988542046e2));
+            q = L::add(L::mul(q, z), L::set(4.328810604912902668951e2));
+            q = L::add(L::mul(q, z), L::set(4.853903996359136964868e2));
+            q = L::add(L::mul(q, z), L::set(1.945506571482613964425e2));
+            V result = L::add(L::mul(reduced, L::div(L::mul(z, p), q)), reduced);
+            result = L::add(offset, L::add(result, moreBits));
+            return L::xorSign(result, x);
+        }
+
+        /**
+         * @brief atan2 of each lane with the quadrants and signed zeros of std::atan2, for
+         * finite arguments
+         */
+        template <class L>
+        inline typename L::V atan2(typename L::V y, typename L::V x)
+        {
+            typedef typename L::V V;
+            const V zero = L::set(0.0);
+            // atan2(+-0, +-0) is +-0 or +-pi, the ratio is a signed zero then instead of nan
+            const V bothZero = L::andMask(L::eq(y, zero), L::eq(x, zero));
+            const V angle = atan<L>(L::select(bothZero, L::copySign(zero, y), L::div(y, x)));
+            // left half plane, also for x = -0
+            return L::selectSign(x, L::add(L::copySign(L::set(g_pi), y), angle), angle);
+        }
+
+        /**
+         * @brief Euler angles of width quaternions, the same steps as
+         * Quaternion::toRotationMatrix().eulerAngles(2, 1, 0) of the vendored Eigen
+         */
+        template <class L>
+        inline void convert(const double* quaternion, size_t stride, double* euler)
+        {
+            typedef typename L::V V;
+            const V qw = L::load(quaternion, stride);
+            const V qx = L::load(quaternion + 1, stride);
+            const V qy = L::load(quaternion + 2, stride);
+            const V qz = L::load(quaternion + 3, stride);
+
+            // the rotation matrix, term by term as Eigen builds it
+            const V two = L::set(2.0), one = L::set(1.0);
+            const V tx = L::mul(two, qx), ty = L::mul(two, qy), tz = L::mul(two, qz);
+            const V twx = L::mul(tx, qw), twy = L::mul(ty, qw), twz = L::mul(tz, qw);
+            const V txx = L::mul(tx, qx), txy = L::mul(ty, qx), txz = L::mul(tz, qx);
+            const V tyy = L::mul(ty, qy), tyz = L::mul(tz, qy), tzz = L::mul(tz, qz);
+            const V m00 = L::sub(one, L::add(tyy, tzz));
+            const V m01 = L::sub(txy, twz);
+            const V m02 = L::add(txz, twy);
+            const V m10 = L::add(txy, twz);
+            const V m11 = L::sub(one, L::add(txx, tzz));
+            const V m12 = L::sub(tyz, twx);
+            const V m20 = L::sub(txz, twy);
+            const V m21 = L::add(tyz, twx);
+            const V m22 = L::sub(one, L::add(txx, tyy));
+
+            // the first angle is kept in [0, pi], the second one follows when it is turned
+            V yaw = atan2<L>(m10, m00);
+            const V turned = L::lt(yaw, L::set(0.0));
+            yaw = L::select(turned, L::add(yaw, L::set(g_pi)), yaw);
+            const V c2 = L::sqrt(L::add(L::mul(m22, m22), L::mul(m21, m21)));
+            const V pitch = atan2<L>(L::neg(m20), L::select(turned, L::neg(c2), c2));
+
+            // sin and cos of the first angle from the matrix instead of from the angle. Where
+            // the angle is 0, pi/2 or pi they are what std::sin and std::cos give, that covers
+            // a zero first column too.
+            const V r = L::sqrt(L::add(L::mul(m10, m10), L::mul(m00, m00)));
+            V s1 = L::div(m10, r);
+            V c1 = L::div(m00, r);
+            s1 = L::select(turned, L::neg(s1), s1);
+            c1 = L::select(turned, L::neg(c1), c1);
+            const V atZero = L::eq(yaw, L::set(0.0));
+            s1 = L::select(atZero, yaw, s1);
+            c1 = L::select(atZero, L::set(1.0), c1);
+            const V atHalfPi = L::eq(yaw, L::set(g_pi / 2));
+            s1 = L::select(atHalfPi, L::set(1.0), s1);
+            c1 = L::select(atHalfPi, L::set(g_cosHalfPi), c1);
+            const V atPi = L::eq(yaw, L::set(g_pi));
+            s1 = L::select(atPi, L::set(g_sinPi), s1);
+            c1 = L::select(atPi, L::set(-1.0), c1);
+            const V roll = atan2<L>(L::sub(L::mul(s1, m02), L::mul(c1, m12)), L::sub(L::mul(c1, m11), L::mul(s1, m01)));
+
+            L::store(euler, yaw);
+            L::store(euler + 1, pitch);
+            L::store(euler + 2, roll);
+        }
+
+    } /* namespace euler_lanes */
+
+    /**
+     * @brief Convert a column of quaternions to ZYX euler angles, the same angles as
+     * Eigen's toRotationMatrix().eulerAngles(2, 1, 0) within 1e-12: the first one in
+     * [0, pi], the others in [-pi, pi]. Closed form, several samples at once in the widest
+     * vector lanes the build has.
+     * @param[in] quaternions w, x, y, z of the first quaternion
+     * @param[in] stride doubles from one quaternion to the next
+     * @param[in] count the number of quaternions
+     * @param[out] euler 3 angles per quaternion [rad]
+     */
+    inline void quaternionsToEuler(const double* quaternions, size_t stride, size_t count, double* euler)
+    {
+        typedef euler_lanes::Widest Lanes;
+        size_t i = 0;
+        for (; i + Lanes::width <= count; i += Lanes::width){
+            euler_lanes::convert<Lanes>(quaternions + i * stride, stride, euler + 3 * i);
+        }
+        for (; i < count; i++){
+            euler_lanes::convert<euler_lanes::Scalar>(quaternions + i * stride, stride, euler + 3 * i);
+        }
+    }
+
+} /* namespace kostal */
+
+#endif /* FLEXIVRDK_EULERBATCH_HPP_ */
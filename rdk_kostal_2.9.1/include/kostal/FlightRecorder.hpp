@@ -0,0 +1,393 @@
+/*
+ * @file FlightRecorder.hpp
+ * @copyright Copyright (C) 2016-2022 Flexiv Ltd. All Rights Reserved.
+ */
+
+#ifndef FLEXIVRDK_FLIGHTRECORDER_HPP_
+#define FLEXIVRDK_FLIGHTRECORDER_HPP_
+
+// Kostal header files
+#include <kostal/SystemParams.h>
+#include <kostal/CaptureStore.hpp>
+#include <kostal/StatePoller.hpp>
+#include <kostal/SPIIngest.hpp>
+#include <kostal/CaptureFile.hpp>
+
+#include <sys/stat.h>
+
+namespace kostal {
+
+    /**
+     * @struct FlightSample
+     * @brief The robot states of one cycle as the flight recorder keeps them
+     */
+    struct FlightSample
+    {
+        int64_t timestamp = 0;
+        // index into the node names of the recorder, g_flightNodes if the table was full
+        uint32_t node = 0;
+        double tcpPose[7];
+        double flangePose[7];
+        double rawForce[6];
+    };
+
+    /**
+     * @struct FlightEvent
+     * @brief Something that happened to the station, a status change, a task or a fault
+     */
+    struct FlightEvent
+    {
+        int64_t timestamp = 0;
+        // zero terminated, longer texts are cut
+        char text[g_flightEventSize] = {};
+    };
+
+    /**
+     * @class FlightRing
+     * @brief The last entries one producer pushed, in memory allocated once. The oldest entry
+     * is overwritten without asking anyone, the producer never waits. A reader copies the
+     * ring at any time and drops what the producer overwrote while it copied, like a seqlock
+     * the producer publishes the count of entries with release after writing one.
+     */
+    template <class T>
+    class FlightRing
+    {
+    private:
+        std::vector<T> m_slots;
+        size_t m_mask = 0;
+        // entries pushed since the last resize(), written by the producer only
+        alignas(64) std::atomic<uint64_t> m_pushed = {0};
+
+    public:
+        FlightRing() = default;
+        virtual ~FlightRing() = default;
+        FlightRing(const FlightRing&) = delete;
+        FlightRing& operator=(const FlightRing&) = delete;
+
+        /**
+         * @brief Allocate room for at least a number of entries, rounded up to a power of
+         * two. Not while the producer pushes.
+         */
+        void resize(size_t entries)
+        {
+            size_t capacity = 1;
+            while (capacity < entries){
+                capacity <<= 1;
+            }
+            m_slots.assign(capacity, T());
+            m_mask = capacity - 1;
+            m_pushed.store(0, std::memory_order_release);
+        }
+
+        size_t capacity() const{
+            return m_slots.size();
+        }
+
+        /**
+         * @brief Overwrite the oldest entry, called by the producer only
+         */
+        void push(const T& entry)
+        {
+            uint64_t pushed = m_pushed.load(std::memory_order_relaxed);
+            m_slots[pushed & m_mask] = entry;
+            m_pushed.store(pushed + 1, std::memory_order_release);
+        }
+
+        uint64_t pushed() const{
+            return m_pushed.load(std::memory_order_acquire);
+        }
+
+        /**
+         * @brief Copy the entries the ring holds, oldest first, from any thread. The slot the
+         * producer writes next is left out, a copy has capacity() - 1 entries at most.
+         * @param[out] entries the entries, replaced
+         */
+        void copy(std::vector<T>* entries) const
+        {
+            entries->clear();
+            if (m_slots.empty()){
+                return;
+            }
+            uint64_t end = m_pushed.load(std::memory_order_acquire);
+            uint64_t begin = end > m_slots.size() ? end - m_slots.size() : 0;
+            entries->reserve(end - begin);
+            for (uint64_t i=begin; i<end; i++){
+                entries->push_back(m_slots[i & m_mask]);
+            }
+            // the producer may be writing the slot of entry "pushed" minus the capacity
+            std::atomic_thread_fence(std::memory_order_acquire);
+            uint64_t pushed = m_pushed.load(std::memory_order_relaxed);
+            uint64_t valid = pushed + 1 > m_slots.size() ? pushed + 1 - m_slots.size() : 0;
+            if (valid > begin){
+                entries->erase(entries->begin(), entries->begin() + std::min<uint64_t>(valid - begin, entries->size()));
+            }
+        }
+    };
+
+    /**
+     * @class FlightRecorder
+     * @brief Keeps the last g_flightRecorderSeconds of robot states, plan nodes and spi
+     * frames of a station and the events around them, all the time and not only in the
+     * capture window of a plan. Everything lives in rings allocated when the recorder is
+     * configured, recording copies a sample and takes no lock. On a fault dump() writes
+     * what the rings hold as a binary capture file, with the events in the json next to it.
+     * The robot states have one producer at a time, the sampling task while a plan runs and
+     * the idle recorder of the station between plans, the spi frames are recorded where
+     * the frames are stored. Events can come from any thread.
+     */
+    class FlightRecorder
+    {
+    private:
+        FlightRing<FlightSample> m_samples;
+        FlightRing<SPIFrame> m_frames;
+
+        // node names seen so far, a name is written before the count is published
+        char m_nodeNames[g_flightNodes][g_stateNameSize] = {};
+        std::atomic<uint32_t> m_nodeCount = {0};
+        // the node of the last sample, used by the robot producer only
+        uint32_t m_lastNode = g_flightNodes;
+
+        // each slot is published by the number of its event plus one
+        FlightEvent m_events[g_flightEvents];
+        std::atomic<uint64_t> m_eventSequence[g_flightEvents] = {};
+        std::atomic<uint64_t> m_eventCount = {0};
+
+        // the last system status that was recorded, used by its one producer only
+        int m_programRunning = -1;
+        int m_robotFault = -1;
+
+        uint32_t nodeId(const char* name)
+        {
+            if (m_lastNode < g_flightNodes && std::strncmp(m_nodeNames[m_lastNode], name, g_stateNameSize) == 0){
+                return m_lastNode;
+            }
+            uint32_t count = m_nodeCount.load(std::memory_order_relaxed);
+            for (uint32_t id=0; id<count; id++){
+                if (std::strncmp(m_nodeNames[id], name, g_stateNameSize) == 0){
+                    return m_lastNode = id;
+                }
+            }
+            if (count == g_flightNodes){
+                return m_lastNode = g_flightNodes;
+            }
+            size_t n = strnlen(name, g_stateNameSize - 1);
+            std::memcpy(m_nodeNames[count], name, n);
+            m_nodeNames[count][n] = '\0';
+            m_nodeCount.store(count + 1, std::memory_order_release);
+            return m_lastNode = count;
+        }
+
+    public:
+        FlightRecorder()
+        {
+            configure(g_flightRecorderSeconds);
+        }
+        virtual ~FlightRecorder() = default;
+        FlightRecorder(const FlightRecorder&) = delete;
+        FlightRecorder& operator=(const FlightRecorder&) = delete;
+
+        /**
+         * @brief Allocate the rings for a number of seconds at the sampling and spi intervals,
+         * the recorded entries are dropped. Not while anything is recorded.
+         */
+        void configure(double seconds)
+        {
+            m_samples.resize(static_cast<size_t>(seconds * 1000 / g_samplingInterval));
+            m_frames.resize(static_cast<size_t>(seconds * 1000 / g_spiInterval));
+        }
+
+        /**
+         * @brief Get how many seconds of samples the rings hold at most
+         */
+        double seconds() const{
+            return m_samples.capacity() * g_samplingInterval / 1000.0;
+        }
+
+        /**
+         * @brief Record the robot states of a cycle, called by the robot producer only
+         */
+        void record(const RobotSnapshot& snapshot)
+        {
+            FlightSample sample;
+            sample.timestamp = snapshot.timestamp;
+            sample.node = nodeId(snapshot.nodeName);
+            std::memcpy(sample.tcpPose, snapshot.tcpPose.data(), sizeof(sample.tcpPose));
+            std::memcpy(sample.flangePose, snapshot.flangePose.data(), sizeof(sample.flangePose));
+            std::memcpy(sample.rawForce, snapshot.rawExtForceInTcpFrame.data(), sizeof(sample.rawForce));
+            m_samples.push(sample);
+        }
+
+        /**
+         * @brief Record a spi frame, called by the spi producer only
+         */
+        void record(const SPIFrame& frame)
+        {
+            m_frames.push(frame);
+        }
+
+        /**
+         * @brief Record the system status, an event is only added when it changed. Called by
+         * the robot producer only.
+         */
+        void record(const flexiv::SystemStatus& status)
+        {
+            if (static_cast<int>(status.m_programRunning) != m_programRunning){
+                m_programRunning = status.m_programRunning;
+                mark(m_programRunning ? "program running" : "program stopped");
+            }
+        }
+
+        /**
+         * @brief Record whether the robot has a fault, an event is only added when it changed.
+         * Called by the robot producer only.
+         */
+        void recordFault(bool robotFault)
+        {
+            if (static_cast<int>(robotFault) != m_robotFault){
+                m_robotFault = robotFault;
+                mark(m_robotFault ? "robot fault" : "robot fault cleared");
+            }
+        }
+
+        /**
+         * @brief Add an event, from any thread
+         */
+        void mark(const std::string& text)
+        {
+            uint64_t number = m_eventCount.fetch_add(1, std::memory_order_relaxed);
+            size_t slot = number % g_flightEvents;
+            // a reader skips the slot while it is rewritten
+            m_eventSequence[slot].store(0, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            m_events[slot].timestamp = captureTime();
+            size_t length = text.copy(m_events[slot].text, g_flightEventSize - 1);
+            m_events[slot].text[length] = '\0';
+            m_eventSequence[slot].store(number + 1, std::memory_order_release);
+        }
+
+        /**
+         * @brief Copy the events the recorder holds, oldest first
+         */
+        std::vector<FlightEvent> events() const
+        {
+            std::vector<std::pair<uint64_t, FlightEvent>> numbered;
+            for (size_t slot=0; slot<g_flightEvents; slot++){
+                uint64_t sequence = m_eventSequence[slot].load(std::memory_order_acquire);
+                if (sequence == 0){
+                    continue;
+                }
+                FlightEvent event = m_events[slot];
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (m_eventSequence[slot].load(std::memory_order_relaxed) == sequence){
+                    numbered.emplace_back(sequence, event);
+                }
+            }
+            std::sort(numbered.begin(), numbered.end(), [](const auto& a, const auto& b){ return a.first < b.first; });
+            std::vector<FlightEvent> events;
+            for (auto& entry : numbered){
+                events.push_back(entry.second);
+            }
+            return events;
+        }
+
+        /**
+         * @brief Copy what the rings hold into stores, as a capture of the last seconds
+         * @param[out] capture the robot samples with their node names
+         * @param[out] spiFrames the spi frames
+         */
+        void snapshot(CaptureStore* capture, SPIFrameStore* spiFrames) const
+        {
+            std::vector<FlightSample> samples;
+            std::vector<SPIFrame> frames;
+            m_samples.copy(&samples);
+            m_frames.copy(&frames);
+            uint32_t nodeCount = m_nodeCount.load(std::memory_order_acquire);
+            std::vector<uint32_t> ids(g_flightNodes + 1, std::numeric_limits<uint32_t>::max());
+            capture->clear();
+            capture->reserve(samples.size());
+            for (const FlightSample& sample : samples){
+                uint32_t& id = ids[std::min<uint32_t>(sample.node, g_flightNodes)];
+                if (id == std::numeric_limits<uint32_t>::max()){
+                    id = capture->internNode(sample.node < nodeCount ? m_nodeNames[sample.node] : "");
+                }
+                capture->append(sample.tcpPose, sample.flangePose, sample.rawForce, id, sample.timestamp);
+            }
+            spiFrames->clear();
+            spiFrames->reserve(frames.size());
+            for (const SPIFrame& frame : frames){
+                spiFrames->append(frame.data, frame.timestamp, frame.sequence);
+            }
+        }
+
+        /**
+         * @brief Get the path of a new dump of a station under the upload address
+         */
+        static std::string dumpPath(int stationId)
+        {
+            return UPLOADADDRESS + "FAULT/Station" + std::to_string(stationId) + getResultStamp() + ".kcap";
+        }
+
+        /**
+         * @brief Write what the recorder holds as a binary capture file, the events and the
+         * reason go into the json next to it. Recording goes on while the rings are copied.
+         * @param[in] reason why the station dumps, the task name of the capture file
+         * @param[in] stationId the station of the recorder
+         * @param[in] spiConfig the spi settings of the station
+         * @param[in] logPtr robot's log pointer
+         * @param[out] dumpPathPtr the path of the written file
+         * @return Status code, CSV if the file could not be written
+         */
+        Status dump(const std::string& reason, int stationId, const SPIConfig& spiConfig,
+                    flexiv::Log* logPtr, std::string* dumpPathPtr = nullptr) const
+        {
+            auto start = std::chrono::steady_clock::now();
+            std::vector<FlightEvent> recorded = events();
+            CaptureStore capture;
+            SPIFrameStore spiFrames;
+            snapshot(&capture, &spiFrames);
+
+            std::string path = dumpPath(stationId);
+            mkdir((UPLOADADDRESS + "FAULT").c_str(), 0755);
+            Json::Value flight;
+            flight["reason"] = reason;
+            flight["station"] = stationId;
+            flight["seconds"] = seconds();
+            Json::Value eventValues(Json::arrayValue);
+            for (const FlightEvent& event : recorded){
+                Json::Value value;
+                value["time_ns"] = Json::Int64(event.timestamp);
+                value["event"] = event.text;
+                eventValues.append(value);
+            }
+            flight["events"] = eventValues;
+            flight["capture"] = capture.summary();
+            Status result = WriteExcelHandler::writeSummary(WriteExcelHandler::summaryPath(path), flight, logPtr);
+            if (result == SUCCESS){
+                CaptureFileInfo info;
+                info.taskType = "FAULT";
+                info.taskName = reason;
+                info.stationId = stationId;
+                info.spiConfig = spiConfig;
+                CaptureFileWriter writer;
+                result = writer.write(path, info, capture, spiFrames, logPtr);
+            }
+            if (result != SUCCESS){
+                std::remove(WriteExcelHandler::summaryPath(path).c_str());
+                logPtr->error("The flight recorder could not dump the station");
+                return result;
+            }
+            int64_t dumpMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start).count();
+            logPtr->info("The flight recorder dumped " + std::to_string(capture.size()) + " samples and "
+                         + std::to_string(spiFrames.size()) + " spi frames to " + path + " in "
+                         + std::to_string(dumpMs) + " ms: " + reason);
+            if (dumpPathPtr != nullptr){
+                *dumpPathPtr = path;
+            }
+            return SUCCESS;
+        }
+    };
+
+} /* namespace kostal */
+
+#endif /* FLEXIVRDK_FLIGHTRECORDER_HPP_ */
@@ -9,6 +9,8 @@
 // Kostal header files
 #include <kostal/KostalLogger.hpp>
 #include <kostal/SystemParams.h>
+#include <kostal/StationContext.hpp>
+#include <kostal/TaskQueue.hpp>
 
 namespace kostal {
 
@@ -28,23 +30,52 @@ namespace kostal {
         JSONMessageHandler() = default;
         virtual ~JSONMessageHandler() = default;
 
+        /**
+         * @brief Whether a flag value in a Testman message means yes
+         * @param[in] value the value of the flag
+         * @return true for yes, Yes, true and True
+         */
+        static bool isYes(const std::string& value)
+        {
+            return value=="true" || 
+                   value=="yes" || 
+                   value=="True" || 
+                   value=="Yes";
+        }
+
         /**
          * @brief Parse the received message and take out key value for SPI initialization
          * @param[in] recvMsg the received message that will be parsed
-         * @param[out] recvToken the received token parsed from recvMsg
+         * @param[out] sessionConfig token, spi config and station id parsed from recvMsg
+         * @param[in] logPtr kostal's log pointer
+         * @return Status code
+         */
+        Status parseSPI(std::string* recvMsg, SessionConfig* sessionConfig, kostal::Log* logPtr)
+        {
+            if (recvMsg == nullptr){
+                logPtr->error("The received json message is empty");
+                return JSON;
+            }
+            return parseSPI(std::string_view(*recvMsg), sessionConfig, logPtr);
+        }
+
+        /**
+         * @brief Parse the received frame in place and take out key value for SPI initialization
+         * @param[in] recvMsg view of the received frame that will be parsed
+         * @param[out] sessionConfig token, spi config and station id parsed from recvMsg
          * @param[in] logPtr kostal's log pointer
          * @return Status code
          */
-        Status parseSPI(std::string* recvMsg, std::string* recvToken, kostal::Log* logPtr)
+        Status parseSPI(std::string_view recvMsg, SessionConfig* sessionConfig, kostal::Log* logPtr)
         {
             // if the received message is null
-            if (recvMsg == nullptr || recvMsg->size() == 0){
+            if (recvMsg.size() == 0){
                 logPtr->error("The received json message is empty");
                 return JSON;
             }
             // if the json reader is failed
             bool result;
-            result = m_jsonReader.parse(*recvMsg, m_jsonRecvValue);
+            result = m_jsonReader.parse(recvMsg.data(), recvMsg.data() + recvMsg.size(), m_jsonRecvValue);
             if (!result){
                 logPtr->error("The received message is not json format");
                 return JSON;
@@ -72,11 +103,72 @@ namespace kostal {
                 return JSON;
             }
             // Retrieve the key value from init json message
-            g_CPOL = std::stoi(m_jsonRecvValue[CPOL].asCString());
-            g_CPHA = std::stoi(m_jsonRecvValue[CPHA].asCString());
-            g_LSB = std::stoi(m_jsonRecvValue[LSB].asCString());
-            g_SelPol = std::stoi(m_jsonRecvValue[SELP].asCString());
-            *recvToken = m_jsonRecvValue[TOKEN].asString();
+            sessionConfig->spiConfig.CPOL = std::stoi(m_jsonRecvValue[CPOL].asCString());
+            sessionConfig->spiConfig.CPHA = std::stoi(m_jsonRecvValue[CPHA].asCString());
+            sessionConfig->spiConfig.LSB = std::stoi(m_jsonRecvValue[LSB].asCString());
+            sessionConfig->spiConfig.SelPol = std::stoi(m_jsonRecvValue[SELP].asCString());
+            sessionConfig->token = m_jsonRecvValue[TOKEN].asString();
+            // The station is optional, a single station server ignores it
+            sessionConfig->stationId = -1;
+            if (m_jsonRecvValue.isMember(STATION.c_str())){
+                sessionConfig->stationId = std::stoi(m_jsonRecvValue[STATION].asString());
+            }
+            // Notifications are optional too, without them the client polls as before
+            sessionConfig->notify = false;
+            if (m_jsonRecvValue.isMember(NOTIFY.c_str())){
+                sessionConfig->notify = isYes(m_jsonRecvValue[NOTIFY].asString());
+            }
+            // The spi source is optional, without it the configured one is used
+            SPIConfig defaults;
+            sessionConfig->spiConfig.source = m_jsonRecvValue.get(SPISOURCE, defaults.source).asString();
+            sessionConfig->spiConfig.pattern = m_jsonRecvValue.get(SPIPATTERN, defaults.pattern).asString();
+            sessionConfig->spiConfig.replayFile = m_jsonRecvValue.get(SPIREPLAY, defaults.replayFile).asString();
+            sessionConfig->spiConfig.frameRate = defaults.frameRate;
+            if (m_jsonRecvValue.isMember(SPIRATE.c_str())){
+                sessionConfig->spiConfig.frameRate = std::stod(m_jsonRecvValue[SPIRATE].asString());
+            }
+            sessionConfig->spiConfig.replaySpeed = defaults.replaySpeed;
+            if (m_jsonRecvValue.isMember(SPISPEED.c_str())){
+                sessionConfig->spiConfig.replaySpeed = std::stod(m_jsonRecvValue[SPISPEED].asString());
+            }
+            // The capture trigger is optional, without it a plan is captured from Start to Stop
+            CaptureTrigger trigger;
+            if (m_jsonRecvValue.isMember(TRIGGERSTART.c_str())){
+                trigger.startNodes = splitList(m_jsonRecvValue[TRIGGERSTART].asString());
+            }
+            if (m_jsonRecvValue.isMember(TRIGGERSTOP.c_str())){
+                trigger.stopNodes = splitList(m_jsonRecvValue[TRIGGERSTOP].asString());
+            }
+            if (m_jsonRecvValue.isMember(TRIGGERPATH.c_str())){
+                trigger.pathPrefixes = splitList(m_jsonRecvValue[TRIGGERPATH].asString());
+            }
+            if (m_jsonRecvValue.isMember(PRETRIGGER.c_str())){
+                trigger.preTriggerMs = std::stoll(m_jsonRecvValue[PRETRIGGER].asString());
+            }
+            if (m_jsonRecvValue.isMember(POSTTRIGGER.c_str())){
+                trigger.postTriggerMs = std::stoll(m_jsonRecvValue[POSTTRIGGER].asString());
+            }
+            sessionConfig->captureTrigger = trigger;
+            // The summary in TASK_DONE is optional, it is always written next to the result
+            sessionConfig->summary = false;
+            if (m_jsonRecvValue.isMember(SUMMARY.c_str())){
+                sessionConfig->summary = isYes(m_jsonRecvValue[SUMMARY].asString());
+            }
+            // Results are csv files unless the client reads binary capture files
+            sessionConfig->binary = false;
+            if (m_jsonRecvValue.isMember(BINARY.c_str())){
+                sessionConfig->binary = isYes(m_jsonRecvValue[BINARY].asString());
+            }
+            // Results are written uncompressed unless the client can read compressed ones
+            sessionConfig->compression = ResultCompression();
+            if (m_jsonRecvValue.isMember(COMPRESSION.c_str())
+                && !ResultCompression::parseMethod(m_jsonRecvValue[COMPRESSION].asString(), &sessionConfig->compression.method)){
+                logPtr->error("The compression " + m_jsonRecvValue[COMPRESSION].asString() + " is unknown");
+                return JSON;
+            }
+            if (m_jsonRecvValue.isMember(COMPRESSIONLEVEL.c_str())){
+                sessionConfig->compression.level = std::stoi(m_jsonRecvValue[COMPRESSIONLEVEL].asString());
+            }
 
             return SUCCESS;
         }
@@ -91,15 +183,33 @@ namespace kostal {
         Status parseJSON(std::string* recvMsg, 
                         std::string* queryStatus, 
                         kostal::Log* logPtr)
+        {
+            if (recvMsg == nullptr){
+                logPtr->error("The received json message is empty");
+                return JSON;
+            }
+            return parseJSON(std::string_view(*recvMsg), queryStatus, logPtr);
+        }
+
+        /**
+         * @brief Parse the received frame in place and take out key value
+         * @param[in] recvMsg view of the received frame that will be parsed
+         * @param[out] queryStatus whether client want to query status or not
+         * @param[in] logPtr kostal's log pointer
+         * @return Status code
+         */
+        Status parseJSON(std::string_view recvMsg, 
+                        std::string* queryStatus, 
+                        kostal::Log* logPtr)
         {
             // if the received message is null
-            if (recvMsg == nullptr || recvMsg->size() == 0){
+            if (recvMsg.size() == 0){
                 logPtr->error("The received json message is empty");
                 return JSON;
             }
             // if the json reader is failed
             bool result;
-            result = m_jsonReader.parse(*recvMsg, m_jsonRecvValue);
+            result = m_jsonReader.parse(recvMsg.data(), recvMsg.data() + recvMsg.size(), m_jsonRecvValue);
             if (!result){
                 logPtr->error("The received message is not json format");
                 return JSON;
@@ -135,15 +245,37 @@ namespace kostal {
                          std::string* taskType,
                          std::string* taskName, 
                          kostal::Log* logPtr)
+        {
+            if (recvMsg == nullptr){
+                logPtr->error("The received json message is empty");
+                return JSON;
+            }
+            return parseJSON(std::string_view(*recvMsg), queryStatus, taskType, taskName, logPtr);
+        }
+
+        /**
+         * @brief Parse the received frame in place and take out key value
+         * @param[in] recvMsg view of the received frame that will be parsed
+         * @param[out] queryStatus whether client want to query or not
+         * @param[out] taskType the name of the work plan in message: NORMAL BIAS DUMMY
+         * @param[out] taskName the name of the task: workplan name
+         * @param[in] logPtr kostal's log pointer
+         * @return Status code
+         */
+        Status parseJSON(std::string_view recvMsg, 
+                         std::string* queryStatus, 
+                         std::string* taskType,
+                         std::string* taskName, 
+                         kostal::Log* logPtr)
         {
             // if the received message is null
-            if (recvMsg == nullptr || recvMsg->size() == 0){
+            if (recvMsg.size() == 0){
                 logPtr->error("The received json message is empty");
                 return JSON;
             }
             // if the json reader is failed
             bool result;
-            result = m_jsonReader.parse(*recvMsg, m_jsonRecvValue);
+            result = m_jsonReader.parse(recvMsg.data(), recvMsg.data() + recvMsg.size(), m_jsonRecvValue);
             if (!result){
                 logPtr->error("The received message is not json format");
                 return JSON;
@@ -177,6 +309,87 @@ namespace kostal {
             return SUCCESS;
         }
 
+        /**
+         * @brief Parse a task message into the tasks it asks for, either the single
+         * TASKTYPE/TASKNAME pair or the TASKLIST sequence
+         * @param[in] recvMsg view of the received frame that will be parsed
+         * @param[out] tasks the requested tasks in execution order
+         * @param[out] enqueue whether the client wants the tasks queued while the system is BUSY
+         * @param[in] logPtr kostal's log pointer
+         * @return Status code
+         */
+        Status parseTasks(std::string_view recvMsg,
+                          std::vector<TaskRequest>* tasks,
+                          bool* enqueue,
+                          kostal::Log* logPtr)
+        {
+            tasks->clear();
+            *enqueue = false;
+            // if the received message is null
+            if (recvMsg.size() == 0){
+                logPtr->error("The received json message is empty");
+                return JSON;
+            }
+            // if the json reader is failed
+            bool result;
+            result = m_jsonReader.parse(recvMsg.data(), recvMsg.data() + recvMsg.size(), m_jsonRecvValue);
+            if (!result){
+                logPtr->error("The received message is not json format");
+                return JSON;
+            }
+            if (m_jsonRecvValue.isMember(TASKENQUEUE.c_str())){
+                *enqueue = isYes(m_jsonRecvValue[TASKENQUEUE].asString());
+            }
+            // A batch message lists the plans, a single task message carries one
+            if (m_jsonRecvValue.isMember(TASKLIST.c_str())){
+                const Json::Value& taskList = m_jsonRecvValue[TASKLIST];
+                if (!taskList.isArray()){
+                    logPtr->error("The received param is not a list: " + TASKLIST);
+                    return JSON;
+                }
+                for (const Json::Value& task : taskList){
+                    if (!task.isObject() || !task.isMember(TASKTYPE.c_str()) || !task.isMember(TASKNAME.c_str())){
+                        logPtr->error("Every task in " + TASKLIST + " needs " + TASKTYPE + " and " + TASKNAME);
+                        tasks->clear();
+                        return JSON;
+                    }
+                    tasks->push_back({task[TASKTYPE].asString(), task[TASKNAME].asString()});
+                }
+                if (tasks->empty()){
+                    logPtr->error("The received task list is empty: " + TASKLIST);
+                    return JSON;
+                }
+                logPtr->info("Task list with " + std::to_string(tasks->size()) + " tasks received!");
+                return SUCCESS;
+            }
+            if (m_jsonRecvValue.isMember(TASKTYPE.c_str())==0){
+                logPtr->error("The received json message does not have param: " + TASKTYPE);
+                return JSON;
+            }
+            if (m_jsonRecvValue.isMember(TASKNAME.c_str())==0){
+                logPtr->error("The received json message does not have param: " + TASKNAME);
+                return JSON;
+            }
+            tasks->push_back({m_jsonRecvValue[TASKTYPE].asString(), m_jsonRecvValue[TASKNAME].asString()});
+            return SUCCESS;
+        }
+
+        /**
+         * @brief Check quietly whether a message asks to queue tasks while the system is BUSY,
+         * status polls are not logged
+         * @param[in] recvMsg view of the received frame
+         * @return true if both the query status and TASKENQUEUE say yes
+         */
+        bool isEnqueueRequest(std::string_view recvMsg)
+        {
+            if (recvMsg.size() == 0 || !m_jsonReader.parse(recvMsg.data(), recvMsg.data() + recvMsg.size(), m_jsonRecvValue)){
+                return false;
+            }
+            return m_jsonRecvValue.isObject()
+                   && isYes(m_jsonRecvValue.get(QUERYSTATUS, "").asString())
+                   && isYes(m_jsonRecvValue.get(TASKENQUEUE, "").asString());
+        }
+
         /**
          * @brief This function read current JSON and print it on the screen
          * @param[in] logPtr kostal's log pointer
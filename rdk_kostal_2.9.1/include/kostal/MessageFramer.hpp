@@ -0,0 +1,206 @@
+/*
+ * @file MessageFramer.hpp
+ * @copyright Copyright (C) 2016-2022 Flexiv Ltd. All Rights Reserved.
+ */
+#ifndef FLEXIVRDK_MESSAGEFRAMER_HPP_
+#define FLEXIVRDK_MESSAGEFRAMER_HPP_
+
+// Kostal header files
+#include <kostal/SystemParams.h>
+
+#include <string_view>
+#include <limits>
+
+namespace kostal {
+
+    /**
+     * @class MessageFramer
+     * @brief Split the byte stream of a socket into Testman messages. A frame is either
+     * terminated by '\n' (NEWLINE) or preceded by its length as a 4-byte big-endian
+     * integer (LENGTHPREFIX). In AUTO mode the first byte of the first frame decides:
+     * a JSON message starts with '{' or white space, a length header does not.
+     */
+    class MessageFramer
+    {
+    private:
+        boost::asio::streambuf m_buffer;
+        FramingMode m_mode;
+        // bytes of the current frame inside m_buffer, including delimiter or header
+        std::size_t m_frameSize = 0;
+        std::string_view m_frame;
+        const std::size_t m_maxFrameSize;
+        static constexpr std::size_t m_headerSize = 4;
+
+    public:
+        /**
+         * @param[in] mode framing mode of the stream
+         * @param[in] maxFrameSize frames larger than this are rejected with message_size
+         */
+        explicit MessageFramer(FramingMode mode = g_framingMode,
+                               std::size_t maxFrameSize = std::numeric_limits<std::size_t>::max())
+        : m_buffer(maxFrameSize == std::numeric_limits<std::size_t>::max() ? maxFrameSize : maxFrameSize + m_headerSize)
+        , m_mode(mode)
+        , m_maxFrameSize(maxFrameSize)
+        {}
+        virtual ~MessageFramer() = default;
+
+        /**
+         * @brief Read the next complete frame, bytes that were already received after the
+         * previous frame are used first, so pipelined frames cost no extra read
+         * @param[in] stream the asio stream to read from
+         * @param[in] handler called as handler(error_code, std::string_view frame), the view
+         * points into the receive buffer and stays valid until the next read or consume()
+         */
+        template <typename Stream, typename Handler>
+        void asyncReadFrame(Stream& stream, Handler handler)
+        {
+            consume();
+            if (m_mode == AUTO && m_buffer.size() == 0){
+                // need at least one byte to decide the framing mode
+                stream.async_read_some(m_buffer.prepare(g_MSGMAXSIZE),
+                    [this, &stream, handler](const boost::system::error_code& ec, std::size_t n) mutable {
+                        if (ec){
+                            handler(ec, std::string_view());
+                            return;
+                        }
+                        m_buffer.commit(n);
+                        asyncReadFrame(stream, handler);
+                    });
+                return;
+            }
+            if (m_mode == AUTO){
+                m_mode = detectMode();
+            }
+            if (m_mode == LENGTHPREFIX){
+                readLengthPrefixed(stream, handler);
+                return;
+            }
+            boost::asio::async_read_until(stream, m_buffer, '\n',
+                [this, handler](const boost::system::error_code& ec, std::size_t n) mutable {
+                    if (ec){
+                        handler(ec == boost::asio::error::not_found ? boost::asio::error::message_size : ec,
+                                std::string_view());
+                        return;
+                    }
+                    m_frameSize = n;
+                    std::size_t length = n - 1;
+                    const char* data = bufferData();
+                    if (length > 0 && data[length - 1] == '\r'){
+                        length--;
+                    }
+                    m_frame = std::string_view(data, length);
+                    handler(boost::system::error_code(), m_frame);
+                });
+        }
+
+        /**
+         * @brief Release the bytes of the current frame, the previous view becomes invalid
+         */
+        void consume()
+        {
+            m_buffer.consume(m_frameSize);
+            m_frameSize = 0;
+            m_frame = std::string_view();
+        }
+
+        /**
+         * @brief Frame an outgoing message in the mode of this stream
+         * @param[in] payload the message content
+         * @param[out] output reused buffer that receives the framed message
+         */
+        void encode(std::string_view payload, std::string* output) const
+        {
+            output->clear();
+            if (m_mode == LENGTHPREFIX){
+                uint32_t length = static_cast<uint32_t>(payload.size());
+                char header[m_headerSize] = {static_cast<char>(length >> 24), static_cast<char>(length >> 16),
+                                             static_cast<char>(length >> 8), static_cast<char>(length)};
+                output->append(header, m_headerSize);
+                output->append(payload.data(), payload.size());
+            }else{
+                output->append(payload.data(), payload.size());
+                output->push_back('\n');
+            }
+        }
+
+        /**
+         * @brief Get the current frame
+         * @return view of the frame, empty if no frame was read
+         */
+        std::string_view frame() const{
+            return m_frame;
+        }
+
+        /**
+         * @brief Get the framing mode, AUTO until the first byte is received
+         */
+        FramingMode getMode() const{
+            return m_mode;
+        }
+
+        /**
+         * @brief Drop all buffered bytes, called when the stream is reconnected
+         * @param[in] mode framing mode of the next stream
+         */
+        void reset(FramingMode mode)
+        {
+            m_buffer.consume(m_buffer.size());
+            m_frameSize = 0;
+            m_frame = std::string_view();
+            m_mode = mode;
+        }
+
+    private:
+        const char* bufferData() const{
+            return static_cast<const char*>(m_buffer.data().data());
+        }
+
+        FramingMode detectMode() const
+        {
+            char first = bufferData()[0];
+            if (first == '{' || first == ' ' || first == '\t' || first == '\r' || first == '\n'){
+                return NEWLINE;
+            }
+            return LENGTHPREFIX;
+        }
+
+        template <typename Stream, typename Handler>
+        void readLengthPrefixed(Stream& stream, Handler handler)
+        {
+            std::size_t required = m_headerSize;
+            if (m_buffer.size() >= m_headerSize){
+                const unsigned char* header = reinterpret_cast<const unsigned char*>(bufferData());
+                std::size_t length = (std::size_t(header[0]) << 24) | (std::size_t(header[1]) << 16)
+                                     | (std::size_t(header[2]) << 8) | std::size_t(header[3]);
+                if (length > m_maxFrameSize){
+                    boost::asio::post(stream.get_executor(), [handler]() mutable {
+                        handler(boost::asio::error::message_size, std::string_view());
+                    });
+                    return;
+                }
+                required += length;
+                if (m_buffer.size() >= required){
+                    m_frameSize = required;
+                    m_frame = std::string_view(bufferData() + m_headerSize, length);
+                    // complete through the executor like every other read, a stream of
+                    // pipelined frames must not recurse on the stack
+                    boost::asio::post(stream.get_executor(), [this, handler]() mutable {
+                        handler(boost::system::error_code(), m_frame);
+                    });
+                    return;
+                }
+            }
+            boost::asio::async_read(stream, m_buffer, boost::asio::transfer_at_least(required - m_buffer.size()),
+                [this, &stream, handler](const boost::system::error_code& ec, std::size_t) mutable {
+                    if (ec){
+                        handler(ec, std::string_view());
+                        return;
+                    }
+                    readLengthPrefixed(stream, handler);
+                });
+        }
+    };
+
+} /* namespace kostal */
+
+#endif /* FLEXIVRDK_MESSAGEFRAMER_HPP_ */
@@ -0,0 +1,287 @@
+/*
+ * @file NodeTracker.hpp
+ * @copyright Copyright (C) 2016-2022 Flexiv Ltd. All Rights Reserved.
+ */
+
+#ifndef FLEXIVRDK_NODETRACKER_HPP_
+#define FLEXIVRDK_NODETRACKER_HPP_
+
+// Kostal header files
+#include <kostal/SystemParams.h>
+#include <kostal/CaptureStore.hpp>
+#include <kostal/StatePoller.hpp>
+
+#include <limits>
+#include <sstream>
+
+namespace kostal {
+
+    /**
+     * @struct CaptureTrigger
+     * @brief When a plan is captured. The capture starts on entering a start node or a node
+     * whose path begins with one of the path prefixes, and stops on entering a stop node or
+     * leaving the prefixed paths. preTriggerMs of samples before the start and postTriggerMs
+     * after the stop are kept too. The default captures from Start to Stop as before.
+     */
+    struct CaptureTrigger
+    {
+        std::vector<std::string> startNodes = {"Start"};
+        std::vector<std::string> stopNodes = {"Stop"};
+        std::vector<std::string> pathPrefixes;
+        int64_t preTriggerMs = 0;
+        int64_t postTriggerMs = 0;
+
+        bool operator==(const CaptureTrigger& other) const
+        {
+            return startNodes == other.startNodes && stopNodes == other.stopNodes
+                   && pathPrefixes == other.pathPrefixes && preTriggerMs == other.preTriggerMs
+                   && postTriggerMs == other.postTriggerMs;
+        }
+    };
+
+    /**
+     * @struct NodeTransition
+     * @brief The plan entered node to, coming from node from. Ids of the NodeTracker.
+     */
+    struct NodeTransition
+    {
+        uint32_t from;
+        uint32_t to;
+        // steady clock time of the first sample in the new node in nanoseconds
+        int64_t timestamp;
+    };
+
+    /**
+     * @class NodeTracker
+     * @brief Follows the node of the running plan sample by sample. Nodes are interned by
+     * name and path into small ids and what a node does to the capture is decided once per id,
+     * so a sample in the same node as the last one costs a name and a path comparison. A name
+     * that repeats in several sub plans is a node of its own under every path. A transition is recorded
+     * only when the node changes, and it opens or closes the capture window of the trigger.
+     * Used by the sampling task only.
+     */
+    class NodeTracker
+    {
+    public:
+        static constexpr uint32_t NONE = std::numeric_limits<uint32_t>::max();
+
+    private:
+        enum Role : uint8_t {START = 1, STOP = 2, PATH = 4};
+        enum Window {IDLE, OPEN, CLOSING};
+
+        /** A sample kept for the pre-trigger, in the fields the capture stores */
+        struct PendingSample
+        {
+            double tcpPose[7];
+            double flangePose[7];
+            double rawForce[6];
+            uint32_t nodeId;
+            int64_t timestamp;
+        };
+
+        CaptureTrigger m_trigger;
+        std::vector<std::string> m_names;
+        // the path of each node in the plan, indexed by id
+        std::vector<std::string> m_paths;
+        // what entering each node does, indexed by id
+        std::vector<uint8_t> m_roles;
+        std::vector<NodeTransition> m_transitions;
+        uint32_t m_node = NONE;
+        Window m_window = IDLE;
+        // whether the open window was started by a path prefix, leaving the paths closes it
+        bool m_openedByPath = false;
+        int64_t m_closeAt = 0;
+        // steady clock time of the last sample in nanoseconds
+        int64_t m_lastTimestamp = 0;
+        // the id of the current node in the capture store, interned once per visit
+        uint32_t m_storeNode = NONE;
+        // pre-trigger samples, a ring of fixed size
+        std::vector<PendingSample> m_pending;
+        size_t m_pendingHead = 0;
+        size_t m_pendingCount = 0;
+
+        uint32_t intern(std::string_view name, std::string_view path)
+        {
+            for (uint32_t id=0; id<m_names.size(); id++){
+                if (m_names[id] == name && m_paths[id] == path){
+                    return id;
+                }
+            }
+            m_names.emplace_back(name);
+            m_paths.emplace_back(path);
+            uint8_t role = 0;
+            for (const std::string& start : m_trigger.startNodes){
+                role |= (start == name) ? START : 0;
+            }
+            for (const std::string& stop : m_trigger.stopNodes){
+                role |= (stop == name) ? STOP : 0;
+            }
+            for (const std::string& prefix : m_trigger.pathPrefixes){
+                role |= (path.compare(0, prefix.size(), prefix) == 0) ? PATH : 0;
+            }
+            m_roles.push_back(role);
+            return static_cast<uint32_t>(m_names.size() - 1);
+        }
+
+        void open(CaptureStore* store, bool byPath)
+        {
+            m_window = OPEN;
+            m_openedByPath = byPath;
+            // the pre-trigger samples go first, oldest first
+            size_t first = (m_pendingHead + m_pending.size() - m_pendingCount) % std::max<size_t>(m_pending.size(), 1);
+            for (size_t i=0; i<m_pendingCount; i++){
+                const PendingSample& sample = m_pending[(first + i) % m_pending.size()];
+                store->append(sample.tcpPose, sample.flangePose, sample.rawForce,
+                              store->internNode(m_names[sample.nodeId]), sample.timestamp);
+            }
+            m_pendingCount = 0;
+            m_storeNode = NONE;
+        }
+
+        void keep(const RobotSnapshot& state)
+        {
+            PendingSample& sample = m_pending[m_pendingHead];
+            std::copy(state.tcpPose.begin(), state.tcpPose.end(), sample.tcpPose);
+            std::copy(state.flangePose.begin(), state.flangePose.end(), sample.flangePose);
+            std::copy(state.rawExtForceInTcpFrame.begin(), state.rawExtForceInTcpFrame.end(), sample.rawForce);
+            sample.nodeId = m_node;
+            sample.timestamp = state.timestamp;
+            m_pendingHead = (m_pendingHead + 1) % m_pending.size();
+            m_pendingCount = std::min(m_pendingCount + 1, m_pending.size());
+        }
+
+    public:
+        NodeTracker() = default;
+        virtual ~NodeTracker() = default;
+
+        /**
+         * @brief Use a trigger from the next plan on, the ids are interned again
+         */
+        void configure(const CaptureTrigger& trigger)
+        {
+            m_trigger = trigger;
+            m_names.clear();
+            m_paths.clear();
+            m_roles.clear();
+            m_pending.assign(std::max<int64_t>(trigger.preTriggerMs / std::max(g_samplingInterval, 1u), 0), PendingSample());
+            reset();
+        }
+
+        const CaptureTrigger& trigger() const{
+            return m_trigger;
+        }
+
+        /**
+         * @brief Forget the last plan, called before a plan starts
+         */
+        void reset()
+        {
+            m_transitions.clear();
+            m_transitions.reserve(g_captureSegments);
+            m_node = NONE;
+            m_window = IDLE;
+            m_openedByPath = false;
+            m_storeNode = NONE;
+            m_pendingHead = 0;
+            m_pendingCount = 0;
+            m_lastTimestamp = 0;
+        }
+
+        /**
+         * @brief Track one sample and store it if the capture window is open
+         * @param[in] state the snapshot of the sampling cycle
+         * @param[in,out] store the capture store of the plan
+         * @return whether the sample is in another node than the last one
+         */
+        bool sample(const RobotSnapshot& state, CaptureStore* store)
+        {
+            m_lastTimestamp = state.timestamp;
+            bool changed = m_node == NONE || m_names[m_node] != state.node() || m_paths[m_node] != state.path();
+            if (changed){
+                uint32_t node = intern(state.node(), state.path());
+                m_transitions.push_back(NodeTransition{m_node, node, state.timestamp});
+                m_node = node;
+                m_storeNode = NONE;
+                uint8_t role = m_roles[node];
+                bool pathTriggered = !m_trigger.pathPrefixes.empty();
+                if (m_window != OPEN && ((role & START) || (pathTriggered && (role & PATH)))){
+                    open(store, !(role & START));
+                }else if (m_window == OPEN && ((role & STOP) || (m_openedByPath && !(role & PATH)))){
+                    m_window = CLOSING;
+                    m_closeAt = state.timestamp + m_trigger.postTriggerMs * 1000000;
+                }
+            }
+            if (m_window == CLOSING && state.timestamp >= m_closeAt){
+                m_window = IDLE;
+            }
+            if (m_window == IDLE){
+                if (!m_pending.empty()){
+                    keep(state);
+                }
+                return changed;
+            }
+            if (m_storeNode == NONE){
+                m_storeNode = store->internNode(state.node());
+            }
+            store->append(state.tcpPose.data(), state.flangePose.data(), state.rawExtForceInTcpFrame.data(),
+                          m_storeNode, state.timestamp);
+            return changed;
+        }
+
+        /**
+         * @brief Whether the samples are stored at the moment
+         */
+        bool capturing() const{
+            return m_window != IDLE;
+        }
+
+        /**
+         * @brief Get the node changes of the plan so far
+         */
+        const std::vector<NodeTransition>& transitions() const{
+            return m_transitions;
+        }
+
+        /**
+         * @brief Get the time of the last sample of the plan so far, in nanoseconds
+         */
+        int64_t lastTimestamp() const{
+            return m_lastTimestamp;
+        }
+
+        /**
+         * @brief Get the name of a node id, NONE is the empty name before the plan started
+         */
+        const std::string& nodeName(uint32_t id) const{
+            static const std::string none;
+            return id == NONE ? none : m_names[id];
+        }
+
+        /**
+         * @brief Get the path of a node id in the plan, empty for NONE
+         */
+        const std::string& nodePath(uint32_t id) const{
+            static const std::string none;
+            return id == NONE ? none : m_paths[id];
+        }
+    };
+
+    /**
+     * @brief Split a comma separated list of a handshake message
+     */
+    inline std::vector<std::string> splitList(const std::string& list)
+    {
+        std::vector<std::string> items;
+        std::stringstream stream(list);
+        std::string item;
+        while (std::getline(stream, item, ',')){
+            if (!item.empty()){
+                items.push_back(item);
+            }
+        }
+        return items;
+    }
+
+} /* namespace kostal */
+
+#endif /* FLEXIVRDK_NODETRACKER_HPP_ */
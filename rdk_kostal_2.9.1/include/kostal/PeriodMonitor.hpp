@@ -0,0 +1,150 @@
+/*
+ * @file PeriodMonitor.hpp
+ * @copyright Copyright (C) 2016-2022 Flexiv Ltd. All Rights Reserved.
+ */
+#ifndef FLEXIVRDK_PERIODMONITOR_HPP_
+#define FLEXIVRDK_PERIODMONITOR_HPP_
+
+// Kostal header files
+#include <kostal/SystemParams.h>
+
+namespace kostal {
+
+    /**
+     * @class PeriodMonitor
+     * @brief Measures how regularly a periodic task really runs. tick() is called at the
+     * start of every cycle from the task thread, the results are read after the task is
+     * stopped. A period longer than one and a half intervals counts the cycles that did
+     * not happen in between as missed.
+     */
+    class PeriodMonitor
+    {
+    public:
+        typedef std::chrono::steady_clock Clock;
+
+    private:
+        double m_interval = 1000;
+        bool m_started = false;
+        Clock::time_point m_lastTick;
+        uint64_t m_periods = 0;
+        uint64_t m_missed = 0;
+        // in microseconds
+        double m_sum = 0;
+        double m_sumSquares = 0;
+        double m_min = 0;
+        double m_max = 0;
+
+    public:
+        /**
+         * @param[in] intervalMs the interval the task is scheduled with [ms]
+         */
+        explicit PeriodMonitor(unsigned int intervalMs = 1)
+        {
+            reset(intervalMs);
+        }
+        virtual ~PeriodMonitor() = default;
+
+        /**
+         * @brief Forget all measured periods, done before the task starts again
+         * @param[in] intervalMs the interval the task is scheduled with [ms]
+         */
+        void reset(unsigned int intervalMs)
+        {
+            m_interval = intervalMs * 1000.0;
+            m_started = false;
+            m_periods = 0;
+            m_missed = 0;
+            m_sum = 0;
+            m_sumSquares = 0;
+            m_min = 0;
+            m_max = 0;
+        }
+
+        /**
+         * @brief Mark the start of a cycle
+         */
+        void tick()
+        {
+            tick(Clock::now());
+        }
+
+        /**
+         * @brief Mark the start of a cycle at a given time
+         * @param[in] now the start of the cycle
+         */
+        void tick(Clock::time_point now)
+        {
+            if (m_started){
+                double period = std::chrono::duration<double, std::micro>(now - m_lastTick).count();
+                m_sum += period;
+                m_sumSquares += period * period;
+                m_min = (m_periods == 0) ? period : std::min(m_min, period);
+                m_max = (m_periods == 0) ? period : std::max(m_max, period);
+                m_periods++;
+                if (period > 1.5 * m_interval){
+                    m_missed += static_cast<uint64_t>(period / m_interval + 0.5) - 1;
+                }
+            }
+            m_started = true;
+            m_lastTick = now;
+        }
+
+        /**
+         * @brief Get the number of measured periods, one less than the cycles
+         */
+        uint64_t periods() const{
+            return m_periods;
+        }
+
+        /**
+         * @brief Get the number of cycles that should have run but did not
+         */
+        uint64_t missed() const{
+            return m_missed;
+        }
+
+        /**
+         * @brief Get the average period [us]
+         */
+        double meanPeriod() const{
+            return m_periods == 0 ? 0 : m_sum / m_periods;
+        }
+
+        /**
+         * @brief Get the standard deviation of the period [us]
+         */
+        double jitter() const{
+            if (m_periods == 0){
+                return 0;
+            }
+            double mean = meanPeriod();
+            return std::sqrt(std::max(0.0, m_sumSquares / m_periods - mean * mean));
+        }
+
+        double minPeriod() const{
+            return m_min;
+        }
+
+        double maxPeriod() const{
+            return m_max;
+        }
+
+        /**
+         * @brief Describe the measured periods in one line
+         * @param[in] taskName the name of the task
+         */
+        std::string summary(const std::string& taskName) const
+        {
+            return taskName + " period (mean | jitter | min | max) = "
+                   + std::to_string(static_cast<int64_t>(meanPeriod())) + " | "
+                   + std::to_string(static_cast<int64_t>(jitter())) + " | "
+                   + std::to_string(static_cast<int64_t>(m_min)) + " | "
+                   + std::to_string(static_cast<int64_t>(m_max)) + " us, "
+                   + std::to_string(m_missed) + " missed of "
+                   + std::to_string(m_periods + m_missed) + " cycles";
+        }
+    };
+
+} /* namespace kostal */
+
+#endif /* FLEXIVRDK_PERIODMONITOR_HPP_ */
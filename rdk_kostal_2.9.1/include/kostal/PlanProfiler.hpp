@@ -0,0 +1,444 @@
+/*
+ * @file PlanProfiler.hpp
+ * @copyright Copyright (C) 2016-2022 Flexiv Ltd. All Rights Reserved.
+ */
+
+#ifndef FLEXIVRDK_PLANPROFILER_HPP_
+#define FLEXIVRDK_PLANPROFILER_HPP_
+
+// Kostal header files
+#include <kostal/SystemParams.h>
+#include <kostal/CaptureStats.hpp>
+#include <kostal/NodeTracker.hpp>
+
+#include <cstdio>
+#include <iomanip>
+#include <sys/stat.h>
+
+namespace kostal {
+
+    /**
+     * @struct DurationHistogram
+     * @brief Durations in g_profileBucketsPerOctave logarithmic buckets per doubling, from 1 ms
+     * to about a minute. The first bucket holds everything below 1 ms, the last everything
+     * above. A percentile is the upper edge of its bucket, at most 19% above the duration
+     * with the default 4 buckets per octave, and never above the longest one.
+     */
+    struct DurationHistogram
+    {
+        std::array<uint32_t, g_profileBuckets> counts = {};
+        // count, range, mean and spread of the durations [ms]
+        ChannelStats stats;
+
+        /**
+         * @brief Get the bucket of a duration
+         */
+        static size_t bucket(double ms)
+        {
+            if (!(ms >= 1)){
+                return 0;
+            }
+            double index = std::floor(std::log2(ms) * g_profileBucketsPerOctave) + 1;
+            return static_cast<size_t>(std::min(index, static_cast<double>(g_profileBuckets - 1)));
+        }
+
+        /**
+         * @brief Get the upper edge of a bucket [ms]
+         */
+        static double upperEdge(size_t bucket)
+        {
+            return std::exp2(static_cast<double>(bucket) / g_profileBucketsPerOctave);
+        }
+
+        void add(double ms)
+        {
+            counts[bucket(ms)]++;
+            stats.add(ms);
+        }
+
+        /**
+         * @brief Get the duration below which a share of the durations lie [ms]
+         * @param[in] share 0 ~ 1, 0.5 for the median
+         */
+        double percentile(double share) const
+        {
+            if (stats.count == 0){
+                return 0;
+            }
+            uint64_t rank = static_cast<uint64_t>(std::ceil(share * stats.count));
+            uint64_t seen = 0;
+            for (size_t i=0; i<counts.size(); i++){
+                seen += counts[i];
+                if (seen >= std::max<uint64_t>(rank, 1)){
+                    return std::min(upperEdge(i), stats.max);
+                }
+            }
+            return stats.max;
+        }
+
+        /**
+         * @brief The histogram as json: count, min, max, mean, stddev, p50, p90 and p99 [ms],
+         * and only the buckets that are not empty as [upper edge, count]
+         */
+        Json::Value toJson() const
+        {
+            Json::Value value;
+            bool any = stats.count > 0;
+            value["count"] = Json::UInt64(stats.count);
+            value["min"] = any ? stats.min : 0.0;
+            value["max"] = any ? stats.max : 0.0;
+            value["mean"] = stats.mean;
+            value["stddev"] = stats.stddev();
+            value["p50"] = percentile(0.5);
+            value["p90"] = percentile(0.9);
+            value["p99"] = percentile(0.99);
+            Json::Value buckets(Json::arrayValue);
+            for (size_t i=0; i<counts.size(); i++){
+                if (counts[i] > 0){
+                    Json::Value bucketValue(Json::arrayValue);
+                    bucketValue.append(upperEdge(i));
+                    bucketValue.append(counts[i]);
+                    buckets.append(bucketValue);
+                }
+            }
+            value["buckets"] = buckets;
+            return value;
+        }
+    };
+
+    /**
+     * @struct NodeVisit
+     * @brief The plan was in a node from enter to exit, steady clock time in nanoseconds
+     */
+    struct NodeVisit
+    {
+        // index into the nodes of the plan profile
+        uint32_t node;
+        int64_t enter;
+        int64_t exit;
+    };
+
+    /**
+     * @struct NodeProfile
+     * @brief How long the runs of a plan spent in one of its nodes, a node name that repeats
+     * in several sub plans has a profile under every path
+     */
+    struct NodeProfile
+    {
+        std::string name;
+        std::string path;
+        // the time of a run in the node, all its visits summed [ms]
+        DurationHistogram runTime;
+        // the time of each visit [ms]
+        DurationHistogram visitTime;
+        // runs that visited the node
+        uint64_t runs = 0;
+        // the time of the last run in the node, -1 if it did not visit it [ms]
+        double lastMs = -1;
+        // the p90 of the runs before the last one, what the last run is compared with [ms]
+        double previousP90 = 0;
+
+        /**
+         * @brief Get the path of the node, or its name if the path is not known
+         */
+        const std::string& label() const
+        {
+            return path.empty() ? name : path;
+        }
+    };
+
+    /**
+     * @struct PlanProfile
+     * @brief The node times of every run of one plan
+     */
+    struct PlanProfile
+    {
+        std::string name;
+        // from entering the first node to leaving the last one [ms]
+        DurationHistogram cycleTime;
+        // in the order the plan first entered them
+        std::vector<NodeProfile> nodes;
+        // the node visits of the last run
+        std::vector<NodeVisit> lastRun;
+
+        uint32_t node(std::string_view nodeName, std::string_view path)
+        {
+            for (uint32_t id=0; id<nodes.size(); id++){
+                if (nodes[id].name == nodeName && nodes[id].path == path){
+                    return id;
+                }
+            }
+            nodes.emplace_back();
+            nodes.back().name = nodeName;
+            nodes.back().path = path;
+            return static_cast<uint32_t>(nodes.size() - 1);
+        }
+    };
+
+    /**
+     * @class PlanProfiler
+     * @brief Records when a plan entered and left each of its nodes and keeps per plan and
+     * node histograms of the durations over all runs, so a cycle time regression shows which
+     * node it comes from. A run is either recorded node by node with begin(), enter() and
+     * end(), or taken from the transitions the NodeTracker of the sampling task already keeps,
+     * then the plan costs the sampling task nothing. Used by the thread that runs the plans
+     * of a station only.
+     */
+    class PlanProfiler
+    {
+    private:
+        std::vector<PlanProfile> m_plans;
+        // the run being recorded, an index into m_plans, or -1
+        int m_plan = -1;
+        std::vector<NodeVisit> m_run;
+
+        PlanProfile& plan(const std::string& planName)
+        {
+            for (PlanProfile& profile : m_plans){
+                if (profile.name == planName){
+                    return profile;
+                }
+            }
+            m_plans.emplace_back();
+            m_plans.back().name = planName;
+            return m_plans.back();
+        }
+
+    public:
+        PlanProfiler() = default;
+        virtual ~PlanProfiler() = default;
+
+        /**
+         * @brief Start recording a run of a plan, a run that was not ended is dropped
+         */
+        void begin(const std::string& planName)
+        {
+            PlanProfile& profile = plan(planName);
+            m_plan = static_cast<int>(&profile - m_plans.data());
+            m_run.clear();
+            m_run.reserve(g_captureSegments);
+        }
+
+        /**
+         * @brief The plan entered a node, the node before is left at the same time
+         * @param[in] nodeName the node, empty if the plan is in none
+         * @param[in] path the path of the node in the plan
+         * @param[in] timestamp steady clock time in nanoseconds
+         */
+        void enter(std::string_view nodeName, std::string_view path, int64_t timestamp)
+        {
+            if (m_plan < 0){
+                return;
+            }
+            PlanProfile& profile = m_plans[m_plan];
+            if (!m_run.empty() && m_run.back().exit < 0){
+                const NodeProfile& node = profile.nodes[m_run.back().node];
+                if (node.name == nodeName && node.path == path){
+                    return;
+                }
+                m_run.back().exit = timestamp;
+            }
+            if (!nodeName.empty()){
+                m_run.push_back(NodeVisit{profile.node(nodeName, path), timestamp, -1});
+            }
+        }
+
+        /**
+         * @brief The plan ended, leave the last node and add the run to the histograms
+         * @param[in] timestamp steady clock time in nanoseconds
+         * @return whether a run with at least one node was added
+         */
+        bool end(int64_t timestamp)
+        {
+            if (m_plan < 0){
+                return false;
+            }
+            PlanProfile& profile = m_plans[m_plan];
+            m_plan = -1;
+            if (m_run.empty()){
+                return false;
+            }
+            if (m_run.back().exit < 0){
+                m_run.back().exit = timestamp;
+            }
+            std::vector<double> runMs(profile.nodes.size(), -1);
+            for (const NodeVisit& visit : m_run){
+                double ms = (visit.exit - visit.enter) * 1e-6;
+                profile.nodes[visit.node].visitTime.add(ms);
+                runMs[visit.node] = std::max(runMs[visit.node], 0.0) + ms;
+            }
+            for (size_t id=0; id<profile.nodes.size(); id++){
+                NodeProfile& node = profile.nodes[id];
+                node.previousP90 = node.runTime.percentile(0.9);
+                node.lastMs = runMs[id];
+                if (runMs[id] >= 0){
+                    node.runTime.add(runMs[id]);
+                    node.runs++;
+                }
+            }
+            profile.cycleTime.add((m_run.back().exit - m_run.front().enter) * 1e-6);
+            profile.lastRun.swap(m_run);
+            return true;
+        }
+
+        /**
+         * @brief Add the run the sampling task tracked, from the node transitions of the tracker
+         * @param[in] planName the plan that ran
+         * @param[in] tracker the node tracker of the station, after the plan ended
+         * @return whether a run with at least one node was added
+         */
+        bool record(const std::string& planName, const NodeTracker& tracker)
+        {
+            begin(planName);
+            for (const NodeTransition& transition : tracker.transitions()){
+                enter(tracker.nodeName(transition.to), tracker.nodePath(transition.to), transition.timestamp);
+            }
+            // the last node lasts until the sample after the last one would have been taken
+            return end(tracker.lastTimestamp() + static_cast<int64_t>(g_samplingInterval) * 1000000);
+        }
+
+        /**
+         * @brief Get the profile of a plan, nullptr if it never ran
+         */
+        const PlanProfile* profile(const std::string& planName) const
+        {
+            for (const PlanProfile& profile : m_plans){
+                if (profile.name == planName){
+                    return &profile;
+                }
+            }
+            return nullptr;
+        }
+
+        /**
+         * @brief Describe the last run of a plan in one line: its cycle time, the nodes it
+         * spent most of it in, and the nodes that took longer than the p90 of the runs before
+         * @param[in] planName the plan
+         * @param[in] slowest how many nodes are named
+         */
+        std::string summary(const std::string& planName, size_t slowest = 3) const
+        {
+            const PlanProfile* planProfile = profile(planName);
+            if (planProfile == nullptr || planProfile->lastRun.empty()){
+                return "The plan " + planName + " has no profile";
+            }
+            double cycleMs = (planProfile->lastRun.back().exit - planProfile->lastRun.front().enter) * 1e-6;
+            std::vector<const NodeProfile*> nodes;
+            for (const NodeProfile& node : planProfile->nodes){
+                if (node.lastMs >= 0){
+                    nodes.push_back(&node);
+                }
+            }
+            std::sort(nodes.begin(), nodes.end(), [](const NodeProfile* a, const NodeProfile* b){
+                return a->lastMs > b->lastMs;
+            });
+            std::ostringstream line;
+            line << std::fixed << std::setprecision(1) << "The plan " << planName << " took " << cycleMs
+                 << " ms in run " << planProfile->cycleTime.stats.count << ", p50 "
+                 << planProfile->cycleTime.percentile(0.5) << " ms; slowest nodes:";
+            for (size_t i=0; i<std::min(slowest, nodes.size()); i++){
+                line << " " << nodes[i]->label() << " " << nodes[i]->lastMs << " ms ("
+                     << std::setprecision(0) << (cycleMs > 0 ? nodes[i]->lastMs / cycleMs * 100 : 0)
+                     << "%)" << std::setprecision(1);
+            }
+            std::string slower;
+            for (const NodeProfile& node : planProfile->nodes){
+                // the p90 of a handful of runs says nothing yet
+                if (node.runs > g_profileMinRuns && node.lastMs > node.previousP90 + g_samplingInterval){
+                    std::ostringstream nodeLine;
+                    nodeLine << std::fixed << std::setprecision(1) << " " << node.label() << " " << node.lastMs
+                             << " ms > p90 " << node.previousP90 << " ms";
+                    slower += nodeLine.str();
+                }
+            }
+            if (!slower.empty()){
+                line << "; slower than before:" << slower;
+            }
+            return line.str();
+        }
+
+        /**
+         * @brief The profiles as json, per plan its runs, its cycle time and per node, in plan
+         * order, the time of a run in it, of a visit, its share of the mean cycle time and the
+         * time of the last run
+         */
+        Json::Value report() const
+        {
+            Json::Value plans;
+            for (const PlanProfile& planProfile : m_plans){
+                Json::Value planValue;
+                planValue["runs"] = Json::UInt64(planProfile.cycleTime.stats.count);
+                planValue["cycle_ms"] = planProfile.cycleTime.toJson();
+                Json::Value nodes(Json::arrayValue);
+                for (const NodeProfile& node : planProfile.nodes){
+                    Json::Value nodeValue;
+                    nodeValue["node"] = node.name;
+                    if (!node.path.empty()){
+                        nodeValue["path"] = node.path;
+                    }
+                    nodeValue["runs"] = Json::UInt64(node.runs);
+                    double total = node.runTime.stats.mean * node.runs;
+                    double cycles = planProfile.cycleTime.stats.mean * planProfile.cycleTime.stats.count;
+                    nodeValue["share"] = cycles > 0 ? total / cycles : 0.0;
+                    nodeValue["last_ms"] = node.lastMs;
+                    nodeValue["run_ms"] = node.runTime.toJson();
+                    nodeValue["visit_ms"] = node.visitTime.toJson();
+                    nodes.append(nodeValue);
+                }
+                planValue["nodes"] = nodes;
+                plans[planProfile.name] = planValue;
+            }
+            Json::Value value;
+            value["bucket_edges"] = "upper edges 2^(i/" + std::to_string(g_profileBucketsPerOctave) + ") ms";
+            value["plans"] = plans;
+            return value;
+        }
+
+        /**
+         * @brief Get the path of the profile report of a station
+         */
+        static std::string reportPath(int stationId)
+        {
+            return UPLOADADDRESS + "PROFILE/Station" + std::to_string(stationId) + ".json";
+        }
+
+        /**
+         * @brief Write a report over the last one. It is written next to it first and
+         * renamed, a reader never finds half a report. Replacing a file makes the file system
+         * flush it, this is left to the export thread.
+         * @param[in] path the report file
+         * @param[in] report what report() returned
+         * @param[in] logPtr robot's log pointer
+         * @return Status code, JSON if it could not be written
+         */
+        static Status writeReport(const std::string& path, const Json::Value& report, flexiv::Log* logPtr)
+        {
+            std::string directory = path.substr(0, path.find_last_of('/') + 1);
+            if (!directory.empty()){
+                mkdir(directory.c_str(), 0755);
+            }
+            std::string tempPath = path + ".part";
+            {
+                std::ofstream file(tempPath);
+                Json::StreamWriterBuilder builder;
+                builder["indentation"] = "";
+                file << Json::writeString(builder, report);
+                file.close();
+                if (file.fail()){
+                    logPtr->error("The plan profile " + path + " is not written");
+                    std::remove(tempPath.c_str());
+                    return JSON;
+                }
+            }
+            if (std::rename(tempPath.c_str(), path.c_str()) != 0){
+                logPtr->error("The plan profile " + path + " is not written");
+                std::remove(tempPath.c_str());
+                return JSON;
+            }
+            return SUCCESS;
+        }
+    };
+
+} /* namespace kostal */
+
+#endif /* FLEXIVRDK_PLANPROFILER_HPP_ */
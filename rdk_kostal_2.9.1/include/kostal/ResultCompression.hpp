@@ -0,0 +1,408 @@
+/*
+ * @file ResultCompression.hpp
+ * @copyright Copyright (C) 2016-2022 Flexiv Ltd. All Rights Reserved.
+ */
+#ifndef FLEXIVRDK_RESULTCOMPRESSION_HPP_
+#define FLEXIVRDK_RESULTCOMPRESSION_HPP_
+
+// Kostal header files
+#include <kostal/SystemParams.h>
+#include <kostal/AsyncFileWriter.hpp>
+
+// third-party header files
+#include <zlib.h>
+#ifdef KOSTAL_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+#include <streambuf>
+
+namespace kostal {
+
+    // How a result file is compressed while it is written
+    enum CompressionMethod{NOCOMPRESSION, GZIP, ZSTD};
+
+    /**
+     * @struct ResultCompression
+     * @brief The compression of the result files of a session, none unless Testman asks for it
+     */
+    struct ResultCompression
+    {
+        CompressionMethod method = NOCOMPRESSION;
+        // 0 takes the level of g_gzipLevel or g_zstdLevel
+        int level = 0;
+
+        /**
+         * @brief Parse the name of a method as Testman sends it: NONE, GZIP, ZSTD, or yes for
+         * the default one. ZSTD falls back to GZIP in a build without zstd.
+         * @param[in] name the name of the method
+         * @param[out] method the method
+         * @return whether the name is known
+         */
+        static bool parseMethod(const std::string& name, CompressionMethod* method)
+        {
+            if (name.empty() || name == "NONE" || name == "no" || name == "false"){
+                *method = NOCOMPRESSION;
+            }else if (name == "GZIP"){
+                *method = GZIP;
+            }else if (name == "ZSTD" || name == "yes" || name == "true" || name == "Yes" || name == "True"){
+                *method = zstdAvailable() ? ZSTD : GZIP;
+            }else{
+                return false;
+            }
+            return true;
+        }
+
+        /**
+         * @brief Whether the build links zstd, see the WITH_ZSTD option
+         */
+        static constexpr bool zstdAvailable()
+        {
+#ifdef KOSTAL_WITH_ZSTD
+            return true;
+#else
+            return false;
+#endif
+        }
+
+        /**
+         * @brief Get the level the compressor runs at
+         */
+        int effectiveLevel() const{
+            return level != 0 ? level : (method == ZSTD ? g_zstdLevel : g_gzipLevel);
+        }
+
+        /**
+         * @brief Get what is appended to the name of a compressed file, empty without compression
+         */
+        const char* extension() const{
+            return method == GZIP ? ".gz" : (method == ZSTD ? ".zst" : "");
+        }
+
+        /**
+         * @brief Remove the extension of a compression method from a path, if it has one
+         */
+        static std::string stripExtension(const std::string& path)
+        {
+            for (const char* extension : {".gz", ".zst"}){
+                size_t length = std::strlen(extension);
+                if (path.size() >= length && path.compare(path.size() - length, length, extension) == 0){
+                    return path.substr(0, path.size() - length);
+                }
+            }
+            return path;
+        }
+    };
+
+    /**
+     * @class CompressedFileBuffer
+     * @brief A stream buffer that compresses what is written to it into a file, a block of
+     * g_streamBufferBytes at a time. The compressor runs on the thread that writes, so the
+     * result streaming and export threads compress while they write and no file is read back.
+     * Without compression the blocks are written as they are. The file is written by an
+     * AsyncFileWriter under a temporary name and only gets its own when close() published it,
+     * a file that is dropped or never closed leaves nothing behind.
+     */
+    class CompressedFileBuffer : public std::streambuf
+    {
+    private:
+        AsyncFileWriter m_file;
+        ResultCompression m_compression;
+        std::vector<char> m_input;
+        std::vector<char> m_output;
+        z_stream m_gzip = {};
+#ifdef KOSTAL_WITH_ZSTD
+        ZSTD_CCtx* m_zstd = nullptr;
+#endif
+        bool m_failed = false;
+        // whether the compressed stream is ended and only the publishing is left
+        bool m_ended = false;
+        uint64_t m_bytesIn = 0;
+        uint64_t m_bytesOut = 0;
+
+    public:
+        CompressedFileBuffer() = default;
+        virtual ~CompressedFileBuffer()
+        {
+            abort();
+        }
+        CompressedFileBuffer(const CompressedFileBuffer&) = delete;
+        CompressedFileBuffer& operator=(const CompressedFileBuffer&) = delete;
+
+        /**
+         * @brief Create the temporary file of a result and start a compressed stream in it
+         * @param[in] fileName the path the file is published at, its extension is up to the caller
+         * @param[in] compression the method and level
+         * @return whether the file is open
+         */
+        bool open(const std::string& fileName, const ResultCompression& compression)
+        {
+            abort();
+            m_compression = compression;
+            m_failed = false;
+            m_ended = false;
+            m_bytesIn = 0;
+            m_bytesOut = 0;
+            if (!m_file.open(fileName)){
+                return false;
+            }
+            if (m_compression.method == GZIP){
+                // 16 over the largest window writes a gzip header instead of a zlib one
+                m_gzip = z_stream();
+                if (deflateInit2(&m_gzip, m_compression.effectiveLevel(), Z_DEFLATED, 15 + 16, 8,
+                                 Z_DEFAULT_STRATEGY) != Z_OK){
+                    m_file.abort();
+                    return false;
+                }
+            }
+#ifdef KOSTAL_WITH_ZSTD
+            if (m_compression.method == ZSTD){
+                m_zstd = ZSTD_createCCtx();
+                if (m_zstd == nullptr
+                    || ZSTD_isError(ZSTD_CCtx_setParameter(m_zstd, ZSTD_c_compressionLevel, m_compression.effectiveLevel()))){
+                    ZSTD_freeCCtx(m_zstd);
+                    m_zstd = nullptr;
+                    m_file.abort();
+                    return false;
+                }
+            }
+#else
+            if (m_compression.method == ZSTD){
+                m_file.abort();
+                return false;
+            }
+#endif
+            m_input.resize(g_streamBufferBytes);
+            m_output.resize(m_compression.method == NOCOMPRESSION ? 0 : g_streamBufferBytes / 2);
+            setp(m_input.data(), m_input.data() + m_input.size());
+            return true;
+        }
+
+        /**
+         * @brief Compress what is buffered and end the compressed stream, the last block is
+         * written in the background and the file is not published yet
+         * @return whether everything was written so far
+         */
+        bool finish()
+        {
+            if (!m_file.is_open() || m_ended){
+                return !m_failed;
+            }
+            compress(pbase(), pptr() - pbase(), true);
+            setp(nullptr, nullptr);
+            endCompressor();
+            m_ended = true;
+            m_file.flush();
+            return !m_failed;
+        }
+
+        /**
+         * @brief Finish the file, wait until it is on the disk and publish it under its name
+         * @return whether everything was written and the file is published
+         */
+        bool close()
+        {
+            if (!m_file.is_open()){
+                return !m_failed;
+            }
+            finish();
+            std::string error;
+            if (m_failed){
+                m_file.abort();
+            }else if (!m_file.publish(&error)){
+                m_failed = true;
+            }
+            return !m_failed;
+        }
+
+        /**
+         * @brief Drop the file, nothing is published
+         */
+        void abort()
+        {
+            if (!m_file.is_open()){
+                return;
+            }
+            setp(nullptr, nullptr);
+            if (!m_ended){
+                endCompressor();
+            }
+            m_file.abort();
+        }
+
+        bool is_open() const{
+            return m_file.is_open();
+        }
+
+        /**
+         * @brief Get the bytes written to the buffer and the bytes that went to the file
+         */
+        uint64_t bytesIn() const{
+            return m_bytesIn;
+        }
+
+        uint64_t bytesOut() const{
+            return m_bytesOut;
+        }
+
+    protected:
+        int_type overflow(int_type c) override
+        {
+            if (!m_file.is_open() || m_ended || !compress(pbase(), pptr() - pbase(), false)){
+                return traits_type::eof();
+            }
+            setp(m_input.data(), m_input.data() + m_input.size());
+            if (!traits_type::eq_int_type(c, traits_type::eof())){
+                *pptr() = traits_type::to_char_type(c);
+                pbump(1);
+            }
+            return traits_type::not_eof(c);
+        }
+
+        int sync() override
+        {
+            // a compressed block is only complete at the end, nothing is flushed before
+            return m_failed ? -1 : 0;
+        }
+
+    private:
+        void put(const char* data, size_t bytes)
+        {
+            m_failed |= !m_file.write(data, bytes);
+            m_bytesOut += bytes;
+        }
+
+        void endCompressor()
+        {
+            if (m_compression.method == GZIP){
+                deflateEnd(&m_gzip);
+            }
+#ifdef KOSTAL_WITH_ZSTD
+            ZSTD_freeCCtx(m_zstd);
+            m_zstd = nullptr;
+#endif
+        }
+
+        /**
+         * @brief Compress a block into the file
+         * @param[in] data the block
+         * @param[in] bytes the size of the block
+         * @param[in] end whether the block is the last one, the compressed stream is ended
+         * @return whether the file is still good
+         */
+        bool compress(const char* data, size_t bytes, bool end)
+        {
+            m_bytesIn += bytes;
+            if (m_failed){
+                return false;
+            }
+            if (m_compression.method == GZIP){
+                m_gzip.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+                m_gzip.avail_in = static_cast<uInt>(bytes);
+                int result;
+                do{
+                    m_gzip.next_out = reinterpret_cast<Bytef*>(m_output.data());
+                    m_gzip.avail_out = static_cast<uInt>(m_output.size());
+                    result = deflate(&m_gzip, end ? Z_FINISH : Z_NO_FLUSH);
+                    if (result == Z_STREAM_ERROR){
+                        m_failed = true;
+                        return false;
+                    }
+                    put(m_output.data(), m_output.size() - m_gzip.avail_out);
+                }while (m_gzip.avail_out == 0 || (end && result != Z_STREAM_END));
+                return !m_failed;
+            }
+#ifdef KOSTAL_WITH_ZSTD
+            if (m_compression.method == ZSTD){
+                ZSTD_inBuffer input = {data, bytes, 0};
+                size_t remaining;
+                do{
+                    ZSTD_outBuffer output = {m_output.data(), m_output.size(), 0};
+                    remaining = ZSTD_compressStream2(m_zstd, &output, &input, end ? ZSTD_e_end : ZSTD_e_continue);
+                    if (ZSTD_isError(remaining)){
+                        m_failed = true;
+                        return false;
+                    }
+                    put(m_output.data(), output.pos);
+                }while (end ? remaining != 0 : input.pos < input.size);
+                return !m_failed;
+            }
+#endif
+            put(data, bytes);
+            return !m_failed;
+        }
+    };
+
+    /**
+     * @class CompressedFile
+     * @brief An output file stream that compresses through a CompressedFileBuffer
+     */
+    class CompressedFile : public std::ostream
+    {
+    private:
+        CompressedFileBuffer m_buffer;
+
+    public:
+        CompressedFile()
+        : std::ostream(nullptr)
+        {
+            rdbuf(&m_buffer);
+        }
+        virtual ~CompressedFile() = default;
+
+        /**
+         * @brief Open a file, the stream fails if it can not be created
+         */
+        void open(const std::string& fileName, const ResultCompression& compression)
+        {
+            clear();
+            if (!m_buffer.open(fileName, compression)){
+                setstate(std::ios::failbit);
+            }
+        }
+
+        /**
+         * @brief End the file without waiting for the disk, close() publishes it later
+         */
+        void finish()
+        {
+            if (!m_buffer.finish()){
+                setstate(std::ios::failbit);
+            }
+        }
+
+        /**
+         * @brief Finish the file and publish it, the stream fails if anything was not written
+         * or the file could not take its name
+         */
+        void close()
+        {
+            if (!m_buffer.close()){
+                setstate(std::ios::failbit);
+            }
+        }
+
+        /**
+         * @brief Drop the file, its name is never taken
+         */
+        void abort()
+        {
+            m_buffer.abort();
+        }
+
+        bool is_open() const{
+            return m_buffer.is_open();
+        }
+
+        uint64_t bytesIn() const{
+            return m_buffer.bytesIn();
+        }
+
+        uint64_t bytesOut() const{
+            return m_buffer.bytesOut();
+        }
+    };
+
+} /* namespace kostal */
+
+#endif /* FLEXIVRDK_RESULTCOMPRESSION_HPP_ */
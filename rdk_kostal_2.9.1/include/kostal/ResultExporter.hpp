@@ -0,0 +1,242 @@
+/*
+ * @file ResultExporter.hpp
+ * @copyright Copyright (C) 2016-2022 Flexiv Ltd. All Rights Reserved.
+ */
+#ifndef FLEXIVRDK_RESULTEXPORTER_HPP_
+#define FLEXIVRDK_RESULTEXPORTER_HPP_
+
+// Kostal header files
+#include <kostal/SystemParams.h>
+#include <kostal/KostalStates.hpp>
+#include <kostal/StationContext.hpp>
+#include <kostal/CaptureStore.hpp>
+#include <kostal/TaskQueue.hpp>
+#include <kostal/WriteExcel.hpp>
+#include <kostal/CaptureFile.hpp>
+
+#include <condition_variable>
+#include <functional>
+
+namespace kostal {
+
+    /**
+     * @struct CaptureSet
+     * @brief The data one plan collected, together with the task it belongs to
+     */
+    struct CaptureSet
+    {
+        TaskRequest task;
+        kostal::CaptureStore capture;
+        kostal::SPIFrameStore spiFrames;
+        // the station and spi settings the data was captured with
+        int stationId = 0;
+        SPIConfig spiConfig;
+        // write a binary capture file instead of a csv file
+        bool binary = false;
+        ResultCompression compression;
+    };
+
+    /**
+     * @class ResultExporter
+     * @brief Writes the result files of finished plans on its own thread while the robot
+     * already runs the next plan. The capture stores of a station are double buffered: the
+     * stores of a finished plan are swapped into a free capture set and the emptied stores of
+     * that set, chunks still allocated, are armed for the next plan. With every set still
+     * being exported the next handover waits, so a slow disk slows the station down instead
+     * of piling up data.
+     * Results are exported and reported in the order the plans finished.
+     */
+    class ResultExporter
+    {
+    public:
+        /** Writes one capture set, returns the path of the result file */
+        typedef std::function<Status(CaptureSet* capture, std::string* resultPath)> Writer;
+        /** Called on the export thread when the result of a task is written or failed */
+        typedef std::function<void(const TaskRequest& task, Status result, const std::string& resultPath)> ExportHandler;
+
+    private:
+        std::array<CaptureSet, g_captureSetCount> m_captureSets;
+        // the capture sets that are not being exported
+        std::vector<CaptureSet*> m_freeSets;
+        // jobs handed over and not finished yet, failures included
+        size_t m_pendingJobs = 0;
+        std::mutex m_mutex;
+        std::condition_variable m_jobDone;
+        Writer m_writer;
+        kostal::WriteExcelHandler m_weHandler;
+        kostal::CaptureFileWriter m_cfWriter;
+        flexiv::Log f_log;
+        // one thread, so results are written in plan order
+        boost::asio::thread_pool e_pool{1};
+
+    public:
+        /**
+         * @brief Export the results as csv files with WriteExcelHandler, or as binary capture
+         * files with CaptureFileWriter for the sets that ask for it
+         */
+        ResultExporter()
+        : ResultExporter([this](CaptureSet* capture, std::string* resultPath){
+            if (capture->binary){
+                return writeCaptureFile(capture, resultPath);
+            }
+            return m_weHandler.writeDataToExcel(capture->task.taskType, capture->task.taskName,
+                &capture->capture, &capture->spiFrames, &f_log, resultPath, capture->compression);
+        })
+        {}
+
+        /**
+         * @param[in] writer writes one capture set
+         */
+        explicit ResultExporter(Writer writer)
+        : m_writer(std::move(writer))
+        {
+            for (auto& captureSet : m_captureSets){
+                m_freeSets.push_back(&captureSet);
+            }
+        }
+
+        virtual ~ResultExporter()
+        {
+            e_pool.join();
+        }
+
+        ResultExporter(const ResultExporter&) = delete;
+        ResultExporter& operator=(const ResultExporter&) = delete;
+
+        /**
+         * @brief Hand the data a finished plan collected on a station over to the export
+         * thread and arm empty stores for the next plan. Waits while no capture set is free.
+         * @param[in,out] stationPtr the station whose plan is finished, its collectors are stopped
+         * @param[in] task the finished task
+         * @param[in] onExported called on the export thread when the result is written or failed
+         * @param[in] binary write a binary capture file instead of a csv file
+         * @param[in] compression how the result file is compressed, on the export thread
+         */
+        void exportCapture(StationContext* stationPtr, const TaskRequest& task, ExportHandler onExported,
+                           bool binary = false, const ResultCompression& compression = ResultCompression())
+        {
+            CaptureSet* capture;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_jobDone.wait(lock, [this]{ return !m_freeSets.empty(); });
+                capture = m_freeSets.back();
+                m_freeSets.pop_back();
+                m_pendingJobs++;
+            }
+            capture->task = task;
+            capture->stationId = stationPtr->stationId;
+            capture->spiConfig = stationPtr->spiConfig;
+            capture->binary = binary;
+            capture->compression = compression;
+            {
+                std::lock_guard<std::mutex> lock(stationPtr->dataMutex);
+                std::lock_guard<std::mutex> spiLock(stationPtr->spiMutex);
+                capture->capture.swap(stationPtr->capture);
+                capture->spiFrames.swap(stationPtr->spiFrames);
+            }
+            boost::asio::post(e_pool, [this, capture, onExported = std::move(onExported)]{
+                std::string resultPath;
+                Status result = m_writer(capture, &resultPath);
+                capture->capture.clear();
+                capture->spiFrames.clear();
+                onExported(capture->task, result, resultPath);
+                finishJob(capture);
+            });
+        }
+
+        /**
+         * @brief Report a task that has no result behind the results still being exported,
+         * so the reports keep the order of the tasks
+         * @param[in] task the failed task
+         * @param[in] result why the task failed
+         * @param[in] onExported called on the export thread with an empty result path
+         */
+        void exportFailure(const TaskRequest& task, Status result, ExportHandler onExported)
+        {
+            exportWritten(task, result, "", std::move(onExported));
+        }
+
+        /**
+         * @brief Report a result that is written already, e.g. streamed while its plan ran,
+         * behind the results still being exported
+         * @param[in] task the finished task
+         * @param[in] result SUCCESS if the result file is written
+         * @param[in] resultPath the path of the result file, empty if there is none
+         * @param[in] onExported called on the export thread
+         */
+        void exportWritten(const TaskRequest& task, Status result, const std::string& resultPath, ExportHandler onExported)
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_pendingJobs++;
+            }
+            boost::asio::post(e_pool, [this, task, result, resultPath, onExported = std::move(onExported)]{
+                onExported(task, result, resultPath);
+                finishJob(nullptr);
+            });
+        }
+
+        /**
+         * @brief Wait until every handed over result is written and reported
+         */
+        void wait()
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_jobDone.wait(lock, [this]{ return m_pendingJobs == 0; });
+        }
+
+        /**
+         * @brief Get the number of results that are not written yet
+         */
+        size_t pending()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_pendingJobs;
+        }
+
+    private:
+        /**
+         * @brief Write a capture set as a binary capture file and the summary next to it
+         */
+        Status writeCaptureFile(CaptureSet* capture, std::string* resultPath)
+        {
+            if (capture->spiFrames.empty() || capture->capture.empty()){
+                f_log.error("The collected robot or spi data list is null");
+                return CSV;
+            }
+            CaptureFileInfo info;
+            info.taskType = capture->task.taskType;
+            info.taskName = capture->task.taskName;
+            info.stationId = capture->stationId;
+            info.spiConfig = capture->spiConfig;
+            std::string path = CaptureFileWriter::capturePath(info.taskType, info.taskName) + capture->compression.extension();
+            // the summary is published first, whoever finds the result finds its summary too
+            Status result = m_weHandler.writeSummary(WriteExcelHandler::summaryPath(path), &capture->capture, &f_log);
+            if (result == SUCCESS){
+                result = m_cfWriter.write(path, info, capture->capture, capture->spiFrames, &f_log, capture->compression);
+            }
+            if (result != SUCCESS){
+                std::remove(WriteExcelHandler::summaryPath(path).c_str());
+                return result;
+            }
+            *resultPath = path;
+            return SUCCESS;
+        }
+
+        /**
+         * @brief Give the capture set of a finished job back, only called on the export thread
+         */
+        void finishJob(CaptureSet* capture)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (capture != nullptr){
+                m_freeSets.push_back(capture);
+            }
+            m_pendingJobs--;
+            m_jobDone.notify_all();
+        }
+    };
+
+} /* namespace kostal */
+
+#endif /* FLEXIVRDK_RESULTEXPORTER_HPP_ */
@@ -0,0 +1,251 @@
+/*
+ * @file ResultStreamer.hpp
+ * @copyright Copyright (C) 2016-2022 Flexiv Ltd. All Rights Reserved.
+ */
+#ifndef FLEXIVRDK_RESULTSTREAMER_HPP_
+#define FLEXIVRDK_RESULTSTREAMER_HPP_
+
+// Kostal header files
+#include <kostal/SystemParams.h>
+#include <kostal/KostalStates.hpp>
+#include <kostal/StationContext.hpp>
+#include <kostal/CaptureStore.hpp>
+#include <kostal/TaskQueue.hpp>
+#include <kostal/WriteExcel.hpp>
+
+#include <condition_variable>
+#include <pthread.h>
+
+namespace kostal {
+
+    /**
+     * @class ResultStreamer
+     * @brief Writes the result file of a plan while the plan runs. A low priority thread
+     * takes the samples and frames the station published every g_streamInterval ms and
+     * appends the rows whose spi frames are complete to the file, through a buffer of
+     * g_streamBufferBytes. When the plan ends only the rows of the last interval are left,
+     * so the file is ready a bounded time after the robot finished. Waiting for the disk and
+     * publishing the file under its name can be left to the export thread, see finish().
+     * The samples are copied into stores of the streamer, the station keeps capturing into
+     * its own without waiting for the writer.
+     */
+    class ResultStreamer
+    {
+    private:
+        StationContext* m_station = nullptr;
+        // copies of what the station captured so far, only used by the streaming thread
+        // until finish() joined it
+        kostal::CaptureStore m_capture;
+        kostal::SPIFrameStore m_spiFrames;
+        std::unique_ptr<ResultRowWriter> m_rows;
+        // compresses on the streaming thread, the rows of an interval at a time, handed over
+        // to whoever publishes it when the plan ended
+        std::shared_ptr<CompressedFile> m_file;
+        std::string m_path;
+        std::thread m_thread;
+        std::mutex m_mutex;
+        std::condition_variable m_stop;
+        bool m_stopping = false;
+        // rows written while the plan ran and the time finish() took, of the last plan
+        size_t m_streamedRows = 0;
+        int64_t m_finishUs = 0;
+
+    public:
+        ResultStreamer() = default;
+        virtual ~ResultStreamer()
+        {
+            abort();
+        }
+        ResultStreamer(const ResultStreamer&) = delete;
+        ResultStreamer& operator=(const ResultStreamer&) = delete;
+
+        /**
+         * @brief Create the result file of a task and start writing it, called before the
+         * plan starts
+         * @param[in] stationPtr the station that runs the plan, its stores are only read
+         * @param[in] task the task of the plan
+         * @param[in] logPtr robot's log pointer
+         * @param[in] compression how the file is compressed, its extension is appended to the path
+         * @return Status code, CSV if the file can not be created
+         */
+        Status begin(StationContext* stationPtr, const TaskRequest& task, flexiv::Log* logPtr,
+                     const ResultCompression& compression = ResultCompression())
+        {
+            abort();
+            m_station = stationPtr;
+            m_capture.clear();
+            m_spiFrames.clear();
+            m_capture.reserve(g_expectedPlanSeconds * 1000 / g_samplingInterval);
+            m_spiFrames.reserve(g_expectedPlanSeconds * 1000 / g_spiInterval);
+            m_rows = std::make_unique<ResultRowWriter>(m_capture, m_spiFrames);
+            m_streamedRows = 0;
+            m_finishUs = 0;
+            m_path = WriteExcelHandler::resultPath(task.taskType, task.taskName) + compression.extension();
+            m_file = std::make_shared<CompressedFile>();
+            m_file->open(m_path, compression);
+            if (!m_file->is_open()){
+                logPtr->error("The associated excel file is not created correctly");
+                m_file.reset();
+                return CSV;
+            }
+            ResultRowWriter::writeHeader(*m_file);
+            m_stopping = false;
+            m_thread = std::thread([this]{ run(); });
+            return SUCCESS;
+        }
+
+        /**
+         * @brief Write the rows that are left after the plan ended and the summary, called
+         * when the collectors of the station are stopped and its last frames are stored
+         * @param[out] resultPath the path of the result file
+         * @param[in] logPtr robot's log pointer
+         * @param[out] publish if given, the file is not published yet and this publishes it,
+         * so syncing it to the disk can run on another thread than the station. It may run
+         * after the next plan began. Without it the file is published before finish returns.
+         * @return Status code, CSV if there is no data or the file could not be written
+         */
+        Status finish(std::string* resultPath, flexiv::Log* logPtr, std::function<Status()>* publish = nullptr)
+        {
+            auto start = std::chrono::steady_clock::now();
+            stop();
+            if (!m_file){
+                return CSV;
+            }
+            // nothing is captured any more, every row is final
+            drain(true);
+            m_file->finish();
+            Status result = SUCCESS;
+            if (m_file->fail()){
+                logPtr->error("The associated excel file is not written correctly");
+                result = CSV;
+            }else if (m_spiFrames.empty() || m_capture.empty()){
+                logPtr->error("The collected robot or spi data list is null");
+                result = CSV;
+            }
+            std::shared_ptr<CompressedFile> file = std::move(m_file);
+            if (result != SUCCESS){
+                file->abort();
+                return result;
+            }
+            auto publishFile = [file, path = m_path, summary = m_capture.summary(), logPtr]{
+                // the summary is published first, whoever finds the result finds its summary too
+                Status published = WriteExcelHandler::writeSummary(WriteExcelHandler::summaryPath(path), summary, logPtr);
+                if (published != SUCCESS){
+                    file->abort();
+                    return published;
+                }
+                file->close();
+                if (file->fail()){
+                    logPtr->error("The associated excel file is not published correctly");
+                    std::remove(WriteExcelHandler::summaryPath(path).c_str());
+                    return CSV;
+                }
+                return SUCCESS;
+            };
+            if (publish != nullptr){
+                *publish = publishFile;
+            }else{
+                result = publishFile();
+            }
+            m_finishUs = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start).count();
+            logPtr->info("The result file is ready " + std::to_string(m_finishUs) + " us after the plan ended, "
+                         + std::to_string(m_streamedRows) + " of " + std::to_string(m_capture.size())
+                         + " rows were written while it ran");
+            if (result != SUCCESS){
+                return result;
+            }
+            *resultPath = m_path;
+            return SUCCESS;
+        }
+
+        /**
+         * @brief Stop writing and drop the result file, for a plan that failed
+         */
+        void abort()
+        {
+            stop();
+            if (m_file){
+                m_file->abort();
+                m_file.reset();
+            }
+        }
+
+        /**
+         * @brief Get the rows of the last plan that were written while it ran
+         */
+        size_t streamedRows() const{
+            return m_streamedRows;
+        }
+
+        /**
+         * @brief Get how long the last finish() took, from the plan end to the file being ready [us]
+         */
+        int64_t finishTime() const{
+            return m_finishUs;
+        }
+
+    private:
+        void stop()
+        {
+            if (!m_thread.joinable()){
+                return;
+            }
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stopping = true;
+            }
+            m_stop.notify_all();
+            m_thread.join();
+        }
+
+        /**
+         * @brief The streaming thread, it runs below the capture tasks and the server threads
+         */
+        void run()
+        {
+#ifdef SCHED_IDLE
+            sched_param param = {};
+            pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+#endif
+            std::unique_lock<std::mutex> lock(m_mutex);
+            while (!m_stop.wait_for(lock, std::chrono::milliseconds(g_streamInterval), [this]{ return m_stopping; })){
+                lock.unlock();
+                drain(false);
+                m_streamedRows = m_rows->written();
+                lock.lock();
+            }
+        }
+
+        /**
+         * @brief Copy what the station captured since the last drain and write the rows that
+         * are final. A row is final when a spi frame after its sample is stored, the frame
+         * SPIAligner picks for it can not change any more.
+         * @param[in] planEnded whether the station stopped capturing, all rows are final then
+         */
+        void drain(bool planEnded)
+        {
+            m_station->capture.copyPublished(m_capture.size(), &m_capture);
+            {
+                std::lock_guard<std::mutex> lock(m_station->spiMutex);
+                const SPIFrameStore& frames = m_station->spiFrames;
+                for (size_t i=m_spiFrames.size(); i<frames.size(); i++){
+                    m_spiFrames.append(frames.frame(i), frames.timestamp(i), frames.sequence(i));
+                }
+            }
+            size_t end = m_capture.size();
+            if (!planEnded){
+                int64_t lastFrame = m_spiFrames.empty() ? std::numeric_limits<int64_t>::min()
+                                                        : m_spiFrames.timestamp(m_spiFrames.size() - 1);
+                end = m_rows->written();
+                while (end < m_capture.size() && m_capture.timestamp(end) < lastFrame){
+                    end++;
+                }
+            }
+            m_rows->writeRows(*m_file, end);
+        }
+    };
+
+} /* namespace kostal */
+
+#endif /* FLEXIVRDK_RESULTSTREAMER_HPP_ */
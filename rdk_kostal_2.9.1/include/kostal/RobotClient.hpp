@@ -0,0 +1,95 @@
+/*
+ * @file RobotClient.hpp
+ * @copyright Copyright (C) 2016-2022 Flexiv Ltd. All Rights Reserved.
+ */
+#ifndef FLEXIVRDK_ROBOTCLIENT_HPP_
+#define FLEXIVRDK_ROBOTCLIENT_HPP_
+
+// Kostal header files
+#include <kostal/SystemParams.h>
+
+namespace kostal {
+
+    /**
+     * @class RobotClient
+     * @brief The robot calls the kostal handlers make. A FlexivRobotClient passes them to a Rizon,
+     * a SimulatedRobot answers them without hardware. The calls behave like the ones of
+     * flexiv::Robot of the same name and throw flexiv::Exception the same way.
+     */
+    class RobotClient
+    {
+    public:
+        RobotClient() = default;
+        virtual ~RobotClient() = default;
+        RobotClient(const RobotClient&) = delete;
+        RobotClient& operator=(const RobotClient&) = delete;
+
+        virtual bool isConnected() const = 0;
+        virtual bool isFault() const = 0;
+        virtual void clearFault() = 0;
+        virtual bool isOperational() const = 0;
+        virtual void setMode(flexiv::Mode mode) = 0;
+        virtual flexiv::Mode getMode() const = 0;
+        virtual std::vector<std::string> getPlanNameList() const = 0;
+        virtual void executePlanByName(const std::string& name) = 0;
+        virtual void getSystemStatus(flexiv::SystemStatus* output) = 0;
+        virtual void getPlanInfo(flexiv::PlanInfo* output) = 0;
+        virtual void getRobotStates(flexiv::RobotStates* output) = 0;
+    };
+
+    /**
+     * @class FlexivRobotClient
+     * @brief A Rizon reached through the rdk
+     */
+    class FlexivRobotClient : public RobotClient
+    {
+    private:
+        flexiv::Robot m_robot;
+
+    public:
+        /**
+         * @param[in] serverIP the address of the robot
+         * @param[in] localIP the address of this computer
+         */
+        FlexivRobotClient(const std::string& serverIP, const std::string& localIP)
+        : m_robot(serverIP, localIP)
+        {}
+
+        bool isConnected() const override{
+            return m_robot.isConnected();
+        }
+        bool isFault() const override{
+            return m_robot.isFault();
+        }
+        void clearFault() override{
+            m_robot.clearFault();
+        }
+        bool isOperational() const override{
+            return m_robot.isOperational();
+        }
+        void setMode(flexiv::Mode mode) override{
+            m_robot.setMode(mode);
+        }
+        flexiv::Mode getMode() const override{
+            return m_robot.getMode();
+        }
+        std::vector<std::string> getPlanNameList() const override{
+            return m_robot.getPlanNameList();
+        }
+        void executePlanByName(const std::string& name) override{
+            m_robot.executePlanByName(name);
+        }
+        void getSystemStatus(flexiv::SystemStatus* output) override{
+            m_robot.getSystemStatus(output);
+        }
+        void getPlanInfo(flexiv::PlanInfo* output) override{
+            m_robot.getPlanInfo(output);
+        }
+        void getRobotStates(flexiv::RobotStates* output) override{
+            m_robot.getRobotStates(output);
+        }
+    };
+
+} /* namespace kostal */
+
+#endif /* FLEXIVRDK_ROBOTCLIENT_HPP_ */
@@ -9,6 +9,8 @@
 #include <kostal/KostalStates.hpp>
 #include <kostal/SystemParams.h>
 #include <kostal/SPIOperation.hpp>
+#include <kostal/StationContext.hpp>
+#include <kostal/RobotClient.hpp>
 
 namespace kostal {
 
@@ -30,7 +32,7 @@ namespace kostal {
          * @param[in] logPtr robot's log pointer
          * @return Status code
          */
-        Status buildRobotConnection(flexiv::Robot* robotPtr, flexiv::Log* logPtr)
+        Status buildRobotConnection(kostal::RobotClient* robotPtr, flexiv::Log* logPtr)
         {   
             // Check whether the robot is connected or not
             if(robotPtr->isConnected()!=true){
@@ -82,6 +84,18 @@ namespace kostal {
             return SUCCESS;
         }
 
+        /**
+         * @brief Check whether the robot can run plans right away, without clearing a
+         * fault or switching the mode as buildRobotConnection() does
+         * @param[in] robotPtr robot's pointer
+         * @return true if the robot is connected, operational and in plan execution mode
+         */
+        bool isRobotReady(kostal::RobotClient* robotPtr)
+        {
+            return robotPtr->isConnected() && !robotPtr->isFault() && robotPtr->isOperational()
+                   && robotPtr->getMode() == flexiv::MODE_PLAN_EXECUTION;
+        }
+
         /**
          * @brief This function helps to clear some tiny software fault that users trigger
          * if return is not success, it means the error can not be eliminated
@@ -89,7 +103,7 @@ namespace kostal {
          * @param[in] logPtr Pointer to flexiv log object
          * @return Flexiv status code
          */
-        Status clearTinyFault(flexiv::Robot* robotPtr, flexiv::Log* logPtr)
+        Status clearTinyFault(kostal::RobotClient* robotPtr, flexiv::Log* logPtr)
         {
             // Clear fault on robot server if any
             if (robotPtr->isFault()) 
@@ -109,101 +123,75 @@ namespace kostal {
         }
 
         /**
-         * @brief Access the current robot data and store it
-         * @param[in] robotPtr robot's pointer
-         * @param[out] robotDataPtr robot data's pointer
-         * @param[out] robotDataListPtr robot data list's pointer
+         * @brief Take one sample of the robot data if the plan is in the capture window of the
+         * trigger of the station, by default between its Start and Stop node. One cycle of the
+         * sampling task. The robot is polled through the state poller
+         * of the station, so its other subscribers get the same snapshot without calling the
+         * robot again. The sample is stamped with the poll time, spi frames are paired with
+         * it by time on export.
+         * @param[in]  robotPtr robot's pointer
+         * @param[in,out] stationPtr station whose robot data is stored
          * @return Status code
          */
-        Status collectRobotData(flexiv::Robot* robotPtr, 
-                                RobotData* robotDataPtr, 
-                                std::list<RobotData>* robotDataListPtr)
+        Status sampleUsefulData(kostal::RobotClient* robotPtr, StationContext* stationPtr)
         {
-        while (g_collectSwitch)
+            const kostal::RobotSnapshot& state = stationPtr->statePoller.poll(robotPtr);
+            // the node is only looked at again when it changed, a sample is copied into the
+            // preallocated columns. The store belongs to this task until the scheduler stops,
+            // no lock is taken.
+            stationPtr->nodeTracker.sample(state, &stationPtr->capture);
+            stationPtr->dataCollectFlag = stationPtr->nodeTracker.capturing();
+            stationPtr->flightRecorder.record(state);
+            return SUCCESS;
+        }
+
+        /**
+         * @brief Record the robot states into the flight recorder of the station between
+         * plans, one cycle of its idle recorder. Nothing is polled while a plan runs, the
+         * sampling task records then.
+         * @param[in] robotPtr robot's pointer
+         * @param[in,out] stationPtr station whose flight recorder is filled
+         * @param[in] systemStatus whether the system status and robot fault are recorded too
+         * @return Status code, ROBOT if a robot call threw
+         */
+        Status recordIdleState(kostal::RobotClient* robotPtr, StationContext* stationPtr, bool systemStatus)
         {
-            // get plan info and put it into instance pointer
-            flexiv::PlanInfo planInfo;
-            robotPtr->getPlanInfo(&planInfo); 
-            if (planInfo.m_nodeName == "Start")
-            {
-                g_dataCollectFlag = true;
-            }
-            if (planInfo.m_nodeName == "Stop")
-            {
-                g_dataCollectFlag = false;
-                //k_log.info("The node is now Stop");
+            std::lock_guard<std::mutex> lock(stationPtr->idlePollMutex);
+            if (stationPtr->collectSwitch){
+                return SUCCESS;
             }
-            if (g_dataCollectFlag == true)
-            {
-                std::lock_guard<std::mutex> lock(g_kostalDataMutex);
-                robotDataPtr->nodeName = planInfo.m_nodeName;   
-                // get robot states and put it into instance pointer
-                flexiv::RobotStates robotStates;
-                robotPtr->getRobotStates(&robotStates);
-                {
-                    // use mutex to lock robot data, store robot data to kostal data 
-                    
-                    robotDataPtr->tcpPose = robotStates.m_tcpPose;
-                    robotDataPtr->rawDataForceSensor = robotStates.m_rawExtForceInTcpFrame;
-                    robotDataPtr->flangePose = robotStates.m_flangePose;
-                    robotDataListPtr->push_back(*robotDataPtr);
+            try {
+                stationPtr->flightRecorder.record(stationPtr->statePoller.poll(robotPtr));
+                if (systemStatus){
+                    flexiv::SystemStatus status;
+                    robotPtr->getSystemStatus(&status);
+                    stationPtr->flightRecorder.record(status);
+                    stationPtr->flightRecorder.recordFault(robotPtr->isFault());
                 }
+            } catch (const flexiv::Exception& e) {
+                return ROBOT;
             }
-            //std::this_thread::sleep_for(std::chrono::milliseconds(1));
-        }
-        return SUCCESS;
+            return SUCCESS;
         }
 
+
         /**
-         * @brief Access the current robot and spi data and store it into each list
-         * @param[in]  robotPtr robot's pointer
-         * @param[out] robotDataPtr robot data's pointer
-         * @param[out] robotDataListPtr robot data list's pointer
-         * @param[out] spiDataPtr spi data's pointer
-         * @param[out] spiDataListPtr spi data list's pointer
-         * @return Status code
+         * @brief Add the node times of the plan that just ended to the profile of the station,
+         * from the node transitions its sampling task tracked, and log how the run compares
+         * @param[in,out] stationPtr station whose plan ended
+         * @param[in] planName the name of the plan
+         * @param[in] logPtr robot's log pointer
+         * @return whether the run was profiled
          */
-        Status collectUsefulData(flexiv::Robot* robotPtr, 
-                                 RobotData* robotDataPtr, 
-                                 std::list<RobotData>* robotDataListPtr,
-                                 SPIData* spiDataPtr,
-                                 std::list<SPIData>* spiDataListPtr)
+        bool profilePlan(StationContext* stationPtr, const std::string& planName, flexiv::Log* logPtr)
         {
-            while (g_collectSwitch)
-            {
-                // get plan info and put it into instance pointer
-                flexiv::PlanInfo planInfo;
-                robotPtr->getPlanInfo(&planInfo); 
-                if (planInfo.m_nodeName == "Start")
-                {
-                    g_dataCollectFlag = true;
-                }
-                if (planInfo.m_nodeName == "Stop")
-                {
-                    g_dataCollectFlag = false;
-                }
-                if (g_dataCollectFlag == true)
-                {
-                    robotDataPtr->nodeName = planInfo.m_nodeName;   
-                    // get robot states and put it into instance pointer
-                    flexiv::RobotStates robotStates;
-                    {
-                        std::lock_guard<std::mutex> lock(g_kostalDataMutex);
-                        robotPtr->getRobotStates(&robotStates);
-
-                        robotDataPtr->tcpPose = robotStates.m_tcpPose;
-                        robotDataPtr->rawDataForceSensor = robotStates.m_rawExtForceInTcpFrame;
-                        robotDataPtr->flangePose = robotStates.m_flangePose;
-                        robotDataListPtr->push_back(*robotDataPtr);
-                        spiDataListPtr->push_back(*spiDataPtr);
-                    }
-                }
-                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            if (!g_planProfiler || !stationPtr->planProfiler.record(planName, stationPtr->nodeTracker)){
+                return false;
             }
-            return SUCCESS;
+            logPtr->info(stationPtr->planProfiler.summary(planName));
+            return true;
         }
 
-
         /**
          * @brief Check whether robot has this plan in list
          * @param[in] robotPtr robot's pointer
@@ -211,7 +199,7 @@ namespace kostal {
          * @param[in] planName the name of the executing work plan
          * @return yes for do have, no for do not have
          */
-        bool checkRobotPlan(flexiv::Robot* robotPtr, 
+        bool checkRobotPlan(kostal::RobotClient* robotPtr, 
                               flexiv::Log* logPtr,
                               std::string planName)
         {
@@ -232,24 +220,38 @@ namespace kostal {
          * @param[in] robotPtr robot's pointer
          * @param[in] logPtr robot's log pointer
          * @param[in] planName the name of the executing work plan
+         * @param[in,out] profilerPtr if given, the node the plan is in is polled with the
+         * system status and its node times are added to the profiler
          * @return Status code
          */
-        Status executeRobotPlan(flexiv::Robot* robotPtr, 
+        Status executeRobotPlan(kostal::RobotClient* robotPtr, 
                                 flexiv::Log* logPtr,
-                                std::string planName)
+                                std::string planName,
+                                kostal::PlanProfiler* profilerPtr = nullptr)
         {      
             flexiv::SystemStatus systemStatus;
+            flexiv::PlanInfo planInfo;
             robotPtr->executePlanByName(planName);
             while (systemStatus.m_programRunning == false)
             {
                 std::this_thread::sleep_for(std::chrono::milliseconds(1));
                 robotPtr->getSystemStatus(&systemStatus);
             }
+            if (profilerPtr != nullptr){
+                profilerPtr->begin(planName);
+            }
             while (systemStatus.m_programRunning == true)
             {
+                if (profilerPtr != nullptr){
+                    robotPtr->getPlanInfo(&planInfo);
+                    profilerPtr->enter(planInfo.m_nodeName, planInfo.m_nodePath, captureTime());
+                }
                 std::this_thread::sleep_for(std::chrono::milliseconds(1));
                 robotPtr->getSystemStatus(&systemStatus);
             }
+            if (profilerPtr != nullptr){
+                profilerPtr->end(captureTime());
+            }
             //logPtr->info("The robot has executed plan: " + planName);
             return SUCCESS;
         }
@@ -0,0 +1,260 @@
+/*
+ * @file SPIIngest.hpp
+ * @copyright Copyright (C) 2016-2022 Flexiv Ltd. All Rights Reserved.
+ */
+#ifndef FLEXIVRDK_SPIINGEST_HPP_
+#define FLEXIVRDK_SPIINGEST_HPP_
+
+// Kostal header files
+#include <kostal/SystemParams.h>
+
+#include <atomic>
+
+namespace kostal {
+
+    /**
+     * @struct SPIFrame
+     * @brief One 16 bytes frame of the lever, numbered in the order the spi device received it
+     */
+    struct SPIFrame
+    {
+        uint8_t data[16];
+        // counts every frame of the plan, a gap in the stored numbers is a lost frame
+        uint64_t sequence = 0;
+        // steady clock time of the read that delivered the frame in nanoseconds
+        int64_t timestamp = 0;
+    };
+
+    /**
+     * @class SPIFrameRing
+     * @brief Fixed number of frames between the spi task and the task that stores them. One
+     * thread pushes and one other thread pops, neither ever waits for the other: each side only
+     * writes its own index and publishes it with release, the other side reads it with acquire.
+     * Never allocates after construction, a full ring refuses new frames instead of overwriting
+     * the ones that were not stored yet.
+     */
+    class SPIFrameRing
+    {
+    private:
+        static_assert((g_spiRingFrames & (g_spiRingFrames - 1)) == 0, "g_spiRingFrames must be a power of two");
+
+        std::vector<SPIFrame> m_frames;
+        // the next frame to pop, written by the consumer
+        alignas(64) std::atomic<size_t> m_head = {0};
+        // the consumer's last look at m_tail, saves reading the producer's cache line
+        size_t m_tailSeen = 0;
+        // the next frame to push, written by the producer
+        alignas(64) std::atomic<size_t> m_tail = {0};
+        // the producer's last look at m_head
+        size_t m_headSeen = 0;
+
+    public:
+        SPIFrameRing()
+        : m_frames(g_spiRingFrames)
+        {}
+        virtual ~SPIFrameRing() = default;
+
+        /**
+         * @brief Add a frame at the end, called by the producer only
+         * @return false if the ring is full
+         */
+        bool push(const SPIFrame& frame)
+        {
+            size_t tail = m_tail.load(std::memory_order_relaxed);
+            if (tail - m_headSeen == g_spiRingFrames){
+                m_headSeen = m_head.load(std::memory_order_acquire);
+                if (tail - m_headSeen == g_spiRingFrames){
+                    return false;
+                }
+            }
+            m_frames[tail & (g_spiRingFrames - 1)] = frame;
+            m_tail.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+
+        /**
+         * @brief Take the oldest frame, called by the consumer only
+         * @return false if the ring is empty
+         */
+        bool pop(SPIFrame* frame)
+        {
+            size_t head = m_head.load(std::memory_order_relaxed);
+            if (head == m_tailSeen){
+                m_tailSeen = m_tail.load(std::memory_order_acquire);
+                if (head == m_tailSeen){
+                    return false;
+                }
+            }
+            *frame = m_frames[head & (g_spiRingFrames - 1)];
+            m_head.store(head + 1, std::memory_order_release);
+            return true;
+        }
+
+        /**
+         * @brief Drop all frames, only while neither the producer nor the consumer runs
+         */
+        void clear()
+        {
+            m_head = 0;
+            m_tail = 0;
+            m_headSeen = 0;
+            m_tailSeen = 0;
+        }
+
+        /**
+         * @brief Get the number of frames waiting, exact only if the other side is not running
+         */
+        size_t size() const{
+            return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire);
+        }
+    };
+
+    /**
+     * @class SPIIngest
+     * @brief Turns what the USB-SPI device delivers into frames. One read returns every byte
+     * received since the last one, that can be several frames, and a frame can be cut by the
+     * end of a read. The bytes of a cut frame are kept and completed by the next read. The read
+     * buffer is reused by every read, only the bytes the device reports are looked at, so it is
+     * never cleared. Used by the spi task of one station only.
+     */
+    class SPIIngest
+    {
+    private:
+        uint8_t m_buffer[g_spiReadBufferSize];
+        // the start of a frame the last read did not complete
+        uint8_t m_partial[16];
+        size_t m_partialBytes = 0;
+        uint64_t m_sequence = 0;
+        uint64_t m_overruns = 0;
+        uint64_t m_partialFrames = 0;
+        int64_t m_firstRead = 0;
+        int64_t m_lastRead = 0;
+
+        void store(const uint8_t* data, int64_t readTime, SPIFrameRing* ringPtr)
+        {
+            SPIFrame frame;
+            std::memcpy(frame.data, data, sizeof(frame.data));
+            frame.sequence = m_sequence++;
+            frame.timestamp = readTime;
+            if (!ringPtr->push(frame)){
+                m_overruns++;
+            }
+        }
+
+    public:
+        SPIIngest() = default;
+        virtual ~SPIIngest() = default;
+
+        /**
+         * @brief Forget the frames and counters of the last plan
+         */
+        void reset()
+        {
+            m_partialBytes = 0;
+            m_sequence = 0;
+            m_overruns = 0;
+            m_partialFrames = 0;
+            m_firstRead = 0;
+            m_lastRead = 0;
+        }
+
+        /**
+         * @brief The buffer the device reads into
+         */
+        uint8_t* buffer(){
+            return m_buffer;
+        }
+
+        /**
+         * @brief Get the number of bytes the buffer holds
+         */
+        static constexpr int32_t bufferSize(){
+            return static_cast<int32_t>(g_spiReadBufferSize);
+        }
+
+        /**
+         * @brief Split the bytes of one read into frames and put them into the ring. Frames
+         * that do not fit into the ring are counted as overruns and lost.
+         * @param[in] bytes the number of bytes the device read into the buffer
+         * @param[in] readTime steady clock time of the read in nanoseconds
+         * @param[in,out] ringPtr the ring the frames are put into
+         */
+        void split(int32_t bytes, int64_t readTime, SPIFrameRing* ringPtr)
+        {
+            if (bytes <= 0){
+                return;
+            }
+            if (m_firstRead == 0){
+                m_firstRead = readTime;
+            }
+            m_lastRead = readTime;
+            size_t count = std::min(static_cast<size_t>(bytes), g_spiReadBufferSize);
+            size_t offset = 0;
+            // complete the frame the last read cut
+            if (m_partialBytes > 0){
+                size_t missing = std::min(16 - m_partialBytes, count);
+                std::memcpy(m_partial + m_partialBytes, m_buffer, missing);
+                m_partialBytes += missing;
+                offset = missing;
+                if (m_partialBytes < 16){
+                    return;
+                }
+                store(m_partial, readTime, ringPtr);
+                m_partialBytes = 0;
+            }
+            for (; offset + 16 <= count; offset += 16){
+                store(m_buffer + offset, readTime, ringPtr);
+            }
+            if (offset < count){
+                m_partialBytes = count - offset;
+                std::memcpy(m_partial, m_buffer + offset, m_partialBytes);
+                m_partialFrames++;
+            }
+        }
+
+        /**
+         * @brief Get the number of complete frames received in this plan
+         */
+        uint64_t frames() const{
+            return m_sequence;
+        }
+
+        /**
+         * @brief Get the number of frames lost because the ring was full
+         */
+        uint64_t overruns() const{
+            return m_overruns;
+        }
+
+        /**
+         * @brief Get the number of reads that ended inside a frame
+         */
+        uint64_t partialFrames() const{
+            return m_partialFrames;
+        }
+
+        /**
+         * @brief Get the frames received per second between the first and the last read
+         */
+        double frameRate() const{
+            if (m_lastRead <= m_firstRead){
+                return 0;
+            }
+            return m_sequence * 1e9 / (m_lastRead - m_firstRead);
+        }
+
+        /**
+         * @brief Describe the frames received in this plan in one line
+         */
+        std::string summary() const
+        {
+            return "SPI frames = " + std::to_string(m_sequence) + " at "
+                   + std::to_string(static_cast<int64_t>(frameRate())) + " frames/s, "
+                   + std::to_string(m_overruns) + " overruns, "
+                   + std::to_string(m_partialFrames) + " reads ended inside a frame";
+        }
+    };
+
+} /* namespace kostal */
+
+#endif /* FLEXIVRDK_SPIINGEST_HPP_ */
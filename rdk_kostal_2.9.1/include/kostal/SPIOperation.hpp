@@ -9,13 +9,16 @@
 // Kostal header files
 #include <kostal/KostalStates.hpp>
 #include <kostal/SystemParams.h>
-#include <kostal/ControlSPI.h>
+#include <kostal/SPISource.hpp>
+#include <kostal/StationContext.hpp>
+#include <kostal/SPIIngest.hpp>
 
 namespace kostal {
 
     /**
      * @class SPIOperationHandler
-     * @brief Base class for SPI device operations like connect and collect 
+     * @brief Base class for SPI device operations like connect and collect, the device itself
+     * is the spi source of the station
      */
     class SPIOperationHandler
     {
@@ -23,143 +26,95 @@ namespace kostal {
         SPIOperationHandler() = default;
         virtual ~SPIOperationHandler() = default;
         
-        Status buildSPIConnectionDummy(){
-            return SUCCESS;
-        }
-
-        /**
-         * @brief Build connection between SPI device and system with socket message
-         * @return Status code
-         */
-        Status buildSPIConnectionSocket()
-        {
-            flexiv::Log log;
-            int ret;
-            VSI_INIT_CONFIG SPI_Config;
-            // Scan connected device 
-            ret = VSI_ScanDevice(1);
-            if (ret <= 0){
-                log.error("The SPI device can not be found, please check the USB interface!");
-                return SPI;
-            }
-            ret = VSI_OpenDevice(VSI_USBSPI, 0, 0);
-            if (ret != ERR_SUCCESS){
-                log.error("The SPI device can not be open, please check SPI device!");
-                return SPI;
-            }
-            SPI_Config.ControlMode = 0;
-            SPI_Config.MasterMode = 0; // Slave Mode
-            SPI_Config.CPHA = g_CPHA; // Clock Polarity and Phase must be same as master
-            SPI_Config.CPOL = g_CPOL;
-            SPI_Config.LSBFirst = g_LSB;
-            SPI_Config.TranBits = 8; // Support 8bit mode only
-            SPI_Config.SelPolarity = g_SelPol;
-            SPI_Config.ClockSpeed = 1395000;
-            ret = VSI_InitSPI(VSI_USBSPI, 0, &SPI_Config);
-            if (ret != ERR_SUCCESS) {
-                log.error("The SPI device can not be initialized, please check SPI device or use sudo!");
-                return SPI;
-            }
-            return SUCCESS;
-        }
-        
         /**
-         * @brief Build the connection to SPI device with default params
+         * @brief Create the spi source the station config asks for and connect it, the Ginkgo
+         * adapter is scanned and initialized with the spi config of the handshake
+         * @param[in,out] stationPtr station whose spi config is used and spi source is replaced
          * @return Status code
          */
-        Status buildSPIConnection()
+        Status buildSPIConnection(StationContext* stationPtr)
         {
             flexiv::Log log;
-            int ret;
-            VSI_INIT_CONFIG SPI_Config;
-            // Scan connected device 
-            ret = VSI_ScanDevice(1);
-            if (ret <= 0){
-                log.error("The SPI device can not be found, please check the USB interface!");
+            stationPtr->spiSource = makeSPISource(stationPtr->spiConfig);
+            if (stationPtr->spiSource == nullptr){
+                log.error("The SPI source " + stationPtr->spiConfig.source + " is unknown");
                 return SPI;
             }
-            ret = VSI_OpenDevice(VSI_USBSPI, 0, 0);
-            if (ret != ERR_SUCCESS){
-                log.error("The SPI device can not be open, please check SPI device!");
-                return SPI;
-            }
-            SPI_Config.ControlMode = 0;
-            SPI_Config.MasterMode = 0; // Slave Mode
-            SPI_Config.CPHA = 1; // Clock Polarity and Phase must be same as master
-            SPI_Config.CPOL = 0;
-            SPI_Config.LSBFirst = 0;
-            SPI_Config.TranBits = 8; // Support 8bit mode only
-            SPI_Config.SelPolarity = 0;
-            SPI_Config.ClockSpeed = 1395000;
-            ret = VSI_InitSPI(VSI_USBSPI, 0, &SPI_Config);
-            if (ret != ERR_SUCCESS) {
-                log.error("The SPI device can not be initialized, please check SPI device!");
-                return SPI;
+            Status result = stationPtr->spiSource->connect(stationPtr->spiConfig, stationPtr->spiDeviceIndex, &log);
+            if (result != SUCCESS){
+                stationPtr->spiSource.reset();
+                return result;
             }
+            log.info("The SPI source is " + stationPtr->spiSource->name());
             return SUCCESS;
         }
 
         /**
          * @brief Read SPI data from the USB-SPI device, put them into the SPI data list
+         * @param[in,out] stationPtr station whose spi device is read and spi data is updated
          * @param[in] logPtr robot's log pointer
-         * @param[in] spiDataPtr spi data's pointer
          * @return Status code
          */
-        Status collectSPIData(SPIData* spiDataPtr, flexiv::Log* logPtr)
+        Status collectSPIData(StationContext* stationPtr, flexiv::Log* logPtr)
         {
-            while(g_collectSwitch)
+            while(stationPtr->collectSwitch)
             {   
-                uint8_t read_buffer[10240] = {0};
-                int32_t read_data_num = 0;
-                int ret = VSI_SlaveReadBytes(VSI_USBSPI, 0, read_buffer, &read_data_num, 2);
-
-                if (ret != ERR_SUCCESS){
-                    logPtr->error("The SPI device read data error");
+                if (readSPIData(stationPtr, logPtr) != SUCCESS){
                     return SPI;
                 }
-                if (read_data_num >0) // filter and only keep data with 16 bytes length
-                {
-                    std::lock_guard<std::mutex> lock(g_kostalDataMutex);
-                    uint8_t SPISensorBuffer[16]= {0};
-                    for (int i = 0; i < read_data_num; i++){
-                        SPISensorBuffer[i]=read_buffer[i];
-                    }
-                    *spiDataPtr = SPISensorBuffer;
-                }
             }
 
             return SUCCESS;
         }
 
         /**
-         * @brief Fake Reading SPI data from the USB-SPI device, put them into the SPI data list
+         * @brief Read what the spi source received since the last read, one cycle of the
+         * spi task. Every complete frame is put into the spi ring with its sequence number and
+         * the time of the read. Takes no lock, the spi task never waits for another task.
+         * @param[in,out] stationPtr station whose spi device is read and spi ring is filled
          * @param[in] logPtr robot's log pointer
-         * @param[in] spiDataPtr spi data's pointer
-         * @param[in] spiDataListPtr spi data list's pointer
          * @return Status code
          */
-        Status collectSPIDataDummy(SPIData* spiDataPtr, flexiv::Log* logPtr)  
+        Status readSPIData(StationContext* stationPtr, flexiv::Log* logPtr)
         {
-            int ret;
-            uint8_t read_buffer[10240] = {0};
-            int32_t read_data_num = 16;
-            if (read_data_num == 16) // collect only when data is 16 bytes length
-            { 
-                std::lock_guard<std::mutex> lock(g_kostalDataMutex);
-                uint8_t SPISensorBuffer[16]= {0}; // put 0 in buffer
-                for (int i = 0; i < 16; i++){
-                    SPISensorBuffer[i]=read_buffer[i];
-                }
-                *spiDataPtr = SPISensorBuffer;
-                // // use mutex to lock spi data, store spi data to kostal data 
-                // {
-                //     std::lock_guard<std::mutex> lock(g_kostalDataMutex);
-                //     spiDataListPtr->push_back(*spiDataPtr);
-                // }   
+            if (stationPtr->spiSource == nullptr){
+                logPtr->error("The SPI source is not connected");
+                return SPI;
+            }
+            int32_t read_data_num = 0;
+            Status ret = stationPtr->spiSource->read(stationPtr->spiIngest.buffer(),
+                                                     SPIIngest::bufferSize(), &read_data_num);
+            int64_t readTime = captureTime();
+
+            if (ret != SUCCESS){
+                logPtr->error("The SPI device read data error");
+                return SPI;
+            }
+            if (read_data_num > 0)
+            {
+                stationPtr->spiIngest.split(read_data_num, readTime, &stationPtr->spiRing);
             }
-            
             return SUCCESS;
         }
+
+        /**
+         * @brief Move the frames waiting in the spi ring into the spi frames of the plan, only
+         * one task may call this while the spi task runs
+         * @param[in,out] stationPtr station whose spi ring is emptied
+         * @return the number of frames stored
+         */
+        size_t storeSPIFrames(StationContext* stationPtr)
+        {
+            std::lock_guard<std::mutex> lock(stationPtr->spiMutex);
+            size_t stored = 0;
+            SPIFrame frame;
+            while (stationPtr->spiRing.pop(&frame)){
+                stationPtr->spiFrames.append(frame.data, frame.timestamp, frame.sequence);
+                stationPtr->flightRecorder.record(frame);
+                stored++;
+            }
+            return stored;
+        }
     };
 
 } /* namespace kostal */
@@ -0,0 +1,370 @@
+/*
+ * @file SPISource.hpp
+ * @copyright Copyright (C) 2016-2022 Flexiv Ltd. All Rights Reserved.
+ */
+#ifndef FLEXIVRDK_SPISOURCE_HPP_
+#define FLEXIVRDK_SPISOURCE_HPP_
+
+// Kostal header files
+#include <kostal/SystemParams.h>
+#include <kostal/ControlSPI.h>
+#include <kostal/CaptureStore.hpp>
+
+#include <sstream>
+
+namespace kostal {
+
+    /**
+     * @struct SPIConfig
+     * @brief SPI bus settings and the source of the frames that Testman sends in the handshake
+     */
+    struct SPIConfig
+    {
+        int CPHA = 1;
+        int CPOL = 0;
+        int LSB = 0;
+        int SelPol = 0;
+        // GINKGO reads the USB-SPI adapter, SYNTHETIC generates frames, REPLAY streams a result file
+        std::string source = g_spiSource;
+        // frames per second and bits of the SYNTHETIC source
+        double frameRate = g_syntheticFrameRate;
+        std::string pattern = g_syntheticPattern;
+        // the csv result the REPLAY source streams, and how many times faster than recorded
+        std::string replayFile;
+        double replaySpeed = 1;
+
+        bool operator==(const SPIConfig& other) const{
+            return CPHA == other.CPHA && CPOL == other.CPOL && LSB == other.LSB && SelPol == other.SelPol
+                   && source == other.source && frameRate == other.frameRate && pattern == other.pattern
+                   && replayFile == other.replayFile && replaySpeed == other.replaySpeed;
+        }
+        bool operator!=(const SPIConfig& other) const{
+            return !(*this == other);
+        }
+    };
+
+    /**
+     * @class SPISource
+     * @brief Where the spi task gets its bytes from. A read returns every byte received since
+     * the last read, as the USB-SPI adapter does, so the frames of every source go through the
+     * same splitting, ring and store.
+     */
+    class SPISource
+    {
+    public:
+        SPISource() = default;
+        virtual ~SPISource() = default;
+
+        /**
+         * @brief Open the device or file
+         * @param[in] config the spi config of the station
+         * @param[in] deviceIndex the index of the USB-SPI adapter of the station
+         * @param[in] logPtr log pointer
+         * @return Status code
+         */
+        virtual Status connect(const SPIConfig& config, int deviceIndex, flexiv::Log* logPtr) = 0;
+
+        /**
+         * @brief Called before every plan, a generated or replayed stream starts over
+         */
+        virtual void start(){}
+
+        /**
+         * @brief Read the bytes received since the last read
+         * @param[out] buffer where the bytes are written
+         * @param[in] capacity the size of the buffer
+         * @param[out] bytes the number of bytes written
+         * @return Status code
+         */
+        virtual Status read(uint8_t* buffer, int32_t capacity, int32_t* bytes) = 0;
+
+        virtual std::string name() const = 0;
+    };
+
+    /**
+     * @class GinkgoSPISource
+     * @brief The Ginkgo USB-SPI adapter in slave mode
+     */
+    class GinkgoSPISource : public SPISource
+    {
+    private:
+        int m_deviceIndex = 0;
+
+    public:
+        Status connect(const SPIConfig& config, int deviceIndex, flexiv::Log* logPtr) override
+        {
+            int ret;
+            VSI_INIT_CONFIG SPI_Config;
+            // Scan connected device
+            ret = VSI_ScanDevice(1);
+            if (ret <= deviceIndex){
+                logPtr->error("The SPI device can not be found, please check the USB interface!");
+                return SPI;
+            }
+            ret = VSI_OpenDevice(VSI_USBSPI, deviceIndex, 0);
+            if (ret != ERR_SUCCESS){
+                logPtr->error("The SPI device can not be open, please check SPI device!");
+                return SPI;
+            }
+            SPI_Config.ControlMode = 0;
+            SPI_Config.MasterMode = 0; // Slave Mode
+            SPI_Config.CPHA = config.CPHA; // Clock Polarity and Phase must be same as master
+            SPI_Config.CPOL = config.CPOL;
+            SPI_Config.LSBFirst = config.LSB;
+            SPI_Config.TranBits = 8; // Support 8bit mode only
+            SPI_Config.SelPolarity = config.SelPol;
+            SPI_Config.ClockSpeed = 1395000;
+            ret = VSI_InitSPI(VSI_USBSPI, deviceIndex, &SPI_Config);
+            if (ret != ERR_SUCCESS) {
+                logPtr->error("The SPI device can not be initialized, please check SPI device or use sudo!");
+                return SPI;
+            }
+            m_deviceIndex = deviceIndex;
+            return SUCCESS;
+        }
+
+        Status read(uint8_t* buffer, int32_t /*capacity*/, int32_t* bytes) override
+        {
+            // the driver returns at most the 10 KB the buffer is sized for
+            *bytes = 0;
+            int ret = VSI_SlaveReadBytes(VSI_USBSPI, m_deviceIndex, buffer, bytes, 2);
+            return ret == ERR_SUCCESS ? SUCCESS : SPI;
+        }
+
+        std::string name() const override{
+            return "GINKGO";
+        }
+    };
+
+    /**
+     * @class SyntheticSPISource
+     * @brief Generates frames at a fixed rate from the start of the plan, a read returns the
+     * frames that became due since the last one. The bits of a frame follow a pattern:
+     * - COUNTER, the frame number in the first 8 bytes and its complement in the last 8,
+     * - WALKING, a single one bit that moves through the 128 bits frame by frame,
+     * - LEVER, the first byte switches between 0 and 1 every half second, COUNTER otherwise,
+     * - RANDOM, bytes of a xorshift generator.
+     */
+    class SyntheticSPISource : public SPISource
+    {
+    private:
+        double m_frameRate = 1000;
+        std::string m_pattern;
+        int64_t m_start = 0;
+        uint64_t m_frames = 0;
+        uint64_t m_random = 88172645463325252ull;
+
+    public:
+        /**
+         * @brief Write the bytes of frame n
+         * @param[in] pattern one of the patterns of the class
+         * @param[in] n the frame number since the start
+         * @param[in] frameRate frames per second
+         * @param[in,out] random the state of the RANDOM pattern
+         * @param[out] frame the frame [16]
+         */
+        static void makeFrame(const std::string& pattern, uint64_t n, double frameRate, uint64_t* random, uint8_t* frame)
+        {
+            if (pattern == "WALKING"){
+                std::memset(frame, 0, 16);
+                frame[(n % 128) / 8] = static_cast<uint8_t>(1 << (n % 8));
+                return;
+            }
+            if (pattern == "RANDOM"){
+                for (int i=0; i<16; i+=8){
+                    *random ^= *random << 13;
+                    *random ^= *random >> 7;
+                    *random ^= *random << 17;
+                    std::memcpy(frame + i, random, 8);
+                }
+                return;
+            }
+            uint64_t inverse = ~n;
+            std::memcpy(frame, &n, 8);
+            std::memcpy(frame + 8, &inverse, 8);
+            if (pattern == "LEVER"){
+                uint64_t halfSecond = std::max<uint64_t>(1, static_cast<uint64_t>(frameRate / 2));
+                frame[0] = static_cast<uint8_t>((n / halfSecond) % 2);
+            }
+        }
+
+        Status connect(const SPIConfig& config, int /*deviceIndex*/, flexiv::Log* logPtr) override
+        {
+            if (config.frameRate <= 0){
+                logPtr->error("The synthetic SPI frame rate has to be positive");
+                return SPI;
+            }
+            if (config.pattern != "COUNTER" && config.pattern != "WALKING"
+                && config.pattern != "LEVER" && config.pattern != "RANDOM"){
+                logPtr->error("The synthetic SPI pattern " + config.pattern + " is unknown");
+                return SPI;
+            }
+            m_frameRate = config.frameRate;
+            m_pattern = config.pattern;
+            start();
+            return SUCCESS;
+        }
+
+        void start() override
+        {
+            m_start = captureTime();
+            m_frames = 0;
+            m_random = 88172645463325252ull;
+        }
+
+        Status read(uint8_t* buffer, int32_t capacity, int32_t* bytes) override
+        {
+            uint64_t due = static_cast<uint64_t>((captureTime() - m_start) * 1e-9 * m_frameRate) + 1;
+            uint64_t count = std::min<uint64_t>(due - std::min(due, m_frames), capacity / 16);
+            for (uint64_t i=0; i<count; i++){
+                makeFrame(m_pattern, m_frames++, m_frameRate, &m_random, buffer + i * 16);
+            }
+            *bytes = static_cast<int32_t>(count * 16);
+            return SUCCESS;
+        }
+
+        std::string name() const override{
+            return "SYNTHETIC " + m_pattern + " " + std::to_string(static_cast<int64_t>(m_frameRate)) + " frames/s";
+        }
+    };
+
+    /**
+     * @class ReplaySPISource
+     * @brief Streams the spi frames of a csv result again with the time they were recorded.
+     * A frame paired with several robot samples is replayed once, rows without a frame are
+     * skipped. The stream starts over with every plan and runs replaySpeed times faster than
+     * recorded, a speed of 0 returns as many frames as a read can hold.
+     */
+    class ReplaySPISource : public SPISource
+    {
+    private:
+        // the frames and their time since the first recorded frame [ns]
+        std::vector<std::array<uint8_t, 16>> m_frames;
+        std::vector<int64_t> m_times;
+        double m_speed = 1;
+        int64_t m_start = 0;
+        size_t m_next = 0;
+
+        static std::vector<std::string> splitLine(const std::string& line)
+        {
+            std::vector<std::string> cells;
+            std::stringstream stream(line);
+            std::string cell;
+            while (std::getline(stream, cell, ',')){
+                cells.push_back(cell);
+            }
+            return cells;
+        }
+
+    public:
+        Status connect(const SPIConfig& config, int /*deviceIndex*/, flexiv::Log* logPtr) override
+        {
+            std::ifstream file(config.replayFile);
+            if (!file.is_open()){
+                logPtr->error("The SPI replay file " + config.replayFile + " can not be opened");
+                return SPI;
+            }
+            if (config.replaySpeed < 0){
+                logPtr->error("The SPI replay speed can not be negative");
+                return SPI;
+            }
+            std::string line;
+            std::getline(file, line);
+            std::vector<std::string> header = splitLine(line);
+            auto column = [&header](const std::string& name) -> int {
+                auto it = std::find(header.begin(), header.end(), name);
+                return it == header.end() ? -1 : static_cast<int>(it - header.begin());
+            };
+            int firstByte = column("SPI0-0");
+            int time = column("Time_us");
+            int offset = column("SPI_Offset_us");
+            int sequence = column("SPI_Seq");
+            if (firstByte < 0 || time < 0 || offset < 0 || sequence < 0){
+                logPtr->error("The SPI replay file has no spi frame times, it was written before they were recorded");
+                return SPI;
+            }
+            m_frames.clear();
+            m_times.clear();
+            std::string lastSequence;
+            while (std::getline(file, line)){
+                std::vector<std::string> cells = splitLine(line);
+                if (static_cast<int>(cells.size()) <= sequence || cells[sequence].empty()
+                    || cells[sequence] == lastSequence){
+                    continue;
+                }
+                lastSequence = cells[sequence];
+                std::array<uint8_t, 16> frame;
+                for (int i=0; i<16; i++){
+                    frame[i] = static_cast<uint8_t>(std::stoul(cells[firstByte + i], nullptr, 16));
+                }
+                int64_t frameTime = static_cast<int64_t>((std::stod(cells[time]) + std::stod(cells[offset])) * 1000);
+                m_frames.push_back(frame);
+                m_times.push_back(frameTime);
+            }
+            if (m_frames.empty()){
+                logPtr->error("The SPI replay file " + config.replayFile + " has no spi frames");
+                return SPI;
+            }
+            int64_t first = m_times.front();
+            for (int64_t& t : m_times){
+                t -= first;
+            }
+            m_speed = config.replaySpeed;
+            start();
+            return SUCCESS;
+        }
+
+        void start() override
+        {
+            m_start = captureTime();
+            m_next = 0;
+        }
+
+        Status read(uint8_t* buffer, int32_t capacity, int32_t* bytes) override
+        {
+            double elapsed = (captureTime() - m_start) * m_speed;
+            int32_t written = 0;
+            while (m_next < m_frames.size() && written + 16 <= capacity
+                   && (m_speed == 0 || m_times[m_next] <= elapsed)){
+                std::memcpy(buffer + written, m_frames[m_next].data(), 16);
+                written += 16;
+                m_next++;
+            }
+            *bytes = written;
+            return SUCCESS;
+        }
+
+        /**
+         * @brief Get the number of frames in the file
+         */
+        size_t frames() const{
+            return m_frames.size();
+        }
+
+        std::string name() const override{
+            return "REPLAY " + std::to_string(m_frames.size()) + " frames";
+        }
+    };
+
+    /**
+     * @brief Create the source a spi config asks for
+     * @param[in] config the spi config of the station
+     * @return the source, nullptr if the source is unknown
+     */
+    inline std::unique_ptr<SPISource> makeSPISource(const SPIConfig& config)
+    {
+        if (config.source == "GINKGO"){
+            return std::make_unique<GinkgoSPISource>();
+        }
+        if (config.source == "SYNTHETIC"){
+            return std::make_unique<SyntheticSPISource>();
+        }
+        if (config.source == "REPLAY"){
+            return std::make_unique<ReplaySPISource>();
+        }
+        return nullptr;
+    }
+
+} /* namespace kostal */
+
+#endif /* FLEXIVRDK_SPISOURCE_HPP_ */
@@ -0,0 +1,450 @@
+/*
+ * @file SimulatedRobot.hpp
+ * @copyright Copyright (C) 2016-2022 Flexiv Ltd. All Rights Reserved.
+ */
+#ifndef FLEXIVRDK_SIMULATEDROBOT_HPP_
+#define FLEXIVRDK_SIMULATEDROBOT_HPP_
+
+// Kostal header files
+#include <kostal/SystemParams.h>
+#include <kostal/RobotClient.hpp>
+
+#include <random>
+
+namespace kostal {
+
+    /**
+     * @struct SimulatedNode
+     * @brief One node of a simulated plan, the tcp pose and raw force move linearly from their
+     * start to their end value while the node runs
+     */
+    struct SimulatedNode
+    {
+        std::string name;
+        // the node path the plan info reports, the name if empty
+        std::string path;
+        double seconds = 0.1;
+        // position [m] and quaternion w x y z
+        std::array<double, 7> tcpStart = {0.6, 0, 0.3, 0, 0, 1, 0};
+        std::array<double, 7> tcpEnd = {0.6, 0, 0.3, 0, 0, 1, 0};
+        // force [N] and moment [Nm]
+        std::array<double, 6> forceStart = {0, 0, 0, 0, 0, 0};
+        std::array<double, 6> forceEnd = {0, 0, 0, 0, 0, 0};
+    };
+
+    /**
+     * @struct SimulatedPlan
+     * @brief The nodes a simulated plan runs through one after the other
+     */
+    struct SimulatedPlan
+    {
+        std::string name;
+        std::vector<SimulatedNode> nodes;
+
+        double seconds() const
+        {
+            double total = 0;
+            for (const SimulatedNode& node : nodes){
+                total += node.seconds;
+            }
+            return total;
+        }
+    };
+
+    /**
+     * @class SimulatedRobot
+     * @brief A robot without hardware that runs scripted plans in real time. A plan starts
+     * programStartDelay after executePlanByName and then runs through its nodes, the plan info,
+     * system status and robot states are computed from the time since then. Every call waits for
+     * the configured rpc latency like a call to the robot server does. Faults can be injected:
+     * a fault when a plan reaches a node, calls that throw, and a lost connection.
+     */
+    class SimulatedRobot : public RobotClient
+    {
+    public:
+        typedef std::chrono::steady_clock Clock;
+
+    private:
+        mutable std::mutex m_mutex;
+        std::vector<SimulatedPlan> m_plans;
+        bool m_connected = true;
+        bool m_fault = false;
+        bool m_faultClearable = true;
+        flexiv::Mode m_mode = flexiv::MODE_IDLE;
+        // the running plan, -1 if none runs
+        int m_plan = -1;
+        Clock::time_point m_planStart;
+        std::chrono::microseconds m_programStartDelay = std::chrono::milliseconds(10);
+        // the node that faults the robot when a plan reaches it
+        std::string m_faultNode;
+        bool m_faultNodeClearable = true;
+        // the call counted down to 0 throws
+        mutable int64_t m_callsUntilThrow = -1;
+        mutable uint64_t m_calls = 0;
+        std::chrono::microseconds m_latency = std::chrono::microseconds(0);
+        std::chrono::microseconds m_latencyJitter = std::chrono::microseconds(0);
+        mutable std::mt19937 m_random{5};
+
+        /** Wait like an rpc, then count the call and throw if one is injected */
+        void rpc() const
+        {
+            std::chrono::microseconds latency = m_latency;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (m_latencyJitter.count() > 0){
+                    std::uniform_int_distribution<int64_t> jitter(0, m_latencyJitter.count());
+                    latency += std::chrono::microseconds(jitter(m_random));
+                }
+                m_calls++;
+                if (!m_connected){
+                    throw flexiv::CommException("The simulated robot is disconnected");
+                }
+                if (m_callsUntilThrow > 0 && --m_callsUntilThrow == 0){
+                    m_callsUntilThrow = -1;
+                    throw flexiv::CommException("Injected failure of the simulated robot");
+                }
+            }
+            if (latency.count() > 0){
+                std::this_thread::sleep_for(latency);
+            }
+        }
+
+        /**
+         * Find where the running plan is, under the mutex. Reaching the fault node faults the
+         * robot and stops the plan, the end of the last node stops it too.
+         * @param[out] node the running node, nullptr before the program started
+         * @param[out] fraction how far the node is done [0, 1]
+         * @return whether the program runs
+         */
+        bool advance(const SimulatedNode** node, double* fraction)
+        {
+            *node = nullptr;
+            *fraction = 0;
+            if (m_plan < 0){
+                return false;
+            }
+            double elapsed = std::chrono::duration<double>(Clock::now() - m_planStart - m_programStartDelay).count();
+            if (elapsed < 0){
+                return false;
+            }
+            for (const SimulatedNode& candidate : m_plans[m_plan].nodes){
+                if (candidate.name == m_faultNode){
+                    m_fault = true;
+                    m_faultClearable = m_faultNodeClearable;
+                    m_faultNode.clear();
+                    m_plan = -1;
+                    return false;
+                }
+                if (elapsed < candidate.seconds){
+                    *node = &candidate;
+                    *fraction = candidate.seconds > 0 ? elapsed / candidate.seconds : 1;
+                    return true;
+                }
+                elapsed -= candidate.seconds;
+            }
+            m_plan = -1;
+            return false;
+        }
+
+        template <size_t N>
+        static void interpolate(const std::array<double, N>& start, const std::array<double, N>& end,
+                                double fraction, size_t count, double* output)
+        {
+            for (size_t i=0; i<count; i++){
+                output[i] = start[i] + (end[i] - start[i]) * fraction;
+            }
+        }
+
+    public:
+        SimulatedRobot() = default;
+        virtual ~SimulatedRobot() = default;
+
+        /**
+         * @brief A plan as the kostal plans run it: the samples are taken between Start and Stop,
+         * where the tcp presses the lever down by 5 mm and the force rises to 20 N. The nodes
+         * Start, Press and Stop have the path Lever/, Approach and Retract the path Move/.
+         * @param[in] name the name of the plan
+         * @param[in] seconds the duration of the plan
+         */
+        static SimulatedPlan kostalPlan(const std::string& name, double seconds)
+        {
+            SimulatedPlan plan;
+            plan.name = name;
+            SimulatedNode node;
+            for (auto step : {std::make_pair("Approach", 0.1), std::make_pair("Start", 0.05),
+                              std::make_pair("Press", 0.6), std::make_pair("Stop", 0.05),
+                              std::make_pair("Retract", 0.2)}){
+                node.name = step.first;
+                // the lever nodes sit in one sub plan, the moves around them in another
+                bool move = node.name == "Approach" || node.name == "Retract";
+                node.path = (move ? "Move/" : "Lever/") + node.name;
+                node.seconds = seconds * step.second;
+                node.tcpStart = node.tcpEnd;
+                node.forceStart = node.forceEnd;
+                if (node.name == "Press"){
+                    node.tcpEnd[2] -= 0.005;
+                    node.forceEnd[2] = 20;
+                }else if (node.name == "Retract"){
+                    node.tcpEnd[2] += 0.005;
+                    node.forceEnd[2] = 0;
+                }
+                plan.nodes.push_back(node);
+            }
+            return plan;
+        }
+
+        /**
+         * @brief Add a plan or replace the one with the same name
+         */
+        void addPlan(const SimulatedPlan& plan)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (SimulatedPlan& existing : m_plans){
+                if (existing.name == plan.name){
+                    existing = plan;
+                    return;
+                }
+            }
+            m_plans.push_back(plan);
+        }
+
+        /**
+         * @brief Load plans from a json file of the form
+         * {"plans": [{"name": "Kostal-MainPlan", "nodes": [{"name": "Start", "path": "Main/Start", "seconds": 0.5,
+         * "tcpStart": [7], "tcpEnd": [7], "forceStart": [6], "forceEnd": [6]}, ...]}, ...]},
+         * a pose or force that is left out continues from the node before
+         * @param[in] fileName the json file
+         * @param[in] logPtr log pointer
+         * @return Status code
+         */
+        Status loadPlans(const std::string& fileName, flexiv::Log* logPtr)
+        {
+            std::ifstream file(fileName);
+            Json::Value root;
+            Json::Reader reader;
+            if (!file.is_open() || !reader.parse(file, root) || !root["plans"].isArray()){
+                logPtr->error("The simulated plans can not be read from " + fileName);
+                return JSON;
+            }
+            for (const Json::Value& planValue : root["plans"]){
+                SimulatedPlan plan;
+                plan.name = planValue["name"].asString();
+                SimulatedNode node;
+                for (const Json::Value& nodeValue : planValue["nodes"]){
+                    node.name = nodeValue["name"].asString();
+                    node.path = nodeValue.get("path", "").asString();
+                    node.seconds = nodeValue.get("seconds", 0.1).asDouble();
+                    node.tcpStart = node.tcpEnd;
+                    node.forceStart = node.forceEnd;
+                    auto read = [&nodeValue](const char* key, double* values, size_t count){
+                        if (nodeValue[key].isArray() && nodeValue[key].size() == count){
+                            for (Json::ArrayIndex i=0; i<count; i++){
+                                values[i] = nodeValue[key][i].asDouble();
+                            }
+                        }
+                    };
+                    read("tcpStart", node.tcpStart.data(), 7);
+                    node.tcpEnd = node.tcpStart;
+                    read("tcpEnd", node.tcpEnd.data(), 7);
+                    read("forceStart", node.forceStart.data(), 6);
+                    node.forceEnd = node.forceStart;
+                    read("forceEnd", node.forceEnd.data(), 6);
+                    plan.nodes.push_back(node);
+                }
+                if (plan.name.empty() || plan.nodes.empty()){
+                    logPtr->error("A simulated plan in " + fileName + " has no name or no nodes");
+                    return JSON;
+                }
+                addPlan(plan);
+            }
+            return SUCCESS;
+        }
+
+        /**
+         * @brief Set how long every call waits, a random jitter up to the given one is added
+         */
+        void setLatency(std::chrono::microseconds latency, std::chrono::microseconds jitter = std::chrono::microseconds(0))
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_latency = latency;
+            m_latencyJitter = jitter;
+        }
+
+        /**
+         * @brief Set the time between executePlanByName and the running program
+         */
+        void setProgramStartDelay(std::chrono::microseconds delay)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_programStartDelay = delay;
+        }
+
+        /**
+         * @brief Fault the robot when the next plan reaches a node, the plan stops there
+         * @param[in] nodeName the node
+         * @param[in] clearable whether clearFault() can clear the fault
+         */
+        void injectFault(const std::string& nodeName, bool clearable = true)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_faultNode = nodeName;
+            m_faultNodeClearable = clearable;
+        }
+
+        /**
+         * @brief Make the n-th call from now throw a flexiv::CommException
+         */
+        void throwOnCall(int64_t n)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_callsUntilThrow = n;
+        }
+
+        /**
+         * @brief Lose or get back the connection, every call throws while disconnected
+         */
+        void setConnected(bool connected)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_connected = connected;
+            if (!connected){
+                m_plan = -1;
+            }
+        }
+
+        /**
+         * @brief Get the number of calls made so far
+         */
+        uint64_t calls() const
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_calls;
+        }
+
+        bool isConnected() const override
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_connected;
+        }
+
+        bool isFault() const override
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_fault;
+        }
+
+        void clearFault() override
+        {
+            rpc();
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_faultClearable){
+                m_fault = false;
+            }
+        }
+
+        bool isOperational() const override
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_connected && !m_fault;
+        }
+
+        void setMode(flexiv::Mode mode) override
+        {
+            rpc();
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_mode = mode;
+        }
+
+        flexiv::Mode getMode() const override
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_mode;
+        }
+
+        std::vector<std::string> getPlanNameList() const override
+        {
+            rpc();
+            std::lock_guard<std::mutex> lock(m_mutex);
+            std::vector<std::string> names;
+            for (const SimulatedPlan& plan : m_plans){
+                names.push_back(plan.name);
+            }
+            return names;
+        }
+
+        void executePlanByName(const std::string& name) override
+        {
+            rpc();
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_mode != flexiv::MODE_PLAN_EXECUTION){
+                throw flexiv::ExecutionException("The simulated robot is not in plan execution mode");
+            }
+            if (m_fault){
+                throw flexiv::ExecutionException("The simulated robot has a fault");
+            }
+            for (size_t i=0; i<m_plans.size(); i++){
+                if (m_plans[i].name == name){
+                    m_plan = static_cast<int>(i);
+                    m_planStart = Clock::now();
+                    return;
+                }
+            }
+            throw flexiv::InputException("The simulated robot has no plan " + name);
+        }
+
+        void getSystemStatus(flexiv::SystemStatus* output) override
+        {
+            rpc();
+            std::lock_guard<std::mutex> lock(m_mutex);
+            const SimulatedNode* node;
+            double fraction;
+            output->m_programRunning = advance(&node, &fraction);
+            output->m_emergencyStop = true;
+            output->m_externalActive = output->m_programRunning;
+            output->m_programRequest = !output->m_programRunning && !m_fault;
+        }
+
+        void getPlanInfo(flexiv::PlanInfo* output) override
+        {
+            rpc();
+            std::lock_guard<std::mutex> lock(m_mutex);
+            const SimulatedNode* node;
+            double fraction;
+            advance(&node, &fraction);
+            output->m_nodeName = (node != nullptr) ? node->name : "";
+            output->m_nodePath = (node != nullptr) ? (node->path.empty() ? node->name : node->path) : "";
+            output->m_assignedPlanName = (m_plan >= 0) ? m_plans[m_plan].name : "";
+        }
+
+        void getRobotStates(flexiv::RobotStates* output) override
+        {
+            rpc();
+            std::lock_guard<std::mutex> lock(m_mutex);
+            const SimulatedNode* node;
+            double fraction;
+            advance(&node, &fraction);
+            SimulatedNode rest;
+            if (node == nullptr){
+                node = &rest;
+            }
+            // resized once, later samples are written in place like the rdk does
+            output->m_tcpPose.resize(7);
+            output->m_flangePose.resize(7);
+            output->m_rawExtForceInTcpFrame.resize(6);
+            interpolate(node->tcpStart, node->tcpEnd, fraction, 7, output->m_tcpPose.data());
+            // the quaternion is normalized again after the linear blend
+            double* q = output->m_tcpPose.data() + 3;
+            double norm = std::sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+            for (int i=0; i<4; i++){
+                q[i] = norm > 0 ? q[i] / norm : (i == 0 ? 1 : 0);
+            }
+            // the flange sits 10 cm above the tcp of the lever tool
+            std::copy(output->m_tcpPose.begin(), output->m_tcpPose.end(), output->m_flangePose.begin());
+            output->m_flangePose[2] += 0.1;
+            interpolate(node->forceStart, node->forceEnd, fraction, 6, output->m_rawExtForceInTcpFrame.data());
+        }
+    };
+
+} /* namespace kostal */
+
+#endif /* FLEXIVRDK_SIMULATEDROBOT_HPP_ */
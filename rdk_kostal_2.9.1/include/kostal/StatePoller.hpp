@@ -0,0 +1,237 @@
+/*
+ * @file StatePoller.hpp
+ * @copyright Copyright (C) 2016-2022 Flexiv Ltd. All Rights Reserved.
+ */
+
+#ifndef FLEXIVRDK_STATEPOLLER_HPP_
+#define FLEXIVRDK_STATEPOLLER_HPP_
+
+// Kostal header files
+#include <kostal/SystemParams.h>
+#include <kostal/RobotClient.hpp>
+#include <kostal/CaptureStore.hpp>
+
+namespace kostal {
+
+    /**
+     * @struct RobotSnapshot
+     * @brief The robot states and plan info of one control cycle in fixed size fields, so it
+     * is copied without allocating. Fields the robot does not report stay zero.
+     */
+    struct RobotSnapshot
+    {
+        // counts the polls, a consumer sees how many cycles it skipped
+        uint64_t version = 0;
+        // steady clock time of the poll in nanoseconds, see captureTime()
+        int64_t timestamp = 0;
+
+        std::array<double, 7> q = {};
+        std::array<double, 7> theta = {};
+        std::array<double, 7> dq = {};
+        std::array<double, 7> dtheta = {};
+        std::array<double, 7> tau = {};
+        std::array<double, 7> tauDes = {};
+        std::array<double, 7> tauDot = {};
+        std::array<double, 7> tauExt = {};
+        std::array<double, 7> tcpPose = {};
+        std::array<double, 7> tcpPoseDes = {};
+        std::array<double, 6> tcpVel = {};
+        std::array<double, 7> camPose = {};
+        std::array<double, 7> flangePose = {};
+        std::array<double, 7> endLinkPose = {};
+        std::array<double, 6> extForceInTcpFrame = {};
+        std::array<double, 6> extForceInBaseFrame = {};
+        std::array<double, 6> rawExtForceInTcpFrame = {};
+
+        // zero terminated, longer names are cut
+        char nodeName[g_stateNameSize] = {};
+        char assignedPlanName[g_stateNameSize] = {};
+        char ptName[g_stateNameSize] = {};
+        char nodePath[g_statePathSize] = {};
+
+        std::string_view node() const{
+            return std::string_view(nodeName);
+        }
+        std::string_view plan() const{
+            return std::string_view(assignedPlanName);
+        }
+        std::string_view path() const{
+            return std::string_view(nodePath);
+        }
+    };
+
+    /**
+     * @class StateTripleBuffer
+     * @brief Hands snapshots from the poller to one consumer without locks. The poller writes
+     * its back slot and swaps it with the middle one, the consumer swaps the middle slot with
+     * its front slot when a newer snapshot is there. Neither ever waits for the other, the
+     * consumer reads the latest complete snapshot and skips the ones it was too slow for.
+     */
+    class StateTripleBuffer
+    {
+    private:
+        // set in m_middle when the middle slot holds a snapshot the consumer did not take
+        static constexpr uint8_t FRESH = 4;
+
+        RobotSnapshot m_slots[3];
+        alignas(64) std::atomic<uint8_t> m_middle = {1};
+        // used by the poller only
+        alignas(64) uint8_t m_back = 0;
+        // used by the consumer only
+        alignas(64) uint8_t m_front = 2;
+
+    public:
+        StateTripleBuffer() = default;
+        StateTripleBuffer(const StateTripleBuffer&) = delete;
+        StateTripleBuffer& operator=(const StateTripleBuffer&) = delete;
+
+        /**
+         * @brief Publish a snapshot, called by the poller only
+         */
+        void publish(const RobotSnapshot& snapshot)
+        {
+            m_slots[m_back] = snapshot;
+            m_back = m_middle.exchange(m_back | FRESH, std::memory_order_acq_rel) & 3;
+        }
+
+        /**
+         * @brief Take the newest snapshot if there is one, called by the consumer only
+         * @return whether latest() changed
+         */
+        bool update()
+        {
+            if ((m_middle.load(std::memory_order_relaxed) & FRESH) == 0){
+                return false;
+            }
+            m_front = m_middle.exchange(m_front, std::memory_order_acq_rel) & 3;
+            return true;
+        }
+
+        /**
+         * @brief The snapshot taken by the last update(), version 0 before the first one.
+         * It stays valid and unchanged until the next update().
+         */
+        const RobotSnapshot& latest() const
+        {
+            return m_slots[m_front];
+        }
+    };
+
+    /**
+     * @class StatePoller
+     * @brief Fetches the robot states and plan info once per control cycle and fans the
+     * snapshot out to every subscriber, so the calls to the robot do not grow with the
+     * number of consumers. The sampling task of a station polls and uses the returned
+     * snapshot directly, the supervision task subscribes and reads its StateTripleBuffer at
+     * its own rate to see whether the sampling task still delivers.
+     */
+    class StatePoller
+    {
+    private:
+        // refilled by every poll, the rdk reuses their memory
+        flexiv::PlanInfo m_planInfo;
+        flexiv::RobotStates m_robotStates;
+        RobotSnapshot m_snapshot;
+        std::array<StateTripleBuffer, g_stateSubscribers> m_buffers;
+        // the buffers handed out, the poller publishes to the first m_subscribers ones
+        std::atomic<size_t> m_subscribers = {0};
+        std::mutex m_subscribeMutex;
+        std::atomic<uint64_t> m_calls = {0};
+
+        template <size_t N>
+        static void copyField(const std::vector<double>& from, std::array<double, N>* to)
+        {
+            std::copy_n(from.begin(), std::min(from.size(), N), to->begin());
+        }
+
+        template <size_t N>
+        static void copyName(const std::string& from, char (&to)[N])
+        {
+            size_t length = from.copy(to, N - 1);
+            to[length] = '\0';
+        }
+
+    public:
+        StatePoller() = default;
+        virtual ~StatePoller() = default;
+        StatePoller(const StatePoller&) = delete;
+        StatePoller& operator=(const StatePoller&) = delete;
+
+        /**
+         * @brief Get a buffer that receives every snapshot polled from now on, it lives as
+         * long as the poller. Can be called while the poller runs.
+         * @return the buffer, nullptr if all g_stateSubscribers are taken
+         */
+        StateTripleBuffer* subscribe()
+        {
+            std::lock_guard<std::mutex> lock(m_subscribeMutex);
+            size_t index = m_subscribers.load(std::memory_order_relaxed);
+            if (index == m_buffers.size()){
+                return nullptr;
+            }
+            m_subscribers.store(index + 1, std::memory_order_release);
+            return &m_buffers[index];
+        }
+
+        /**
+         * @brief Fetch the plan info and robot states once and publish them to every
+         * subscriber, one cycle of the polling task. Throws flexiv::Exception like the
+         * robot calls do.
+         * @param[in] robotPtr robot's pointer
+         * @return the new snapshot, valid until the next poll
+         */
+        const RobotSnapshot& poll(kostal::RobotClient* robotPtr)
+        {
+            robotPtr->getPlanInfo(&m_planInfo);
+            robotPtr->getRobotStates(&m_robotStates);
+            m_calls.fetch_add(2, std::memory_order_relaxed);
+            m_snapshot.version++;
+            m_snapshot.timestamp = captureTime();
+            copyField(m_robotStates.m_q, &m_snapshot.q);
+            copyField(m_robotStates.m_theta, &m_snapshot.theta);
+            copyField(m_robotStates.m_dq, &m_snapshot.dq);
+            copyField(m_robotStates.m_dtheta, &m_snapshot.dtheta);
+            copyField(m_robotStates.m_tau, &m_snapshot.tau);
+            copyField(m_robotStates.m_tauDes, &m_snapshot.tauDes);
+            copyField(m_robotStates.m_tauDot, &m_snapshot.tauDot);
+            copyField(m_robotStates.m_tauExt, &m_snapshot.tauExt);
+            copyField(m_robotStates.m_tcpPose, &m_snapshot.tcpPose);
+            copyField(m_robotStates.m_tcpPoseDes, &m_snapshot.tcpPoseDes);
+            copyField(m_robotStates.m_tcpVel, &m_snapshot.tcpVel);
+            copyField(m_robotStates.m_camPose, &m_snapshot.camPose);
+            copyField(m_robotStates.m_flangePose, &m_snapshot.flangePose);
+            copyField(m_robotStates.m_endLinkPose, &m_snapshot.endLinkPose);
+            copyField(m_robotStates.m_extForceInTcpFrame, &m_snapshot.extForceInTcpFrame);
+            copyField(m_robotStates.m_extForceInBaseFrame, &m_snapshot.extForceInBaseFrame);
+            copyField(m_robotStates.m_rawExtForceInTcpFrame, &m_snapshot.rawExtForceInTcpFrame);
+            copyName(m_planInfo.m_nodeName, m_snapshot.nodeName);
+            copyName(m_planInfo.m_assignedPlanName, m_snapshot.assignedPlanName);
+            copyName(m_planInfo.m_ptName, m_snapshot.ptName);
+            copyName(m_planInfo.m_nodePath, m_snapshot.nodePath);
+            publish(m_snapshot);
+            return m_snapshot;
+        }
+
+        /**
+         * @brief Publish a snapshot that was not polled here, e.g. by a replay
+         */
+        void publish(const RobotSnapshot& snapshot)
+        {
+            size_t subscribers = m_subscribers.load(std::memory_order_acquire);
+            for (size_t i=0; i<subscribers; i++){
+                m_buffers[i].publish(snapshot);
+            }
+        }
+
+        /**
+         * @brief Get the robot calls made by all polls so far
+         */
+        uint64_t calls() const
+        {
+            return m_calls.load(std::memory_order_relaxed);
+        }
+    };
+
+} /* namespace kostal */
+
+#endif /* FLEXIVRDK_STATEPOLLER_HPP_ */
@@ -0,0 +1,113 @@
+/*
+ * @file StationContext.hpp
+ * @copyright Copyright (C) 2016-2022 Flexiv Ltd. All Rights Reserved.
+ */
+
+#ifndef FLEXIVRDK_STATIONCONTEXT_HPP_
+#define FLEXIVRDK_STATIONCONTEXT_HPP_
+
+// Kostal header files
+#include <kostal/SystemParams.h>
+#include <kostal/KostalStates.hpp>
+#include <kostal/CaptureStore.hpp>
+#include <kostal/PeriodMonitor.hpp>
+#include <kostal/SPIIngest.hpp>
+#include <kostal/SPISource.hpp>
+#include <kostal/RobotClient.hpp>
+#include <kostal/StatePoller.hpp>
+#include <kostal/NodeTracker.hpp>
+#include <kostal/FlightRecorder.hpp>
+#include <kostal/PlanProfiler.hpp>
+#include <kostal/ResultCompression.hpp>
+
+namespace kostal {
+
+    /**
+     * @struct SessionConfig
+     * @brief Everything a Testman client negotiates in its handshake message
+     */
+    struct SessionConfig
+    {
+        std::string token;
+        SPIConfig spiConfig;
+        // which part of a plan is captured
+        CaptureTrigger captureTrigger;
+        // the station the client wants to drive, -1 lets the server pick a free one
+        int stationId = -1;
+        // push status changes and finished tasks instead of waiting for polls
+        bool notify = false;
+        // add the per node stats of the result to the TASK_DONE event
+        bool summary = false;
+        // write results as binary capture files instead of csv, see CaptureFileWriter
+        bool binary = false;
+        // how result files are compressed while they are written
+        ResultCompression compression;
+    };
+
+    /**
+     * @class StationContext
+     * @brief All state of one lever test cell: its robot, its SPI device and the capture
+     * buffers. Nothing in here is shared with another station, so stations never contend
+     * on each other's locks.
+     */
+    class StationContext
+    {
+        public:
+            StationContext() = default;
+            virtual ~StationContext() = default;
+            StationContext(const StationContext&) = delete;
+            StationContext& operator=(const StationContext&) = delete;
+
+            // the id Testman uses to address this station
+            int stationId = 0;
+            // the robot of this station, not owned
+            kostal::RobotClient* robotPtr = nullptr;
+            // the index of the USB-SPI adapter of this station
+            int spiDeviceIndex = 0;
+            SPIConfig spiConfig;
+            // the source the spi task reads, created from spiConfig when the spi connection is built
+            std::unique_ptr<kostal::SPISource> spiSource;
+
+            // polled once per sampling cycle and between plans by the idle recorder
+            kostal::StatePoller statePoller;
+            // the supervision task follows the snapshots of the sampling task through it
+            kostal::StateTripleBuffer* samplingWatch = statePoller.subscribe();
+            // follows the plan nodes and decides which samples are captured, sampling task only
+            kostal::NodeTracker nodeTracker;
+            // the last seconds of the station in and between plans, dumped on a fault
+            kostal::FlightRecorder flightRecorder;
+            // the idle recorder polls the robot under it, the sampling task never takes it
+            std::mutex idlePollMutex;
+            // the node times of every plan the station ran, used by the thread running the plans
+            kostal::PlanProfiler planProfiler;
+
+            // the robot samples of the running plan
+            kostal::CaptureStore capture;
+            // the spi frames of the running plan, paired with the robot samples on export
+            kostal::SPIFrameStore spiFrames;
+            // splits what the spi device reads into frames, used by the spi task only
+            kostal::SPIIngest spiIngest;
+            // frames the spi task received and the supervision task did not store yet, lock free
+            kostal::SPIFrameRing spiRing;
+
+            // Whether the node data should be collected or not, mirrors the capture window of nodeTracker
+            std::atomic<bool> dataCollectFlag = {false};
+            // Whether the whole collecting logic should be used or not
+            std::atomic<bool> collectSwitch = {false};
+            // protects the robot samples of this station. While the scheduler runs only the
+            // sampling task writes them and does so without the lock.
+            std::mutex dataMutex;
+            // protects the spi frames, the spi task itself only touches the lock free ring
+            std::mutex spiMutex;
+
+            // how regularly the capture tasks ran during the last plan
+            kostal::PeriodMonitor samplingTiming;
+            kostal::PeriodMonitor spiTiming;
+            kostal::PeriodMonitor supervisionTiming;
+            // supervision cycles of the last plan that found no new snapshot of the sampling task
+            std::atomic<uint32_t> samplingStalls = {0};
+    };
+
+} /* namespace kostal */
+
+#endif /* FLEXIVRDK_STATIONCONTEXT_HPP_ */
@@ -0,0 +1,263 @@
+/*
+ * @file StationServer.hpp
+ * @copyright Copyright (C) 2016-2022 Flexiv Ltd. All Rights Reserved.
+ */
+#ifndef FLEXIVRDK_STATIONSERVER_HPP_
+#define FLEXIVRDK_STATIONSERVER_HPP_
+
+// Kostal header files
+#include <kostal/SystemParams.h>
+#include <kostal/KostalLogger.hpp>
+#include <kostal/StationContext.hpp>
+#include <kostal/SyncServer.hpp>
+
+#include <condition_variable>
+
+namespace kostal {
+
+    /**
+     * @class StationServer
+     * @brief Serve several lever test cells from one process. Every Testman connection is
+     * a kostal::Server session on its own strand of a shared io context, and is bound to one
+     * station by the STATION key of its handshake (or to the first free station without it).
+     * Each station runs its sessions on its own worker thread against its own context, so
+     * stations share nothing but the listening port and the io threads.
+     */
+    class StationServer
+    {
+    public:
+        /**
+         * Called on the worker thread of a station for every session bound to it, returns
+         * when the session is over
+         */
+        typedef std::function<void(std::shared_ptr<Server>, StationContext*)> SessionHandler;
+
+    private:
+        /** One test cell and the session currently bound to it */
+        struct Station
+        {
+            std::unique_ptr<StationContext> context;
+            SessionHandler handler;
+            std::thread worker;
+            std::mutex mutex;
+            std::condition_variable sessionReady;
+            std::shared_ptr<Server> pendingSession;
+            std::shared_ptr<Server> activeSession;
+            // a client is bound to this station, pending or active
+            bool attached = false;
+        };
+
+        kostal::Log m_log;
+        boost::asio::io_context m_ioContext;
+        boost::asio::executor_work_guard<boost::asio::io_context::executor_type> m_workGuard;
+        acc m_acceptor;
+        std::vector<std::thread> m_ioThreads;
+        std::vector<std::unique_ptr<Station>> m_stations;
+        // only taken while a new client is bound to a station
+        std::mutex m_bindMutex;
+        std::atomic<bool> m_running = {false};
+        unsigned short m_portNumber = g_COMMPORT;
+        const size_t m_ioThreadCount;
+
+    public:
+        /**
+         * @param[in] ioThreadCount number of threads running the shared io context
+         */
+        explicit StationServer(size_t ioThreadCount = 1)
+        : m_workGuard(boost::asio::make_work_guard(m_ioContext))
+        , m_acceptor(m_ioContext)
+        , m_ioThreadCount(ioThreadCount)
+        {}
+
+        virtual ~StationServer()
+        {
+            stop();
+        }
+
+        /**
+         * @brief Add a station, must be called before start()
+         * @param[in] context the state of the station, its stationId is assigned here
+         * @param[in] handler serves the sessions bound to this station
+         * @return the id of the new station
+         */
+        int addStation(std::unique_ptr<StationContext> context, SessionHandler handler)
+        {
+            auto station = std::make_unique<Station>();
+            context->stationId = static_cast<int>(m_stations.size());
+            station->context = std::move(context);
+            station->handler = handler;
+            m_stations.push_back(std::move(station));
+            return static_cast<int>(m_stations.size()) - 1;
+        }
+
+        /**
+         * @brief Set the port number of the listening socket
+         */
+        void setPortNumber(unsigned short port){
+            m_portNumber = port;
+        }
+
+        /**
+         * @brief Get the number of stations
+         */
+        size_t getStationCount() const{
+            return m_stations.size();
+        }
+
+        /**
+         * @brief Open the listening socket and start the io threads and the station workers
+         * @return Status code
+         */
+        Status start()
+        {
+            try
+            {
+                end endpoint(boost::asio::ip::tcp::v4(), m_portNumber);
+                m_acceptor.open(endpoint.protocol());
+                m_acceptor.set_option(acc::reuse_address(true));
+                m_acceptor.bind(endpoint);
+                m_acceptor.listen();
+            }
+            catch(std::exception& e){
+                m_log.error(e.what());
+                return SOCKET;
+            }
+            m_running = true;
+            for (auto& station : m_stations){
+                Station* stationPtr = station.get();
+                station->worker = std::thread([this, stationPtr]{ runStation(stationPtr); });
+            }
+            for (size_t i=0; i<m_ioThreadCount; i++){
+                m_ioThreads.emplace_back([this]{ m_ioContext.run(); });
+            }
+            boost::asio::post(m_acceptor.get_executor(), [this]{ startAccept(); });
+            m_log.info("The station server is listening on port " + std::to_string(m_portNumber)
+                       + " for " + std::to_string(m_stations.size()) + " stations");
+            return SUCCESS;
+        }
+
+        /**
+         * @brief Close all sessions and wait for the station workers and io threads
+         */
+        void stop()
+        {
+            if (!m_running.exchange(false)){
+                return;
+            }
+            boost::asio::post(m_acceptor.get_executor(), [this]{
+                boost::system::error_code ec;
+                m_acceptor.close(ec);
+            });
+            for (auto& station : m_stations){
+                {
+                    std::lock_guard<std::mutex> lock(station->mutex);
+                    if (station->activeSession){
+                        station->activeSession->close();
+                    }
+                }
+                station->sessionReady.notify_all();
+                if (station->worker.joinable()){
+                    station->worker.join();
+                }
+            }
+            m_workGuard.reset();
+            m_ioContext.stop();
+            for (auto& thread : m_ioThreads){
+                thread.join();
+            }
+            m_ioThreads.clear();
+        }
+
+    private:
+        void startAccept()
+        {
+            auto session = std::make_shared<Server>(m_ioContext);
+            m_acceptor.async_accept(session->socket(), [this, session](const boost::system::error_code& ec){
+                if (ec){
+                    if (m_running){
+                        m_log.error("Station server accepts client error: " + ec.message());
+                        startAccept();
+                    }
+                    return;
+                }
+                auto stationId = std::make_shared<int>(-1);
+                session->asyncHandshake(
+                    [this, stationId](const SessionConfig& config){
+                        *stationId = reserveStation(config.stationId);
+                        return *stationId >= 0;
+                    },
+                    [this, session, stationId](Status result){
+                        bindSession(session, *stationId, result);
+                    });
+                startAccept();
+            });
+        }
+
+        /**
+         * @brief Find the station a new client asks for and mark it as attached
+         * @param[in] requested the station id from the handshake, -1 for any free station
+         * @return the reserved station id, -1 if it does not exist or is busy
+         */
+        int reserveStation(int requested)
+        {
+            std::lock_guard<std::mutex> lock(m_bindMutex);
+            for (size_t i=0; i<m_stations.size(); i++){
+                if (requested >= 0 && static_cast<int>(i) != requested){
+                    continue;
+                }
+                std::lock_guard<std::mutex> stationLock(m_stations[i]->mutex);
+                if (!m_stations[i]->attached){
+                    m_stations[i]->attached = true;
+                    return static_cast<int>(i);
+                }
+            }
+            m_log.warn("The station " + std::to_string(requested) + " is not available");
+            return -1;
+        }
+
+        /**
+         * @brief Hand a session that finished its handshake to the worker of its station
+         */
+        void bindSession(std::shared_ptr<Server> session, int stationId, Status result)
+        {
+            if (stationId < 0){
+                return;
+            }
+            Station* station = m_stations[stationId].get();
+            std::lock_guard<std::mutex> lock(station->mutex);
+            if (result != SUCCESS){
+                station->attached = false;
+                return;
+            }
+            station->pendingSession = session;
+            station->sessionReady.notify_one();
+        }
+
+        void runStation(Station* station)
+        {
+            while (m_running)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(station->mutex);
+                    station->sessionReady.wait(lock, [this, station]{
+                        return station->pendingSession || !m_running;
+                    });
+                    if (!m_running){
+                        return;
+                    }
+                    station->activeSession = std::move(station->pendingSession);
+                }
+                m_log.info("Station " + std::to_string(station->context->stationId) + " is serving a new client");
+                station->handler(station->activeSession, station->context.get());
+                {
+                    std::lock_guard<std::mutex> lock(station->mutex);
+                    station->activeSession.reset();
+                    station->attached = false;
+                }
+            }
+        }
+    };
+
+} /* namespace kostal */
+
+#endif /* FLEXIVRDK_STATIONSERVER_HPP_ */
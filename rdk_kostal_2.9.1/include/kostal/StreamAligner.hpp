@@ -0,0 +1,78 @@
+/*
+ * @file StreamAligner.hpp
+ * @copyright Copyright (C) 2016-2022 Flexiv Ltd. All Rights Reserved.
+ */
+#ifndef FLEXIVRDK_STREAMALIGNER_HPP_
+#define FLEXIVRDK_STREAMALIGNER_HPP_
+
+// Kostal header files
+#include <kostal/SystemParams.h>
+#include <kostal/CaptureStore.hpp>
+
+namespace kostal {
+
+    /**
+     * @class SPIAligner
+     * @brief Pairs robot samples with the spi frames captured around them. Both streams are
+     * ordered by time, so the robot samples are aligned one after the other in a single pass
+     * over the frames. A spi frame holds raw sensor bytes that can not be interpolated, a
+     * sample gets the NEAREST frame or the PREVIOUS one received, and none if that frame is
+     * further away than the tolerance.
+     */
+    class SPIAligner
+    {
+    private:
+        const SPIFrameStore& m_frames;
+        AlignMode m_mode;
+        int64_t m_toleranceNs;
+        // the first frame received after the last aligned sample
+        size_t m_next = 0;
+
+    public:
+        /**
+         * @param[in] frames the spi frames of the plan
+         * @param[in] mode how a sample picks its frame
+         * @param[in] toleranceUs the largest distance between sample and frame [us]
+         */
+        explicit SPIAligner(const SPIFrameStore& frames,
+                            AlignMode mode = g_spiAlignMode,
+                            int64_t toleranceUs = g_spiAlignToleranceUs)
+        : m_frames(frames)
+        , m_mode(mode)
+        , m_toleranceNs(toleranceUs * 1000)
+        {}
+        virtual ~SPIAligner() = default;
+
+        /**
+         * @brief Find the frame of the next robot sample, samples have to come in time order
+         * @param[in] sampleTime steady clock time of the robot sample [ns]
+         * @param[out] frameIndex the index of the frame in the spi frame store
+         * @return false if no frame is within the tolerance
+         */
+        bool align(int64_t sampleTime, size_t* frameIndex)
+        {
+            while (m_next < m_frames.size() && m_frames.timestamp(m_next) <= sampleTime){
+                m_next++;
+            }
+            bool found = false;
+            int64_t distance = 0;
+            if (m_next > 0){
+                *frameIndex = m_next - 1;
+                distance = sampleTime - m_frames.timestamp(m_next - 1);
+                found = true;
+            }
+            if (m_mode == NEAREST && m_next < m_frames.size()){
+                int64_t following = m_frames.timestamp(m_next) - sampleTime;
+                if (!found || following < distance){
+                    *frameIndex = m_next;
+                    distance = following;
+                    found = true;
+                }
+            }
+            return found && distance <= m_toleranceNs;
+        }
+    };
+
+} /* namespace kostal */
+
+#endif /* FLEXIVRDK_STREAMALIGNER_HPP_ */
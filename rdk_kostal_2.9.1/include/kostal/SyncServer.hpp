@@ -9,6 +9,7 @@
 #include <kostal/SystemParams.h>
 #include <kostal/KostalLogger.hpp>
 #include <kostal/JsonParser.hpp>
+#include <kostal/MessageFramer.hpp>
 
 namespace kostal {
 
@@ -16,7 +17,18 @@ namespace kostal {
     typedef boost::asio::ip::tcp::endpoint end;
     typedef boost::asio::ip::tcp::socket soc;
 
+    /**
+     * @class Server
+     * @brief One Testman talking session. A standalone server owns its io context, io thread
+     * and acceptor, a session of a StationServer shares the io context of the station server
+     * and runs all of its operations on its own strand.
+     */
     class Server{
+        public:
+            typedef std::function<void(Status)> Callback;
+            typedef std::function<bool(const SessionConfig&)> AdmitHandler;
+            typedef std::function<bool(std::string_view)> RequestFilter;
+
         protected:
             std::unique_ptr<soc> m_socketPtr;
             std::unique_ptr<acc> m_acceptorPtr;
@@ -24,134 +36,140 @@ namespace kostal {
         private:
             kostal::Log m_log;
             kostal::JSONMessageHandler m_parser;
-            boost::asio::io_context m_ioContext;
+            // io context of a standalone server, null for a session of a StationServer
+            std::unique_ptr<boost::asio::io_context> m_ownContext;
+            boost::asio::io_context& m_ioContext;
+            // every operation of this session runs on this strand
+            boost::asio::strand<boost::asio::io_context::executor_type> m_strand;
+            // keep the own io context running between requests
+            std::unique_ptr<boost::asio::executor_work_guard<boost::asio::io_context::executor_type>> m_workGuard;
+            // deadline of the request that is currently in flight
+            boost::asio::steady_timer m_deadline;
+            // the only thread that runs the own io context
+            std::thread m_ioThread;
             end m_endpoint;
             unsigned short m_portNumber=g_COMMPORT;
             const std::string m_token = g_TOKEN;
-            const int msgLength = g_MSGMAXSIZE;
-            std::string m_recvMsg;
+            // splits the received byte stream into messages, owns the receive buffer
+            kostal::MessageFramer m_framer;
+            FramingMode m_framingMode = g_framingMode;
+            SessionConfig m_sessionConfig;
             std::string m_replyMsg;
+            // the last published status of the station, answers polls in monitor(filter)
+            std::string m_statusMsg = "IDLE";
+            /** A framed message waiting to be written */
+            struct PendingWrite
+            {
+                std::string frame;
+                Callback done;
+            };
+            // replies and pushed events are written one after another in this order
+            std::deque<PendingWrite> m_writeQueue;
+            // called once the write queue is empty
+            std::function<void()> m_writesDone;
+            // turns pushed events into one-line json frames
+            Json::StreamWriterBuilder m_eventWriter;
             boost::system::error_code m_ec;
             std::atomic<bool> m_clientConnected = {false};
+            std::atomic<bool> m_timedOut = {false};
 
         public:
-            Server() = default;
-            virtual ~Server() = default;
+            /**
+             * @brief Create a standalone server with its own io thread
+             */
+            Server()
+            : m_ownContext(new boost::asio::io_context)
+            , m_ioContext(*m_ownContext)
+            , m_strand(boost::asio::make_strand(m_ioContext))
+            , m_workGuard(new boost::asio::executor_work_guard<boost::asio::io_context::executor_type>(m_ioContext.get_executor()))
+            , m_deadline(m_strand)
+            {
+                m_eventWriter["indentation"] = "";
+                m_ioThread = std::thread([this]{ m_ioContext.run(); });
+            }
+
+            /**
+             * @brief Create a session on a shared io context, the caller accepts into socket()
+             * @param[in] ioContext io context run by the station server
+             */
+            explicit Server(boost::asio::io_context& ioContext)
+            : m_ioContext(ioContext)
+            , m_strand(boost::asio::make_strand(m_ioContext))
+            , m_deadline(m_strand)
+            {
+                m_eventWriter["indentation"] = "";
+                m_socketPtr = std::make_unique<soc>(m_strand);
+            }
+
+            virtual ~Server()
+            {
+                if (m_ownContext){
+                    m_workGuard.reset();
+                    m_ioContext.stop();
+                    if (m_ioThread.joinable()){
+                        m_ioThread.join();
+                    }
+                    // declared before the own io context, they would be destroyed after it
+                    m_socketPtr.reset();
+                    m_acceptorPtr.reset();
+                }
+            }
 
             /**
-             * @brief Initialize the socket and get the spi config from the first message of client
+             * @brief Initialize the socket and get the spi config from the first message of client.
+             * The acceptor is opened by the first call and kept listening afterwards, so a
+             * reconnecting client is queued by the kernel while the last session winds down.
              * @return Status code
              */
             Status init()
             {
-                Status result;
                 try
                 {
-                    // create an endpoint
-                    m_endpoint = std::move(boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), m_portNumber));
-                    m_socketPtr = std::make_unique<boost::asio::ip::tcp::socket>(m_ioContext);
-                    m_acceptorPtr.reset(new boost::asio::ip::tcp::acceptor(m_ioContext, m_endpoint));
+                    if (!m_acceptorPtr){
+                        // create an endpoint
+                        m_endpoint = std::move(boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), m_portNumber));
+                        m_acceptorPtr.reset(new boost::asio::ip::tcp::acceptor(m_ioContext, m_endpoint));
+                    }
+                    m_socketPtr = std::make_unique<soc>(m_strand);
                     m_log.info("Waiting for client to send token...");
                     m_acceptorPtr->accept(*m_socketPtr);
-                    
-                    //receive buffer
-                    char m_recvBuffer[msgLength];
-                    
-                    while(true)
-                    {
-                        size_t read_length = m_socketPtr->read_some(boost::asio::buffer(m_recvBuffer, msgLength), m_ec);
-                        if (m_ec == boost::asio::error::eof){
-                            m_log.error("===================================================");
-                            m_log.error("The connection is closed cleanly by client or timeout");
-                            return SOCKET;
-                        }else if (m_ec){
-                            m_log.error("Socket reads message error: " + m_ec.message());
-                            return SOCKET;
-                        }         
-
-                        clearMsg();
-                        for (int i=0; i<read_length; i++){
-                            m_recvMsg += m_recvBuffer[i];
-                        }
-                        std::string recvToken="";
-                        // parse the spi config
-                        result = m_parser.parseSPI(&m_recvMsg, &recvToken, &m_log);
-                        // Judge whether the received message is matching the token
-                        if (recvToken != m_token){
-                            m_log.warn("The client is sending an unkown token: " + recvToken);
-                            const char wrongreply[6] = "wrong";
-                            boost::asio::write(*m_socketPtr, boost::asio::buffer(wrongreply, std::strlen(wrongreply)), m_ec);
-                            m_log.info("Waiting for client to resend token...");
-                            continue;
-                        }
-                        m_log.info("The socket initialization is completed");
-                        
-                        std::string reply = "received";
-                        boost::asio::write(*m_socketPtr, boost::asio::buffer(reply, reply.size()), m_ec);
-
-                        if (m_ec == boost::asio::error::eof){
-                            m_log.error("===================================================");
-                            m_log.error("The connection is closed cleanly by client or timeout");
-                            return SOCKET;
-                        }else if (m_ec){
-                            m_log.error("Socket writes message error: " + m_ec.message());
-                            return SOCKET;
-                        }
-                        
-                        m_clientConnected = true;
-                        return SUCCESS;
-                    }
                 }
                 catch(std::exception& e){
                     m_log.error(e.what());
                     return SOCKET;
                 }
+                return wait([this](Callback done){
+                    asyncHandshake([](const SessionConfig&){ return true; }, done);
+                });
             }
 
             /**
-             * @brief Receive buffer from the established talking session
+             * @brief Read handshake messages until one carries the right token, reply to it
+             * and store the negotiated session config. Runs on the strand and never blocks.
+             * @param[in] admit decides whether the station can take this client, called before
+             * the handshake is answered
+             * @param[in] done called with the result of the handshake
+             */
+            void asyncHandshake(AdmitHandler admit, Callback done)
+            {
+                boost::asio::post(m_strand, [this, admit, done]{
+                    // replies and pushed events are small, send them without waiting for acks
+                    m_socketPtr->set_option(boost::asio::ip::tcp::no_delay(true), m_ec);
+                    m_framer.reset(m_framingMode);
+                    readHandshake(admit, done);
+                });
+            }
+
+            /**
+             * @brief Receive one request from the established talking session and answer it
+             * with the reply message, the whole round trip has to finish before the deadline
              * @return Status code
              */
             Status recv()
-            {   
-                try
-                {                
-                    // receive buffer
-                    char m_recvBuffer[msgLength];
-                    size_t read_length = m_socketPtr->read_some(boost::asio::buffer(m_recvBuffer, msgLength), m_ec);
-                    if (m_ec == boost::asio::error::eof){
-                        m_log.error("===================================================");
-                        m_log.error("The connection is closed cleanly by client or timeout");
-                        return SOCKET;
-                    }else if (m_ec){
-                        m_log.error("Socket reads message error: " + m_ec.message());
-                        return SOCKET;
-                    }
-                    
-                    clearMsg();
-                    for (int i=0; i<read_length;i++){
-                        m_recvMsg += m_recvBuffer[i];
-                    }
-                    //std::cout<<"The recv msg is: "<<m_recvMsg<<std::endl;
-
-                    boost::asio::write(*m_socketPtr, boost::asio::buffer(m_replyMsg, m_replyMsg.size()), m_ec);   
-                    if (m_ec == boost::asio::error::eof){
-                        m_log.error("===================================================");
-                        m_log.error("The connection is closed cleanly by client or timeout");
-                        return SOCKET;
-                    }
-                    else if (m_ec){
-                        m_log.error("Socket writes message error: " + m_ec.message());
-                        return SOCKET;
-                    }
-                    
-                    return SUCCESS;
-                }
-                catch (std::exception& e)
-                {
-                    m_log.error(e.what());
-                    return SOCKET;
-                }
+            {
+                return wait([this](Callback done){
+                    boost::asio::post(m_strand, [this, done]{ startRequest(done); });
+                });
             }
 
             /**
@@ -161,34 +179,85 @@ namespace kostal {
              */
             Status monitor()
             {
-                auto result = std::async(&Server::recv, this);
-                std::future_status status = result.wait_for(std::chrono::seconds(g_timeoutInterval));
-                if (status == std::future_status::timeout)
-                {
-                    m_log.error("===================================================");
-                    m_log.error("The connection with client is timeout...");
-                    this->disconnect();
-                    return SOCKET;
-                }
-                else if (status == std::future_status::ready) 
-                {
-                    if (result.get()!=SUCCESS){
-                        m_log.error("The receiving of client's message fails...");
-                        this->disconnect();
-                        return SOCKET;
-                    }else{
-                        return SUCCESS;
+                return closeOnError(recv());
+            }
+
+            /**
+             * @brief Answer requests on the io thread with the published status until one passes
+             * the filter, so status polls never wake up the caller. The request that passed stays
+             * readable with getRecvView() and is not answered yet, answer it with send().
+             * Every request has to arrive before the deadline.
+             * @param[in] filter called on the io thread for every request, true hands it to the caller
+             * @return Status code
+             */
+            Status monitor(RequestFilter filter)
+            {
+                return closeOnError(wait([this, filter](Callback done){
+                    boost::asio::post(m_strand, [this, filter, done]{ startAutoReply(filter, done); });
+                }));
+            }
+
+            /**
+             * @brief Send one message to the client outside of a request round trip
+             * @param[in] msg the message content
+             * @return Status code
+             */
+            Status send(const std::string& msg)
+            {
+                return wait([this, msg](Callback done){
+                    boost::asio::post(m_strand, [this, msg, done]{ startWrite(msg, done); });
+                });
+            }
+
+            /**
+             * @brief Publish a new status of the station. Requests answered by monitor(filter) get
+             * it as reply, and a client that asked for NOTIFY in its handshake gets it pushed.
+             * Can be called from any thread.
+             * @param[in] status IDLE, BUSY or FAULT
+             */
+            void publishStatus(const std::string& status)
+            {
+                boost::asio::post(m_strand, [this, status]{
+                    m_statusMsg = status;
+                    Json::Value event;
+                    event[SYSTEMEVENT] = EVENTSTATUS;
+                    event[SYSTEMSTATUS] = status;
+                    push(event);
+                });
+            }
+
+            /**
+             * @brief Publish that the result of a task is ready together with the status of the station,
+             * a client that asked for NOTIFY gets it pushed. Can be called from any thread.
+             * @param[in] status the status of the station by then, the next task may already be running
+             * @param[in] task the finished task
+             * @param[in] resultPath where the result of the task is stored, empty if it failed
+             * @param[in] error why the task has no result, empty if it succeeded
+             * @param[in] summary the per node stats of the result, null if the client did not ask for them
+             */
+            void publishTaskDone(const std::string& status, const TaskRequest& task, const std::string& resultPath,
+                                 const std::string& error = "", const Json::Value& summary = Json::Value())
+            {
+                boost::asio::post(m_strand, [this, status, task, resultPath, error, summary]{
+                    m_statusMsg = status;
+                    Json::Value event;
+                    event[SYSTEMEVENT] = EVENTTASKDONE;
+                    event[SYSTEMSTATUS] = status;
+                    event[TASKTYPE] = task.taskType;
+                    event[TASKNAME] = task.taskName;
+                    event[TASKRESULT] = resultPath;
+                    if (!error.empty()){
+                        event[TASKERROR] = error;
                     }
-                }
-                else{
-                    m_log.error("The future status is deferred...");
-                    this->disconnect();
-                    return SOCKET;
-                }
+                    if (!summary.isNull()){
+                        event[TASKSUMMARY] = summary;
+                    }
+                    push(event);
+                });
             }
 
             /**
-             * @brief Set the port number of the socket
+             * @brief Set the port number of the socket, takes effect before the first init()
              */
             void setPortNumber(unsigned short port){
                 m_portNumber = port;
@@ -202,15 +271,47 @@ namespace kostal {
                 return m_portNumber;
             }
 
+            /**
+             * @brief Get the config the client negotiated in its handshake
+             * @return session config
+             */
+            SessionConfig getSessionConfig(){
+                return m_sessionConfig;
+            }
+
+            /**
+             * @brief Get the socket a station server accepts the client into
+             * @return socket of this session
+             */
+            soc& socket(){
+                return *m_socketPtr;
+            }
+
+            /**
+             * @brief Set how messages are delimited, takes effect with the next connection
+             * @param[in] mode NEWLINE, LENGTHPREFIX or AUTO
+             */
+            void setFramingMode(FramingMode mode){
+                m_framingMode = mode;
+            }
+
             /**
              * @brief Get the content of the recv message
              * @return recv message content
              */
             std::string getRecvMsg(){
-                if (m_recvMsg.empty()){
+                return std::string(getRecvView());
+            }
+
+            /**
+             * @brief Get the recv message without copying it out of the receive buffer
+             * @return view of the recv message, valid until the next monitor()
+             */
+            std::string_view getRecvView(){
+                if (m_framer.frame().empty()){
                     m_log.warn("The received message is empty");
                 }
-                return m_recvMsg;
+                return m_framer.frame();
             }
 
             /**
@@ -228,7 +329,7 @@ namespace kostal {
              * @brief Clear the received message buffer
              */
             void clearMsg(){
-                m_recvMsg="";
+                m_framer.consume();
             }
         
             /**
@@ -245,23 +346,284 @@ namespace kostal {
             }
             
             /**
-             * @brief Disconnect the current socket and reset socket and acceptor in asio
+             * @brief Disconnect the current socket, the acceptor keeps listening for the next client.
+             * Returns once the events that were still being pushed are given up.
              */
             void disconnect()
             {
-                // disconnect socket
-                if (m_socketPtr->is_open()){
-                    m_socketPtr->shutdown(soc::shutdown_both, m_ec);
-                }    
-                m_socketPtr->close(m_ec);
-                if (m_ec){
-                    m_log.error(m_ec.message());
+                if (!m_socketPtr){
+                    return;
                 }
-                m_socketPtr.reset();
-                m_acceptorPtr.reset();
-                m_clientConnected = false;
+                auto closed = std::make_shared<std::promise<void>>();
+                std::future<void> result = closed->get_future();
+                boost::asio::post(m_strand, [this, closed]{
+                    m_deadline.cancel();
+                    // disconnect socket
+                    if (m_socketPtr->is_open()){
+                        m_socketPtr->shutdown(soc::shutdown_both, m_ec);
+                        m_socketPtr->close(m_ec);
+                        if (m_ec){
+                            m_log.error(m_ec.message());
+                        }
+                    }
+                    m_clientConnected = false;
+                    whenWritesDone([closed]{ closed->set_value(); });
+                });
+                result.wait();
                 m_log.error("Flexiv system server closed this connection");
             }
+
+            /**
+             * @brief Abort whatever the session is waiting for, used when the server shuts down
+             */
+            void close()
+            {
+                boost::asio::post(m_strand, [this]{
+                    m_deadline.cancel();
+                    if (m_socketPtr){
+                        m_socketPtr->close(m_ec);
+                    }
+                });
+            }
+
+        private:
+            /**
+             * @brief Log a failed request and disconnect the client
+             * @param[in] result the result of the request
+             * @return Status code
+             */
+            Status closeOnError(Status result)
+            {
+                if (result != SUCCESS){
+                    if (m_timedOut){
+                        m_log.error("===================================================");
+                        m_log.error("The connection with client is timeout...");
+                    }else{
+                        m_log.error("The receiving of client's message fails...");
+                    }
+                    this->disconnect();
+                    return SOCKET;
+                }
+                return SUCCESS;
+            }
+
+            /**
+             * @brief Start an asynchronous operation and block until it reports its result
+             * @param[in] operation starts the operation and calls its callback once
+             * @return Status code
+             */
+            Status wait(std::function<void(Callback)> operation)
+            {
+                if (!m_socketPtr || !m_socketPtr->is_open()){
+                    m_log.error("The socket is not connected");
+                    return SOCKET;
+                }
+                auto done = std::make_shared<std::promise<Status>>();
+                std::future<Status> result = done->get_future();
+                operation([done](Status status){ done->set_value(status); });
+                return result.get();
+            }
+
+            /**
+             * @brief Read one handshake frame and answer it, only called on the strand
+             */
+            void readHandshake(AdmitHandler admit, Callback done)
+            {
+                // the handshake has no deadline, the client may take its time
+                m_framer.asyncReadFrame(*m_socketPtr,
+                    [this, admit, done](const boost::system::error_code& ec, std::string_view frame){
+                        if (ec){
+                            logSocketError("reads", ec);
+                            done(SOCKET);
+                            return;
+                        }
+                        SessionConfig config;
+                        try{
+                            // parse the spi config
+                            m_parser.parseSPI(frame, &config, &m_log);
+                        }catch(std::exception& e){
+                            m_log.error(e.what());
+                        }
+                        // Judge whether the received message is matching the token
+                        if (config.token != m_token){
+                            m_log.warn("The client is sending an unkown token: " + config.token);
+                            startWrite("wrong", [this, admit, done](Status status){
+                                if (status != SUCCESS){
+                                    done(status);
+                                    return;
+                                }
+                                m_log.info("Waiting for client to resend token...");
+                                readHandshake(admit, done);
+                            });
+                            return;
+                        }
+                        if (!admit(config)){
+                            m_log.warn("No station can take this client, closing the connection");
+                            startWrite("rejected", [done](Status){ done(SOCKET); });
+                            return;
+                        }
+                        m_sessionConfig = config;
+                        m_log.info("The socket initialization is completed");
+                        startWrite("received", [this, done](Status status){
+                            m_clientConnected = (status == SUCCESS);
+                            done(status);
+                        });
+                    });
+            }
+
+            /**
+             * @brief Cancel the socket if no request arrives in time, only called on the strand
+             */
+            void armDeadline()
+            {
+                m_timedOut = false;
+                m_deadline.expires_after(std::chrono::seconds(g_timeoutInterval));
+                m_deadline.async_wait([this](const boost::system::error_code& ec){
+                    if (ec != boost::asio::error::operation_aborted){
+                        m_timedOut = true;
+                        m_socketPtr->cancel(m_ec);
+                    }
+                });
+            }
+
+            /**
+             * @brief Arm the deadline, read one frame and answer it with the reply message,
+             * only called on the strand
+             * @param[in] done called when the round trip is finished
+             */
+            void startRequest(Callback done)
+            {
+                armDeadline();
+                m_framer.asyncReadFrame(*m_socketPtr,
+                    [this, done](const boost::system::error_code& ec, std::string_view){
+                        if (ec){
+                            m_deadline.cancel();
+                            logSocketError("reads", ec);
+                            done(SOCKET);
+                            return;
+                        }
+                        startWrite(m_replyMsg, [this, done](Status status){
+                            m_deadline.cancel();
+                            done(status);
+                        });
+                    });
+            }
+
+            /**
+             * @brief Answer requests with the published status until one passes the filter,
+             * only called on the strand
+             * @param[in] filter decides which request is handed to the caller
+             * @param[in] done called with the request that passed or the first error
+             */
+            void startAutoReply(RequestFilter filter, Callback done)
+            {
+                armDeadline();
+                m_framer.asyncReadFrame(*m_socketPtr,
+                    [this, filter, done](const boost::system::error_code& ec, std::string_view frame){
+                        if (ec){
+                            m_deadline.cancel();
+                            logSocketError("reads", ec);
+                            done(SOCKET);
+                            return;
+                        }
+                        if (filter(frame)){
+                            m_deadline.cancel();
+                            done(SUCCESS);
+                            return;
+                        }
+                        startWrite(m_statusMsg, [this, filter, done](Status status){
+                            if (status != SUCCESS){
+                                m_deadline.cancel();
+                                done(status);
+                                return;
+                            }
+                            startAutoReply(filter, done);
+                        });
+                    });
+            }
+
+            /**
+             * @brief Push an event to a client that asked for NOTIFY, only called on the strand
+             * @param[in] event the event as json object
+             */
+            void push(const Json::Value& event)
+            {
+                if (!m_clientConnected || !m_sessionConfig.notify){
+                    return;
+                }
+                startWrite(Json::writeString(m_eventWriter, event), [](Status){});
+            }
+
+            /**
+             * @brief Frame one message and queue it behind the messages that are still being
+             * written, only called on the strand
+             * @param[in] msg the message content, copied into the write queue
+             * @param[in] done called when the message is written
+             */
+            void startWrite(const std::string& msg, Callback done)
+            {
+                m_writeQueue.emplace_back();
+                m_framer.encode(msg, &m_writeQueue.back().frame);
+                m_writeQueue.back().done = done;
+                if (m_writeQueue.size() == 1){
+                    writeNext();
+                }
+            }
+
+            /**
+             * @brief Write the message at the head of the write queue, only called on the strand
+             */
+            void writeNext()
+            {
+                boost::asio::async_write(*m_socketPtr, boost::asio::buffer(m_writeQueue.front().frame),
+                    [this](const boost::system::error_code& ec, std::size_t){
+                        Callback done = std::move(m_writeQueue.front().done);
+                        m_writeQueue.pop_front();
+                        if (!m_writeQueue.empty()){
+                            writeNext();
+                        }else if (m_writesDone){
+                            std::function<void()> writesDone = std::move(m_writesDone);
+                            m_writesDone = nullptr;
+                            writesDone();
+                        }
+                        if (ec){
+                            logSocketError("writes", ec);
+                            done(SOCKET);
+                            return;
+                        }
+                        done(SUCCESS);
+                    });
+            }
+
+            /**
+             * @brief Call handler once all queued messages are written or given up, only
+             * called on the strand
+             */
+            void whenWritesDone(std::function<void()> handler)
+            {
+                if (m_writeQueue.empty()){
+                    handler();
+                    return;
+                }
+                m_writesDone = handler;
+            }
+
+            /**
+             * @brief Print the socket error of an asynchronous operation
+             * @param[in] operation the name of the failed operation
+             * @param[in] ec error code of the operation
+             */
+            void logSocketError(const std::string& operation, const boost::system::error_code& ec)
+            {
+                if (ec == boost::asio::error::eof){
+                    m_log.error("===================================================");
+                    m_log.error("The connection is closed cleanly by client or timeout");
+                }else if (ec == boost::asio::error::operation_aborted && m_timedOut){
+                    m_log.error("Socket " + operation + " message timeout");
+                }else{
+                    m_log.error("Socket " + operation + " message error: " + ec.message());
+                }
+            }
     };
 
 } /* namespace kostal */
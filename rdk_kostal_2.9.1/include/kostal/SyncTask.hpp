@@ -11,6 +11,7 @@
 #include <kostal/SystemParams.h>
 #include <kostal/SPIOperation.hpp>
 #include <kostal/RobotOperation.hpp>
+#include <kostal/StationContext.hpp>
 
 namespace kostal {
 
@@ -23,60 +24,156 @@ namespace kostal {
     private:
         kostal::RobotOperationHandler m_robotHandler;
         kostal::SPIOperationHandler m_spiHandler;
+
+        /**
+         * @brief Check in a supervision cycle whether the sampling task published a snapshot
+         * since the last cycle. A cycle that finds none counts as a stall of the station and
+         * is marked in its flight recorder, once until the sampling delivers again.
+         * @param[in,out] stationPtr station whose sampling is watched
+         * @param[in] programStarted whether the sampling task polls the robot yet
+         * @param[in,out] stalled whether the last cycle found no new snapshot
+         */
+        void watchSampling(StationContext* stationPtr, bool programStarted, bool* stalled)
+        {
+            if (!programStarted || stationPtr->samplingWatch == nullptr){
+                return;
+            }
+            if (stationPtr->samplingWatch->update()){
+                *stalled = false;
+            }else if (!*stalled){
+                *stalled = true;
+                stationPtr->samplingStalls++;
+                stationPtr->flightRecorder.mark("sampling stalled");
+            }
+        }
     public:
         SyncTaskHandler() = default;
         virtual ~SyncTaskHandler() = default;
 
         /**
-         * @brief Run embedded scheduler to execute task in a desired frequency
+         * @brief Run embedded scheduler to execute task in a desired frequency. Sampling,
+         * spi polling and the supervision of the plan are periodic tasks of a flexiv::Scheduler,
+         * sampling with the highest priority. How regularly each task ran is kept in the
+         * timing monitors of the station.
          * @param[in] robotPtr robot's pointer
-         * @param[in] spiDataPtr spi data's pointer
-         * @param[in] spiDataListPtr spi data list's pointer
-         * @param[in] robotDataPtr robot data's pointer
-         * @param[in] robotDataListPtr robot data list's pointer
+         * @param[in,out] stationPtr station whose data is collected
          * @param[in] logPtr robot's log pointer
          * @param[in] planName the name of the executing work plan
          * @return Status code
          */
-        Status runScheduler(flexiv::Robot* robotPtr,
-                            SPIData* spiDataPtr,
-                            std::list<SPIData>* spiDataListPtr,
-                            RobotData* robotDataPtr,
-                            std::list<RobotData>* robotDataListPtr,
+        Status runScheduler(kostal::RobotClient* robotPtr,
+                            StationContext* stationPtr,
                             flexiv::Log* logPtr, 
                             std::string planName)
         {
-            Status result;
             if (m_robotHandler.checkRobotPlan(robotPtr, logPtr, planName)==false){
                 return ROBOT;
             }
 
-            g_collectSwitch = true;
-            flexiv::SystemStatus systemStatus;
-            // Execute the plan by name, need to wait until the system response
-            robotPtr->executePlanByName(planName);
-            while (systemStatus.m_programRunning == false)
             {
-                std::this_thread::sleep_for(std::chrono::milliseconds(1));
-                robotPtr->getSystemStatus(&systemStatus);
+                // the samples of a plan of the expected length fit without allocating
+                std::lock_guard<std::mutex> lock(stationPtr->dataMutex);
+                stationPtr->capture.reserve(g_expectedPlanSeconds * 1000 / g_samplingInterval);
             }
-            // Create two threads to realize data collecting and inserting collectSPIDataDummy
-            //boost::thread T1(boost::bind(&kostal::SPIOperationHandler::collectSPIDataDummy, m_spiHandler, spiDataPtr, logPtr));
-            boost::thread T1(boost::bind(&kostal::SPIOperationHandler::collectSPIData, m_spiHandler, spiDataPtr, logPtr));
-            boost::thread T2(boost::bind(&kostal::RobotOperationHandler::collectUsefulData, m_robotHandler, robotPtr, robotDataPtr, robotDataListPtr, spiDataPtr, spiDataListPtr));
-            T1.detach();
-            T2.detach();
-            // Wait until the program is finished
-            while (systemStatus.m_programRunning == true)
             {
-                std::this_thread::sleep_for(std::chrono::milliseconds(1));
-                robotPtr->getSystemStatus(&systemStatus);
+                std::lock_guard<std::mutex> lock(stationPtr->spiMutex);
+                stationPtr->spiFrames.reserve(g_expectedPlanSeconds * 1000 / g_spiInterval);
+                stationPtr->spiRing.clear();
+                stationPtr->spiIngest.reset();
+            }
+            if (stationPtr->spiSource != nullptr){
+                // a synthetic or replayed stream starts with the plan
+                stationPtr->spiSource->start();
             }
-            // Close the two while loop in threads
+            stationPtr->nodeTracker.reset();
+            stationPtr->samplingTiming.reset(g_samplingInterval);
+            stationPtr->spiTiming.reset(g_spiInterval);
+            stationPtr->supervisionTiming.reset(g_supervisionInterval);
+            stationPtr->samplingStalls = 0;
+            stationPtr->collectSwitch = true;
             {
-                std::lock_guard<std::mutex> lock(g_kostalDataMutex);
-                g_collectSwitch = false;
+                // the idle recorder finished its last poll, the sampling task records from now on
+                std::lock_guard<std::mutex> lock(stationPtr->idlePollMutex);
+            }
+            stationPtr->flightRecorder.mark("plan " + planName + " started");
+            // the program has to run before sampling starts, it is over when it stops again
+            std::atomic<bool> programStarted = {false};
+            // whether the last supervision cycle found no new snapshot of the sampling task
+            bool samplingStalled = false;
+            bool spiFailed = false;
+            flexiv::SystemStatus systemStatus;
+            // a robot call that throws in a task ends the plan, the error is logged after the stop
+            std::mutex robotErrorMutex;
+            std::string robotError;
+            try {
+                flexiv::Scheduler scheduler;
+                auto robotCall = [&](const std::function<void()>& call){
+                    try {
+                        call();
+                    } catch (const flexiv::Exception& e) {
+                        std::lock_guard<std::mutex> lock(robotErrorMutex);
+                        robotError = e.what();
+                        scheduler.stop();
+                    }
+                };
+                scheduler.addTask([&]{
+                    stationPtr->samplingTiming.tick();
+                    if (programStarted){
+                        robotCall([&]{ m_robotHandler.sampleUsefulData(robotPtr, stationPtr); });
+                    }
+                }, "Kostal sampling", g_samplingInterval, g_samplingPriority);
+                scheduler.addTask([&]{
+                    stationPtr->spiTiming.tick();
+                    // a device that failed once is not read again in this plan
+                    if (!spiFailed){
+                        spiFailed = m_spiHandler.readSPIData(stationPtr, logPtr) != SUCCESS;
+                    }
+                }, "Kostal spi", g_spiInterval, g_spiPriority);
+                scheduler.addTask([&]{
+                    stationPtr->supervisionTiming.tick();
+                    m_spiHandler.storeSPIFrames(stationPtr);
+                    watchSampling(stationPtr, programStarted, &samplingStalled);
+                    robotCall([&]{
+                        robotPtr->getSystemStatus(&systemStatus);
+                        stationPtr->flightRecorder.record(systemStatus);
+                        if (!programStarted && systemStatus.m_programRunning){
+                            programStarted = true;
+                        }else if (programStarted && !systemStatus.m_programRunning){
+                            scheduler.stop();
+                        }
+                    });
+                }, "Kostal supervision", g_supervisionInterval, g_supervisionPriority);
+                // Execute the plan by name, the supervision waits until the system response
+                robotPtr->executePlanByName(planName);
+                // Blocks until the supervision sees the program finished
+                scheduler.start();
+            } catch (const flexiv::Exception& e) {
+                logPtr->error(e.what());
+                stationPtr->collectSwitch = false;
+                return ROBOT;
+            }
+            if (!robotError.empty()){
+                logPtr->error(robotError);
+                stationPtr->flightRecorder.mark("robot error: " + robotError);
+                stationPtr->collectSwitch = false;
+                m_spiHandler.storeSPIFrames(stationPtr);
+                return ROBOT;
+            }
+            {
+                std::lock_guard<std::mutex> lock(stationPtr->dataMutex);
+                stationPtr->collectSwitch = false;
+            }
+            // the frames read after the last supervision cycle
+            m_spiHandler.storeSPIFrames(stationPtr);
+            logPtr->info(stationPtr->samplingTiming.summary("Sampling"));
+            logPtr->info(stationPtr->spiTiming.summary("SPI polling"));
+            logPtr->info(stationPtr->spiIngest.summary());
+            logPtr->info(stationPtr->supervisionTiming.summary("Supervision"));
+            if (stationPtr->samplingStalls > 0){
+                logPtr->warn("The sampling task delivered no snapshot in " + std::to_string(stationPtr->samplingStalls)
+                             + " supervision cycles");
             }
+            m_robotHandler.profilePlan(stationPtr, planName, logPtr);
             
             logPtr->info("The sync task is finished by scheduler");
             return SUCCESS;
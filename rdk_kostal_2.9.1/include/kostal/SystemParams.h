@@ -30,6 +30,7 @@
 #include <iomanip>
 #include <fstream>
 #include <future>
+#include <string_view>
 #include "math.h"
 
 // third-party lib files
@@ -43,24 +44,21 @@
 const unsigned short g_COMMPORT = 6060; // The port number of destination host
 std::string ROBOTADDRESS = "127.0.0.1";
 std::string LOCALADDRESS = "127.0.0.1";
-const int g_MSGMAXSIZE=1024;
+const int g_MSGMAXSIZE=1024; // The size of one socket read, messages can be larger than this
 const std::string g_TOKEN = "kostal";
 struct timeval timeo = {10, 0};
-const std::string UPLOADADDRESS = "/home/ftp/"; // The file stored location
-
-//spi config
-int g_CPHA=1;
-int g_CPOL=0;
-int g_LSB=0;
-int g_SelPol=0;
+std::string UPLOADADDRESS = "/home/ftp/"; // The file stored location
 
 // The global variant status shows the status of the system, 0 means success, 1-4 means errors in different periods
 enum Status{SUCCESS, SOCKET, JSON, ROBOT, SPI, CSV, FTP, SYSTEM};
-std::mutex g_kostalDataMutex;
 
 // The status of the flexiv server
 enum serverStatus{INIT, IDLE, BUSY, FAULT};
 
+// How Testman messages are delimited in the byte stream, AUTO decides on the first byte
+enum FramingMode{AUTO, NEWLINE, LENGTHPREFIX};
+FramingMode g_framingMode = AUTO;
+
 // Testman 's message constants
 const char* cobotStatus   = "COBOT_STATUS"; // read cobot current status 
 const char* processBias   = "PROCESS_BIAS"; // bias mode 
@@ -76,22 +74,124 @@ const std::string CPHA   = "CPHA";
 const std::string LSB    = "LSB";
 const std::string SELP   = "SELP";
 const std::string TOKEN  = "TOKEN";
+const std::string STATION = "STATION"; // optional, the station id the client drives
+const std::string NOTIFY  = "NOTIFY"; // optional, yes lets the server push status and task events
+const std::string SPISOURCE  = "SPISOURCE"; // optional, GINKGO SYNTHETIC REPLAY, where the spi frames come from
+const std::string SPIRATE    = "SPIRATE"; // optional, frames per second of the SYNTHETIC source
+const std::string SPIPATTERN = "SPIPATTERN"; // optional, COUNTER WALKING LEVER RANDOM bits of the SYNTHETIC source
+const std::string SPIREPLAY  = "SPIREPLAY"; // optional, the recorded result file the REPLAY source streams
+const std::string SPISPEED   = "SPISPEED"; // optional, how many times faster REPLAY runs, 0 as fast as possible
+const std::string TRIGGERSTART = "TRIGGERSTART"; // optional, comma separated nodes that start the capture, Start by default
+const std::string TRIGGERSTOP  = "TRIGGERSTOP"; // optional, comma separated nodes that stop the capture, Stop by default
+const std::string TRIGGERPATH  = "TRIGGERPATH"; // optional, comma separated node path prefixes captured while the plan is in them
+const std::string PRETRIGGER   = "PRETRIGGER"; // optional, ms captured before the capture starts
+const std::string POSTTRIGGER  = "POSTTRIGGER"; // optional, ms captured after the capture stops
+const std::string SUMMARY      = "SUMMARY"; // optional, yes adds the per node stats of the result to TASK_DONE
+const std::string BINARY       = "BINARY"; // optional, yes writes results as binary capture files instead of csv
+const std::string COMPRESSION  = "COMPRESSION"; // optional, NONE GZIP ZSTD, compresses the result files while they are written
+const std::string COMPRESSIONLEVEL = "COMPRESSIONLEVEL"; // optional, the level of COMPRESSION, the configured one by default
 
 // Task msg keythat testman will send
 const std::string QUERYSTATUS    = "TM_FLEXIV_QUERY_STATUS"; // TRUE FALSE
 const std::string TASKTYPE       = "TM_FLEXIV_TASK_TYPE"; //NORMAL BIAS DUMMY
 const std::string TASKNAME       = "TM_FLEXIV_TASK_NAME"; // xxplan
+const std::string TASKLIST       = "TM_FLEXIV_TASK_LIST"; // optional, [{TASKTYPE, TASKNAME}, ...] run in order
+const std::string TASKENQUEUE    = "TM_FLEXIV_TASK_ENQUEUE"; // yes queues the task while the system is BUSY
 
 // Key that flexiv system will response
 const std::string SYSTEMSTATUS   = "FLEXIV_TM_STATUS"; // IDLE BUSY FAULT
 
-// Whether the node data should be collected or not
-std::atomic<bool> g_dataCollectFlag = {false};
-
-// Whether the whole collecting logic should be used or not
-std::atomic<bool> g_collectSwitch = {false};
+// Keys of the events flexiv system pushes to a client that asked for NOTIFY
+const std::string SYSTEMEVENT    = "FLEXIV_TM_EVENT"; // STATUS TASK_DONE
+const std::string TASKRESULT     = "FLEXIV_TM_RESULT"; // the result file of a finished task
+const std::string TASKERROR      = "FLEXIV_TM_ERROR"; // why a finished task has no result file
+const std::string TASKSUMMARY    = "FLEXIV_TM_SUMMARY"; // the per node stats of the result, if SUMMARY was asked for
+const std::string EVENTSTATUS    = "STATUS";
+const std::string EVENTTASKDONE  = "TASK_DONE";
 
 // Connection timeout interval after first handshake with Testman, unit is second
 int64_t g_timeoutInterval = 5;
 
+// The most tasks that can wait for execution on one station
+const size_t g_taskQueueSize = 16;
+
+// Capture sets of one station, one is filled by the running plan while the others are exported
+const size_t g_captureSetCount = 2;
+
+// Samples per chunk of a capture store, a power of two
+const size_t g_captureChunkSamples = 4096;
+// Plan length the capture store is reserved for before a plan starts
+const size_t g_expectedPlanSeconds = 60;
+// Node visits the capture store is reserved for before a plan starts
+const size_t g_captureSegments = 256;
+// Write the node name into every row of a result, by default only the first row of a node has it
+bool g_nodeNameEveryRow = false;
+
+// Write the result file while the plan runs, only its tail is written after the plan ends
+bool g_streamExport = true;
+// How often the streaming export takes the new samples and frames [ms]
+unsigned int g_streamInterval = 20;
+// Bytes the result file buffers before they are written to the disk
+const size_t g_streamBufferBytes = 1 << 20;
+// Characters of formatted rows written to a result file at once
+const size_t g_csvBlockBytes = 1 << 18;
+// Samples whose euler angles are converted at once before their rows are formatted
+const size_t g_eulerBlockSamples = 256;
+// Byte alignment of the column blocks in a binary capture file
+const size_t g_captureFileAlignment = 64;
+// Compression levels of result files when the session asks for compression and gives no level
+int g_gzipLevel = 6;
+int g_zstdLevel = 1;
+// Blocks of a result file that are written in the background at once, and their bytes
+const size_t g_asyncWriteBlocks = 4;
+const size_t g_asyncWriteBytes = 1 << 20;
+// Write result files through io_uring where the kernel allows it, a pwrite thread otherwise
+bool g_ioUring = true;
+
+// Interval [ms] and priority (0 ~ 45) of the capture tasks on the flexiv::Scheduler
+unsigned int g_samplingInterval = 1;
+unsigned int g_samplingPriority = 45;
+unsigned int g_spiInterval = 1;
+unsigned int g_spiPriority = 40;
+unsigned int g_supervisionInterval = 5;
+unsigned int g_supervisionPriority = 20;
+
+// The spi source a client gets if its handshake does not name one
+std::string g_spiSource = "GINKGO";
+double g_syntheticFrameRate = 1000;
+std::string g_syntheticPattern = "COUNTER";
+
+// Bytes one read of the USB-SPI device can return
+const size_t g_spiReadBufferSize = 10240;
+// SPI frames that wait between the spi task and the capture store, the supervision task empties it
+const size_t g_spiRingFrames = 1024;
+
+// Characters kept of the node and plan names and of the node path in a robot state snapshot
+const size_t g_stateNameSize = 64;
+const size_t g_statePathSize = 256;
+// Consumers that can subscribe to the robot state poller of one station
+const size_t g_stateSubscribers = 8;
+
+// Keep the last seconds of robot states and spi frames of a station and dump them on a fault
+bool g_flightRecorder = true;
+double g_flightRecorderSeconds = 10;
+// Events, node names and characters of an event text the flight recorder keeps
+const size_t g_flightEvents = 256;
+const size_t g_flightNodes = 256;
+const size_t g_flightEventSize = 96;
+
+// Profile the node times of every plan and write the report of the station after each plan
+bool g_planProfiler = true;
+// Logarithmic buckets per doubling of a node duration, and buckets from below 1 ms to above a minute
+const size_t g_profileBucketsPerOctave = 4;
+const size_t g_profileBuckets = g_profileBucketsPerOctave * 16 + 2;
+// Runs of a node before its last run is compared with the ones before
+const uint64_t g_profileMinRuns = 5;
+
+// How a robot sample finds its spi frame on export, NEAREST in time or the PREVIOUS one received
+enum AlignMode{NEAREST, PREVIOUS};
+AlignMode g_spiAlignMode = NEAREST;
+// A frame further away from the robot sample than this is not paired with it, unit is us
+int64_t g_spiAlignToleranceUs = 2000;
+
 #endif
\ No newline at end of file
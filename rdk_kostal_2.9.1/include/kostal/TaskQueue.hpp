@@ -0,0 +1,133 @@
+/*
+ * @file TaskQueue.hpp
+ * @copyright Copyright (C) 2016-2022 Flexiv Ltd. All Rights Reserved.
+ */
+#ifndef FLEXIVRDK_TASKQUEUE_HPP_
+#define FLEXIVRDK_TASKQUEUE_HPP_
+
+// Kostal header files
+#include <kostal/SystemParams.h>
+
+#include <deque>
+#include <functional>
+
+namespace kostal {
+
+    /**
+     * @struct TaskRequest
+     * @brief One plan Testman asks the station to run
+     */
+    struct TaskRequest
+    {
+        // NORMAL BIAS DUMMY
+        std::string taskType;
+        // the work plan name
+        std::string taskName;
+    };
+
+    /**
+     * @class TaskQueue
+     * @brief Bounded queue of the plans a station still has to run. One executor drains
+     * it; push() tells the caller when no executor is running and one has to be started,
+     * pop() retires the executor when the queue runs empty, both under the same lock so
+     * a task pushed while the executor retires is never left behind. The callbacks run
+     * under that lock too, so status changes made in them happen in queue order.
+     */
+    class TaskQueue
+    {
+    private:
+        std::mutex m_mutex;
+        std::deque<TaskRequest> m_tasks;
+        const size_t m_capacity;
+        // an executor is draining the queue
+        bool m_executing = false;
+
+    public:
+        /**
+         * @param[in] capacity the most tasks waiting at the same time
+         */
+        explicit TaskQueue(size_t capacity = g_taskQueueSize)
+        : m_capacity(capacity)
+        {}
+        virtual ~TaskQueue() = default;
+
+        /**
+         * @brief Queue a sequence of tasks, either all of them or none
+         * @param[in] tasks the tasks in execution order
+         * @param[out] startExecutor true if the caller has to start the executor
+         * @param[in] onQueued called after the tasks are queued, optional
+         * @return false if the queue has no room for all tasks
+         */
+        bool push(const std::vector<TaskRequest>& tasks, bool* startExecutor,
+                  const std::function<void()>& onQueued = nullptr)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            *startExecutor = false;
+            if (tasks.empty() || m_tasks.size() + tasks.size() > m_capacity){
+                return false;
+            }
+            m_tasks.insert(m_tasks.end(), tasks.begin(), tasks.end());
+            *startExecutor = !m_executing;
+            m_executing = true;
+            if (onQueued){
+                onQueued();
+            }
+            return true;
+        }
+
+        /**
+         * @brief Take the next task, called by the executor only
+         * @param[out] task the next task
+         * @param[in] onRetire called when the queue is empty and the executor retires, optional
+         * @return false if the queue is empty, the executor has to stop then
+         */
+        bool pop(TaskRequest* task, const std::function<void()>& onRetire = nullptr)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_tasks.empty()){
+                m_executing = false;
+                if (onRetire){
+                    onRetire();
+                }
+                return false;
+            }
+            *task = std::move(m_tasks.front());
+            m_tasks.pop_front();
+            return true;
+        }
+
+        /**
+         * @brief Run a function with the number of waiting tasks while nothing can be queued
+         * @param[in] reporter called as reporter(waiting tasks)
+         */
+        void report(const std::function<void(size_t)>& reporter)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            reporter(m_tasks.size());
+        }
+
+        /**
+         * @brief Drop all waiting tasks, the running one is not affected
+         * @return the number of dropped tasks
+         */
+        size_t clear()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            size_t dropped = m_tasks.size();
+            m_tasks.clear();
+            return dropped;
+        }
+
+        /**
+         * @brief Get the number of waiting tasks
+         */
+        size_t size()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_tasks.size();
+        }
+    };
+
+} /* namespace kostal */
+
+#endif /* FLEXIVRDK_TASKQUEUE_HPP_ */
@@ -11,6 +11,11 @@
 // Kostal header files
 #include <kostal/KostalStates.hpp>
 #include <kostal/SystemParams.h>
+#include <kostal/CaptureStore.hpp>
+#include <kostal/StreamAligner.hpp>
+#include <kostal/CSVFormatter.hpp>
+#include <kostal/EulerBatch.hpp>
+#include <kostal/ResultCompression.hpp>
 
 namespace kostal {
     
@@ -24,8 +29,17 @@ namespace kostal {
         return strTime;
     }
 
+    // get the current time and the sequence number of a new result file, the time alone
+    // repeats for the results of one second
+    std::string getResultStamp()
+    {
+        char sequence[32];
+        snprintf(sequence, sizeof(sequence), "_%06llu", static_cast<unsigned long long>(nextResultSequence()));
+        return getTime() + sequence;
+    }
+
     // transfer a double array of tcp quaternion to an array of euler
-    std::array<double, 3> quaternionToEuler(double* tcpPose){
+    std::array<double, 3> quaternionToEuler(const double* tcpPose){
         double M_Pi;
         double rad = 180/M_PI;
         Eigen::Quaternion<double> q;
@@ -41,6 +55,164 @@ namespace kostal {
         return eulerAngle;
     }
 
+    /**
+     * @class ResultRowWriter
+     * @brief Formats the rows of a result file in order, each robot sample with the spi frame
+     * SPIAligner finds for it. Rows can be written in several steps while the stores still
+     * grow, a row only depends on the rows before it. Doubles are written in full precision,
+     * see CSVFormatter. The euler angles are converted g_eulerBlockSamples rows at a time,
+     * see quaternionsToEuler().
+     */
+    class ResultRowWriter
+    {
+    private:
+        const CaptureStore& m_capture;
+        const SPIFrameStore& m_spiFrames;
+        SPIAligner m_aligner;
+        CSVFormatter m_csv;
+        // the next row to write and the segment it is in or before
+        size_t m_row = 0;
+        size_t m_segment = 0;
+        int64_t m_startTime = 0;
+        // euler angles of the tcp and the flange for the rows from m_eulerFirst to m_eulerEnd
+        double m_tcpEuler[g_eulerBlockSamples][3];
+        double m_flangeEuler[g_eulerBlockSamples][3];
+        size_t m_eulerFirst = 0;
+        size_t m_eulerEnd = 0;
+
+        /**
+         * @brief Convert the quaternions of the rows from m_row on, up to end, the end of the
+         * block or of the chunk the row is in, the rows of a chunk are evenly spaced
+         */
+        void convertEuler(size_t end)
+        {
+            size_t chunkEnd = (m_row / g_captureChunkSamples + 1) * g_captureChunkSamples;
+            size_t count = std::min({end, chunkEnd, m_row + g_eulerBlockSamples}) - m_row;
+            quaternionsToEuler(m_capture.tcpPose(m_row) + 3, 7, count, m_tcpEuler[0]);
+            quaternionsToEuler(m_capture.flangePose(m_row) + 3, 7, count, m_flangeEuler[0]);
+            m_eulerFirst = m_row;
+            m_eulerEnd = m_row + count;
+        }
+
+    public:
+        /**
+         * @param[in] capture the robot samples, may grow between writeRows()
+         * @param[in] spiFrames the spi frames, may grow between writeRows()
+         */
+        ResultRowWriter(const CaptureStore& capture, const SPIFrameStore& spiFrames)
+        : m_capture(capture)
+        , m_spiFrames(spiFrames)
+        , m_aligner(spiFrames)
+        {}
+        virtual ~ResultRowWriter() = default;
+
+        /**
+         * @brief Write the header line of a result file
+         */
+        static void writeHeader(std::ostream& excelFile)
+        {
+            excelFile << "NodeName"<<",";
+            excelFile << "TCP_x"<<","<<"TCP_y"<<"," << "TCP_z"<<"," ;
+            excelFile << "TCP_Rx"<<","<<"TCP_Ry"<<"," << "TCP_Rz"<<"," ;
+            excelFile << "FLANGE_x"<<","<<"FLANGE_y"<<"," << "FLANGE_z"<<"," ;
+            excelFile << "FLANGE_Rx"<<","<<"FLANGE_Ry"<<"," << "FLANGR_Rz"<<",";
+            excelFile << "RowDataSensor0"<<","<< "RowDataSensor1"<<","<< "RowDataSensor2"<<",";
+            excelFile << "RowDataSensor3"<<","<< "RowDataSensor4"<<","<< "RowDataSensor5"<<",";
+            excelFile << "SPI0-0"<<","<< "SPI0-1"<<","<< "SPI0-2"<<","<< "SPI0-3"<<","<< "SPI0-4"<<",";
+            excelFile << "SPI0-5"<<","<< "SPI0-6"<<","<< "SPI0-7"<<",";
+            excelFile << "SPI1-0"<<","<< "SPI1-1"<<","<< "SPI1-2"<<","<< "SPI1-3"<<","<< "SPI1-4"<<",";
+            excelFile << "SPI1-5"<<","<< "SPI1-6"<<","<< "SPI1-7"<<",";
+            excelFile << "Time_us"<<","<< "SPI_Offset_us"<<","<< "SPI_Seq"<<","<< "\n";
+        }
+
+        /**
+         * @brief Get the number of rows written so far
+         */
+        size_t written() const{
+            return m_row;
+        }
+
+        /**
+         * @brief Write the rows from the last written one up to end. A row is final once the
+         * spi frames around its sample are stored, see SPIAligner. The rows are formatted by
+         * a CSVFormatter and written to the stream in blocks, the last one when all are done.
+         * @param[in] excelFile the stream of the result file
+         * @param[in] end the row after the last one to write, at most the size of the capture
+         */
+        void writeRows(std::ostream& excelFile, size_t end)
+        {
+            if (m_row == 0 && end > 0){
+                m_startTime = m_capture.timestamp(0);
+            }
+            const std::vector<NodeSegment>& segments = m_capture.segments();
+            for (; m_row < end; m_row++){
+
+                const double* tcpPose = m_capture.tcpPose(m_row);
+                const double* flangePose = m_capture.flangePose(m_row);
+                const double* rawForce = m_capture.rawForce(m_row);
+                int64_t sampleTime = m_capture.timestamp(m_row);
+                size_t frame = 0;
+                bool aligned = m_aligner.align(sampleTime, &frame);
+                //node name, once at the first row of a node
+                bool firstOfNode = m_segment < segments.size() && segments[m_segment].firstSample == m_row;
+                if (firstOfNode || g_nodeNameEveryRow){
+                    m_csv.field(m_capture.segmentName(segments[firstOfNode ? m_segment : m_segment - 1]));
+                }else{
+                    m_csv.empty();
+                }
+                m_segment += firstOfNode;
+
+                if (m_row >= m_eulerEnd){
+                    convertEuler(end);
+                }
+                const double* eulerTcp = m_tcpEuler[m_row - m_eulerFirst];
+                const double* eulerFlange = m_flangeEuler[m_row - m_eulerFirst];
+
+                //tcp xyz and euler data
+                m_csv.field(tcpPose[0]);
+                m_csv.field(tcpPose[1]);
+                m_csv.field(tcpPose[2]);
+                m_csv.field(eulerTcp[0]);
+                m_csv.field(eulerTcp[1]);
+                m_csv.field(eulerTcp[2]);
+
+                //flange xyz and euler data
+                m_csv.field(flangePose[0]);
+                m_csv.field(flangePose[1]);
+                m_csv.field(flangePose[2]);
+                m_csv.field(eulerFlange[0]);
+                m_csv.field(eulerFlange[1]);
+                m_csv.field(eulerFlange[2]);
+
+                //raw sensor data
+                for (int i=0; i<6; i++){
+                    m_csv.field(rawForce[i]);
+                }
+
+                //spi sensor data as hex bytes, left empty if no frame was received close enough
+                if (aligned){
+                    const uint8_t* bytes = m_spiFrames.frame(frame);
+                    for (int i = 0; i < 16; i++){
+                        m_csv.hexField(bytes[i]);
+                    }
+                }else{
+                    m_csv.empty(16);
+                }
+
+                //sample time, spi offset and the number of the spi frame
+                m_csv.field(static_cast<int64_t>((sampleTime - m_startTime) / 1000));
+                if (aligned){
+                    m_csv.field(static_cast<int64_t>((m_spiFrames.timestamp(frame) - sampleTime) / 1000));
+                    m_csv.field(static_cast<uint64_t>(m_spiFrames.sequence(frame)));
+                }else{
+                    m_csv.empty(2);
+                }
+                m_csv.endRow(excelFile);
+            }
+            m_csv.flush(excelFile);
+        }
+    };
+
     /**
      * @class WriteExcelHandler
      * @brief Base class of writing different data into an excel file
@@ -52,103 +224,135 @@ namespace kostal {
         virtual ~WriteExcelHandler() = default;
 
         /**
-         * @brief Write the global spi data list and robot data list into a csv file with associated name
+         * @brief Write the robot and spi data a plan captured into a csv file with associated name,
+         * every robot sample is paired with the spi frame SPIAligner finds for it. The time of
+         * the sample since the first one and the offset of its frame are written in us, followed
+         * by the sequence number of the frame.
          * @param[in] taskType the type of the task, can be NORMAL, BIAS, DUMMY
          * @param[in] taskName the name of the task
-         * @param[in] robotDataListPtr robot data list's pointer
-         * @param[in] spiDataListPtr spi data list's pointer
+         * @param[in] capturePtr the captured robot samples
+         * @param[in] spiFramesPtr the captured spi frames
          * @param[in] logPtr robot's log pointer
+         * @param[out] filePathPtr the path of the generated file, optional
+         * @param[in] compression how the file is compressed, its extension is appended to the path
          * @return Status code
          */
         Status writeDataToExcel(std::string taskType,
                                 std::string taskName, 
-                                std::list<RobotData>* robotDataListPtr,
-                                std::list<SPIData>* spiDataListPtr, 
-                                flexiv::Log* logPtr)
+                                const CaptureStore* capturePtr,
+                                const SPIFrameStore* spiFramesPtr,
+                                flexiv::Log* logPtr,
+                                std::string* filePathPtr = nullptr,
+                                const ResultCompression& compression = ResultCompression())
         {
             
-            if(spiDataListPtr->size() == 0){
+            if(spiFramesPtr->empty()){
                 logPtr->error("The collected spi data list is null, exiting...");  
                 return CSV;
             }
 
-            if(robotDataListPtr->size() == 0){
+            if(capturePtr->empty()){
                 logPtr->error("The collected robot data list is null, exiting...");  
                 return CSV;
             }
 
-            std::fstream excelFile;
-            std::string filePath = UPLOADADDRESS;
-            std::string excelFileName = filePath + taskType + "/" + taskName + getTime() + ".csv";
+            CompressedFile excelFile;
+            std::string excelFileName = resultPath(taskType, taskName) + compression.extension();
             std::cout<<"The generated file path is: "<<excelFileName<<std::endl;
-            excelFile.open(excelFileName, std::ios::out);
+            excelFile.open(excelFileName, compression);
             if(!excelFile.is_open()){
                 logPtr->error("The associated excel file is not created correctly");        
                 return CSV;
             }
 
-            //Header
-            excelFile << "NodeName"<<",";
-            excelFile << "TCP_x"<<","<<"TCP_y"<<"," << "TCP_z"<<"," ;
-            excelFile << "TCP_Rx"<<","<<"TCP_Ry"<<"," << "TCP_Rz"<<"," ;
-            excelFile << "FLANGE_x"<<","<<"FLANGE_y"<<"," << "FLANGE_z"<<"," ;
-            excelFile << "FLANGE_Rx"<<","<<"FLANGE_Ry"<<"," << "FLANGR_Rz"<<",";
-            excelFile << "RowDataSensor0"<<","<< "RowDataSensor1"<<","<< "RowDataSensor2"<<",";
-            excelFile << "RowDataSensor3"<<","<< "RowDataSensor4"<<","<< "RowDataSensor5"<<",";
-            excelFile << "SPI0-0"<<","<< "SPI0-1"<<","<< "SPI0-2"<<","<< "SPI0-3"<<","<< "SPI0-4"<<",";
-            excelFile << "SPI0-5"<<","<< "SPI0-6"<<","<< "SPI0-7"<<",";
-            excelFile << "SPI1-0"<<","<< "SPI1-1"<<","<< "SPI1-2"<<","<< "SPI1-3"<<","<< "SPI1-4"<<",";
-            excelFile << "SPI1-5"<<","<< "SPI1-6"<<","<< "SPI1-7"<<","<< std::endl;
-
-            while(robotDataListPtr->size()>0){
-
-                RobotData robotDataRow = robotDataListPtr->front();
-                SPIData spiDataRow = spiDataListPtr->front();
-                //node name
-                excelFile << robotDataRow.nodeName << ",";
-
-                //tcp xyz
-                excelFile << robotDataRow.tcpPose[0] << ",";
-                excelFile << robotDataRow.tcpPose[1] << ",";
-                excelFile << robotDataRow.tcpPose[2] << ",";
-
-                //tcp euler data
-                double quaternionTcp[4] = {robotDataRow.tcpPose[3], robotDataRow.tcpPose[4], robotDataRow.tcpPose[5], robotDataRow.tcpPose[6]};
-                auto eulerTcp = quaternionToEuler(quaternionTcp);
-                excelFile << eulerTcp[0] << ",";
-                excelFile << eulerTcp[1] << ",";
-                excelFile << eulerTcp[2] << ",";
+            ResultRowWriter::writeHeader(excelFile);
+            ResultRowWriter rows(*capturePtr, *spiFramesPtr);
+            rows.writeRows(excelFile, capturePtr->size());
 
-                //flange xyz
-                excelFile << robotDataRow.flangePose[0] << ",";
-                excelFile << robotDataRow.flangePose[1] << ",";
-                excelFile << robotDataRow.flangePose[2] << ",";
-                
-                //flange euler data
-                double quaternionFlange[4] = {robotDataRow.flangePose[3], robotDataRow.flangePose[4], robotDataRow.flangePose[5], robotDataRow.flangePose[6]};
-                auto eulerFlange = quaternionToEuler(quaternionFlange);
-                excelFile << eulerFlange[0] << ",";
-                excelFile << eulerFlange[1] << ",";
-                excelFile << eulerFlange[2] << ",";
+            // the summary is published first, whoever finds the result finds its summary too
+            excelFile.finish();
+            Status result = excelFile.fail() ? CSV : writeSummary(summaryPath(excelFileName), capturePtr, logPtr);
+            if (result != SUCCESS){
+                excelFile.abort();
+            }else{
+                excelFile.close();
+            }
+            if (excelFile.fail()){
+                logPtr->error("The associated excel file is not written correctly");
+                std::remove(summaryPath(excelFileName).c_str());
+                return CSV;
+            }
+            if (result != SUCCESS){
+                return result;
+            }
+            if (filePathPtr != nullptr){
+                *filePathPtr = excelFileName;
+            }
+            return SUCCESS;
+        }
 
-                //raw sensor data
-                for (int i=0; i<6; i++){
-                excelFile << robotDataRow.rawDataForceSensor[i] << ",";
-                }
+        /**
+         * @brief Get the path of a new result file under the upload address
+         * @param[in] taskType the type of the task, the directory of the file
+         * @param[in] taskName the name of the task, followed by the current time and the
+         * sequence number of the file
+         */
+        static std::string resultPath(const std::string& taskType, const std::string& taskName)
+        {
+            return UPLOADADDRESS + taskType + "/" + taskName + getResultStamp() + ".csv";
+        }
 
-                //spi sensor data
-                for (int i = 0; i < 16; i++){
-                excelFile << std::setfill('0') << std::setw(2) << std::right<<std::hex ;
-                excelFile << + static_cast<uint8_t>(spiDataRow.SPISensor[i])<<",";
+        /**
+         * @brief Get the path of the summary written next to a result file
+         * @param[in] excelFileName the path of the csv or binary capture file, compressed or not
+         * @return the path with .csv or .kcap and the compression replaced by .summary.json
+         */
+        static std::string summaryPath(const std::string& excelFileName)
+        {
+            std::string path = ResultCompression::stripExtension(excelFileName);
+            for (const char* extension : {".csv", ".kcap"}){
+                size_t length = std::strlen(extension);
+                if (path.size() >= length && path.compare(path.size() - length, length, extension) == 0){
+                    path.resize(path.size() - length);
+                    break;
                 }
-                //finish this line
-                excelFile << std::endl;
-                robotDataListPtr->pop_front();
-                spiDataListPtr->pop_front();
             }
+            return path + ".summary.json";
+        }
 
-            excelFile.close();
-            return SUCCESS;
+        /**
+         * @brief Write the per node stats of the capture as compact json, a few hundred bytes
+         * per node instead of the rows of the csv
+         * @param[in] fileName the path of the summary file
+         * @param[in] capturePtr the captured robot samples
+         * @param[in] logPtr robot's log pointer
+         * @return Status code
+         */
+        Status writeSummary(const std::string& fileName, const CaptureStore* capturePtr, flexiv::Log* logPtr)
+        {
+            return writeSummary(fileName, capturePtr->summary(), logPtr);
+        }
+
+        /**
+         * @brief Write a summary taken from a capture before, published like the result files
+         * @param[in] fileName the path of the summary file
+         * @param[in] summary the per node stats of the capture
+         * @param[in] logPtr robot's log pointer
+         * @return Status code
+         */
+        static Status writeSummary(const std::string& fileName, const Json::Value& summary, flexiv::Log* logPtr)
+        {
+            CompressedFile summaryFile;
+            summaryFile.open(fileName, ResultCompression());
+            if (!summaryFile.is_open()){
+                logPtr->error("The summary file is not created correctly");
+                return CSV;
+            }
+            Json::StreamWriterBuilder builder;
+            builder["indentation"] = "";
+            summaryFile << Json::writeString(builder, summary);
+            summaryFile.close();
+            return summaryFile.fail() ? CSV : SUCCESS;
         }
 
         /**
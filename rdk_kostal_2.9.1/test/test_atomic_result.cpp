@@ -0,0 +1,196 @@
+/**
+ * @test test_atomic_result.cpp
+ * Write result files through kostal::AsyncFileWriter with io_uring, where the
+ * kernel allows it, and with the pwrite thread. The published files have to
+ * hold what was written byte by byte and no temporary file may be left. A
+ * writer process that dies before it published may leave only its hidden
+ * .part file, never a cut file under the result name, an existing file is
+ * never replaced, and the names of results started in one second differ.
+ * Then the time the writing thread spends appending is compared with an
+ * std::ofstream, and the time to publish is reported apart, it is spent on
+ * the export thread.
+ * @copyright Copyright (C) 2016-2022 Flexiv Ltd. All Rights Reserved.
+ * @author lcc@Flexiv
+ */
+
+// Kostal header files
+#include <kostal/KostalLogger.hpp>
+#include <kostal/WriteExcel.hpp>
+#include <kostal/CaptureFile.hpp>
+
+#include <filesystem>
+#include <random>
+#include <set>
+#include <sys/wait.h>
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+const std::string g_directory = "/tmp/test_atomic_result/";
+
+/** Bytes of the written files, about a minute of csv rows */
+const size_t g_fileBytes = 32 << 20;
+
+std::string readFile(const std::string& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    std::stringstream content;
+    content << file.rdbuf();
+    return content.str();
+}
+
+std::string makeContent()
+{
+    std::mt19937_64 random(23);
+    std::string content(g_fileBytes, '\0');
+    for (char& c : content){
+        c = static_cast<char>('0' + random() % 64);
+    }
+    return content;
+}
+
+/**
+ * Append the content in the sizes of formatted row blocks
+ * @return the longest append [us]
+ */
+template <class Append>
+double appendAll(const std::string& content, Append append, double* totalUs)
+{
+    std::mt19937_64 random(5);
+    double longest = 0;
+    *totalUs = 0;
+    for (size_t offset=0; offset<content.size();){
+        size_t bytes = std::min<size_t>(content.size() - offset, 1000 + random() % (1 << 18));
+        auto start = Clock::now();
+        append(content.data() + offset, bytes);
+        double us = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+        longest = std::max(longest, us);
+        *totalUs += us;
+        offset += bytes;
+    }
+    return longest;
+}
+
+/** Write and publish with one queue, then compare the file and look for left overs */
+bool writesAndPublishes(const std::string& content, bool ioUring, kostal::Log* log)
+{
+    g_ioUring = ioUring;
+    std::string path = g_directory + (ioUring ? "uring.csv" : "pwrite.csv");
+    kostal::AsyncFileWriter writer;
+    if (!writer.open(path)){
+        log->error("the temporary file is not created");
+        return false;
+    }
+    bool hidden = !std::filesystem::exists(path) && std::filesystem::exists(kostal::AsyncFileWriter::tempPath(path));
+    double totalUs = 0;
+    double longest = appendAll(content, [&](const char* data, size_t bytes){ writer.write(data, bytes); }, &totalUs);
+    auto start = Clock::now();
+    std::string error;
+    bool published = writer.publish(&error);
+    double publishUs = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+    bool passed = hidden && published && readFile(path) == content
+                  && !std::filesystem::exists(kostal::AsyncFileWriter::tempPath(path));
+    std::ostringstream line;
+    line << std::fixed << std::setprecision(0) << writer.queueName() << ": appends " << totalUs
+         << " us, longest " << longest << " us, publish " << publishUs << " us";
+    (passed ? log->info(line.str()) : log->error(line.str() + ", the published file is wrong " + error));
+    return passed;
+}
+
+/** The same appends through an ofstream, as the files were written before */
+void measureOfstream(const std::string& content, kostal::Log* log)
+{
+    std::string path = g_directory + "ofstream.csv";
+    std::ofstream file(path, std::ios::binary);
+    std::vector<char> buffer(g_streamBufferBytes);
+    file.rdbuf()->pubsetbuf(buffer.data(), buffer.size());
+    double totalUs = 0;
+    double longest = appendAll(content, [&](const char* data, size_t bytes){ file.write(data, bytes); }, &totalUs);
+    auto start = Clock::now();
+    file.close();
+    double closeUs = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+    std::ostringstream line;
+    line << std::fixed << std::setprecision(0) << "ofstream: appends " << totalUs << " us, longest " << longest
+         << " us, close without sync " << closeUs << " us";
+    log->info(line.str());
+}
+
+/** A writer that dies before it published leaves no file under the result name */
+bool survivesCrash(const std::string& content, kostal::Log* log)
+{
+    std::string path = g_directory + "crashed.csv";
+    pid_t child = fork();
+    if (child == 0){
+        kostal::CompressedFile file;
+        file.open(path, kostal::ResultCompression());
+        file.write(content.data(), content.size() / 2);
+        file.finish();
+        // no destructor runs, as if the process was killed
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(child, &status, 0);
+    bool passed = !std::filesystem::exists(path) && std::filesystem::exists(kostal::AsyncFileWriter::tempPath(path));
+    (passed ? log->info("a writer that died left only its .part file")
+            : log->error("a writer that died left a file under the result name"));
+    return passed;
+}
+
+/** Publishing never replaces a file, a dropped file leaves nothing */
+bool keepsExisting(const std::string& content, kostal::Log* log)
+{
+    std::string path = g_directory + "existing.csv";
+    std::ofstream(path) << "first";
+    kostal::AsyncFileWriter writer;
+    writer.open(path);
+    writer.write(content.data(), 1000);
+    std::string error;
+    bool refused = !writer.publish(&error) && readFile(path) == "first"
+                   && !std::filesystem::exists(kostal::AsyncFileWriter::tempPath(path));
+
+    std::string dropped = g_directory + "dropped.csv";
+    {
+        kostal::CompressedFile file;
+        file.open(dropped, kostal::ResultCompression());
+        file << content.substr(0, 1000);
+    }
+    bool passed = refused && !std::filesystem::exists(dropped)
+                  && !std::filesystem::exists(kostal::AsyncFileWriter::tempPath(dropped));
+    (passed ? log->info("an existing file is kept (" + error + "), a dropped file leaves nothing")
+            : log->error("an existing file was replaced or a dropped file left something"));
+    return passed;
+}
+
+/** Results of one task started in the same second get different names */
+bool uniqueNames(kostal::Log* log)
+{
+    std::set<std::string> names;
+    for (int i=0; i<1000; i++){
+        names.insert(kostal::WriteExcelHandler::resultPath("NORMAL", "Kostal-Same"));
+        names.insert(kostal::CaptureFileWriter::capturePath("NORMAL", "Kostal-Same"));
+    }
+    bool passed = names.size() == 2000;
+    (passed ? log->info("2000 result names in a row are unique, e.g. " + *names.begin())
+            : log->error("result names repeat"));
+    return passed;
+}
+
+}
+
+int main()
+{
+    kostal::Log log;
+    std::filesystem::create_directories(g_directory + "NORMAL");
+    UPLOADADDRESS = g_directory;
+    std::string content = makeContent();
+
+    bool passed = writesAndPublishes(content, true, &log);
+    passed &= writesAndPublishes(content, false, &log);
+    measureOfstream(content, &log);
+    passed &= survivesCrash(content, &log);
+    passed &= keepsExisting(content, &log);
+    passed &= uniqueNames(&log);
+    std::filesystem::remove_all(g_directory);
+    return passed ? 0 : 1;
+}
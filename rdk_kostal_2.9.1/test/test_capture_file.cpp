@@ -0,0 +1,253 @@
+/**
+ * @test test_capture_file.cpp
+ * Write a capture of one minute at 1 kHz as a binary capture file with
+ * kostal::CaptureFileWriter and as a result csv. The columns the mapped
+ * kostal::CaptureFileReader gives have to hold the stored values bit by bit,
+ * the csv converted from the capture file has to equal the csv written from
+ * the stores byte by byte, and cut or foreign files have to be refused. Then
+ * the sizes and the times to write and to read the columns back are compared.
+ * Also runs a capture set through kostal::ResultExporter with binary results.
+ * @copyright Copyright (C) 2016-2022 Flexiv Ltd. All Rights Reserved.
+ * @author lcc@Flexiv
+ */
+
+// Kostal header files
+#include <kostal/KostalLogger.hpp>
+#include <kostal/ResultExporter.hpp>
+#include <kostal/CaptureFile.hpp>
+
+#include <filesystem>
+#include <random>
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+const size_t g_samples = 60000;
+
+const std::string g_directory = "/tmp/test_capture_file/";
+
+/** Samples of four nodes, one visited twice, and a frame per sample 200 us later */
+void makeCapture(kostal::CaptureStore* capture, kostal::SPIFrameStore* spiFrames)
+{
+    std::mt19937_64 random(21);
+    std::normal_distribution<double> normal(0.0, 1.0);
+    const char* nodes[] = {"Start", "MoveL-Approach", "Press", "MoveL-Approach", "Stop"};
+    capture->reserve(g_samples);
+    spiFrames->reserve(g_samples);
+    uint8_t frame[16] = {};
+    for (size_t i=0; i<g_samples; i++){
+        double tcp[7], flange[7], force[6];
+        for (double* values : {tcp, flange}){
+            double norm = 0;
+            for (int j=0; j<7; j++){
+                values[j] = normal(random);
+                norm += j >= 3 ? values[j] * values[j] : 0;
+            }
+            for (int j=3; j<7; j++){
+                values[j] /= std::sqrt(norm);
+            }
+        }
+        for (double& value : force){
+            value = normal(random) * 10;
+        }
+        int64_t timestamp = static_cast<int64_t>(i) * 1000000;
+        capture->append(tcp, flange, force, capture->internNode(nodes[i * 5 / g_samples]), timestamp);
+        frame[i % 16] = static_cast<uint8_t>(random());
+        spiFrames->append(frame, timestamp + 200000, i);
+    }
+}
+
+std::string readFile(const std::string& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    std::stringstream content;
+    content << file.rdbuf();
+    return content.str();
+}
+
+/** Every column of the reader has to hold the values of the stores */
+bool sameColumns(const kostal::CaptureFileReader& reader, const kostal::CaptureStore& capture,
+                 const kostal::SPIFrameStore& spiFrames)
+{
+    if (reader.samples() != capture.size() || reader.frames() != spiFrames.size()
+        || reader.nodeNames() != capture.nodeNames()){
+        return false;
+    }
+    auto tcp = reader.tcpPose(), flange = reader.flangePose(), force = reader.rawForce();
+    auto time = reader.timestamp();
+    auto node = reader.nodeId();
+    bool same = true;
+    for (size_t i=0; i<capture.size(); i++){
+        same &= std::memcmp(tcp[i], capture.tcpPose(i), 7 * sizeof(double)) == 0;
+        same &= std::memcmp(flange[i], capture.flangePose(i), 7 * sizeof(double)) == 0;
+        same &= std::memcmp(force[i], capture.rawForce(i), 6 * sizeof(double)) == 0;
+        same &= *time[i] == capture.timestamp(i);
+        same &= reader.nodeNames()[*node[i]] == capture.nodeName(i);
+    }
+    auto frame = reader.spiFrame();
+    auto frameTime = reader.spiTimestamp();
+    auto sequence = reader.spiSequence();
+    for (size_t i=0; i<spiFrames.size(); i++){
+        same &= std::memcmp(frame[i], spiFrames.frame(i), 16) == 0;
+        same &= *frameTime[i] == spiFrames.timestamp(i) && *sequence[i] == spiFrames.sequence(i);
+    }
+    // the columns are used in place, aligned as written
+    same &= reinterpret_cast<uintptr_t>(tcp.data) % g_captureFileAlignment == 0;
+    return same;
+}
+
+/** Files that are cut, foreign or carry a node id without a name are refused */
+bool refusesBroken(const std::string& capturePath, flexiv::Log* flexivLog)
+{
+    std::string content = readFile(capturePath);
+    std::vector<std::string> broken = {content.substr(0, content.size() / 2), content.substr(0, 40),
+                                       "KOSTALCP" + std::string(200, '\0'), std::string(500, 'x')};
+    bool refused = true;
+    for (size_t i=0; i<broken.size(); i++){
+        std::string path = g_directory + "broken" + std::to_string(i) + ".kcap";
+        std::ofstream(path, std::ios::binary) << broken[i];
+        kostal::CaptureFileReader reader;
+        refused &= reader.open(path, flexivLog) == CSV && reader.samples() == 0;
+    }
+    kostal::CaptureFileReader reader;
+    refused &= reader.open(g_directory + "missing.kcap", flexivLog) == CSV;
+    return refused;
+}
+
+/** Sum the position and force columns of the csv as the analysis scripts parse them */
+double parseCSV(const std::string& path)
+{
+    const bool summed[] = {1, 1, 1, 0, 0, 0, 1, 1, 1, 0, 0, 0, 1, 1, 1, 1, 1, 1};
+    std::ifstream file(path);
+    std::string line;
+    std::getline(file, line);
+    double sum = 0;
+    while (std::getline(file, line)){
+        const char* field = line.c_str();
+        for (bool column : summed){
+            field = std::strchr(field, ',') + 1;
+            sum += column ? std::strtod(field, nullptr) : 0;
+        }
+    }
+    return sum;
+}
+
+/** Sum the same values from the mapped columns */
+double parseCapture(const std::string& path, flexiv::Log* flexivLog)
+{
+    kostal::CaptureFileReader reader;
+    reader.open(path, flexivLog);
+    auto tcp = reader.tcpPose(), flange = reader.flangePose(), force = reader.rawForce();
+    double sum = 0;
+    for (size_t i=0; i<reader.samples(); i++){
+        for (int j=0; j<3; j++){
+            sum += tcp[i][j] + flange[i][j];
+        }
+        for (int j=0; j<6; j++){
+            sum += force[i][j];
+        }
+    }
+    return sum;
+}
+
+template <class Function>
+double seconds(Function function)
+{
+    auto start = Clock::now();
+    function();
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+/** The default writer of the exporter writes a capture file and its summary for a binary set */
+bool exportsBinary(kostal::Log* log)
+{
+    kostal::StationContext station;
+    station.stationId = 3;
+    station.spiConfig.source = "SYNTHETIC";
+    makeCapture(&station.capture, &station.spiFrames);
+    kostal::ResultExporter exporter;
+    Status exported = SYSTEM;
+    std::string resultPath;
+    exporter.exportCapture(&station, kostal::TaskRequest{"NORMAL", "Kostal-Binary"},
+        [&](const kostal::TaskRequest&, Status result, const std::string& path){
+            exported = result;
+            resultPath = path;
+        }, true);
+    exporter.wait();
+    flexiv::Log flexivLog;
+    kostal::CaptureFileReader reader;
+    bool passed = exported == SUCCESS && resultPath.size() > 5
+                  && resultPath.compare(resultPath.size() - 5, 5, ".kcap") == 0
+                  && reader.open(resultPath, &flexivLog) == SUCCESS && reader.samples() == g_samples
+                  && reader.info().stationId == 3 && reader.info().spiConfig.source == "SYNTHETIC"
+                  && reader.info().taskName == "Kostal-Binary"
+                  && std::filesystem::exists(kostal::WriteExcelHandler::summaryPath(resultPath));
+    (passed ? log->info("the exporter writes binary results, " + resultPath)
+            : log->error("the exporter did not write a binary result"));
+    return passed;
+}
+
+}
+
+int main()
+{
+    kostal::Log log;
+    flexiv::Log flexivLog;
+    std::filesystem::create_directories(g_directory + "NORMAL");
+    UPLOADADDRESS = g_directory;
+
+    kostal::CaptureStore capture;
+    kostal::SPIFrameStore spiFrames;
+    makeCapture(&capture, &spiFrames);
+    kostal::CaptureFileInfo info;
+    info.taskType = "NORMAL";
+    info.taskName = "Kostal-Columns";
+    info.stationId = 2;
+    info.spiConfig.CPOL = 1;
+
+    std::string capturePath = g_directory + "capture.kcap";
+    std::string csvPath;
+    kostal::CaptureFileWriter captureWriter;
+    kostal::WriteExcelHandler csvWriter;
+    Status written = SYSTEM, csvWritten = SYSTEM;
+    double captureWrite = seconds([&]{ written = captureWriter.write(capturePath, info, capture, spiFrames, &flexivLog); });
+    double csvWrite = seconds([&]{
+        csvWritten = csvWriter.writeDataToExcel("NORMAL", "Kostal-Columns", &capture, &spiFrames, &flexivLog, &csvPath);
+    });
+
+    kostal::CaptureFileReader reader;
+    bool passed = written == SUCCESS && csvWritten == SUCCESS && reader.open(capturePath, &flexivLog) == SUCCESS;
+    passed &= reader.info().taskType == "NORMAL" && reader.info().taskName == "Kostal-Columns"
+              && reader.info().stationId == 2 && reader.info().spiConfig.CPOL == 1;
+    bool columns = passed && sameColumns(reader, capture, spiFrames);
+    (columns ? log.info("the mapped columns hold the stored samples and frames")
+             : log.error("the mapped columns differ from the stores"));
+    reader.close();
+
+    std::string convertedPath = g_directory + "converted.csv";
+    bool converted = kostal::convertCaptureToCSV(capturePath, convertedPath, &flexivLog) == SUCCESS
+                     && readFile(convertedPath) == readFile(csvPath);
+    (converted ? log.info("the converted csv equals the written one byte by byte")
+               : log.error("the converted csv differs from the written one"));
+
+    bool refused = refusesBroken(capturePath, &flexivLog);
+    (refused ? log.info("cut and foreign files are refused") : log.error("a broken file was opened"));
+
+    double csvSum = 0, captureSum = 0;
+    double csvRead = seconds([&]{ csvSum = parseCSV(csvPath); });
+    double captureRead = seconds([&]{ captureSum = parseCapture(capturePath, &flexivLog); });
+    double captureBytes = std::filesystem::file_size(capturePath);
+    double csvBytes = std::filesystem::file_size(csvPath);
+    log.info(std::to_string(g_samples) + " samples: csv " + std::to_string(csvBytes / 1e6) + " MB, capture file "
+             + std::to_string(captureBytes / 1e6) + " MB, " + std::to_string(csvBytes / captureBytes) + " times smaller");
+    log.info("write: csv " + std::to_string(csvWrite * 1e3) + " ms, capture file " + std::to_string(captureWrite * 1e3)
+             + " ms, " + std::to_string(csvWrite / captureWrite) + " times faster");
+    log.info("read the position and force columns: csv " + std::to_string(csvRead * 1e3) + " ms, capture file "
+             + std::to_string(captureRead * 1e3) + " ms, " + std::to_string(csvRead / captureRead) + " times faster");
+    bool sameSum = std::fabs(csvSum - captureSum) <= 1e-9 * std::fabs(captureSum) + 1e-9;
+
+    passed &= columns && converted && refused && sameSum && captureBytes < csvBytes && exportsBinary(&log);
+    std::filesystem::remove_all(g_directory);
+    return passed ? 0 : 1;
+}
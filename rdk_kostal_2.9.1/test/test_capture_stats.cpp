@@ -0,0 +1,200 @@
+/**
+ * @test test_capture_stats.cpp
+ * Check the per node stats the kostal::CaptureStore keeps while a plan is
+ * captured. A plan of pseudo random samples over several nodes, one of them
+ * visited twice, is appended and the stats of every segment and of every node
+ * are compared with two passes over the stored samples. Then the size of the
+ * summary written next to the result is compared with the csv, and the cost of
+ * appending with stats is reported.
+ * @copyright Copyright (C) 2016-2022 Flexiv Ltd. All Rights Reserved.
+ * @author lcc@Flexiv
+ */
+
+// Kostal header files
+#include <kostal/KostalLogger.hpp>
+#include <kostal/WriteExcel.hpp>
+
+#include <filesystem>
+#include <random>
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+/** The nodes of the plan in order with the samples they last, Press is visited twice */
+const std::vector<std::pair<std::string, size_t>> g_plan = {
+    {"Start", 500}, {"Press", 3000}, {"Hold", 1000}, {"Press", 2000}, {"Stop", 500}};
+
+void fill(kostal::CaptureStore* store, size_t scale)
+{
+    std::mt19937 random(7);
+    std::normal_distribution<double> noise(0.0, 1.0);
+    double tcp[7] = {0.4, 0.0, 0.3, 1, 0, 0, 0};
+    double flange[7] = {0.4, 0.0, 0.4, 1, 0, 0, 0};
+    double force[6] = {};
+    int64_t timestamp = 0;
+    for (const auto& node : g_plan){
+        uint32_t id = store->internNode(node.first);
+        for (size_t i=0; i<node.second * scale; i++){
+            tcp[2] -= 1e-6;
+            flange[2] = tcp[2] + 0.1;
+            tcp[0] += 1e-5 * noise(random);
+            for (int j=0; j<6; j++){
+                force[j] = (node.first == "Press" ? 20.0 : 1.0) + noise(random);
+            }
+            timestamp += 1000000;
+            store->append(tcp, flange, force, id, timestamp);
+        }
+    }
+}
+
+/** The value of a channel of one stored sample */
+double channelValue(const kostal::CaptureStore& store, size_t row, int channel)
+{
+    if (channel < kostal::FLANGE_X){
+        return store.tcpPose(row)[channel - kostal::TCP_X];
+    }
+    if (channel < kostal::FORCE_0){
+        return store.flangePose(row)[channel - kostal::FLANGE_X];
+    }
+    const double* force = store.rawForce(row);
+    if (channel < kostal::FORCE_NORM){
+        return force[channel - kostal::FORCE_0];
+    }
+    return std::sqrt(force[0] * force[0] + force[1] * force[1] + force[2] * force[2]);
+}
+
+/** Compare the stats of some rows with two passes over them */
+bool same(const kostal::CaptureStore& store, const std::vector<size_t>& rows, const kostal::NodeStats& stats)
+{
+    if (stats.samples != rows.size()){
+        return false;
+    }
+    for (int channel=0; channel<kostal::STATS_CHANNELS; channel++){
+        double min = 1e300, max = -1e300, sum = 0;
+        for (size_t row : rows){
+            double value = channelValue(store, row, channel);
+            min = std::min(min, value);
+            max = std::max(max, value);
+            sum += value;
+        }
+        double mean = sum / rows.size();
+        double squares = 0;
+        for (size_t row : rows){
+            double value = channelValue(store, row, channel);
+            squares += (value - mean) * (value - mean);
+        }
+        double stddev = std::sqrt(squares / (rows.size() - 1));
+        const kostal::ChannelStats& channelStats = stats.channels[channel];
+        double tolerance = 1e-9 * std::max(1.0, std::fabs(mean));
+        if (channelStats.min != min || channelStats.max != max || std::fabs(channelStats.mean - mean) > tolerance
+            || std::fabs(channelStats.stddev() - stddev) > tolerance){
+            return false;
+        }
+    }
+    return true;
+}
+
+bool checkStats(const kostal::CaptureStore& store, kostal::Log* log)
+{
+    const std::vector<kostal::NodeSegment>& segments = store.segments();
+    bool passed = segments.size() == g_plan.size();
+    std::map<std::string, std::vector<size_t>> nodeRows;
+    for (size_t i=0; passed && i<segments.size(); i++){
+        size_t end = i + 1 < segments.size() ? segments[i + 1].firstSample : store.size();
+        std::vector<size_t> rows;
+        for (size_t row=segments[i].firstSample; row<end; row++){
+            rows.push_back(row);
+            nodeRows[store.segmentName(segments[i])].push_back(row);
+        }
+        passed &= same(store, rows, store.segmentStats(i));
+    }
+    Json::Value summary = store.summary();
+    for (const auto& node : nodeRows){
+        kostal::NodeStats merged;
+        for (size_t i=0; i<segments.size(); i++){
+            if (store.segmentName(segments[i]) == node.first){
+                merged.merge(store.segmentStats(i));
+            }
+        }
+        passed &= same(store, node.second, merged);
+        passed &= summary["nodes"][node.first]["samples"].asUInt64() == node.second.size();
+    }
+    passed &= summary["samples"].asUInt64() == store.size() && summary["segments"].size() == segments.size();
+    double peak = summary["nodes"]["Press"]["peak_force"].asDouble();
+    (passed ? log->info("stats of " + std::to_string(segments.size()) + " segments and " + std::to_string(nodeRows.size())
+                        + " nodes match two passes, peak force of Press " + std::to_string(peak) + " N")
+            : log->error("The stats do not match two passes over the samples"));
+    return passed;
+}
+
+bool checkSummarySize(const kostal::CaptureStore& store, kostal::Log* log)
+{
+    kostal::SPIFrameStore spiFrames;
+    uint8_t frame[16] = {};
+    for (size_t i=0; i<store.size(); i++){
+        spiFrames.append(frame, store.timestamp(i), i);
+    }
+    std::string directory = "/tmp/test_capture_stats/";
+    std::filesystem::create_directories(directory + "NORMAL");
+    std::string upload = UPLOADADDRESS;
+    UPLOADADDRESS = directory;
+    kostal::WriteExcelHandler writer;
+    flexiv::Log flexivLog;
+    std::string path;
+    Status status = writer.writeDataToExcel("NORMAL", "Kostal-Stats", &store, &spiFrames, &flexivLog, &path);
+    UPLOADADDRESS = upload;
+    bool passed = status == SUCCESS;
+    uintmax_t csvBytes = 0, summaryBytes = 0;
+    if (passed){
+        std::string summaryPath = kostal::WriteExcelHandler::summaryPath(path);
+        csvBytes = std::filesystem::file_size(path);
+        summaryBytes = std::filesystem::file_size(summaryPath);
+        std::ifstream summaryFile(summaryPath);
+        Json::Value summary;
+        Json::CharReaderBuilder builder;
+        std::string errors;
+        passed = Json::parseFromStream(builder, summaryFile, &summary, &errors)
+                 && summary["samples"].asUInt64() == store.size();
+    }
+    std::filesystem::remove_all(directory);
+    (passed ? log->info("result of " + std::to_string(store.size()) + " samples: " + std::to_string(csvBytes)
+                        + " bytes csv, " + std::to_string(summaryBytes) + " bytes summary")
+            : log->error("The summary is not written next to the result"));
+    return passed;
+}
+
+bool checkCost(kostal::Log* log)
+{
+    // a plan of 70 s
+    const size_t scale = 10;
+    kostal::CaptureStore store;
+    store.reserve(70000);
+    double best = 1e9;
+    for (int run=0; run<5; run++){
+        store.clear();
+        auto start = Clock::now();
+        fill(&store, scale);
+        best = std::min(best, std::chrono::duration<double, std::nano>(Clock::now() - start).count() / store.size());
+    }
+    auto start = Clock::now();
+    Json::Value summary = store.summary();
+    double summaryUs = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+    log->info("append with stats: " + std::to_string(best) + " ns per sample including the sample generation, summary of "
+              + std::to_string(store.size()) + " samples in " + std::to_string(summaryUs) + " us");
+    return summary["samples"].asUInt64() == store.size();
+}
+
+}
+
+int main()
+{
+    kostal::Log log;
+    kostal::CaptureStore store;
+    store.reserve(7000);
+    fill(&store, 1);
+    bool passed = checkStats(store, &log);
+    passed &= checkSummarySize(store, &log);
+    passed &= checkCost(&log);
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,228 @@
+/**
+ * @test test_capture_store.cpp
+ * Benchmark the kostal::CaptureStore and kostal::SPIFrameStore against the
+ * std::list<RobotData> and std::list<SPIData> pair the collectors used to
+ * fill. Both take the samples of a 60 s plan at 1 kHz, one spi frame per
+ * robot sample, then walk them once as the csv writer does. Heap allocations and bytes are counted by
+ * replacing the global operator new. Fails if appending to a reserved store
+ * allocates or a sample reads back different from what was stored.
+ * @copyright Copyright (C) 2016-2022 Flexiv Ltd. All Rights Reserved.
+ * @author lcc@Flexiv
+ */
+
+// Kostal header files
+#include <kostal/KostalLogger.hpp>
+#include <kostal/KostalStates.hpp>
+#include <kostal/CaptureStore.hpp>
+
+#include <new>
+
+namespace {
+
+std::atomic<size_t> g_allocations = {0};
+std::atomic<size_t> g_allocatedBytes = {0};
+
+/** Samples of one plan */
+const size_t g_sampleCount = g_expectedPlanSeconds * 1000 / g_samplingInterval;
+
+/** A node name as long as the ones of the production plans */
+const std::string g_nodeName = "Kostal-MainPlan-MoveL-Node12";
+
+typedef std::chrono::steady_clock Clock;
+
+struct Measurement
+{
+    double allocationsPerSample;
+    double bytesPerSample;
+    double appendNs;
+    double walkNs;
+};
+
+/** The robot states as the rdk hands them over */
+struct States
+{
+    std::vector<double> tcpPose = std::vector<double>(7);
+    std::vector<double> flangePose = std::vector<double>(7);
+    std::vector<double> rawForce = std::vector<double>(6);
+
+    void update(size_t i)
+    {
+        for (size_t j=0; j<7; j++){
+            tcpPose[j] = i + j * 0.1;
+            flangePose[j] = i - j * 0.1;
+        }
+        for (size_t j=0; j<6; j++){
+            rawForce[j] = i * 0.5 + j;
+        }
+    }
+};
+
+Measurement measureLists()
+{
+    States states;
+    kostal::RobotData robotData;
+    kostal::SPIData spiData;
+    std::list<kostal::RobotData> robotDataList;
+    std::list<kostal::SPIData> spiDataList;
+    double appendNs = 0;
+    size_t allocations = g_allocations;
+    size_t bytes = g_allocatedBytes;
+    for (size_t i=0; i<g_sampleCount; i++){
+        states.update(i);
+        spiData.SPISensor[0] = static_cast<uint8_t>(i);
+        auto tic = Clock::now();
+        robotData.nodeName = g_nodeName;
+        robotData.tcpPose = states.tcpPose;
+        robotData.rawDataForceSensor = states.rawForce;
+        robotData.flangePose = states.flangePose;
+        robotDataList.push_back(robotData);
+        spiDataList.push_back(spiData);
+        appendNs += std::chrono::duration<double, std::nano>(Clock::now() - tic).count();
+    }
+    Measurement result;
+    result.allocationsPerSample = static_cast<double>(g_allocations - allocations) / g_sampleCount;
+    result.bytesPerSample = static_cast<double>(g_allocatedBytes - bytes) / g_sampleCount;
+    result.appendNs = appendNs / g_sampleCount;
+
+    double sum = 0;
+    auto tic = Clock::now();
+    while (robotDataList.size() > 0){
+        const kostal::RobotData& robotDataRow = robotDataList.front();
+        sum += robotDataRow.tcpPose[0] + robotDataRow.flangePose[3] + robotDataRow.rawDataForceSensor[5]
+               + robotDataRow.nodeName.size() + spiDataList.front().SPISensor[0];
+        robotDataList.pop_front();
+        spiDataList.pop_front();
+    }
+    result.walkNs = std::chrono::duration<double, std::nano>(Clock::now() - tic).count() / g_sampleCount;
+    volatile double sink = sum;
+    (void)sink;
+    return result;
+}
+
+Measurement measureStore(kostal::CaptureStore* store, kostal::SPIFrameStore* spiFrames, bool* correct)
+{
+    States states;
+    kostal::SPIData spiData;
+    double appendNs = 0;
+    // the chunks reserved for the plan are what the samples take
+    size_t bytes = g_allocatedBytes;
+    store->reserve(g_sampleCount);
+    spiFrames->reserve(g_sampleCount);
+    size_t allocations = g_allocations;
+    for (size_t i=0; i<g_sampleCount; i++){
+        states.update(i);
+        spiData.SPISensor[0] = static_cast<uint8_t>(i);
+        auto tic = Clock::now();
+        store->append(states.tcpPose.data(), states.flangePose.data(), states.rawForce.data(),
+                      store->internNode(g_nodeName), static_cast<int64_t>(i));
+        spiFrames->append(spiData.SPISensor, static_cast<int64_t>(i), i);
+        appendNs += std::chrono::duration<double, std::nano>(Clock::now() - tic).count();
+    }
+    Measurement result;
+    result.allocationsPerSample = static_cast<double>(g_allocations - allocations) / g_sampleCount;
+    result.bytesPerSample = static_cast<double>(g_allocatedBytes - bytes) / g_sampleCount;
+    result.appendNs = appendNs / g_sampleCount;
+
+    double sum = 0;
+    auto tic = Clock::now();
+    for (size_t row=0; row<store->size(); row++){
+        sum += store->tcpPose(row)[0] + store->flangePose(row)[3] + store->rawForce(row)[5]
+               + store->nodeName(row).size() + spiFrames->frame(row)[0];
+    }
+    result.walkNs = std::chrono::duration<double, std::nano>(Clock::now() - tic).count() / g_sampleCount;
+    volatile double sink = sum;
+    (void)sink;
+
+    for (size_t row=0; *correct && row<store->size(); row+=997){
+        states.update(row);
+        *correct = store->size() == g_sampleCount
+                   && std::equal(states.tcpPose.begin(), states.tcpPose.end(), store->tcpPose(row))
+                   && std::equal(states.flangePose.begin(), states.flangePose.end(), store->flangePose(row))
+                   && std::equal(states.rawForce.begin(), states.rawForce.end(), store->rawForce(row))
+                   && spiFrames->frame(row)[0] == static_cast<uint8_t>(row)
+                   && store->nodeName(row) == g_nodeName
+                   && store->timestamp(row) == static_cast<int64_t>(row);
+    }
+    return result;
+}
+
+std::string describe(const Measurement& m)
+{
+    return std::to_string(m.allocationsPerSample) + " allocations and "
+           + std::to_string(static_cast<int>(m.bytesPerSample)) + " bytes per sample, append "
+           + std::to_string(static_cast<int>(m.appendNs)) + " ns, walk "
+           + std::to_string(static_cast<int>(m.walkNs)) + " ns";
+}
+
+}
+
+// the replacements pair malloc with free, GCC sees new matched with free once they are inlined
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+void* operator new(std::size_t size)
+{
+    g_allocations++;
+    g_allocatedBytes += size;
+    if (void* p = std::malloc(size)){
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+#pragma GCC diagnostic pop
+
+int main()
+{
+    kostal::Log log;
+    bool passed = true;
+
+    Measurement lists = measureLists();
+    log.info("std::list pair:  " + describe(lists));
+
+    kostal::CaptureStore store;
+    kostal::SPIFrameStore spiFrames;
+    bool correct = true;
+    Measurement first = measureStore(&store, &spiFrames, &correct);
+    log.info("capture store:   " + describe(first));
+
+    // the next plan reuses the chunks of the store
+    store.clear();
+    spiFrames.clear();
+    size_t allocations = g_allocations;
+    Measurement reused = measureStore(&store, &spiFrames, &correct);
+    log.info("reused store:    " + describe(reused) + ", "
+             + std::to_string(g_allocations - allocations) + " allocations in total");
+
+    // a plan longer than expected grows the store one chunk at a time
+    allocations = g_allocations;
+    const double pose[7] = {0};
+    for (size_t i=0; i<g_captureChunkSamples * 3; i++){
+        store.append(pose, pose, pose, 0, 0);
+    }
+    size_t growth = g_allocations - allocations;
+    log.info("a plan " + std::to_string(g_captureChunkSamples * 3) + " samples longer grows with "
+             + std::to_string(growth) + " chunk allocations");
+
+    // a new store copies the node name once, growing also resizes the chunk index
+    size_t firstAllocations = static_cast<size_t>(first.allocationsPerSample * g_sampleCount + 0.5);
+    if (firstAllocations > 2 || reused.allocationsPerSample != 0 || growth > 4){
+        log.error("Appending to a reserved capture store allocated");
+        passed = false;
+    }
+    if (!correct){
+        log.error("The capture store returned other samples than it was given");
+        passed = false;
+    }
+    return passed ? 0 : 1;
+}
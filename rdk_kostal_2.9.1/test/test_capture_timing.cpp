@@ -0,0 +1,95 @@
+/**
+ * @test test_capture_timing.cpp
+ * Compare the sampling rate of the old sleep_for(1ms) collector loop with a
+ * 1 ms flexiv::Scheduler task. Every cycle spins for the time getPlanInfo,
+ * getRobotStates and the station mutex take, and a kostal::PeriodMonitor
+ * records the achieved period, jitter and missed cycles. The missed-cycle
+ * accounting of the monitor is checked with fixed timestamps first.
+ * @copyright Copyright (C) 2016-2022 Flexiv Ltd. All Rights Reserved.
+ * @author lcc@Flexiv
+ */
+
+// Kostal header files
+#include <kostal/KostalLogger.hpp>
+#include <kostal/PeriodMonitor.hpp>
+
+namespace {
+
+/** Cycles measured for every collector */
+const int g_cycleCount = 3000;
+
+/** Time one sample spends in the rdk and on the station mutex */
+const std::chrono::microseconds g_sampleWork(250);
+
+typedef kostal::PeriodMonitor::Clock Clock;
+
+void sampleWork()
+{
+    auto end = Clock::now() + g_sampleWork;
+    while (Clock::now() < end){
+    }
+}
+
+bool checkAccounting(kostal::Log* log)
+{
+    kostal::PeriodMonitor monitor(1);
+    Clock::time_point start;
+    // cycles at 0, 1, 2, 5 and 6 ms, the ones at 3 and 4 ms are missed
+    for (int ms : {0, 1, 2, 5, 6}){
+        monitor.tick(start + std::chrono::milliseconds(ms));
+    }
+    bool passed = monitor.periods() == 4 && monitor.missed() == 2
+                  && monitor.meanPeriod() == 1500 && monitor.maxPeriod() == 3000 && monitor.minPeriod() == 1000;
+    (passed ? log->info("Missed cycles are counted from the measured periods")
+            : log->error("Wrong period accounting: " + monitor.summary("Synthetic")));
+    return passed;
+}
+
+kostal::PeriodMonitor sleepLoop()
+{
+    kostal::PeriodMonitor monitor(1);
+    for (int i=0; i<g_cycleCount; i++){
+        monitor.tick();
+        sampleWork();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return monitor;
+}
+
+kostal::PeriodMonitor schedulerTask()
+{
+    kostal::PeriodMonitor monitor(1);
+    int cycles = 0;
+    flexiv::Scheduler scheduler;
+    scheduler.addTask([&]{
+        monitor.tick();
+        sampleWork();
+        if (++cycles >= g_cycleCount){
+            scheduler.stop();
+        }
+    }, "Sampling", 1, 45);
+    scheduler.start();
+    return monitor;
+}
+
+}
+
+int main()
+{
+    kostal::Log log;
+    bool passed = checkAccounting(&log);
+    try {
+        kostal::PeriodMonitor loop = sleepLoop();
+        kostal::PeriodMonitor scheduled = schedulerTask();
+        log.info(loop.summary("sleep_for loop"));
+        log.info(scheduled.summary("scheduler task"));
+        if (std::abs(scheduled.meanPeriod() - 1000) > 50){
+            log.error("The scheduler task does not run at 1 kHz");
+            passed = false;
+        }
+    } catch (const flexiv::Exception& e) {
+        log.error(e.what());
+        passed = false;
+    }
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,281 @@
+/**
+ * @test test_csv_formatter.cpp
+ * Check the rows kostal::ResultRowWriter formats with kostal::CSVFormatter.
+ * A small capture is written and compared byte by byte with the golden rows
+ * below, the doubles of a capture of random values have to read back to the
+ * stored values exactly, and the rows of a long capture are timed against
+ * the iostream formatting the result files were written with before, in its
+ * default 6 digits and in round trip precision, extrapolated to a capture of
+ * one hour at 1 kHz. The rows are dropped instead of written to a disk.
+ * @copyright Copyright (C) 2016-2022 Flexiv Ltd. All Rights Reserved.
+ * @author lcc@Flexiv
+ */
+
+// Kostal header files
+#include <kostal/KostalLogger.hpp>
+#include <kostal/WriteExcel.hpp>
+
+#include <random>
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+/** The rows of the golden capture, see goldenCapture() */
+const std::string g_goldenRows =
+    "Start,0.1,-0.25,0.3333333333333333,0,-0,0,0.1,-0.25,0.43333333333333335,0,-0,0,"
+    "1e-07,-2.5,12.000000000000002,0,0,-1234.5678,00,01,02,03,04,05,06,07,08,09,0a,0b,0c,0d,0e,ff,0,100,0,\n"
+    ",0.1,-0.25,0.33333233333333334,1.5707963267948968,-0,0,0.1,-0.25,0.4333323333333334,1.5707963267948968,-0,0,"
+    "1e-07,-2.5,12.000000000000002,0,0,-1234.5678,01,01,02,03,04,05,06,07,08,09,0a,0b,0c,0d,0e,ff,1000,100,1,\n"
+    "Press,0.1,-0.25,0.33333133333333337,0,-0,0,0.1,-0.25,0.4333313333333334,0,-0,0,"
+    "1e-07,-2.5,12.000000000000002,0,0,-1234.5678,,,,,,,,,,,,,,,,,5000,,,\n";
+
+void goldenCapture(kostal::CaptureStore* capture, kostal::SPIFrameStore* spiFrames)
+{
+    const double half = std::sqrt(0.5);
+    double pose[7] = {0.1, -0.25, 1.0 / 3, 1, 0, 0, 0};
+    double flange[7] = {0.1, -0.25, 1.0 / 3 + 0.1, 1, 0, 0, 0};
+    double force[6] = {1e-7, -2.5, 12.000000000000002, 0, 0, -1234.5678};
+    uint8_t frame[16];
+    for (int i=0; i<16; i++){
+        frame[i] = static_cast<uint8_t>(i);
+    }
+    frame[15] = 0xff;
+    const int64_t ms = 1000000;
+    capture->append(pose, flange, force, capture->internNode("Start"), 10 * ms);
+    spiFrames->append(frame, 10 * ms + 100000, 0);
+    // a quarter turn about z in the second row
+    pose[2] -= 1e-6;
+    flange[2] -= 1e-6;
+    pose[3] = flange[3] = half;
+    pose[6] = flange[6] = half;
+    frame[0] = 1;
+    capture->append(pose, flange, force, capture->internNode("Start"), 11 * ms);
+    spiFrames->append(frame, 11 * ms + 100000, 1);
+    // far from any frame, the spi columns stay empty
+    pose[2] -= 1e-6;
+    flange[2] -= 1e-6;
+    pose[3] = flange[3] = 1;
+    pose[6] = flange[6] = 0;
+    capture->append(pose, flange, force, capture->internNode("Press"), 15 * ms);
+}
+
+bool checkGolden(kostal::Log* log)
+{
+    kostal::CaptureStore capture;
+    kostal::SPIFrameStore spiFrames;
+    goldenCapture(&capture, &spiFrames);
+    std::ostringstream rows;
+    kostal::ResultRowWriter writer(capture, spiFrames);
+    writer.writeRows(rows, capture.size());
+    if (rows.str() != g_goldenRows){
+        log->error("The rows differ from the golden rows:\n" + rows.str());
+        return false;
+    }
+    log->info("golden rows match byte by byte");
+    return true;
+}
+
+/** Fill a capture with random values of every magnitude and random quaternions */
+void randomCapture(size_t samples, kostal::CaptureStore* capture, kostal::SPIFrameStore* spiFrames)
+{
+    std::mt19937_64 random(19);
+    std::uniform_real_distribution<double> mantissa(-1.0, 1.0);
+    std::uniform_int_distribution<int> exponent(-12, 6);
+    std::normal_distribution<double> normal(0.0, 1.0);
+    capture->reserve(samples);
+    spiFrames->reserve(samples);
+    uint32_t node = capture->internNode("Kostal-MainPlan-MoveL-Node12");
+    uint8_t frame[16] = {};
+    for (size_t i=0; i<samples; i++){
+        double tcp[7], flange[7], force[6];
+        for (int j=0; j<3; j++){
+            tcp[j] = std::ldexp(mantissa(random), exponent(random));
+            flange[j] = std::ldexp(mantissa(random), exponent(random));
+        }
+        for (double* pose : {tcp, flange}){
+            double norm = 0;
+            for (int j=3; j<7; j++){
+                pose[j] = normal(random);
+                norm += pose[j] * pose[j];
+            }
+            for (int j=3; j<7; j++){
+                pose[j] /= std::sqrt(norm);
+            }
+        }
+        for (int j=0; j<6; j++){
+            force[j] = std::ldexp(mantissa(random), exponent(random));
+        }
+        int64_t timestamp = static_cast<int64_t>(i) * 1000000;
+        capture->append(tcp, flange, force, node, timestamp);
+        frame[i % 16] = static_cast<uint8_t>(random());
+        spiFrames->append(frame, timestamp + 200000, i);
+    }
+}
+
+/** Every double written for the position and force columns has to read back to the stored value */
+bool checkRoundTrip(kostal::Log* log)
+{
+    kostal::CaptureStore capture;
+    kostal::SPIFrameStore spiFrames;
+    randomCapture(20000, &capture, &spiFrames);
+    std::ostringstream rows;
+    kostal::ResultRowWriter writer(capture, spiFrames);
+    writer.writeRows(rows, capture.size());
+    std::istringstream lines(rows.str());
+    std::string line;
+    const int columns[] = {1, 2, 3, 7, 8, 9, 13, 14, 15, 16, 17, 18};
+    size_t row = 0, mismatches = 0;
+    while (std::getline(lines, line)){
+        std::vector<std::string> fields;
+        std::stringstream fieldStream(line);
+        std::string field;
+        while (std::getline(fieldStream, field, ',')){
+            fields.push_back(field);
+        }
+        double stored[12];
+        std::copy(capture.tcpPose(row), capture.tcpPose(row) + 3, stored);
+        std::copy(capture.flangePose(row), capture.flangePose(row) + 3, stored + 3);
+        std::copy(capture.rawForce(row), capture.rawForce(row) + 6, stored + 6);
+        for (int i=0; i<12; i++){
+            mismatches += std::strtod(fields[columns[i]].c_str(), nullptr) != stored[i];
+        }
+        row++;
+    }
+    bool passed = row == capture.size() && mismatches == 0;
+    (passed ? log->info("all doubles of " + std::to_string(row) + " rows read back exactly")
+            : log->error(std::to_string(mismatches) + " doubles do not read back, " + std::to_string(row) + " rows"));
+    return passed;
+}
+
+/** The rows as they were formatted before with iostream, in 6 digits unless another precision is given */
+void writeRowsBefore(std::ostream& excelFile, const kostal::CaptureStore& capture, const kostal::SPIFrameStore& spiFrames,
+                     int precision)
+{
+    excelFile << std::setprecision(precision);
+    kostal::SPIAligner aligner(spiFrames);
+    int64_t startTime = capture.timestamp(0);
+    for (size_t row = 0; row < capture.size(); row++){
+        const double* tcpPose = capture.tcpPose(row);
+        const double* flangePose = capture.flangePose(row);
+        const double* rawForce = capture.rawForce(row);
+        int64_t sampleTime = capture.timestamp(row);
+        size_t frame = 0;
+        bool aligned = aligner.align(sampleTime, &frame);
+        excelFile << (row == 0 ? capture.nodeName(row) : "") << ",";
+        excelFile << tcpPose[0] << "," << tcpPose[1] << "," << tcpPose[2] << ",";
+        auto eulerTcp = kostal::quaternionToEuler(tcpPose + 3);
+        excelFile << eulerTcp[0] << "," << eulerTcp[1] << "," << eulerTcp[2] << ",";
+        excelFile << flangePose[0] << "," << flangePose[1] << "," << flangePose[2] << ",";
+        auto eulerFlange = kostal::quaternionToEuler(flangePose + 3);
+        excelFile << eulerFlange[0] << "," << eulerFlange[1] << "," << eulerFlange[2] << ",";
+        for (int i=0; i<6; i++){
+            excelFile << rawForce[i] << ",";
+        }
+        for (int i = 0; i < 16; i++){
+            if (aligned){
+                excelFile << std::setfill('0') << std::setw(2) << std::right << std::hex;
+                excelFile << + spiFrames.frame(frame)[i];
+            }
+            excelFile << ",";
+        }
+        excelFile << std::dec << (sampleTime - startTime) / 1000 << ",";
+        if (aligned){
+            excelFile << (spiFrames.timestamp(frame) - sampleTime) / 1000 << ",";
+            excelFile << spiFrames.sequence(frame) << ",";
+        }else{
+            excelFile << ",,";
+        }
+        excelFile << std::endl;
+    }
+}
+
+/** A stream that counts the characters and drops them, so the disk is not timed */
+class CountingBuffer : public std::streambuf
+{
+public:
+    size_t count = 0;
+
+protected:
+    int_type overflow(int_type c) override
+    {
+        count++;
+        return c;
+    }
+    std::streamsize xsputn(const char*, std::streamsize n) override
+    {
+        count += n;
+        return n;
+    }
+};
+
+/** The best of three runs of writing the rows of a capture into out [s] */
+template <class WriteRows>
+double timeRows(std::ostream& out, WriteRows write)
+{
+    double best = 1e9;
+    for (int run=0; run<3; run++){
+        auto start = Clock::now();
+        write(out);
+        out.flush();
+        best = std::min(best, std::chrono::duration<double>(Clock::now() - start).count());
+    }
+    return best;
+}
+
+/** Time iostream in 6 digits as before, iostream in round trip precision and the CSVFormatter */
+std::array<double, 3> timeFormatters(const kostal::CaptureStore& capture, const kostal::SPIFrameStore& spiFrames,
+                                     std::ostream& out)
+{
+    const int roundTrip = std::numeric_limits<double>::max_digits10;
+    return {timeRows(out, [&](std::ostream& stream){ writeRowsBefore(stream, capture, spiFrames, 6); }),
+            timeRows(out, [&](std::ostream& stream){ writeRowsBefore(stream, capture, spiFrames, roundTrip); }),
+            timeRows(out, [&](std::ostream& stream){
+                kostal::ResultRowWriter writer(capture, spiFrames);
+                writer.writeRows(stream, capture.size());
+            })};
+}
+
+std::string report(const std::array<double, 3>& seconds, size_t samples)
+{
+    const double hourRows = 3600.0 * 1000 / g_samplingInterval;
+    const char* names[] = {"iostream ", "iostream round trip ", "CSVFormatter "};
+    std::string line;
+    for (int i=0; i<3; i++){
+        line += std::string(i > 0 ? ", " : "") + names[i] + std::to_string(static_cast<int>(seconds[i] / samples * 1e9))
+                + " ns/row " + std::to_string(seconds[i] / samples * hourRows) + " s/hour";
+    }
+    return line + ", " + std::to_string(seconds[0] / seconds[2]) + " and " + std::to_string(seconds[1] / seconds[2])
+           + " times faster";
+}
+
+bool checkSpeed(kostal::Log* log)
+{
+    const size_t samples = 200000;
+    kostal::CaptureStore capture;
+    kostal::SPIFrameStore spiFrames;
+    randomCapture(samples, &capture, &spiFrames);
+
+    // formatting only, the characters are dropped
+    CountingBuffer counter;
+    std::ostream out(&counter);
+    auto memory = timeFormatters(capture, spiFrames, out);
+    log->info(report(memory, samples));
+
+    bool passed = memory[2] < memory[0] && memory[2] < memory[1];
+    if (!passed){
+        log->error("The formatter is not faster than iostream");
+    }
+    return passed;
+}
+
+}
+
+int main()
+{
+    kostal::Log log;
+    bool passed = checkGolden(&log);
+    passed &= checkRoundTrip(&log);
+    passed &= checkSpeed(&log);
+    return passed ? 0 : 1;
+}
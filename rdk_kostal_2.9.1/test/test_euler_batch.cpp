@@ -0,0 +1,159 @@
+/**
+ * @test test_euler_batch.cpp
+ * Check kostal::quaternionsToEuler against kostal::quaternionToEuler, which
+ * goes through Eigen's rotation matrix and eulerAngles(2, 1, 0). Random unit
+ * and unnormalized quaternions and the corner cases of the convention, turns
+ * of 0, pi/2 and pi about each axis, gimbal lock and signed zeros, have to give
+ * the same angles within 1e-12 in every lane width the build has. Then the
+ * throughput of both is compared on a column laid out like a capture chunk.
+ * @copyright Copyright (C) 2016-2022 Flexiv Ltd. All Rights Reserved.
+ * @author lcc@Flexiv
+ */
+
+// Kostal header files
+#include <kostal/KostalLogger.hpp>
+#include <kostal/WriteExcel.hpp>
+#include <kostal/EulerBatch.hpp>
+
+#include <random>
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+/** Doubles from one quaternion to the next, a pose of the capture store */
+const size_t g_stride = 7;
+
+std::vector<double> makeQuaternions(size_t randomCount)
+{
+    std::vector<std::array<double, 4>> quaternions;
+    const double h = std::sqrt(0.5);
+    // 0, pi/2 and pi about each axis, both signs of w
+    for (double w : {1.0, h, 0.0, -h, -1.0, -0.0}){
+        double v = std::sqrt(std::max(0.0, 1 - w * w));
+        quaternions.push_back({w, v, 0, 0});
+        quaternions.push_back({w, 0, v, 0});
+        quaternions.push_back({w, 0, 0, v});
+        quaternions.push_back({w, -v, 0, 0});
+        quaternions.push_back({w, 0, -v, 0});
+        quaternions.push_back({w, 0, 0, -v});
+    }
+    // pitch of +-pi/2 with roll and yaw, the first column of the matrix vanishes
+    for (double angle : {0.0, 0.3, 1.0, -2.0, 3.0}){
+        for (double sign : {1.0, -1.0}){
+            double c = std::cos(angle / 2), s = std::sin(angle / 2);
+            quaternions.push_back({h * c, h * s * sign, h * c * sign, h * s});
+            quaternions.push_back({h * c, -h * s, h * c * sign, -h * s * sign});
+        }
+    }
+    quaternions.push_back({-0.0, -0.0, -0.0, 1});
+    quaternions.push_back({0.5, 0.5, 0.5, 0.5});
+    quaternions.push_back({0.5, -0.5, 0.5, -0.5});
+    std::mt19937_64 random(20);
+    std::normal_distribution<double> normal(0.0, 1.0);
+    std::uniform_real_distribution<double> scale(0.9, 1.1);
+    for (size_t i=0; i<randomCount; i++){
+        std::array<double, 4> q;
+        double norm = 0;
+        for (double& v : q){
+            v = normal(random);
+            norm += v * v;
+        }
+        // every fourth one is a little off unit length, as a sensor quaternion can be
+        double length = std::sqrt(norm) * (i % 4 == 0 ? scale(random) : 1.0);
+        for (double& v : q){
+            v /= length;
+        }
+        quaternions.push_back(q);
+    }
+    std::vector<double> poses(quaternions.size() * g_stride);
+    for (size_t i=0; i<quaternions.size(); i++){
+        std::copy(quaternions[i].begin(), quaternions[i].end(), poses.begin() + i * g_stride + 3);
+    }
+    return poses;
+}
+
+/** The largest difference of any angle of the kernel L to the Eigen path */
+template <class L>
+double maxDifference(const std::vector<double>& poses, size_t* worst)
+{
+    size_t count = poses.size() / g_stride;
+    std::vector<double> euler(count * 3 + 3 * L::width);
+    size_t i = 0;
+    for (; i + L::width <= count; i += L::width){
+        kostal::euler_lanes::convert<L>(poses.data() + i * g_stride + 3, g_stride, euler.data() + 3 * i);
+    }
+    for (; i < count; i++){
+        kostal::euler_lanes::convert<kostal::euler_lanes::Scalar>(poses.data() + i * g_stride + 3, g_stride, euler.data() + 3 * i);
+    }
+    double largest = 0;
+    for (i=0; i<count; i++){
+        auto expected = kostal::quaternionToEuler(poses.data() + i * g_stride + 3);
+        for (int j=0; j<3; j++){
+            double difference = std::fabs(euler[3 * i + j] - expected[j]);
+            if (!(difference <= largest)){
+                largest = difference;
+                *worst = i;
+            }
+        }
+    }
+    return largest;
+}
+
+template <class L>
+bool checkLanes(const std::string& name, const std::vector<double>& poses, kostal::Log* log)
+{
+    size_t worst = 0;
+    double difference = maxDifference<L>(poses, &worst);
+    bool passed = difference <= 1e-12;
+    std::ostringstream line;
+    line << name << " lanes: largest difference " << difference << " rad over " << poses.size() / g_stride
+         << " quaternions";
+    if (!passed){
+        const double* q = poses.data() + worst * g_stride + 3;
+        line << " at " << q[0] << " " << q[1] << " " << q[2] << " " << q[3];
+    }
+    (passed ? log->info(line.str()) : log->error(line.str()));
+    return passed;
+}
+
+bool checkSpeed(kostal::Log* log)
+{
+    std::vector<double> poses = makeQuaternions(1 << 20);
+    size_t count = poses.size() / g_stride;
+    std::vector<double> euler(count * 3);
+    double perRow = 1e9, batch = 1e9, sink = 0;
+    for (int run=0; run<3; run++){
+        auto start = Clock::now();
+        for (size_t i=0; i<count; i++){
+            auto angles = kostal::quaternionToEuler(poses.data() + i * g_stride + 3);
+            sink += angles[0];
+        }
+        perRow = std::min(perRow, std::chrono::duration<double, std::nano>(Clock::now() - start).count() / count);
+        start = Clock::now();
+        kostal::quaternionsToEuler(poses.data() + 3, g_stride, count, euler.data());
+        batch = std::min(batch, std::chrono::duration<double, std::nano>(Clock::now() - start).count() / count);
+        sink += euler[0];
+    }
+    log->info("per row " + std::to_string(perRow) + " ns, batch of " + std::to_string(kostal::euler_lanes::Widest::width)
+              + " lanes " + std::to_string(batch) + " ns per quaternion, " + std::to_string(perRow / batch)
+              + " times faster" + (sink == 0.5 ? " " : ""));
+    return batch < perRow;
+}
+
+}
+
+int main()
+{
+    kostal::Log log;
+    std::vector<double> poses = makeQuaternions(200000);
+    bool passed = checkLanes<kostal::euler_lanes::Scalar>("scalar", poses, &log);
+#if defined(__SSE2__)
+    passed &= checkLanes<kostal::euler_lanes::SSE2>("SSE2", poses, &log);
+#endif
+#if defined(__AVX__)
+    passed &= checkLanes<kostal::euler_lanes::AVX>("AVX", poses, &log);
+#endif
+    passed &= checkSpeed(&log);
+    return passed ? 0 : 1;
+}
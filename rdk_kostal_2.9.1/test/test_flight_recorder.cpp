@@ -0,0 +1,267 @@
+/**
+ * @test test_flight_recorder.cpp
+ * Check the kostal::FlightRecorder of a station and what it costs:
+ * - Its rings keep the last seconds and drop the oldest entries, a reader that
+ *   copies while the producer records at full speed never sees a torn or
+ *   out of order sample.
+ * - A station records a kostal::SimulatedRobot between plans with the idle
+ *   recorder and in the plan with its sampling task. The plan faults the robot
+ *   at the Press node, the dump has to be a capture file that holds the
+ *   samples before and in the plan up to the fault with their nodes, the spi frames, and the
+ *   events up to the fault in the json next to it.
+ * - Recording one sample and one spi frame per ms has to take less than 1% of
+ *   a core, measured on the recording thread, and so does the idle recorder
+ *   polling the robot between plans.
+ * @copyright Copyright (C) 2016-2022 Flexiv Ltd. All Rights Reserved.
+ * @author lcc@Flexiv
+ */
+
+// Kostal header files
+#include <kostal/KostalLogger.hpp>
+#include <kostal/SimulatedRobot.hpp>
+#include <kostal/SyncTask.hpp>
+#include <kostal/FlightRecorder.hpp>
+
+#include <filesystem>
+#include <time.h>
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+const std::string g_directory = "/tmp/test_flight_recorder/";
+
+const std::string g_planName = "Kostal-MainPlan-NORMAL";
+
+/** A snapshot whose every field follows from its number, a torn copy does not */
+kostal::RobotSnapshot makeSnapshot(uint64_t i)
+{
+    kostal::RobotSnapshot snapshot;
+    snapshot.version = i;
+    snapshot.timestamp = static_cast<int64_t>(i) * 1000000;
+    for (size_t j=0; j<7; j++){
+        snapshot.tcpPose[j] = i + j * 0.1;
+        snapshot.flangePose[j] = i + j * 0.2;
+    }
+    for (size_t j=0; j<6; j++){
+        snapshot.rawExtForceInTcpFrame[j] = i + j * 0.3;
+    }
+    std::snprintf(snapshot.nodeName, sizeof(snapshot.nodeName), "Node%d", static_cast<int>(i / 1000 % 5));
+    return snapshot;
+}
+
+kostal::SPIFrame makeFrame(uint64_t i)
+{
+    kostal::SPIFrame frame;
+    std::memset(frame.data, static_cast<int>(i & 0xff), sizeof(frame.data));
+    frame.sequence = i;
+    frame.timestamp = static_cast<int64_t>(i) * 1000000 + 300000;
+    return frame;
+}
+
+bool sampleIsWhole(const kostal::FlightSample& sample, uint64_t i)
+{
+    bool whole = sample.timestamp == static_cast<int64_t>(i) * 1000000;
+    for (size_t j=0; j<7; j++){
+        whole &= sample.tcpPose[j] == i + j * 0.1 && sample.flangePose[j] == i + j * 0.2;
+    }
+    for (size_t j=0; j<6; j++){
+        whole &= sample.rawForce[j] == i + j * 0.3;
+    }
+    return whole;
+}
+
+double threadSeconds()
+{
+    timespec time;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+/** The rings keep the newest entries, the nodes keep their names */
+bool keepsLastSeconds(kostal::Log* log)
+{
+    kostal::FlightRecorder recorder;
+    recorder.configure(2);
+    for (uint64_t i=0; i<5000; i++){
+        recorder.record(makeSnapshot(i));
+        recorder.record(makeFrame(i));
+    }
+    kostal::CaptureStore capture;
+    kostal::SPIFrameStore spiFrames;
+    recorder.snapshot(&capture, &spiFrames);
+    // two seconds round up to 2048 entries, a copy leaves out the slot written next
+    bool passed = capture.size() == 2047 && spiFrames.size() == 2047;
+    for (size_t row=0; passed && row<capture.size(); row++){
+        uint64_t i = 5000 - 2047 + row;
+        kostal::RobotSnapshot expected = makeSnapshot(i);
+        passed &= capture.timestamp(row) == expected.timestamp && capture.tcpPose(row)[6] == expected.tcpPose[6]
+                  && capture.nodeName(row) == expected.node() && spiFrames.sequence(row) == i;
+    }
+    (passed ? log->info("the rings keep the last " + std::to_string(capture.size()) + " samples and frames")
+            : log->error("the rings lost or reordered entries"));
+    return passed;
+}
+
+/** Copies taken while the producer records are whole and in order */
+bool copiesWhileRecording(kostal::Log* log)
+{
+    kostal::FlightRing<kostal::FlightSample> ring;
+    ring.resize(1024);
+    std::atomic<bool> stop = {false};
+    std::thread producer([&]{
+        for (uint64_t i=0; !stop; i++){
+            kostal::RobotSnapshot snapshot = makeSnapshot(i);
+            kostal::FlightSample sample;
+            sample.timestamp = snapshot.timestamp;
+            std::memcpy(sample.tcpPose, snapshot.tcpPose.data(), sizeof(sample.tcpPose));
+            std::memcpy(sample.flangePose, snapshot.flangePose.data(), sizeof(sample.flangePose));
+            std::memcpy(sample.rawForce, snapshot.rawExtForceInTcpFrame.data(), sizeof(sample.rawForce));
+            ring.push(sample);
+        }
+    });
+    std::vector<kostal::FlightSample> copied;
+    size_t copies = 0, torn = 0;
+    auto end = Clock::now() + std::chrono::milliseconds(500);
+    while (Clock::now() < end){
+        ring.copy(&copied);
+        if (copied.empty()){
+            continue;
+        }
+        uint64_t first = static_cast<uint64_t>(copied.front().timestamp / 1000000);
+        for (size_t k=0; k<copied.size(); k++){
+            torn += sampleIsWhole(copied[k], first + k) ? 0 : 1;
+        }
+        copies++;
+    }
+    stop = true;
+    producer.join();
+    bool passed = copies > 0 && torn == 0;
+    (passed ? log->info(std::to_string(copies) + " copies taken while recording, none torn")
+            : log->error(std::to_string(torn) + " torn samples in " + std::to_string(copies) + " copies"));
+    return passed;
+}
+
+/** A station records between and in a plan that faults, the dump holds both */
+bool dumpsFault(kostal::Log* log)
+{
+    kostal::SimulatedRobot robot;
+    robot.addPlan(kostal::SimulatedRobot::kostalPlan(g_planName, 0.5));
+    robot.setMode(flexiv::MODE_PLAN_EXECUTION);
+    robot.injectFault("Press", false);
+    kostal::StationContext station;
+    station.stationId = 4;
+    station.robotPtr = &robot;
+    station.spiConfig.source = "SYNTHETIC";
+    station.spiSource = kostal::makeSPISource(station.spiConfig);
+    flexiv::Log flexivLog;
+
+    // the idle recorder of CommHandler, between plans
+    std::atomic<bool> recording = {true};
+    kostal::RobotOperationHandler robotHandler;
+    std::thread idle([&]{
+        auto next = Clock::now();
+        for (unsigned int cycle=0; recording; cycle++){
+            robotHandler.recordIdleState(&robot, &station, cycle % g_supervisionInterval == 0);
+            next += std::chrono::milliseconds(g_samplingInterval);
+            std::this_thread::sleep_until(next);
+        }
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    kostal::SyncTaskHandler syncTask;
+    syncTask.runScheduler(&robot, &station, &flexivLog, g_planName);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    station.flightRecorder.mark("FAULT: the plan failed");
+    std::string path;
+    Status dumped = station.flightRecorder.dump("the plan failed", station.stationId, station.spiConfig, &flexivLog, &path);
+    recording = false;
+    idle.join();
+
+    kostal::CaptureFileReader reader;
+    bool passed = dumped == SUCCESS && reader.open(path, &flexivLog) == SUCCESS
+                  && reader.info().taskType == "FAULT" && reader.info().taskName == "the plan failed"
+                  && reader.info().stationId == 4 && reader.samples() > 300 && reader.frames() > 0;
+    std::vector<std::string> nodes = passed ? reader.nodeNames() : std::vector<std::string>();
+    // the robot faults when the plan reaches Press, Start is the last node sampled
+    passed &= std::find(nodes.begin(), nodes.end(), "Start") != nodes.end();
+    reader.close();
+
+    Json::Value flight;
+    std::ifstream flightFile(kostal::WriteExcelHandler::summaryPath(path));
+    Json::CharReaderBuilder builder;
+    std::string errors;
+    passed &= Json::parseFromStream(builder, flightFile, &flight, &errors) && flight["reason"] == "the plan failed";
+    std::string events;
+    for (const Json::Value& event : flight["events"]){
+        events += event["event"].asString() + "; ";
+    }
+    for (const char* expected : {"plan " , "program running", "robot fault", "FAULT: the plan failed"}){
+        passed &= events.find(expected) != std::string::npos;
+    }
+    (passed ? log->info("the dump holds " + std::to_string(flight["capture"]["samples"].asUInt64())
+                        + " samples of nodes " + std::to_string(nodes.size()) + ", events: " + events)
+            : log->error("the dump misses the fault, events: " + events));
+    return passed;
+}
+
+/** Recording at 1 kHz takes less than 1% of a core */
+bool costsLittle(kostal::Log* log)
+{
+    kostal::FlightRecorder recorder;
+    const uint64_t cycles = 200000;
+    std::vector<kostal::RobotSnapshot> snapshots;
+    for (uint64_t i=0; i<64; i++){
+        snapshots.push_back(makeSnapshot(i * 997));
+    }
+    double start = threadSeconds();
+    for (uint64_t i=0; i<cycles; i++){
+        recorder.record(snapshots[i & 63]);
+        recorder.record(makeFrame(i));
+    }
+    double recordNs = (threadSeconds() - start) / cycles * 1e9;
+    double recordShare = recordNs * 1000 / 1e9;
+
+    // the idle recorder polls a simulated robot once per ms
+    kostal::SimulatedRobot robot;
+    kostal::StationContext station;
+    kostal::RobotOperationHandler robotHandler;
+    double idleCpu = 0, idleWall = 0;
+    std::thread idle([&]{
+        double cpuStart = threadSeconds();
+        auto wallStart = Clock::now();
+        auto next = wallStart;
+        for (unsigned int cycle=0; cycle<3000; cycle++){
+            robotHandler.recordIdleState(&robot, &station, cycle % g_supervisionInterval == 0);
+            next += std::chrono::milliseconds(g_samplingInterval);
+            std::this_thread::sleep_until(next);
+        }
+        idleCpu = threadSeconds() - cpuStart;
+        idleWall = std::chrono::duration<double>(Clock::now() - wallStart).count();
+    });
+    idle.join();
+    double idleShare = idleCpu / idleWall;
+
+    std::ostringstream line;
+    line << std::fixed << std::setprecision(3) << "recording a sample and a frame takes " << std::setprecision(0)
+         << recordNs << " ns, " << std::setprecision(3) << recordShare * 100 << "% of a core at 1 kHz; the idle "
+         << "recorder polling the robot takes " << idleShare * 100 << "% of a core";
+    bool passed = recordShare < 0.01 && idleShare < 0.01;
+    (passed ? log->info(line.str()) : log->error(line.str() + ", more than 1%"));
+    return passed;
+}
+
+}
+
+int main()
+{
+    kostal::Log log;
+    std::filesystem::create_directories(g_directory);
+    UPLOADADDRESS = g_directory;
+
+    bool passed = keepsLastSeconds(&log);
+    passed &= copiesWhileRecording(&log);
+    passed &= dumpsFault(&log);
+    passed &= costsLittle(&log);
+    std::filesystem::remove_all(g_directory);
+    return passed ? 0 : 1;
+}
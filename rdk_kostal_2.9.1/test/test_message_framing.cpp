@@ -0,0 +1,208 @@
+/**
+ * @test test_message_framing.cpp
+ * Fuzz and benchmark the framing of Testman messages. Random frames in both
+ * framing modes are written fragmented at random boundaries and pipelined
+ * back to back, and every frame must come out of kostal::MessageFramer
+ * unchanged. kostal::Server is then fed a large fragmented handshake and
+ * pipelined polls over loopback.
+ * @copyright Copyright (C) 2016-2022 Flexiv Ltd. All Rights Reserved.
+ * @author lcc@Flexiv
+ */
+
+// Kostal header files
+#include <kostal/SyncServer.hpp>
+#include <kostal/MessageFramer.hpp>
+
+#include <random>
+
+namespace {
+
+/** Port used by this test, so that a running station is not disturbed */
+const unsigned short g_testPort = 6080;
+
+typedef boost::asio::local::stream_protocol::socket LocalSocket;
+
+/** Encode all payloads and write them in random fragments from another thread */
+std::thread writeFragmented(LocalSocket* socket, const std::vector<std::string>& payloads,
+                            FramingMode mode, std::mt19937* rng)
+{
+    kostal::MessageFramer encoder(mode);
+    std::string stream;
+    std::string frame;
+    for (auto& payload : payloads){
+        encoder.encode(payload, &frame);
+        stream += frame;
+    }
+    std::vector<size_t> cuts;
+    std::uniform_int_distribution<size_t> fragment(1, 3000);
+    for (size_t pos = 0; pos < stream.size(); pos += fragment(*rng)){
+        cuts.push_back(pos);
+    }
+    cuts.push_back(stream.size());
+    return std::thread([socket, stream, cuts]{
+        for (size_t i=1; i<cuts.size(); i++){
+            boost::asio::write(*socket, boost::asio::buffer(stream.data() + cuts[i-1], cuts[i] - cuts[i-1]));
+        }
+    });
+}
+
+/** Read frames until all payloads are received or an error occurs */
+size_t readAll(LocalSocket* socket, kostal::MessageFramer* framer, const std::vector<std::string>& payloads,
+               boost::asio::io_context* ioContext)
+{
+    size_t matched = 0;
+    std::function<void(const boost::system::error_code&, std::string_view)> onFrame;
+    onFrame = [&](const boost::system::error_code& ec, std::string_view frame){
+        if (ec || frame != payloads[matched]){
+            return;
+        }
+        if (++matched < payloads.size()){
+            framer->asyncReadFrame(*socket, onFrame);
+        }
+    };
+    framer->asyncReadFrame(*socket, onFrame);
+    ioContext->restart();
+    ioContext->run();
+    return matched;
+}
+
+/** Random frames of 0 bytes up to 256 kB, never containing the newline delimiter */
+std::vector<std::string> randomPayloads(size_t count, std::mt19937* rng)
+{
+    std::uniform_int_distribution<int> sizeClass(0, 9);
+    std::uniform_int_distribution<int> byte(0, 255);
+    std::vector<std::string> payloads;
+    for (size_t i=0; i<count; i++){
+        size_t size = sizeClass(*rng) == 0 ? (*rng)() % 262144 : (*rng)() % 200;
+        std::string payload(size, ' ');
+        for (auto& c : payload){
+            do { c = static_cast<char>(byte(*rng)); } while (c == '\n' || c == '\r');
+        }
+        if (!payload.empty()){
+            payload[0] = '{';
+        }
+        payloads.push_back(payload);
+    }
+    return payloads;
+}
+
+bool fuzz(FramingMode writeMode, FramingMode readMode, const std::string& name, kostal::Log* log)
+{
+    std::mt19937 rng(static_cast<unsigned>(writeMode) * 7919 + 1);
+    boost::asio::io_context ioContext;
+    LocalSocket reader(ioContext);
+    LocalSocket writer(ioContext);
+    boost::asio::local::connect_pair(reader, writer);
+    auto payloads = randomPayloads(500, &rng);
+    if (readMode == AUTO){
+        // the first frame decides the mode and must not be empty
+        payloads[0] = "{\"TOKEN\":\"kostal\"}";
+    }
+    kostal::MessageFramer framer(readMode);
+    std::thread sender = writeFragmented(&writer, payloads, writeMode, &rng);
+    size_t matched = readAll(&reader, &framer, payloads, &ioContext);
+    sender.join();
+    bool passed = matched == payloads.size();
+    (passed ? log->info(name + " fuzz passed, " + std::to_string(matched) + " frames")
+            : log->error(name + " fuzz failed at frame " + std::to_string(matched)));
+    return passed;
+}
+
+bool benchmarkPipelined(FramingMode mode, const std::string& name, kostal::Log* log)
+{
+    std::mt19937 rng(42);
+    boost::asio::io_context ioContext;
+    LocalSocket reader(ioContext);
+    LocalSocket writer(ioContext);
+    boost::asio::local::connect_pair(reader, writer);
+    Json::Value poll;
+    poll[QUERYSTATUS] = "no";
+    poll[TASKTYPE] = "NORMAL";
+    poll[TASKNAME] = "Kostal-MainPlan";
+    std::string request = Json::FastWriter().write(poll);
+    request.pop_back();
+    std::vector<std::string> payloads(100000, request);
+    kostal::MessageFramer framer(mode);
+    auto tic = std::chrono::steady_clock::now();
+    std::thread sender = writeFragmented(&writer, payloads, mode, &rng);
+    size_t matched = readAll(&reader, &framer, payloads, &ioContext);
+    sender.join();
+    auto toc = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(toc - tic).count();
+    log->info(name + " pipelined polls: " + std::to_string(static_cast<int64_t>(matched / seconds))
+              + " frames/s, " + std::to_string(matched * request.size() / seconds / 1e6) + " MB/s");
+    return matched == payloads.size();
+}
+
+/** A large handshake split into small writes and two polls in one write */
+bool serverRoundTrip(kostal::Log* log)
+{
+    kostal::Server server;
+    server.setPortNumber(g_testPort);
+    Status initResult = SOCKET;
+    std::thread acceptor([&]{ initResult = server.init(); });
+
+    boost::asio::io_context ioContext;
+    boost::asio::ip::tcp::socket client(ioContext);
+    boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::address_v4::loopback(), g_testPort);
+    boost::system::error_code ec;
+    for (int i=0; i<1000; i++){
+        client.connect(endpoint, ec);
+        if (!ec) break;
+        client.close();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    Json::Value config;
+    config[CPOL] = "0";
+    config[CPHA] = "1";
+    config[LSB] = "0";
+    config[SELP] = "0";
+    config[TOKEN] = g_TOKEN;
+    config["PADDING"] = std::string(100000, 'x');
+    std::string handshake = Json::FastWriter().write(config);
+    for (size_t pos = 0; pos < handshake.size(); pos += 700){
+        boost::asio::write(client, boost::asio::buffer(handshake.data() + pos, std::min<size_t>(700, handshake.size() - pos)));
+    }
+    boost::asio::streambuf reply;
+    boost::asio::read_until(client, reply, '\n');
+    acceptor.join();
+    if (initResult != SUCCESS){
+        log->error("The server rejected the fragmented handshake");
+        return false;
+    }
+
+    std::string polls = "{\"" + QUERYSTATUS + "\":\"no\"}\n{\"" + QUERYSTATUS + "\":\"yes\"}\n";
+    boost::asio::write(client, boost::asio::buffer(polls));
+    std::string queries[2];
+    for (auto& query : queries){
+        server.setReplyMsg("IDLE");
+        if (server.monitor() != SUCCESS){
+            log->error("The server failed on pipelined polls");
+            return false;
+        }
+        Json::Value value;
+        Json::Reader().parse(server.getRecvMsg(), value);
+        query = value[QUERYSTATUS].asString();
+    }
+    client.close();
+    bool passed = queries[0] == "no" && queries[1] == "yes";
+    (passed ? log->info("Server handled the fragmented handshake and pipelined polls")
+            : log->error("Server merged or dropped pipelined polls"));
+    return passed;
+}
+
+}
+
+int main()
+{
+    kostal::Log log;
+    bool passed = true;
+    passed &= fuzz(NEWLINE, NEWLINE, "newline", &log);
+    passed &= fuzz(LENGTHPREFIX, LENGTHPREFIX, "length-prefix", &log);
+    passed &= fuzz(NEWLINE, AUTO, "auto newline", &log);
+    passed &= fuzz(LENGTHPREFIX, AUTO, "auto length-prefix", &log);
+    passed &= benchmarkPipelined(NEWLINE, "newline", &log);
+    passed &= benchmarkPipelined(LENGTHPREFIX, "length-prefix", &log);
+    passed &= serverRoundTrip(&log);
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,153 @@
+/**
+ * @test test_multi_station.cpp
+ * Run several simulated lever test cells behind one kostal::StationServer.
+ * Every simulated Testman client binds to its own station, polls it and
+ * triggers captures into the station's own buffers. The test checks that no
+ * client talks to another client's station and prints the aggregate poll
+ * rate for 1, 2, 4 and 8 stations.
+ * @copyright Copyright (C) 2016-2022 Flexiv Ltd. All Rights Reserved.
+ * @author lcc@Flexiv
+ */
+
+// Kostal header files
+#include <kostal/StationServer.hpp>
+
+namespace {
+
+/** Port used by this test, so that a running station is not disturbed */
+const unsigned short g_testPort = 6090;
+
+/** Polls sent by every client */
+const int g_pollCount = 2000;
+
+/**
+ * A station that answers every poll with its id and the number of samples it had
+ * captured before the poll, each poll with query "yes" captures one more sample
+ */
+void simulatedStation(std::shared_ptr<kostal::Server> session, kostal::StationContext* station)
+{
+    kostal::JSONMessageHandler parser;
+    kostal::Log log;
+    std::string queryStatus;
+    size_t captured = 0;
+    while (true)
+    {
+        session->setReplyMsg(std::to_string(station->stationId) + ":" + std::to_string(captured));
+        if (session->monitor() != SUCCESS){
+            return;
+        }
+        if (parser.parseJSON(session->getRecvView(), &queryStatus, &log) != SUCCESS){
+            return;
+        }
+        if (queryStatus == "yes"){
+            std::lock_guard<std::mutex> lock(station->dataMutex);
+            const double pose[7] = {0};
+            station->capture.append(pose, pose, pose, station->capture.internNode("Start"), 0);
+            captured = station->capture.size();
+        }
+    }
+}
+
+/**
+ * A Testman client bound to one station
+ * @return number of replies that came from another station or had a wrong count
+ */
+int runClient(int stationId)
+{
+    boost::asio::io_context ioContext;
+    boost::asio::ip::tcp::socket socket(ioContext);
+    boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::address_v4::loopback(), g_testPort);
+    boost::system::error_code ec;
+    for (int i=0; i<1000; i++){
+        socket.connect(endpoint, ec);
+        if (!ec) break;
+        socket.close();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    Json::Value config;
+    config[CPOL] = "0";
+    config[CPHA] = "1";
+    config[LSB] = "0";
+    config[SELP] = "0";
+    config[TOKEN] = g_TOKEN;
+    config[STATION] = std::to_string(stationId);
+    boost::asio::streambuf reply;
+    boost::asio::write(socket, boost::asio::buffer(Json::FastWriter().write(config)));
+    boost::asio::read_until(socket, reply, '\n');
+    reply.consume(reply.size());
+
+    int mismatches = 0;
+    for (int i=0; i<g_pollCount; i++){
+        Json::Value poll;
+        poll[QUERYSTATUS] = (i % 2 == 0) ? "yes" : "no";
+        boost::asio::write(socket, boost::asio::buffer(Json::FastWriter().write(poll)));
+        size_t n = boost::asio::read_until(socket, reply, '\n');
+        std::string answer(static_cast<const char*>(reply.data().data()), n - 1);
+        reply.consume(n);
+        std::string expected = std::to_string(stationId) + ":" + std::to_string((i + 1) / 2);
+        if (answer != expected){
+            mismatches++;
+        }
+    }
+    return mismatches;
+}
+
+/** Serve one client per station at the same time and check the replies */
+bool runStations(int stationCount, kostal::Log* log)
+{
+    kostal::StationServer server(2);
+    server.setPortNumber(g_testPort);
+    std::vector<kostal::StationContext*> stations;
+    for (int i=0; i<stationCount; i++){
+        auto context = std::make_unique<kostal::StationContext>();
+        context->spiDeviceIndex = i;
+        stations.push_back(context.get());
+        server.addStation(std::move(context), simulatedStation);
+    }
+    // the sessions log every client that hangs up, keep the report readable
+    spdlog::set_level(spdlog::level::off);
+    if (server.start() != SUCCESS){
+        spdlog::set_level(spdlog::level::info);
+        return false;
+    }
+
+    std::vector<int> mismatches(stationCount, 0);
+    std::vector<std::thread> clients;
+    auto tic = std::chrono::steady_clock::now();
+    for (int i=0; i<stationCount; i++){
+        clients.emplace_back([i, &mismatches]{ mismatches[i] = runClient(i); });
+    }
+    for (auto& client : clients){
+        client.join();
+    }
+    auto toc = std::chrono::steady_clock::now();
+    server.stop();
+    spdlog::set_level(spdlog::level::info);
+
+    bool passed = true;
+    for (int i=0; i<stationCount; i++){
+        if (mismatches[i] != 0 || stations[i]->capture.size() != g_pollCount / 2){
+            log->error("Station " + std::to_string(i) + " got " + std::to_string(mismatches[i])
+                       + " foreign or wrong replies");
+            passed = false;
+        }
+    }
+    double seconds = std::chrono::duration<double>(toc - tic).count();
+    log->info(std::to_string(stationCount) + " stations: "
+              + std::to_string(static_cast<int64_t>(stationCount * g_pollCount / seconds)) + " polls/s in total");
+    return passed;
+}
+
+}
+
+int main()
+{
+    kostal::Log log;
+    bool passed = true;
+    for (int stationCount : {1, 2, 4, 8}){
+        passed &= runStations(stationCount, &log);
+    }
+    (passed ? log.info("All stations were isolated from each other")
+            : log.error("Stations interfered with each other"));
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,254 @@
+/**
+ * @test test_node_tracker.cpp
+ * Check the kostal::NodeTracker that decides which samples of a plan are
+ * captured. A kostal plan (Approach, Start, Press, Stop, Retract) is fed in as
+ * 1 kHz snapshots and every trigger has to capture the right samples:
+ * - the default from Start to Stop, as the sampling task did before,
+ * - with pre-trigger and post-trigger time around it,
+ * - while the node path is in the Lever/ sub plan, also for a node name that
+ *   repeats outside of it.
+ * Then the cost of one sample and the size of a result of a long plan are
+ * compared with comparing the names of every sample and writing the node
+ * name into every row.
+ * @copyright Copyright (C) 2016-2022 Flexiv Ltd. All Rights Reserved.
+ * @author lcc@Flexiv
+ */
+
+// Kostal header files
+#include <kostal/KostalLogger.hpp>
+#include <kostal/NodeTracker.hpp>
+#include <kostal/WriteExcel.hpp>
+
+#include <filesystem>
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+/** The nodes of the plan with their path and the samples they last at 1 kHz */
+struct PlanNode
+{
+    const char* name;
+    const char* path;
+    size_t samples;
+};
+
+std::vector<kostal::RobotSnapshot> makePlan(const std::vector<PlanNode>& nodes, size_t scale)
+{
+    std::vector<kostal::RobotSnapshot> plan;
+    kostal::RobotSnapshot state;
+    for (const PlanNode& node : nodes){
+        std::strcpy(state.nodeName, node.name);
+        std::strcpy(state.nodePath, node.path);
+        for (size_t i=0; i<node.samples * scale; i++){
+            state.version++;
+            state.timestamp = static_cast<int64_t>(state.version) * 1000000;
+            state.tcpPose[0] = static_cast<double>(state.version);
+            plan.push_back(state);
+        }
+    }
+    return plan;
+}
+
+std::vector<kostal::RobotSnapshot> makePlan(size_t scale)
+{
+    return makePlan({{"Approach", "Move/Approach", 100}, {"Start", "Lever/Start", 50},
+                     {"Press", "Lever/Press", 600}, {"Stop", "Lever/Stop", 50},
+                     {"Retract", "Move/Retract", 200}}, scale);
+}
+
+struct Capture
+{
+    size_t samples = 0;
+    std::string firstNode;
+    std::string lastNode;
+    size_t segments = 0;
+    size_t transitions = 0;
+    // whether the stored samples are the consecutive ones of the plan
+    bool consecutive = true;
+};
+
+Capture capture(const kostal::CaptureTrigger& trigger, const std::vector<kostal::RobotSnapshot>& plan)
+{
+    kostal::NodeTracker tracker;
+    tracker.configure(trigger);
+    kostal::CaptureStore store;
+    store.reserve(plan.size());
+    for (const kostal::RobotSnapshot& state : plan){
+        tracker.sample(state, &store);
+    }
+    Capture result;
+    result.samples = store.size();
+    result.segments = store.segments().size();
+    result.transitions = tracker.transitions().size();
+    if (!store.empty()){
+        result.firstNode = store.nodeName(0);
+        result.lastNode = store.nodeName(store.size() - 1);
+        for (size_t i=1; i<store.size(); i++){
+            result.consecutive &= store.tcpPose(i)[0] == store.tcpPose(i - 1)[0] + 1;
+        }
+    }
+    return result;
+}
+
+bool expect(const std::string& name, const Capture& result, size_t samples, const std::string& firstNode,
+            const std::string& lastNode, kostal::Log* log)
+{
+    bool passed = result.samples == samples && result.firstNode == firstNode && result.lastNode == lastNode
+                  && result.consecutive && result.transitions == 5;
+    std::string line = name + ": " + std::to_string(result.samples) + " samples from " + result.firstNode + " to "
+                       + result.lastNode + " in " + std::to_string(result.segments) + " segments";
+    (passed ? log->info(line) : log->error(line + ", expected " + std::to_string(samples) + " samples from "
+                                           + firstNode + " to " + lastNode));
+    return passed;
+}
+
+bool checkTriggers(kostal::Log* log)
+{
+    std::vector<kostal::RobotSnapshot> plan = makePlan(1);
+    kostal::CaptureTrigger trigger;
+    bool passed = expect("Start to Stop", capture(trigger, plan), 650, "Start", "Press", log);
+    trigger.preTriggerMs = 20;
+    trigger.postTriggerMs = 30;
+    passed &= expect("20 ms before, 30 ms after", capture(trigger, plan), 700, "Approach", "Stop", log);
+    kostal::CaptureTrigger path;
+    path.startNodes.clear();
+    path.stopNodes.clear();
+    path.pathPrefixes = {"Lever/"};
+    passed &= expect("path Lever/", capture(path, plan), 700, "Start", "Stop", log);
+    kostal::CaptureTrigger press;
+    press.startNodes = {"Press"};
+    press.stopNodes = {"Retract"};
+    passed &= expect("Press to Retract", capture(press, plan), 650, "Press", "Stop", log);
+    return passed;
+}
+
+/** A name that repeats in two sub plans is captured only under the prefixed path */
+bool checkRepeatedName(kostal::Log* log)
+{
+    std::vector<kostal::RobotSnapshot> plan = makePlan({{"Approach", "Base/Approach", 100}, {"Move", "Lever/Move", 200},
+                                                        {"Move", "Base/Move", 300}, {"Move", "Lever/Move", 50}}, 1);
+    kostal::CaptureTrigger trigger;
+    trigger.startNodes.clear();
+    trigger.stopNodes.clear();
+    trigger.pathPrefixes = {"Lever/"};
+    kostal::NodeTracker tracker;
+    tracker.configure(trigger);
+    kostal::CaptureStore store;
+    store.reserve(plan.size());
+    for (const kostal::RobotSnapshot& state : plan){
+        tracker.sample(state, &store);
+    }
+    const std::vector<kostal::NodeTransition>& transitions = tracker.transitions();
+    // the samples of Base/Move are skipped, the second visit of Lever/Move starts at sample 601
+    bool passed = store.size() == 250 && store.timestamp(200) == 601 * 1000000 && transitions.size() == 4
+                  && transitions[1].to != transitions[2].to && transitions[3].to == transitions[1].to
+                  && tracker.nodePath(transitions[2].to) == "Base/Move";
+    std::string line = "Move under Lever/ and Base/: " + std::to_string(store.size()) + " samples, "
+                       + std::to_string(transitions.size()) + " transitions";
+    (passed ? log->info(line) : log->error(line + ", expected 250 samples of Lever/Move, 4 transitions"));
+    return passed;
+}
+
+/** The sampling task before: the names of every sample are compared and interned */
+double sampleBefore(const std::vector<kostal::RobotSnapshot>& plan, kostal::CaptureStore* store)
+{
+    bool collect = false;
+    auto start = Clock::now();
+    for (const kostal::RobotSnapshot& state : plan){
+        std::string nodeName(state.nodeName);
+        if (nodeName == "Start"){
+            collect = true;
+        }
+        if (nodeName == "Stop"){
+            collect = false;
+        }
+        if (collect){
+            store->append(state.tcpPose.data(), state.flangePose.data(), state.rawExtForceInTcpFrame.data(),
+                          store->internNode(nodeName), state.timestamp);
+        }
+    }
+    return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / plan.size();
+}
+
+double sampleAfter(const std::vector<kostal::RobotSnapshot>& plan, kostal::CaptureStore* store)
+{
+    kostal::NodeTracker tracker;
+    tracker.configure(kostal::CaptureTrigger());
+    auto start = Clock::now();
+    for (const kostal::RobotSnapshot& state : plan){
+        tracker.sample(state, store);
+    }
+    return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / plan.size();
+}
+
+/** Write the result of a store and return its size in bytes */
+uintmax_t resultSize(const kostal::CaptureStore& store, bool everyRow)
+{
+    kostal::SPIFrameStore spiFrames;
+    uint8_t frame[16] = {};
+    for (size_t i=0; i<store.size(); i++){
+        spiFrames.append(frame, store.timestamp(i), i);
+    }
+    g_nodeNameEveryRow = everyRow;
+    kostal::WriteExcelHandler writer;
+    flexiv::Log flexivLog;
+    std::string path;
+    std::string taskName = "Kostal-LongPlan-" + std::string(everyRow ? "row" : "segment");
+    if (writer.writeDataToExcel("NORMAL", taskName, &store, &spiFrames, &flexivLog, &path) != SUCCESS){
+        return 0;
+    }
+    uintmax_t size = std::filesystem::file_size(path);
+    std::remove(path.c_str());
+    g_nodeNameEveryRow = false;
+    return size;
+}
+
+bool checkCost(kostal::Log* log)
+{
+    // a plan of 100 s
+    std::vector<kostal::RobotSnapshot> plan = makePlan(100);
+    kostal::CaptureStore before, after;
+    before.reserve(plan.size());
+    after.reserve(plan.size());
+    double nsBefore = 1e9, nsAfter = 1e9;
+    for (int run=0; run<5; run++){
+        before.clear();
+        after.clear();
+        nsBefore = std::min(nsBefore, sampleBefore(plan, &before));
+        nsAfter = std::min(nsAfter, sampleAfter(plan, &after));
+    }
+    bool same = before.size() == after.size();
+    for (size_t i=0; same && i<after.size(); i++){
+        same = before.nodeName(i) == after.nodeName(i) && before.timestamp(i) == after.timestamp(i);
+    }
+    std::string directory = "/tmp/test_node_tracker/";
+    std::filesystem::create_directories(directory + "NORMAL");
+    std::string upload = UPLOADADDRESS;
+    UPLOADADDRESS = directory;
+    uintmax_t rowBytes = resultSize(after, true);
+    uintmax_t segmentBytes = resultSize(after, false);
+    UPLOADADDRESS = upload;
+    std::filesystem::remove_all(directory);
+    log->info("one sample: " + std::to_string(nsBefore) + " ns comparing names, " + std::to_string(nsAfter)
+              + " ns with the tracker");
+    log->info("result of " + std::to_string(after.size()) + " samples: " + std::to_string(rowBytes)
+              + " bytes with the node in every row, " + std::to_string(segmentBytes) + " bytes with "
+              + std::to_string(after.segments().size()) + " node segments");
+    bool passed = same && segmentBytes > 0 && segmentBytes < rowBytes;
+    if (!passed){
+        log->error("The tracker captured other samples or its result is not smaller");
+    }
+    return passed;
+}
+
+}
+
+int main()
+{
+    kostal::Log log;
+    bool passed = checkTriggers(&log);
+    passed &= checkRepeatedName(&log);
+    passed &= checkCost(&log);
+    return passed ? 0 : 1;
+}
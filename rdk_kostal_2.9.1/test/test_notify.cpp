@@ -0,0 +1,287 @@
+/**
+ * @test test_notify.cpp
+ * Compare how fast a Testman client learns that a task is finished. A polling
+ * client sends a status query every poll interval and sees IDLE with the next
+ * poll after the task ends. A client that asks for NOTIFY in its handshake gets
+ * the TASK_DONE event pushed the moment the task returns, and its status polls
+ * are answered by kostal::Server on the io thread without waking the station.
+ * @copyright Copyright (C) 2016-2022 Flexiv Ltd. All Rights Reserved.
+ * @author lcc@Flexiv
+ */
+
+// Kostal header files
+#include <kostal/SyncServer.hpp>
+
+namespace {
+
+/** Port used by this test, so that a running station is not disturbed */
+const unsigned short g_testPort = 6110;
+
+/** Tasks run in every mode */
+const int g_taskCount = 20;
+
+/** Duration of one simulated task */
+const std::chrono::milliseconds g_taskDuration(20);
+
+/** Status poll interval of the client, as Testman polls */
+const std::chrono::milliseconds g_pollInterval(10);
+
+typedef std::chrono::steady_clock Clock;
+
+/** A station whose tasks only sleep, records when each task ended */
+struct SimulatedStation
+{
+    kostal::Server server;
+    std::atomic<bool> busy = {false};
+    std::atomic<int> wakeups = {0};
+    Clock::time_point taskEnd;
+    std::mutex taskEndMutex;
+    std::thread task;
+
+    void runTask()
+    {
+        busy = true;
+        if (task.joinable()){
+            task.join();
+        }
+        task = std::thread([this]{
+            std::this_thread::sleep_for(g_taskDuration);
+            {
+                std::lock_guard<std::mutex> lock(taskEndMutex);
+                taskEnd = Clock::now();
+            }
+            busy = false;
+            server.publishTaskDone("IDLE", kostal::TaskRequest{"NORMAL", "Kostal-MainPlan"}, UPLOADADDRESS + "NORMAL/test.csv");
+        });
+    }
+
+    /** The state machine of a polling client, one wakeup for every request */
+    void servePolls()
+    {
+        kostal::JSONMessageHandler parser;
+        kostal::Log log;
+        std::string queryStatus;
+        while (true){
+            server.setReplyMsg(busy ? "BUSY" : "IDLE");
+            if (server.monitor() != SUCCESS){
+                return;
+            }
+            wakeups++;
+            parser.parseJSON(server.getRecvView(), &queryStatus, &log);
+            if (queryStatus == "yes" && !busy){
+                runTask();
+            }
+        }
+    }
+
+    /** The state machine of a NOTIFY client, only wakes up for a new task */
+    void serveNotify()
+    {
+        kostal::JSONMessageHandler parser;
+        kostal::Log log;
+        server.publishStatus("IDLE");
+        while (true){
+            Status result = server.monitor([&](std::string_view request){
+                std::string queryStatus;
+                parser.parseJSON(request, &queryStatus, &log);
+                return queryStatus == "yes" && !busy;
+            });
+            if (result != SUCCESS){
+                return;
+            }
+            wakeups++;
+            runTask();
+            server.publishStatus("BUSY");
+            server.send("BUSY");
+        }
+    }
+
+    void serve(bool notify)
+    {
+        server.setPortNumber(g_testPort);
+        if (server.init() == SUCCESS){
+            notify ? serveNotify() : servePolls();
+        }
+        if (task.joinable()){
+            task.join();
+        }
+    }
+
+    Clock::time_point getTaskEnd()
+    {
+        std::lock_guard<std::mutex> lock(taskEndMutex);
+        return taskEnd;
+    }
+};
+
+class Client
+{
+public:
+    boost::asio::io_context ioContext;
+    boost::asio::ip::tcp::socket socket;
+    boost::asio::streambuf buffer;
+
+    explicit Client(bool notify)
+    : socket(ioContext)
+    {
+        boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::address_v4::loopback(), g_testPort);
+        boost::system::error_code ec;
+        for (int i=0; i<1000; i++){
+            socket.connect(endpoint, ec);
+            if (!ec) break;
+            socket.close();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        Json::Value config;
+        config[CPOL] = "0";
+        config[CPHA] = "1";
+        config[LSB] = "0";
+        config[SELP] = "0";
+        config[TOKEN] = g_TOKEN;
+        if (notify){
+            config[NOTIFY] = "yes";
+        }
+        send(config);
+        readFrame();
+    }
+
+    void send(const Json::Value& message)
+    {
+        boost::asio::write(socket, boost::asio::buffer(Json::FastWriter().write(message)));
+    }
+
+    void sendQuery(const std::string& queryStatus)
+    {
+        Json::Value query;
+        query[QUERYSTATUS] = queryStatus;
+        query[TASKTYPE] = "NORMAL";
+        query[TASKNAME] = "Kostal-MainPlan";
+        send(query);
+    }
+
+    std::string readFrame()
+    {
+        size_t n = boost::asio::read_until(socket, buffer, '\n');
+        std::string frame(static_cast<const char*>(buffer.data().data()), n - 1);
+        buffer.consume(n);
+        return frame;
+    }
+
+    /** Read until a reply that is not a pushed event arrives, remember pushed events */
+    std::string readReply(std::vector<std::string>* events)
+    {
+        while (true){
+            std::string frame = readFrame();
+            if (frame.empty() || frame[0] != '{'){
+                return frame;
+            }
+            events->push_back(frame);
+        }
+    }
+};
+
+/** Microseconds from the end of each task until the client knew about it */
+std::vector<int64_t> runPolling(SimulatedStation* station)
+{
+    Client client(false);
+    std::vector<int64_t> latencies;
+    for (int i=0; i<g_taskCount; i++){
+        client.sendQuery("yes");
+        client.readFrame();
+        while (true){
+            std::this_thread::sleep_for(g_pollInterval);
+            client.sendQuery("no");
+            if (client.readFrame() == "IDLE"){
+                break;
+            }
+        }
+        latencies.push_back(std::chrono::duration_cast<std::chrono::microseconds>(
+            Clock::now() - station->getTaskEnd()).count());
+    }
+    return latencies;
+}
+
+std::vector<int64_t> runNotify(SimulatedStation* station, int* statusPolls, bool* passed)
+{
+    Client client(true);
+    std::vector<int64_t> latencies;
+    std::vector<std::string> events;
+    client.readFrame(); // the initial status event
+    for (int i=0; i<g_taskCount; i++){
+        client.sendQuery("yes");
+        if (client.readReply(&events) != "BUSY"){
+            *passed = false;
+        }
+        // status polls while the task runs are answered without waking the station
+        client.sendQuery("no");
+        if (client.readReply(&events) != "BUSY"){
+            *passed = false;
+        }
+        (*statusPolls)++;
+        while (true){
+            std::string event = events.empty() ? client.readFrame() : events.front();
+            if (!events.empty()){
+                events.erase(events.begin());
+            }
+            if (event.find(EVENTTASKDONE) != std::string::npos){
+                break;
+            }
+        }
+        latencies.push_back(std::chrono::duration_cast<std::chrono::microseconds>(
+            Clock::now() - station->getTaskEnd()).count());
+    }
+    return latencies;
+}
+
+std::string summary(std::vector<int64_t> latencies)
+{
+    std::sort(latencies.begin(), latencies.end());
+    return std::to_string(latencies[latencies.size() / 2]) + " | "
+           + std::to_string(latencies[latencies.size() * 99 / 100]) + " | "
+           + std::to_string(latencies.back()) + " us";
+}
+
+}
+
+int main()
+{
+    kostal::Log log;
+    bool passed = true;
+    spdlog::set_level(spdlog::level::off);
+
+    std::vector<int64_t> pollLatencies;
+    int pollWakeups = 0;
+    {
+        SimulatedStation station;
+        std::thread serving([&]{ station.serve(false); });
+        pollLatencies = runPolling(&station);
+        serving.join();
+        pollWakeups = station.wakeups;
+    }
+
+    std::vector<int64_t> notifyLatencies;
+    int notifyWakeups = 0;
+    int statusPolls = 0;
+    {
+        SimulatedStation station;
+        std::thread serving([&]{ station.serve(true); });
+        notifyLatencies = runNotify(&station, &statusPolls, &passed);
+        serving.join();
+        notifyWakeups = station.wakeups;
+    }
+
+    spdlog::set_level(spdlog::level::info);
+    log.info("polling task done to client p50 | p99 | max = " + summary(pollLatencies)
+             + ", " + std::to_string(pollWakeups) + " station wakeups");
+    log.info("notify  task done to client p50 | p99 | max = " + summary(notifyLatencies)
+             + ", " + std::to_string(notifyWakeups) + " station wakeups for "
+             + std::to_string(statusPolls) + " status polls");
+    if (notifyWakeups != g_taskCount){
+        log.error("Status polls woke up the station in notify mode");
+        passed = false;
+    }
+    if (!passed){
+        log.error("The notify session answered with a wrong status");
+    }
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,227 @@
+/**
+ * @test test_plan_profiler.cpp
+ * Profile the nodes of a kostal plan on a kostal::SimulatedRobot:
+ * - the duration histograms have to place a duration within one bucket and
+ *   give percentiles no further off than a bucket is wide,
+ * - runs of a station profiled from the node transitions of its sampling task,
+ *   and runs of RobotOperationHandler::executeRobotPlan that polls the node,
+ *   have to give every node the time the simulated plan spends in it,
+ * - after the Press node of the plan is edited to take longer, the summary of
+ *   the next run has to name Press as slower than before and no other node,
+ * - the written report has to hold the plan with its nodes in plan order,
+ * - a node name that repeats in two sub plans has to be profiled under each path.
+ * The time profiling a plan takes on the station after the plan and the time
+ * writing the report takes on the export thread are reported, the sampling
+ * task itself does nothing more than before.
+ * @copyright Copyright (C) 2016-2022 Flexiv Ltd. All Rights Reserved.
+ * @author lcc@Flexiv
+ */
+
+// Kostal header files
+#include <kostal/KostalLogger.hpp>
+#include <kostal/SimulatedRobot.hpp>
+#include <kostal/SyncTask.hpp>
+#include <kostal/PlanProfiler.hpp>
+
+#include <filesystem>
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+const std::string g_directory = "/tmp/test_plan_profiler/";
+
+const std::string g_planName = "Kostal-MainPlan-NORMAL";
+
+// the plan takes this long, its nodes Approach 10%, Start 5%, Press 60%, Stop 5%, Retract 20%
+const double g_planSeconds = 0.4;
+
+const std::vector<std::pair<std::string, double>> g_nodeShares = {
+    {"Approach", 0.1}, {"Start", 0.05}, {"Press", 0.6}, {"Stop", 0.05}, {"Retract", 0.2}};
+
+/** Percentiles of known durations are at most one bucket above the exact ones */
+bool histogramIsClose(kostal::Log* log)
+{
+    kostal::DurationHistogram histogram;
+    for (int ms=1; ms<=1000; ms++){
+        histogram.add(ms);
+    }
+    histogram.add(0.2);
+    double width = std::exp2(1.0 / g_profileBucketsPerOctave);
+    bool passed = histogram.counts[0] == 1 && histogram.stats.count == 1001 && histogram.stats.max == 1000;
+    for (double share : {0.5, 0.9, 0.99}){
+        double exact = std::ceil(share * 1001) - 1;
+        double estimate = histogram.percentile(share);
+        passed &= estimate >= exact && estimate <= exact * width;
+    }
+    passed &= histogram.percentile(1) == 1000;
+    passed &= kostal::DurationHistogram::bucket(1e9) == g_profileBuckets - 1;
+    (passed ? log->info("p50 " + std::to_string(histogram.percentile(0.5)) + " ms of 1 ~ 1000 ms")
+            : log->error("the percentiles of the histogram are off by more than a bucket"));
+    return passed;
+}
+
+/** Every node of the last run took the time the plan gives it */
+bool nodesMatchPlan(const kostal::PlanProfile* profile, double planSeconds, const std::string& source, kostal::Log* log)
+{
+    if (profile == nullptr || profile->nodes.size() != g_nodeShares.size()){
+        log->error(source + ": the plan or its nodes are missing");
+        return false;
+    }
+    bool passed = true;
+    std::ostringstream line;
+    line << std::fixed << std::setprecision(1) << source << ":";
+    for (size_t i=0; i<g_nodeShares.size(); i++){
+        const kostal::NodeProfile& node = profile->nodes[i];
+        double expected = g_nodeShares[i].second * planSeconds * 1000;
+        // the first node is entered when the program is seen running, a few ms after it started
+        double tolerance = (i == 0 ? 20 : 4) + expected * 0.02;
+        passed &= node.name == g_nodeShares[i].first && std::abs(node.lastMs - expected) <= tolerance;
+        line << " " << node.name << " " << node.lastMs << "/" << expected << " ms";
+    }
+    (passed ? log->info(line.str()) : log->error(line.str() + ", a node time is off"));
+    return passed;
+}
+
+/** Runs of a station and of executeRobotPlan, then the plan is edited */
+bool profilesRuns(kostal::Log* log)
+{
+    kostal::SimulatedRobot robot;
+    robot.addPlan(kostal::SimulatedRobot::kostalPlan(g_planName, g_planSeconds));
+    robot.setMode(flexiv::MODE_PLAN_EXECUTION);
+    kostal::StationContext station;
+    station.stationId = 2;
+    station.robotPtr = &robot;
+    station.spiConfig.source = "SYNTHETIC";
+    station.spiSource = kostal::makeSPISource(station.spiConfig);
+    flexiv::Log flexivLog;
+    kostal::SyncTaskHandler syncTask;
+    bool passed = true;
+    auto runs = g_profileMinRuns + 1;
+    for (uint64_t i=0; passed && i<runs; i++){
+        passed &= syncTask.runScheduler(&robot, &station, &flexivLog, g_planName) == SUCCESS;
+    }
+    const kostal::PlanProfile* profile = station.planProfiler.profile(g_planName);
+    passed &= profile != nullptr && profile->cycleTime.stats.count == runs;
+    passed &= nodesMatchPlan(profile, g_planSeconds, "sampling task", log);
+    passed &= profile != nullptr && profile->nodes[2].path == "Lever/Press";
+    std::string steady = station.planProfiler.summary(g_planName);
+    passed &= steady.find("slower than before") == std::string::npos;
+
+    // the node polled as executeRobotPlan waits for the plan
+    kostal::RobotOperationHandler robotHandler;
+    kostal::PlanProfiler polled;
+    passed &= robotHandler.executeRobotPlan(&robot, &flexivLog, g_planName, &polled) == SUCCESS;
+    passed &= nodesMatchPlan(polled.profile(g_planName), g_planSeconds, "executeRobotPlan", log);
+    passed &= polled.profile(g_planName) != nullptr && polled.profile(g_planName)->nodes[2].path == "Lever/Press";
+
+    // the press takes 50% longer after the edit
+    kostal::SimulatedPlan edited = kostal::SimulatedRobot::kostalPlan(g_planName, g_planSeconds);
+    edited.nodes[2].seconds *= 1.5;
+    robot.addPlan(edited);
+    passed &= syncTask.runScheduler(&robot, &station, &flexivLog, g_planName) == SUCCESS;
+    std::string regressed = station.planProfiler.summary(g_planName);
+    size_t slower = regressed.find("slower than before");
+    passed &= slower != std::string::npos && regressed.find("Press", slower) != std::string::npos
+              && regressed.find("Retract", slower) == std::string::npos
+              && regressed.find("Start", slower) == std::string::npos;
+    (passed ? log->info(regressed) : log->error("the edited node is not found: " + regressed));
+
+    // the report CommHandler writes after the plan
+    kostal::PlanProfiler::writeReport(kostal::PlanProfiler::reportPath(station.stationId),
+                                      station.planProfiler.report(), &flexivLog);
+    Json::Value report;
+    std::ifstream reportFile(kostal::PlanProfiler::reportPath(station.stationId));
+    Json::CharReaderBuilder builder;
+    std::string errors;
+    bool parsed = Json::parseFromStream(builder, reportFile, &report, &errors);
+    const Json::Value& plan = report["plans"][g_planName];
+    bool reported = parsed && plan["runs"].asUInt64() == runs + 1 && plan["nodes"].size() == g_nodeShares.size()
+                    && plan["nodes"][2]["node"] == "Press" && plan["nodes"][2]["path"] == "Lever/Press"
+                    && plan["nodes"][2]["share"].asDouble() > 0.5
+                    && plan["nodes"][2]["run_ms"]["count"].asUInt64() == runs + 1;
+    (reported ? log->info("the report holds " + plan["runs"].asString() + " runs, Press takes "
+                          + std::to_string(plan["nodes"][2]["share"].asDouble() * 100) + "% of the cycle")
+              : log->error("the report is wrong: " + errors));
+    return passed && reported;
+}
+
+/** A node name in two sub plans is profiled under each path with its own times */
+bool keepsRepeatedNames(kostal::Log* log)
+{
+    kostal::PlanProfiler profiler;
+    const int64_t ms = 1000000;
+    profiler.begin("Kostal-Lever-NORMAL");
+    profiler.enter("Move", "Lever/Move", 0);
+    profiler.enter("Move", "Base/Move", 10 * ms);
+    profiler.enter("Move", "Lever/Move", 40 * ms);
+    profiler.end(45 * ms);
+    const kostal::PlanProfile* profile = profiler.profile("Kostal-Lever-NORMAL");
+    bool passed = profile != nullptr && profile->nodes.size() == 2
+                  && profile->nodes[0].path == "Lever/Move" && profile->nodes[0].lastMs == 15
+                  && profile->nodes[0].visitTime.stats.count == 2
+                  && profile->nodes[1].path == "Base/Move" && profile->nodes[1].lastMs == 30;
+    Json::Value nodes = profiler.report()["plans"]["Kostal-Lever-NORMAL"]["nodes"];
+    passed &= nodes.size() == 2 && nodes[0]["path"] == "Lever/Move" && nodes[1]["path"] == "Base/Move";
+    (passed ? log->info("Move under Lever/ and Base/ is profiled as two nodes")
+            : log->error("the Move nodes of two sub plans are merged"));
+    return passed;
+}
+
+/** What profiling a plan adds after it ended */
+bool costsLittle(kostal::Log* log)
+{
+    // a plan of 40 nodes sampled at 1 kHz for 10 s
+    kostal::NodeTracker tracker;
+    tracker.configure(kostal::CaptureTrigger());
+    kostal::CaptureStore store;
+    store.reserve(10000);
+    for (int64_t i=0; i<10000; i++){
+        kostal::RobotSnapshot state;
+        state.timestamp = i * 1000000;
+        std::snprintf(state.nodeName, sizeof(state.nodeName), "Node%d", static_cast<int>(i / 250));
+        tracker.sample(state, &store);
+    }
+    kostal::PlanProfiler profiler;
+    flexiv::Log flexivLog;
+    std::string path = kostal::PlanProfiler::reportPath(9);
+    double stationUs = 0, longestUs = 0, writeUs = 0;
+    const int runs = 100;
+    for (int run=0; run<runs; run++){
+        // what the station does between the plan and the next one
+        auto start = Clock::now();
+        profiler.record(g_planName, tracker);
+        std::string summary = profiler.summary(g_planName);
+        Json::Value report = profiler.report();
+        double us = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+        stationUs += us;
+        longestUs = std::max(longestUs, us);
+        // what the export thread does
+        start = Clock::now();
+        kostal::PlanProfiler::writeReport(path, report, &flexivLog);
+        writeUs += std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+    }
+    bool passed = longestUs < 5000 && profiler.profile(g_planName)->nodes.size() == 40;
+    std::ostringstream line;
+    line << std::fixed << std::setprecision(0) << "profiling a plan of 40 nodes takes " << stationUs / runs
+         << " us on the station after the plan, at most " << longestUs << " us; writing the report "
+         << writeUs / runs << " us on the export thread";
+    (passed ? log->info(line.str()) : log->error(line.str() + ", more than 5 ms on the station"));
+    return passed;
+}
+
+}
+
+int main()
+{
+    kostal::Log log;
+    std::filesystem::create_directories(g_directory);
+    UPLOADADDRESS = g_directory;
+
+    bool passed = histogramIsClose(&log);
+    passed &= profilesRuns(&log);
+    passed &= keepsRepeatedNames(&log);
+    passed &= costsLittle(&log);
+    std::filesystem::remove_all(g_directory);
+    return passed ? 0 : 1;
+}
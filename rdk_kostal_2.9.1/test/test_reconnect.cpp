@@ -0,0 +1,197 @@
+/**
+ * @test test_reconnect.cpp
+ * Reconnect a Testman client to a kostal::CommHandler session after session
+ * on a kostal::SimulatedRobot with the synthetic spi source:
+ * - a handler that served a session has to keep the robot and the spi device,
+ *   the next session may not call the robot to set it up again nor open a new
+ *   spi source,
+ * - a fresh handler on a fresh robot has to set both up.
+ * How long the client waits from the first connect attempt until IDLE is
+ * reported for the kept handler and for fresh handlers, the robot answers
+ * every call after g_robotLatency like the robot server does.
+ * @copyright Copyright (C) 2016-2022 Flexiv Ltd. All Rights Reserved.
+ * @author lcc@Flexiv
+ */
+
+// Kostal header files
+#include <kostal/Communication.hpp>
+#include <kostal/SimulatedRobot.hpp>
+
+namespace {
+
+/** Sessions measured for every flow */
+const int g_sessionCount = 20;
+
+/** Latency of every call to the simulated robot */
+const std::chrono::milliseconds g_robotLatency(20);
+
+/** What a session left behind when the client got IDLE */
+struct SessionState
+{
+    int64_t latencyUs = -1;
+    uint64_t robotCalls = 0;
+    const kostal::SPISource* spiSource = nullptr;
+};
+
+/** Serve sessions with one handler as the main loop of the station does */
+void serveSessions(kostal::CommHandler* handler, kostal::RobotClient* robotPtr, int sessionCount)
+{
+    for (int i=0; i<sessionCount; i++){
+        Status result = handler->init(robotPtr);
+        if (result != SUCCESS && result != SYSTEM){
+            return;
+        }
+        handler->stateMachine(robotPtr);
+    }
+}
+
+/**
+ * Connect, send the handshake and one poll, start over when the station drops the
+ * connection, as Testman does, and hang up
+ * @return microseconds from the first connect attempt until IDLE is received, -1 if
+ * another answer came
+ */
+int64_t reconnectToIdle(const std::string& handshake, const std::string& poll)
+{
+    boost::asio::io_context ioContext;
+    boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::address_v4::loopback(), g_COMMPORT);
+    auto tic = std::chrono::steady_clock::now();
+    while (true){
+        boost::asio::ip::tcp::socket socket(ioContext);
+        boost::system::error_code ec;
+        socket.connect(endpoint, ec);
+        if (ec){
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+            continue;
+        }
+        try{
+            boost::asio::streambuf reply;
+            boost::asio::write(socket, boost::asio::buffer(handshake));
+            reply.consume(boost::asio::read_until(socket, reply, '\n'));
+            boost::asio::write(socket, boost::asio::buffer(poll));
+            size_t n = boost::asio::read_until(socket, reply, '\n');
+            auto toc = std::chrono::steady_clock::now();
+            std::string answer(static_cast<const char*>(reply.data().data()), n - 1);
+            if (answer != "IDLE"){
+                return -1;
+            }
+            return std::chrono::duration_cast<std::chrono::microseconds>(toc - tic).count();
+        }catch(std::exception&){
+            // the connection landed on a listener that was going away
+        }
+    }
+}
+
+std::string handshakeMessage()
+{
+    Json::Value config;
+    config[CPOL] = "0";
+    config[CPHA] = "1";
+    config[LSB] = "0";
+    config[SELP] = "0";
+    config[TOKEN] = g_TOKEN;
+    config[SPISOURCE] = "SYNTHETIC";
+    return Json::FastWriter().write(config);
+}
+
+std::string pollMessage()
+{
+    Json::Value query;
+    query[QUERYSTATUS] = "no";
+    return Json::FastWriter().write(query);
+}
+
+/** Run sessions through one handler, the station is left as each session found it */
+std::vector<SessionState> keptHandler(int sessionCount)
+{
+    kostal::SimulatedRobot robot;
+    robot.setLatency(g_robotLatency);
+    kostal::StationContext station;
+    kostal::CommHandler handler(&station);
+    std::thread stationThread(serveSessions, &handler, &robot, sessionCount);
+    std::vector<SessionState> sessions;
+    for (int i=0; i<sessionCount; i++){
+        SessionState session;
+        session.latencyUs = reconnectToIdle(handshakeMessage(), pollMessage());
+        session.robotCalls = robot.calls();
+        session.spiSource = station.spiSource.get();
+        sessions.push_back(session);
+    }
+    stationThread.join();
+    return sessions;
+}
+
+/** Run every session through a fresh handler on a fresh robot */
+std::vector<SessionState> freshHandlers(int sessionCount)
+{
+    std::vector<SessionState> sessions;
+    for (int i=0; i<sessionCount; i++){
+        kostal::SimulatedRobot robot;
+        robot.setLatency(g_robotLatency);
+        kostal::StationContext station;
+        kostal::CommHandler handler(&station);
+        std::thread stationThread(serveSessions, &handler, &robot, 1);
+        SessionState session;
+        session.latencyUs = reconnectToIdle(handshakeMessage(), pollMessage());
+        session.robotCalls = robot.calls();
+        session.spiSource = station.spiSource.get();
+        sessions.push_back(session);
+        stationThread.join();
+    }
+    return sessions;
+}
+
+/** Log p50 | max of the reconnect latencies, false if a session was not answered with IDLE */
+bool report(const std::string& name, const std::vector<SessionState>& sessions, kostal::Log* log)
+{
+    std::vector<int64_t> latencies;
+    for (const SessionState& session : sessions){
+        latencies.push_back(session.latencyUs);
+    }
+    if (latencies.empty() || std::find(latencies.begin(), latencies.end(), -1) != latencies.end()){
+        log->error(name + ": a session was not answered with IDLE");
+        return false;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    log->info(name + " reconnect to IDLE p50 | max = "
+              + std::to_string(latencies[latencies.size() / 2]) + " | "
+              + std::to_string(latencies.back()) + " us");
+    return true;
+}
+
+}
+
+int main()
+{
+    kostal::Log log;
+    // the robot is only called by the setup of a session
+    g_flightRecorder = false;
+    spdlog::set_level(spdlog::level::off);
+    std::vector<SessionState> kept = keptHandler(g_sessionCount);
+    std::vector<SessionState> fresh = freshHandlers(g_sessionCount);
+    spdlog::set_level(spdlog::level::info);
+
+    bool passed = report("kept handler", kept, &log);
+    passed &= report("fresh handler", fresh, &log);
+    if (!passed){
+        return 1;
+    }
+
+    // the first session sets the robot and the spi device up, the later ones reuse them
+    bool reused = kept[0].robotCalls > 0 && kept[0].spiSource != nullptr;
+    for (size_t i=1; i<kept.size(); i++){
+        reused &= kept[i].robotCalls == kept[0].robotCalls && kept[i].spiSource == kept[0].spiSource;
+    }
+    (reused ? log.info("the kept handler set the robot and the spi device up once in "
+                        + std::to_string(kept.size()) + " sessions")
+            : log.error("the kept handler set the robot or the spi device up again"));
+
+    // a fresh handler has to set both up
+    bool setUp = true;
+    for (const SessionState& session : fresh){
+        setUp &= session.robotCalls > 0 && session.spiSource != nullptr;
+    }
+    (setUp ? log.info("every fresh handler set the robot and the spi device up")
+           : log.error("a fresh handler did not set the robot or the spi device up"));
+    return reused && setUp ? 0 : 1;
+}
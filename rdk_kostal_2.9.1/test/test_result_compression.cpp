@@ -0,0 +1,286 @@
+/**
+ * @test test_result_compression.cpp
+ * Compress the results of a realistic capture while they are written. The
+ * capture runs the nodes of SimulatedRobot::kostalPlan for 60 s at 1 kHz with
+ * the noise of a real force sensor and tcp, and LEVER spi frames. The result
+ * csv and the binary capture file are written with every compression and
+ * level, decompressed and compared with the uncompressed files byte by byte,
+ * and the throughput and compression ratio of each are reported. Then a plan is
+ * streamed with compression by kostal::ResultStreamer: the file has to decompress
+ * to the one written after the plan, and finishing it may not take longer than
+ * compressing the whole result after the plan would.
+ * @copyright Copyright (C) 2016-2022 Flexiv Ltd. All Rights Reserved.
+ * @author lcc@Flexiv
+ */
+
+// Kostal header files
+#include <kostal/KostalLogger.hpp>
+#include <kostal/ResultStreamer.hpp>
+#include <kostal/CaptureFile.hpp>
+#include <kostal/SimulatedRobot.hpp>
+
+#include <filesystem>
+#include <random>
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+const std::string g_directory = "/tmp/test_result_compression/";
+
+/** Samples of the compressed plan, 60 s at 1 kHz */
+const size_t g_planSamples = 60000;
+
+/** Samples of the streamed plan, captured 10 per ms of real time */
+const size_t g_streamSamples = 20000;
+const size_t g_speedUp = 10;
+
+/** The tcp and force of a sample of the kostal plan, with the noise of the sensors */
+class RealisticSamples
+{
+private:
+    kostal::SimulatedPlan m_plan = kostal::SimulatedRobot::kostalPlan("Kostal-MainPlan", g_planSamples / 1000.0);
+    std::mt19937_64 m_random{22};
+    std::normal_distribution<double> m_positionNoise{0.0, 2e-6};
+    std::normal_distribution<double> m_angleNoise{0.0, 1e-5};
+    std::normal_distribution<double> m_forceNoise{0.0, 0.05};
+    uint64_t m_spiRandom = 0;
+
+public:
+    /**
+     * @param[in] i the sample, one per ms
+     * @param[out] tcp, flange, force the sample
+     * @return the node of the sample
+     */
+    const std::string& sample(size_t i, double* tcp, double* flange, double* force)
+    {
+        double elapsed = i / 1000.0;
+        const kostal::SimulatedNode* node = &m_plan.nodes.back();
+        for (const kostal::SimulatedNode& candidate : m_plan.nodes){
+            if (elapsed < candidate.seconds){
+                node = &candidate;
+                break;
+            }
+            elapsed -= candidate.seconds;
+        }
+        double fraction = std::min(1.0, elapsed / node->seconds);
+        double norm = 0;
+        for (int j=0; j<7; j++){
+            tcp[j] = node->tcpStart[j] + (node->tcpEnd[j] - node->tcpStart[j]) * fraction
+                     + (j < 3 ? m_positionNoise(m_random) : m_angleNoise(m_random));
+            norm += j >= 3 ? tcp[j] * tcp[j] : 0;
+        }
+        for (int j=0; j<7; j++){
+            tcp[j] /= j >= 3 ? std::sqrt(norm) : 1;
+            // the tool is 0.1 m long along z
+            flange[j] = tcp[j] + (j == 2 ? 0.1 : 0);
+        }
+        for (int j=0; j<6; j++){
+            force[j] = node->forceStart[j] + (node->forceEnd[j] - node->forceStart[j]) * fraction
+                       + m_forceNoise(m_random) * (j < 3 ? 1 : 0.01);
+        }
+        return node->name;
+    }
+
+    /** The spi frame of the lever at sample i */
+    void frame(size_t i, uint8_t* frame)
+    {
+        kostal::SyntheticSPISource::makeFrame("LEVER", i, 1000, &m_spiRandom, frame);
+    }
+};
+
+void makeCapture(kostal::CaptureStore* capture, kostal::SPIFrameStore* spiFrames)
+{
+    RealisticSamples samples;
+    capture->reserve(g_planSamples);
+    spiFrames->reserve(g_planSamples);
+    double tcp[7], flange[7], force[6];
+    uint8_t frame[16];
+    for (size_t i=0; i<g_planSamples; i++){
+        const std::string& node = samples.sample(i, tcp, flange, force);
+        int64_t timestamp = static_cast<int64_t>(i) * 1000000;
+        capture->append(tcp, flange, force, capture->internNode(node), timestamp);
+        samples.frame(i, frame);
+        spiFrames->append(frame, timestamp + 300000, i);
+    }
+}
+
+std::string readFile(const std::string& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    std::stringstream content;
+    content << file.rdbuf();
+    return content.str();
+}
+
+/** Decompress a file written by a CompressedFile, gzip or zstd by its extension */
+std::string decompress(const std::string& path)
+{
+    std::string compressed = readFile(path);
+    std::string content;
+    std::vector<char> buffer(1 << 16);
+    if (path.size() > 3 && path.compare(path.size() - 3, 3, ".gz") == 0){
+        z_stream stream = {};
+        inflateInit2(&stream, 15 + 16);
+        stream.next_in = reinterpret_cast<Bytef*>(compressed.data());
+        stream.avail_in = static_cast<uInt>(compressed.size());
+        int result = Z_OK;
+        while (result == Z_OK){
+            stream.next_out = reinterpret_cast<Bytef*>(buffer.data());
+            stream.avail_out = static_cast<uInt>(buffer.size());
+            result = inflate(&stream, Z_NO_FLUSH);
+            content.append(buffer.data(), buffer.size() - stream.avail_out);
+        }
+        inflateEnd(&stream);
+        return result == Z_STREAM_END ? content : "";
+    }
+#ifdef KOSTAL_WITH_ZSTD
+    if (path.size() > 4 && path.compare(path.size() - 4, 4, ".zst") == 0){
+        ZSTD_DCtx* context = ZSTD_createDCtx();
+        ZSTD_inBuffer input = {compressed.data(), compressed.size(), 0};
+        size_t result = 1;
+        while (input.pos < input.size && !ZSTD_isError(result)){
+            ZSTD_outBuffer output = {buffer.data(), buffer.size(), 0};
+            result = ZSTD_decompressStream(context, &output, &input);
+            content.append(buffer.data(), output.pos);
+        }
+        ZSTD_freeDCtx(context);
+        return ZSTD_isError(result) || result != 0 ? "" : content;
+    }
+#endif
+    return compressed;
+}
+
+/** The compressions that are measured, the default level and faster and stronger ones */
+std::vector<kostal::ResultCompression> compressions()
+{
+    std::vector<kostal::ResultCompression> all = {{kostal::NOCOMPRESSION, 0}, {kostal::GZIP, 1},
+                                                  {kostal::GZIP, 0}, {kostal::GZIP, 9}};
+    if (kostal::ResultCompression::zstdAvailable()){
+        all.insert(all.end(), {{kostal::ZSTD, 0}, {kostal::ZSTD, 3}, {kostal::ZSTD, 9}});
+    }
+    return all;
+}
+
+std::string name(const kostal::ResultCompression& compression)
+{
+    const char* names[] = {"none", "gzip", "zstd"};
+    return std::string(names[compression.method])
+           + (compression.method == kostal::NOCOMPRESSION ? "" : " " + std::to_string(compression.effectiveLevel()));
+}
+
+/**
+ * Write the result in every compression, check it decompresses to the uncompressed one
+ * and report size and speed
+ * @param[in] write writes the result with a compression, returns its path
+ */
+template <class Write>
+bool measure(const std::string& kind, Write write, kostal::Log* log)
+{
+    std::string plain;
+    bool passed = true;
+    for (const kostal::ResultCompression& compression : compressions()){
+        std::string path;
+        auto start = Clock::now();
+        Status result = write(compression, &path);
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        std::string content = decompress(path);
+        if (compression.method == kostal::NOCOMPRESSION){
+            plain = content;
+        }
+        bool same = result == SUCCESS && !plain.empty() && content == plain;
+        passed &= same;
+        double bytes = std::filesystem::file_size(path);
+        std::ostringstream line;
+        line << kind << " " << std::left << std::setw(7) << name(compression) << std::right << std::fixed
+             << std::setprecision(2) << std::setw(8) << bytes / 1e6 << " MB, ratio " << std::setw(5)
+             << plain.size() / bytes << ", " << std::setw(7) << seconds * 1e3 << " ms, " << std::setw(7)
+             << plain.size() / seconds / 1e6 << " MB/s of result";
+        (same ? log->info(line.str()) : log->error(line.str() + ", differs after decompression"));
+        std::filesystem::remove(path);
+    }
+    return passed;
+}
+
+/** Stream a plan with compression, the file has to decompress to the one written after the plan */
+bool checkStreamed(flexiv::Log* flexivLog, kostal::Log* log)
+{
+    kostal::ResultCompression compression;
+    compression.method = kostal::ResultCompression::zstdAvailable() ? kostal::ZSTD : kostal::GZIP;
+    kostal::StationContext station;
+    station.capture.reserve(g_streamSamples);
+    station.spiFrames.reserve(g_streamSamples);
+    kostal::ResultStreamer streamer;
+    if (streamer.begin(&station, kostal::TaskRequest{"NORMAL", "Kostal-Streamed"}, flexivLog, compression) != SUCCESS){
+        log->error("The streamed result file is not created");
+        return false;
+    }
+    RealisticSamples samples;
+    double tcp[7], flange[7], force[6];
+    uint8_t frame[16];
+    int64_t planStart = kostal::captureTime();
+    for (size_t i=0; i<g_streamSamples; i++){
+        const std::string& node = samples.sample(i, tcp, flange, force);
+        int64_t sampleTime = planStart + static_cast<int64_t>(i) * 1000000;
+        station.capture.append(tcp, flange, force, station.capture.internNode(node), sampleTime);
+        samples.frame(i, frame);
+        {
+            std::lock_guard<std::mutex> lock(station.spiMutex);
+            station.spiFrames.append(frame, sampleTime + 300000, i);
+        }
+        if (i % g_speedUp == g_speedUp - 1){
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    std::string streamedPath;
+    Status streamed = streamer.finish(&streamedPath, flexivLog);
+
+    auto start = Clock::now();
+    kostal::WriteExcelHandler writer;
+    std::string writtenPath;
+    Status written = writer.writeDataToExcel("NORMAL", "Kostal-After", &station.capture, &station.spiFrames,
+                                             flexivLog, &writtenPath, compression);
+    double afterUs = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+    std::string extension = compression.extension();
+    bool passed = streamed == SUCCESS && written == SUCCESS && !decompress(streamedPath).empty()
+                  && decompress(streamedPath) == decompress(writtenPath)
+                  && streamedPath.compare(streamedPath.size() - extension.size(), extension.size(), extension) == 0
+                  && std::filesystem::exists(kostal::WriteExcelHandler::summaryPath(streamedPath))
+                  && streamer.finishTime() < afterUs;
+    std::string line = "streamed " + name(compression) + ": plan end to file ready " + std::to_string(streamer.finishTime())
+                       + " us, compressed after the plan " + std::to_string(static_cast<int64_t>(afterUs)) + " us";
+    (passed ? log->info(line) : log->error(line + ", the streamed file differs or is late"));
+    return passed;
+}
+
+}
+
+int main()
+{
+    kostal::Log log;
+    flexiv::Log flexivLog;
+    std::filesystem::create_directories(g_directory + "NORMAL");
+    UPLOADADDRESS = g_directory;
+
+    kostal::CaptureStore capture;
+    kostal::SPIFrameStore spiFrames;
+    makeCapture(&capture, &spiFrames);
+
+    kostal::WriteExcelHandler csvWriter;
+    bool passed = measure("csv ", [&](const kostal::ResultCompression& compression, std::string* path){
+        return csvWriter.writeDataToExcel("NORMAL", "Kostal-Compressed", &capture, &spiFrames, &flexivLog, path, compression);
+    }, &log);
+
+    kostal::CaptureFileWriter captureWriter;
+    kostal::CaptureFileInfo info;
+    info.taskType = "NORMAL";
+    info.taskName = "Kostal-Compressed";
+    passed &= measure("kcap", [&](const kostal::ResultCompression& compression, std::string* path){
+        *path = kostal::CaptureFileWriter::capturePath(info.taskType, info.taskName) + compression.extension();
+        return captureWriter.write(*path, info, capture, spiFrames, &flexivLog, compression);
+    }, &log);
+
+    passed &= checkStreamed(&flexivLog, &log);
+    std::filesystem::remove_all(g_directory);
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,154 @@
+/**
+ * @test test_result_export.cpp
+ * Benchmark a station that writes its results on the kostal::ResultExporter
+ * thread against one that writes them before it takes the next plan. The
+ * simulated robot fills the capture stores of a kostal::StationContext at 1 kHz,
+ * the result writer only checks the rows and sleeps for the export time. Also
+ * checks that every capture set holds the rows of its own plan only, results
+ * are reported in plan order, a failed export is reported without stopping the
+ * next plan and a slow disk never has more than g_captureSetCount sets in flight.
+ * @copyright Copyright (C) 2016-2022 Flexiv Ltd. All Rights Reserved.
+ * @author lcc@Flexiv
+ */
+
+// Kostal header files
+#include <kostal/KostalLogger.hpp>
+#include <kostal/ResultExporter.hpp>
+#include <kostal/RobotOperation.hpp>
+
+namespace {
+
+/** Plans run in every mode */
+const int g_planCount = 20;
+
+/** Samples one simulated plan collects at 1 kHz */
+const int g_planSamples = 40;
+
+/** The task whose result can not be written */
+const std::string g_brokenTask = "Variant7";
+
+typedef std::chrono::steady_clock Clock;
+
+struct Report
+{
+    std::vector<std::string> order;
+    std::vector<std::string> failed;
+    int maxInFlight = 0;
+};
+
+/** Collect the rows of one plan the way the robot and spi threads do */
+void runPlan(kostal::StationContext* station, const kostal::TaskRequest& task)
+{
+    for (int i=0; i<g_planSamples; i++){
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        const double pose[7] = {0};
+        std::lock_guard<std::mutex> lock(station->dataMutex);
+        const uint8_t frame[16] = {0};
+        station->capture.append(pose, pose, pose, station->capture.internNode(task.taskName), kostal::captureTime());
+        station->spiFrames.append(frame, kostal::captureTime(), i);
+    }
+}
+
+/** A writer that takes exportTime and fails for rows of another plan and for the broken task */
+kostal::ResultExporter::Writer simulatedWriter(std::chrono::milliseconds exportTime, std::atomic<int>* inFlight, Report* report)
+{
+    return [=](kostal::CaptureSet* capture, std::string* resultPath){
+        report->maxInFlight = std::max(report->maxInFlight, inFlight->load());
+        std::this_thread::sleep_for(exportTime);
+        bool ownRows = capture->capture.size() == g_planSamples && capture->spiFrames.size() == g_planSamples;
+        for (size_t row = 0; row < capture->capture.size(); row++){
+            ownRows &= capture->capture.nodeName(row) == capture->task.taskName;
+        }
+        if (!ownRows || capture->task.taskName == g_brokenTask){
+            return CSV;
+        }
+        *resultPath = UPLOADADDRESS + capture->task.taskType + "/" + capture->task.taskName + ".csv";
+        return SUCCESS;
+    };
+}
+
+/**
+ * Run all plans, the result is written on the export thread or before the next plan
+ * @return the average microseconds from the end of a plan until the station is free again
+ */
+double runStation(bool overlap, std::chrono::milliseconds exportTime, double* partsPerHour, Report* report)
+{
+    kostal::StationContext station;
+    std::atomic<int> inFlight = {0};
+    kostal::ResultExporter exporter(simulatedWriter(exportTime, &inFlight, report));
+    std::mutex reportMutex;
+    auto onExported = [&](const kostal::TaskRequest& task, Status result, const std::string&){
+        inFlight--;
+        std::lock_guard<std::mutex> lock(reportMutex);
+        report->order.push_back(task.taskName);
+        if (result != SUCCESS){
+            report->failed.push_back(task.taskName);
+        }
+    };
+
+    double freeAfterPlan = 0;
+    auto tic = Clock::now();
+    for (int i=0; i<g_planCount; i++){
+        kostal::TaskRequest task{"NORMAL", "Variant" + std::to_string(i)};
+        runPlan(&station, task);
+        auto planEnd = Clock::now();
+        inFlight++;
+        exporter.exportCapture(&station, task, onExported);
+        if (!overlap){
+            exporter.wait();
+        }
+        freeAfterPlan += std::chrono::duration<double, std::micro>(Clock::now() - planEnd).count();
+    }
+    exporter.wait();
+    double seconds = std::chrono::duration<double>(Clock::now() - tic).count();
+    *partsPerHour = g_planCount / seconds * 3600;
+    return freeAfterPlan / g_planCount;
+}
+
+bool check(const std::string& name, const Report& report, kostal::Log* log)
+{
+    bool passed = static_cast<int>(report.order.size()) == g_planCount;
+    for (int i=0; passed && i<g_planCount; i++){
+        passed = report.order[i] == "Variant" + std::to_string(i);
+    }
+    if (!passed){
+        log->error(name + ": the results were not reported in plan order");
+        return false;
+    }
+    if (report.failed != std::vector<std::string>{g_brokenTask}){
+        log->error(name + ": " + std::to_string(report.failed.size())
+                   + " exports failed, a capture set held rows of another plan");
+        return false;
+    }
+    if (report.maxInFlight > static_cast<int>(g_captureSetCount)){
+        log->error(name + ": " + std::to_string(report.maxInFlight) + " capture sets were in flight");
+        return false;
+    }
+    return true;
+}
+
+bool benchmark(const std::string& name, std::chrono::milliseconds exportTime, kostal::Log* log)
+{
+    double serialParts, overlapParts;
+    Report serialReport, overlapReport;
+    double serialFree = runStation(false, exportTime, &serialParts, &serialReport);
+    double overlapFree = runStation(true, exportTime, &overlapParts, &overlapReport);
+    log->info(name + " export then next plan: " + std::to_string(static_cast<int64_t>(serialParts))
+              + " parts per hour, free " + std::to_string(static_cast<int64_t>(serialFree)) + " us after a plan");
+    log->info(name + " export overlapped:     " + std::to_string(static_cast<int64_t>(overlapParts))
+              + " parts per hour, free " + std::to_string(static_cast<int64_t>(overlapFree)) + " us after a plan, "
+              + std::to_string(overlapReport.maxInFlight) + " sets in flight at most");
+    return check(name + " serial", serialReport, log) && check(name + " overlapped", overlapReport, log);
+}
+
+}
+
+int main()
+{
+    kostal::Log log;
+    bool passed = true;
+    passed &= benchmark("fast disk", std::chrono::milliseconds(20), &log);
+    // the exporter falls behind, the handover has to wait for a free capture set
+    passed &= benchmark("slow disk", std::chrono::milliseconds(80), &log);
+    return passed ? 0 : 1;
+}
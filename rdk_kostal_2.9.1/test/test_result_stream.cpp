@@ -0,0 +1,131 @@
+/**
+ * @test test_result_stream.cpp
+ * Compare the kostal::ResultStreamer, which writes the result file while the
+ * plan runs, with writing the whole file after the plan as before. A plan of
+ * 60 s at 1 kHz is captured into a kostal::StationContext ten times faster
+ * than real time, the samples by one thread without locks as the sampling task
+ * does and the spi frames under the spi lock every 5 ms as the supervision task
+ * does. The streamed file has to be the same as the one written after the
+ * plan, and the time from the plan end to the file being ready is reported
+ * for both, along with the longest append while the streamer copies. The
+ * streamed file is published on another thread as the station leaves it to
+ * the export thread, syncing it to the disk is reported apart.
+ * @copyright Copyright (C) 2016-2022 Flexiv Ltd. All Rights Reserved.
+ * @author lcc@Flexiv
+ */
+
+// Kostal header files
+#include <kostal/KostalLogger.hpp>
+#include <kostal/ResultStreamer.hpp>
+
+#include <filesystem>
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+/** Samples of the plan, 60 s at 1 kHz */
+const size_t g_planSamples = 60000;
+
+/** Samples captured per ms of real time */
+const size_t g_speedUp = 10;
+
+const std::vector<std::string> g_nodes = {"Start", "Press", "Hold", "Release"};
+
+/**
+ * Capture the plan like the sampling and supervision tasks do
+ * @return the longest append in ns
+ */
+double runPlan(kostal::StationContext* station)
+{
+    double longest = 0;
+    double pose[7] = {0.5, 0.1, 0.3, 1, 0, 0, 0};
+    double force[6] = {};
+    std::vector<uint8_t> frame(16);
+    int64_t planStart = kostal::captureTime();
+    for (size_t i=0; i<g_planSamples; i++){
+        int64_t sampleTime = planStart + static_cast<int64_t>(i) * 1000000;
+        pose[2] -= 1e-6;
+        force[2] = 0.001 * static_cast<double>(i % 500);
+        uint32_t node = station->capture.internNode(g_nodes[i * g_nodes.size() / g_planSamples]);
+        auto start = Clock::now();
+        station->capture.append(pose, pose, force, node, sampleTime);
+        longest = std::max(longest, std::chrono::duration<double, std::nano>(Clock::now() - start).count());
+        if (i % 5 == 4){
+            std::lock_guard<std::mutex> lock(station->spiMutex);
+            for (size_t j=i-4; j<=i; j++){
+                frame[0] = static_cast<uint8_t>(j);
+                station->spiFrames.append(frame.data(), planStart + static_cast<int64_t>(j) * 1000000 + 300000, j);
+            }
+        }
+        if (i % g_speedUp == g_speedUp - 1){
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    return longest;
+}
+
+std::string readFile(const std::string& path)
+{
+    std::ifstream file(path);
+    std::stringstream content;
+    content << file.rdbuf();
+    return content.str();
+}
+
+}
+
+int main()
+{
+    kostal::Log log;
+    flexiv::Log flexivLog;
+    std::string directory = "/tmp/test_result_stream/";
+    std::filesystem::create_directories(directory + "NORMAL");
+    UPLOADADDRESS = directory;
+
+    kostal::StationContext station;
+    station.capture.reserve(g_planSamples);
+    station.spiFrames.reserve(g_planSamples);
+    kostal::ResultStreamer streamer;
+    kostal::TaskRequest task{"NORMAL", "Kostal-Streamed"};
+    if (streamer.begin(&station, task, &flexivLog) != SUCCESS){
+        log.error("The streamed result file is not created");
+        return 1;
+    }
+    double longestAppend = runPlan(&station);
+    std::string streamedPath;
+    std::function<Status()> publish;
+    Status streamed = streamer.finish(&streamedPath, &flexivLog, &publish);
+    auto publishStart = Clock::now();
+    streamed = streamed == SUCCESS ? std::async(std::launch::async, publish).get() : streamed;
+    double publishUs = std::chrono::duration<double, std::micro>(Clock::now() - publishStart).count();
+
+    // the same plan written after it ended
+    auto planEnd = Clock::now();
+    kostal::WriteExcelHandler writer;
+    std::string writtenPath;
+    Status written = writer.writeDataToExcel("NORMAL", "Kostal-After", &station.capture, &station.spiFrames,
+                                             &flexivLog, &writtenPath);
+    double afterUs = std::chrono::duration<double, std::micro>(Clock::now() - planEnd).count();
+
+    bool passed = streamed == SUCCESS && written == SUCCESS;
+    bool same = passed && readFile(streamedPath) == readFile(writtenPath)
+                && readFile(kostal::WriteExcelHandler::summaryPath(streamedPath))
+                   == readFile(kostal::WriteExcelHandler::summaryPath(writtenPath));
+    std::filesystem::remove_all(directory);
+
+    log.info("plan end to file ready: " + std::to_string(streamer.finishTime()) + " us streamed, "
+             + std::to_string(static_cast<int64_t>(afterUs)) + " us written after the plan, "
+             + std::to_string(static_cast<int64_t>(publishUs)) + " us to publish the streamed file on the export thread");
+    log.info(std::to_string(streamer.streamedRows()) + " of " + std::to_string(g_planSamples)
+             + " rows written while the plan ran, longest append " + std::to_string(longestAppend) + " ns");
+    if (!same){
+        log.error("The streamed result is not the same as the one written after the plan");
+        return 1;
+    }
+    if (streamer.streamedRows() < g_planSamples / 2 || streamer.finishTime() >= afterUs){
+        log.error("The result was not streamed while the plan ran");
+        return 1;
+    }
+    return 0;
+}
@@ -13,13 +13,14 @@ int main(){
     Status result;
     try{
         //we check robot connection and set robot to plan execution mode
-        flexiv::Robot robot(ROBOTADDRESS, LOCALADDRESS);
+        kostal::FlexivRobotClient robot(ROBOTADDRESS, LOCALADDRESS);
         
+        // Instantiation the com object, it keeps the listener, robot and spi device
+        // alive across client sessions
+        kostal::CommHandler com;
+
         while(true)
         {
-            // Instantiation the com object
-            kostal::CommHandler com;
-           
             // 1st Initialize the server
             result = com.init(&robot);
             if (result == SYSTEM){
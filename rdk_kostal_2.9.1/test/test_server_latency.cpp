@@ -0,0 +1,189 @@
+/**
+ * @test test_server_latency.cpp
+ * A benchmark of the status poll round trip between Testman and kostal::Server.
+ * The legacy server starts one std::async thread per request, the current one
+ * serves every request on its long-lived io thread. Both are polled over
+ * loopback and the p50/p99 request latency and the CPU time are printed.
+ * @copyright Copyright (C) 2016-2022 Flexiv Ltd. All Rights Reserved.
+ * @author lcc@Flexiv
+ */
+
+// Kostal header files
+#include <kostal/SyncServer.hpp>
+
+#include <sys/resource.h>
+
+namespace {
+
+/** Number of status polls sent to each server */
+const int g_pollCount = 5000;
+
+/** Port used by this benchmark, so that a running station is not disturbed */
+const unsigned short g_benchPort = 6070;
+
+/**
+ * The request path of kostal::Server before it was moved to the io thread,
+ * one std::async thread per request and a blocking read_some in it
+ */
+class LegacyServer
+{
+public:
+    Status init(unsigned short port)
+    {
+        boost::asio::ip::tcp::acceptor acceptor(m_ioContext,
+            boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), port));
+        m_socketPtr = std::make_unique<boost::asio::ip::tcp::socket>(m_ioContext);
+        acceptor.accept(*m_socketPtr);
+        char buffer[g_MSGMAXSIZE];
+        m_socketPtr->read_some(boost::asio::buffer(buffer, g_MSGMAXSIZE), m_ec);
+        std::string reply = "received";
+        boost::asio::write(*m_socketPtr, boost::asio::buffer(reply), m_ec);
+        return m_ec ? SOCKET : SUCCESS;
+    }
+
+    Status recv()
+    {
+        char buffer[g_MSGMAXSIZE];
+        size_t readLength = m_socketPtr->read_some(boost::asio::buffer(buffer, g_MSGMAXSIZE), m_ec);
+        if (m_ec){
+            return SOCKET;
+        }
+        m_recvMsg = "";
+        for (size_t i=0; i<readLength; i++){
+            m_recvMsg += buffer[i];
+        }
+        boost::asio::write(*m_socketPtr, boost::asio::buffer(m_replyMsg), m_ec);
+        return m_ec ? SOCKET : SUCCESS;
+    }
+
+    Status monitor()
+    {
+        auto result = std::async(&LegacyServer::recv, this);
+        if (result.wait_for(std::chrono::seconds(g_timeoutInterval)) != std::future_status::ready){
+            return SOCKET;
+        }
+        return result.get();
+    }
+
+    void setReplyMsg(std::string reply)
+    {
+        m_replyMsg = reply;
+    }
+
+private:
+    boost::asio::io_context m_ioContext;
+    std::unique_ptr<boost::asio::ip::tcp::socket> m_socketPtr;
+    boost::system::error_code m_ec;
+    std::string m_recvMsg;
+    std::string m_replyMsg;
+};
+
+/** CPU time (user + system) consumed by this process in microseconds */
+int64_t processCpuTime()
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000LL
+           + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+/**
+ * Connect to the server, send the handshake and then the status polls
+ * @return round trip time of every poll in microseconds
+ */
+std::vector<int64_t> runClient(unsigned short port)
+{
+    boost::asio::io_context ioContext;
+    boost::asio::ip::tcp::socket socket(ioContext);
+    boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::address_v4::loopback(), port);
+    boost::system::error_code ec;
+    // the server may still be opening its acceptor
+    for (int i=0; i<1000; i++){
+        socket.connect(endpoint, ec);
+        if (!ec) break;
+        socket.close();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    Json::Value config;
+    config[CPOL] = "0";
+    config[CPHA] = "1";
+    config[LSB] = "0";
+    config[SELP] = "0";
+    config[TOKEN] = g_TOKEN;
+    std::string handshake = Json::FastWriter().write(config);
+    char reply[g_MSGMAXSIZE];
+    boost::asio::write(socket, boost::asio::buffer(handshake));
+    socket.read_some(boost::asio::buffer(reply, g_MSGMAXSIZE));
+
+    Json::Value poll;
+    poll[QUERYSTATUS] = "no";
+    poll[TASKTYPE] = "NORMAL";
+    poll[TASKNAME] = "Kostal-MainPlan";
+    std::string request = Json::FastWriter().write(poll);
+
+    std::vector<int64_t> latency;
+    latency.reserve(g_pollCount);
+    for (int i=0; i<g_pollCount; i++){
+        auto tic = std::chrono::steady_clock::now();
+        boost::asio::write(socket, boost::asio::buffer(request));
+        socket.read_some(boost::asio::buffer(reply, g_MSGMAXSIZE));
+        auto toc = std::chrono::steady_clock::now();
+        latency.push_back(std::chrono::duration_cast<std::chrono::microseconds>(toc - tic).count());
+    }
+    socket.close();
+    return latency;
+}
+
+/** Print the percentiles of the measured latency and the consumed CPU time */
+void report(const std::string& name, std::vector<int64_t> latency, int64_t cpuTime, kostal::Log* log)
+{
+    std::sort(latency.begin(), latency.end());
+    auto percentile = [&latency](double p){
+        return latency[static_cast<size_t>(p * (latency.size() - 1))];
+    };
+    log->info(name + " request latency p50 | p99 | max = "
+              + std::to_string(percentile(0.5)) + " | "
+              + std::to_string(percentile(0.99)) + " | "
+              + std::to_string(latency.back()) + " us, CPU time per request = "
+              + std::to_string(cpuTime / static_cast<int64_t>(latency.size())) + " us");
+}
+
+/**
+ * Answer all polls with the given server while a client measures them
+ * @param[in] initialize accepts the client and performs the handshake
+ */
+template <typename ServerType>
+void benchmark(const std::string& name, ServerType* server, std::function<Status()> initialize,
+               unsigned short port, kostal::Log* log)
+{
+    Status result = SUCCESS;
+    std::thread acceptor([&]{ result = initialize(); });
+    std::vector<int64_t> latency;
+    int64_t cpuStart = processCpuTime();
+    std::thread client([&]{ latency = runClient(port); });
+    acceptor.join();
+    for (int i=0; i<g_pollCount && result==SUCCESS; i++){
+        server->setReplyMsg("IDLE");
+        result = server->monitor();
+    }
+    client.join();
+    report(name, latency, processCpuTime() - cpuStart, log);
+}
+
+}
+
+int main()
+{
+    kostal::Log log;
+
+    LegacyServer legacy;
+    benchmark("std::async per request", &legacy,
+              [&]{ return legacy.init(g_benchPort); }, g_benchPort, &log);
+
+    kostal::Server server;
+    server.setPortNumber(g_benchPort + 1);
+    benchmark("asio io thread", &server,
+              [&]{ return server.init(); }, g_benchPort + 1, &log);
+    return 0;
+}
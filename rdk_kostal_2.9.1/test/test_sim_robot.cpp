@@ -0,0 +1,238 @@
+/**
+ * @test test_sim_robot.cpp
+ * Run whole kostal tasks without a Rizon or USB-SPI adapter, so the cycle time
+ * of a task can be followed in CI:
+ * - A kostal::SimulatedRobot runs the plan, a synthetic source streams the
+ *   spi frames, SyncTaskHandler samples both at 1 kHz as on a station.
+ * - Every task is exported by the ResultExporter into a csv file.
+ * - The samples have to cover the plan from Start to Stop at 1 kHz.
+ * - The time from executing a plan to its result file is reported, with and
+ *   without the rpc latency of a real robot.
+ * A robot slower than the sampling interval has to show up as stalls of the
+ * sampling task in the supervision.
+ * Then the injected faults have to end a task with ROBOT: a fault node, a
+ * call that throws, a lost connection and an unknown plan.
+ * @copyright Copyright (C) 2016-2022 Flexiv Ltd. All Rights Reserved.
+ * @author lcc@Flexiv
+ */
+
+// Kostal header files
+#include <kostal/KostalLogger.hpp>
+#include <kostal/SimulatedRobot.hpp>
+#include <kostal/SyncTask.hpp>
+#include <kostal/ResultExporter.hpp>
+
+#include <filesystem>
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+/** Tasks run in every latency setting */
+const int g_taskCount = 5;
+
+/** Duration of the simulated plan */
+const double g_planSeconds = 0.5;
+
+const std::string g_planName = "Kostal-MainPlan-NORMAL";
+
+/** The samples of one plan, Start and Press are collected */
+size_t expectedSamples()
+{
+    double seconds = 0;
+    for (const kostal::SimulatedNode& node : kostal::SimulatedRobot::kostalPlan(g_planName, g_planSeconds).nodes){
+        if (node.name == "Start" || node.name == "Press"){
+            seconds += node.seconds;
+        }
+    }
+    return static_cast<size_t>(seconds * 1000 / g_samplingInterval);
+}
+
+struct Cycles
+{
+    double mean = 0;
+    double max = 0;
+};
+
+bool setUp(kostal::SimulatedRobot* robot, kostal::StationContext* station, kostal::Log* log)
+{
+    robot->addPlan(kostal::SimulatedRobot::kostalPlan(g_planName, g_planSeconds));
+    robot->setMode(flexiv::MODE_PLAN_EXECUTION);
+    station->robotPtr = robot;
+    station->spiConfig.source = "SYNTHETIC";
+    kostal::SPIOperationHandler spiHandler;
+    if (spiHandler.buildSPIConnection(station) != SUCCESS){
+        log->error("The synthetic source can not be connected");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Run tasks back to back as CommHandler does and measure each from executing the plan
+ * to its written result
+ */
+bool runTasks(std::chrono::microseconds latency, Cycles* cycles, kostal::Log* log)
+{
+    kostal::SimulatedRobot robot;
+    kostal::StationContext station;
+    if (!setUp(&robot, &station, log)){
+        return false;
+    }
+    robot.setLatency(latency, latency / 5);
+    kostal::SyncTaskHandler stHandler;
+    kostal::ResultExporter exporter;
+    flexiv::Log flexivLog;
+    kostal::TaskRequest task{"NORMAL", "Kostal-MainPlan"};
+    bool passed = true;
+    for (int i=0; i<g_taskCount; i++){
+        auto start = Clock::now();
+        if (stHandler.runScheduler(&robot, &station, &flexivLog, g_planName) != SUCCESS){
+            log->error("The simulated task failed");
+            return false;
+        }
+        size_t samples = station.capture.size();
+        size_t frames = station.spiFrames.size();
+        // the first and last sample may fall on either side of a node boundary
+        bool complete = std::abs(static_cast<double>(samples) - expectedSamples()) <= expectedSamples() * 0.05 + 2
+                        && frames > 0;
+        if (complete){
+            // the press moves the tcp down and raises the force
+            const double* first = station.capture.tcpPose(0);
+            const double* last = station.capture.tcpPose(samples - 1);
+            complete = last[2] < first[2] && station.capture.rawForce(samples - 1)[2] > 15;
+        }
+        Status exported = CSV;
+        std::string resultPath;
+        std::promise<void> written;
+        exporter.exportCapture(&station, task, [&](const kostal::TaskRequest&, Status result, const std::string& path){
+            exported = result;
+            resultPath = path;
+            written.set_value();
+        });
+        written.get_future().wait();
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        cycles->mean += seconds / g_taskCount;
+        cycles->max = std::max(cycles->max, seconds);
+        if (!complete || exported != SUCCESS){
+            log->error("Task " + std::to_string(i) + ": " + std::to_string(samples) + " samples of "
+                       + std::to_string(expectedSamples()) + ", " + std::to_string(frames)
+                       + " spi frames, export status " + std::to_string(exported));
+            passed = false;
+        }
+        std::remove(resultPath.c_str());
+    }
+    return passed;
+}
+
+/**
+ * Run one task on a robot that answers slower than the sampling interval, the supervision
+ * task has to find cycles without a new snapshot of the sampling task
+ */
+bool checkSamplingStalls(kostal::Log* log)
+{
+    kostal::SimulatedRobot robot;
+    kostal::StationContext station;
+    if (!setUp(&robot, &station, log)){
+        return false;
+    }
+    robot.setLatency(std::chrono::milliseconds(10));
+    kostal::SyncTaskHandler stHandler;
+    flexiv::Log flexivLog;
+    if (stHandler.runScheduler(&robot, &station, &flexivLog, g_planName) != SUCCESS){
+        log->error("The slow task failed");
+        return false;
+    }
+    bool passed = station.samplingWatch != nullptr && station.samplingStalls > 0;
+    (passed ? log->info("slow robot: the sampling stalled in " + std::to_string(station.samplingStalls)
+                        + " supervision cycles")
+            : log->error("slow robot: no stall of the sampling task was seen"));
+    return passed;
+}
+
+/** Run one task with a fault injected by inject, it has to end with ROBOT */
+bool checkFault(const std::string& name, const std::function<void(kostal::SimulatedRobot*)>& inject,
+                const std::string& planName, kostal::Log* log)
+{
+    kostal::SimulatedRobot robot;
+    kostal::StationContext station;
+    if (!setUp(&robot, &station, log)){
+        return false;
+    }
+    inject(&robot);
+    kostal::SyncTaskHandler stHandler;
+    flexiv::Log flexivLog;
+    Status result = SUCCESS;
+    auto start = Clock::now();
+    try {
+        result = stHandler.runScheduler(&robot, &station, &flexivLog, planName);
+    } catch (const flexiv::Exception& e) {
+        // the plan list is asked for outside of the scheduler
+        log->info(std::string("thrown before the plan: ") + e.what());
+        result = ROBOT;
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    // a fault mid plan has to end the task early, not with the plan
+    bool passed = (result == ROBOT || (name == "fault node" && robot.isFault())) && seconds < g_planSeconds + 0.1;
+    (passed ? log->info(name + ": the task ended after " + std::to_string(static_cast<int>(seconds * 1000)) + " ms")
+            : log->error(name + ": the task was not ended by the fault"));
+    return passed;
+}
+
+bool checkFaults(kostal::Log* log)
+{
+    bool passed = checkFault("fault node", [](kostal::SimulatedRobot* robot){
+        robot->injectFault("Press", false);
+    }, g_planName, log);
+    passed &= checkFault("throwing call", [](kostal::SimulatedRobot* robot){
+        robot->throwOnCall(50);
+    }, g_planName, log);
+    passed &= checkFault("lost connection", [](kostal::SimulatedRobot* robot){
+        robot->setConnected(false);
+    }, g_planName, log);
+    passed &= checkFault("unknown plan", [](kostal::SimulatedRobot*){}, "Kostal-MainPlan-BIAS", log);
+
+    kostal::SimulatedRobot robot;
+    robot.addPlan(kostal::SimulatedRobot::kostalPlan(g_planName, g_planSeconds));
+    robot.injectFault("Press", false);
+    robot.setMode(flexiv::MODE_PLAN_EXECUTION);
+    robot.executePlanByName(g_planName);
+    flexiv::SystemStatus status;
+    while (!robot.isFault()){
+        robot.getSystemStatus(&status);
+    }
+    robot.clearFault();
+    bool sticky = robot.isFault() && !robot.isOperational();
+    if (!sticky){
+        log->error("A fault that can not be cleared was cleared");
+    }
+    return passed && sticky;
+}
+
+}
+
+int main()
+{
+    kostal::Log log;
+    std::string uploadDir = "/tmp/test_sim_robot/";
+    std::filesystem::create_directories(uploadDir + "NORMAL");
+    UPLOADADDRESS = uploadDir;
+    bool passed = true;
+    try {
+        for (int latency : {0, 300}){
+            Cycles cycles;
+            passed &= runTasks(std::chrono::microseconds(latency), &cycles, &log);
+            log.info("rpc latency " + std::to_string(latency) + " us: task cycle (mean | max) = "
+                     + std::to_string(static_cast<int>(cycles.mean * 1000)) + " | "
+                     + std::to_string(static_cast<int>(cycles.max * 1000)) + " ms for a "
+                     + std::to_string(static_cast<int>(g_planSeconds * 1000)) + " ms plan");
+        }
+        passed &= checkSamplingStalls(&log);
+        passed &= checkFaults(&log);
+    } catch (const flexiv::Exception& e) {
+        log.error(e.what());
+        passed = false;
+    }
+    std::filesystem::remove_all(uploadDir);
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,166 @@
+/**
+ * @test test_spi_handoff.cpp
+ * Check the kostal::SPIFrameRing between the spi task and the task that stores
+ * the frames. First one thread pushes numbered frames as fast as it can while
+ * another pops them: every frame has to arrive once and in order. Then measure
+ * how long the spi task stalls handing over the frames of one read:
+ * - before, one mutex is shared with the sampling task, which holds it around
+ *   the 300 us getRobotStates call,
+ * - after, the lock free ring is used while the sampling task takes no lock.
+ * @copyright Copyright (C) 2016-2022 Flexiv Ltd. All Rights Reserved.
+ * @author lcc@Flexiv
+ */
+
+// Kostal header files
+#include <kostal/KostalLogger.hpp>
+#include <kostal/SPIIngest.hpp>
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+/** Reads of the spi task measured for every variant, one every 250 us */
+const int g_readCount = 8000;
+const std::chrono::microseconds g_readInterval(250);
+
+/** Time getRobotStates waits for the robot */
+const std::chrono::microseconds g_robotCall(300);
+
+bool checkOrder(kostal::Log* log)
+{
+    const uint64_t frames = 2000000;
+    kostal::SPIFrameRing ring;
+    std::atomic<bool> done = {false};
+    uint64_t refused = 0;
+    std::thread producer([&]{
+        kostal::SPIFrame frame;
+        for (uint64_t n=0; n<frames; n++){
+            frame.sequence = n;
+            std::memcpy(frame.data, &n, sizeof(n));
+            // a full ring is retried here, so every frame has to arrive
+            while (!ring.push(frame)){
+                refused++;
+                std::this_thread::yield();
+            }
+        }
+        done = true;
+    });
+    uint64_t received = 0;
+    uint64_t last = 0;
+    bool ordered = true;
+    kostal::SPIFrame frame;
+    while (true){
+        // seen before popping, so nothing pushed before done is missed
+        bool finished = done;
+        while (ring.pop(&frame)){
+            uint64_t payload;
+            std::memcpy(&payload, frame.data, sizeof(payload));
+            ordered &= payload == frame.sequence && (received == 0 || frame.sequence > last);
+            last = frame.sequence;
+            received++;
+        }
+        if (finished){
+            break;
+        }
+    }
+    producer.join();
+    bool passed = ordered && received == frames;
+    (passed ? log->info(std::to_string(received) + " frames arrived in order, the full ring refused "
+                        + std::to_string(refused) + " pushes")
+            : log->error("Lost or reordered frames: " + std::to_string(received) + " of "
+                         + std::to_string(frames) + " received"));
+    return passed;
+}
+
+struct Stalls
+{
+    double max = 0;
+    double p99 = 0;
+    double mean = 0;
+};
+
+Stalls describe(std::vector<double> stalls)
+{
+    Stalls result;
+    std::sort(stalls.begin(), stalls.end());
+    result.max = stalls.back();
+    result.p99 = stalls[stalls.size() * 99 / 100];
+    for (double stall : stalls){
+        result.mean += stall;
+    }
+    result.mean /= stalls.size();
+    return result;
+}
+
+/**
+ * Run the spi task against a sampling task at 1 kHz
+ * @param[in] shared whether both share one mutex as before
+ */
+Stalls measure(bool shared)
+{
+    std::mutex dataMutex;
+    kostal::SPIIngest ingest;
+    kostal::SPIFrameRing ring;
+    std::atomic<bool> running = {true};
+    std::thread sampling([&]{
+        auto next = Clock::now();
+        kostal::SPIFrame frame;
+        while (running){
+            next += std::chrono::milliseconds(1);
+            if (shared){
+                std::lock_guard<std::mutex> lock(dataMutex);
+                std::this_thread::sleep_for(g_robotCall);
+                while (ring.pop(&frame)){
+                }
+            }else{
+                std::this_thread::sleep_for(g_robotCall);
+                while (ring.pop(&frame)){
+                }
+            }
+            std::this_thread::sleep_until(next);
+        }
+    });
+    std::vector<double> stalls;
+    stalls.reserve(g_readCount);
+    auto next = Clock::now();
+    for (int i=0; i<g_readCount; i++){
+        next += g_readInterval;
+        std::this_thread::sleep_until(next);
+        // what the device read since the last time, two frames
+        std::memset(ingest.buffer(), i, 32);
+        auto start = Clock::now();
+        if (shared){
+            std::lock_guard<std::mutex> lock(dataMutex);
+            ingest.split(32, i + 1, &ring);
+        }else{
+            ingest.split(32, i + 1, &ring);
+        }
+        stalls.push_back(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+    }
+    running = false;
+    sampling.join();
+    return describe(stalls);
+}
+
+std::string line(const std::string& name, const Stalls& stalls)
+{
+    return name + " spi hand over (mean | p99 | max) = " + std::to_string(stalls.mean) + " | "
+           + std::to_string(stalls.p99) + " | " + std::to_string(stalls.max) + " us";
+}
+
+}
+
+int main()
+{
+    kostal::Log log;
+    bool passed = checkOrder(&log);
+    Stalls before = measure(true);
+    Stalls after = measure(false);
+    log.info(line("shared mutex:", before));
+    log.info(line("lock free ring:", after));
+    if (after.p99 >= before.p99){
+        log.error("The lock free ring does not stall the spi task less");
+        passed = false;
+    }
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,161 @@
+/**
+ * @test test_spi_ingest.cpp
+ * Feed kostal::SPIIngest a stream of numbered 16 byte frames. The stream is cut
+ * into reads of random length, so a read can hold several frames, part of
+ * one, or nothing.
+ * - Every frame has to come out of the ring complete, in order and with
+ *   its sequence number.
+ * - The old path kept the first 16 bytes of a read, so the test also counts
+ *   how many frames that path lost or got wrong.
+ * - A ring nobody empties has to count the frames it refused as overruns.
+ * - The frame rate has to match the read times.
+ * Finally it times one read cycle: the old one zeroed a 10 KB buffer and
+ * copied one frame, the new one splits into the ring.
+ * @copyright Copyright (C) 2016-2022 Flexiv Ltd. All Rights Reserved.
+ * @author lcc@Flexiv
+ */
+
+// Kostal header files
+#include <kostal/KostalLogger.hpp>
+#include <kostal/SPIIngest.hpp>
+
+#include <random>
+
+namespace {
+
+const uint64_t g_frameCount = 100000;
+
+/** The bytes of frame n, every byte tells the frame it belongs to */
+void makeFrame(uint64_t n, uint8_t* frame)
+{
+    for (int i=0; i<16; i++){
+        frame[i] = static_cast<uint8_t>((n * 16 + i) * 7 + (n >> 8));
+    }
+}
+
+bool checkSplitting(kostal::Log* log)
+{
+    std::vector<uint8_t> stream(g_frameCount * 16);
+    for (uint64_t n=0; n<g_frameCount; n++){
+        makeFrame(n, &stream[n * 16]);
+    }
+    std::mt19937 random(11);
+    std::uniform_int_distribution<int> readLength(0, 80);
+    kostal::SPIIngest ingest;
+    kostal::SPIFrameRing ring;
+    uint64_t next = 0;
+    uint64_t wrong = 0;
+    uint64_t oldKept = 0;
+    int64_t readTime = 1;
+    for (size_t offset=0; offset<stream.size(); readTime++){
+        size_t length = std::min<size_t>(readLength(random), stream.size() - offset);
+        std::memcpy(ingest.buffer(), &stream[offset], length);
+        // the old path copied the first 16 bytes and dropped the rest
+        if (length > 0 && offset % 16 == 0 && length >= 16){
+            oldKept++;
+        }
+        ingest.split(static_cast<int32_t>(length), readTime, &ring);
+        offset += length;
+        kostal::SPIFrame frame;
+        while (ring.pop(&frame)){
+            uint8_t expected[16];
+            makeFrame(next, expected);
+            if (frame.sequence != next || std::memcmp(frame.data, expected, 16) != 0 || frame.timestamp != readTime){
+                wrong++;
+            }
+            next++;
+        }
+    }
+    bool passed = next == g_frameCount && wrong == 0 && ingest.frames() == g_frameCount
+                  && ingest.overruns() == 0 && ingest.partialFrames() > 0;
+    (passed ? log->info(std::to_string(next) + " frames out of " + std::to_string(readTime) + " reads, "
+                        + std::to_string(ingest.partialFrames()) + " reads ended inside a frame")
+            : log->error(std::to_string(next) + " frames, " + std::to_string(wrong) + " wrong"));
+    log->info("the first 16 bytes of a read held a whole frame " + std::to_string(oldKept) + " times, "
+              + std::to_string(g_frameCount - oldKept) + " frames lost or cut by the old path");
+    return passed;
+}
+
+bool checkOverruns(kostal::Log* log)
+{
+    kostal::SPIIngest ingest;
+    kostal::SPIFrameRing ring;
+    // two reads of (g_spiRingFrames + 100) / 2 frames
+    const size_t frames = (g_spiRingFrames + 100) / 2;
+    std::memset(ingest.buffer(), 0, frames * 16);
+    ingest.split(static_cast<int32_t>(frames * 16), 1, &ring);
+    ingest.split(static_cast<int32_t>(frames * 16), 2, &ring);
+    kostal::SPIFrame frame;
+    bool oldestKept = ring.pop(&frame) && frame.sequence == 0;
+    bool passed = oldestKept && ring.size() == g_spiRingFrames - 1 && ingest.overruns() == 100;
+    (passed ? log->info("A full ring keeps its frames and counts 100 overruns")
+            : log->error("Wrong overrun accounting: " + ingest.summary()));
+    return passed;
+}
+
+bool checkFrameRate(kostal::Log* log)
+{
+    kostal::SPIIngest ingest;
+    kostal::SPIFrameRing ring;
+    // 2 frames every ms for one second
+    for (int64_t ms=0; ms<=1000; ms++){
+        ingest.split(32, 5000000000 + ms * 1000000, &ring);
+        ring.clear();
+    }
+    bool passed = std::abs(ingest.frameRate() - 2002) < 1;
+    (passed ? log->info(ingest.summary()) : log->error("Wrong frame rate: " + ingest.summary()));
+    return passed;
+}
+
+/** One cycle of the old spi task with one frame in the read */
+uint8_t oldRead(const uint8_t* received, uint8_t* latest)
+{
+    uint8_t read_buffer[10240] = {0};
+    std::memcpy(read_buffer, received, 16);
+    // keeps the zeroing from being optimised away
+    asm volatile("" : : "r"(read_buffer) : "memory");
+    for (int i = 0; i < 16; i++){
+        latest[i] = read_buffer[i];
+    }
+    return latest[0];
+}
+
+void benchmark(kostal::Log* log)
+{
+    const int cycles = 200000;
+    uint8_t received[16];
+    makeFrame(3, received);
+    uint8_t latest[16];
+    unsigned sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i=0; i<cycles; i++){
+        sum += oldRead(received, latest);
+    }
+    double oldNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / cycles;
+
+    kostal::SPIIngest ingest;
+    kostal::SPIFrameRing ring;
+    kostal::SPIFrame frame{};
+    start = std::chrono::steady_clock::now();
+    for (int i=0; i<cycles; i++){
+        std::memcpy(ingest.buffer(), received, 16);
+        ingest.split(16, i, &ring);
+        ring.pop(&frame);
+        sum += frame.data[0];
+    }
+    double newNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / cycles;
+    log->info("one read: zeroed 10 KB buffer " + std::to_string(static_cast<int>(oldNs)) + " ns, split into the ring "
+              + std::to_string(static_cast<int>(newNs)) + " ns (" + std::to_string(sum % 2) + ")");
+}
+
+}
+
+int main()
+{
+    kostal::Log log;
+    bool passed = checkSplitting(&log);
+    passed &= checkOverruns(&log);
+    passed &= checkFrameRate(&log);
+    benchmark(&log);
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,201 @@
+/**
+ * @test test_spi_sources.cpp
+ * Run the spi side of the capture pipeline without a USB-SPI adapter:
+ * - The spi and supervision tasks of a plan run on a flexiv::Scheduler.
+ * - They read a kostal::SyntheticSPISource through SPIOperationHandler into
+ *   the frame store of a station.
+ * - Every frame has to be stored once, in order and with its pattern.
+ * - The achieved frame rate and the overruns are reported for rising rates.
+ * Then a recorded result is replayed:
+ * - At 1x and 10x it has to take the recorded time divided by the speed.
+ * - At full speed all frames have to arrive within the first cycles.
+ * @copyright Copyright (C) 2016-2022 Flexiv Ltd. All Rights Reserved.
+ * @author lcc@Flexiv
+ */
+
+// Kostal header files
+#include <kostal/KostalLogger.hpp>
+#include <kostal/SPIOperation.hpp>
+
+namespace {
+
+struct Run
+{
+    double seconds = 0;
+    uint64_t overruns = 0;
+};
+
+/**
+ * Read a station's spi source like runScheduler does for a plan
+ * @param[in] seconds how long the plan takes, a replay also ends when its frames are done
+ * @param[in] expectedFrames the frames a replay streams, 0 for a synthetic source
+ */
+Run runPlan(kostal::StationContext* station, double seconds, size_t expectedFrames = 0)
+{
+    kostal::SPIOperationHandler spiHandler;
+    flexiv::Log log;
+    station->spiFrames.clear();
+    station->spiRing.clear();
+    station->spiIngest.reset();
+    station->spiSource->start();
+    auto start = std::chrono::steady_clock::now();
+    auto end = start + std::chrono::duration<double>(seconds);
+    {
+        flexiv::Scheduler scheduler;
+        scheduler.addTask([&]{
+            spiHandler.readSPIData(station, &log);
+        }, "Kostal spi", g_spiInterval, g_spiPriority);
+        scheduler.addTask([&]{
+            spiHandler.storeSPIFrames(station);
+            bool replayed = expectedFrames > 0 && station->spiFrames.size() == expectedFrames;
+            if (replayed || std::chrono::steady_clock::now() >= end){
+                scheduler.stop();
+            }
+        }, "Kostal supervision", g_supervisionInterval, g_supervisionPriority);
+        scheduler.start();
+    }
+    spiHandler.storeSPIFrames(station);
+    Run run;
+    run.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    run.overruns = station->spiIngest.overruns();
+    return run;
+}
+
+bool checkSynthetic(double frameRate, kostal::Log* log)
+{
+    kostal::StationContext station;
+    station.spiConfig.source = "SYNTHETIC";
+    station.spiConfig.frameRate = frameRate;
+    kostal::SPIOperationHandler spiHandler;
+    if (spiHandler.buildSPIConnection(&station) != SUCCESS){
+        log->error("The synthetic source can not be connected");
+        return false;
+    }
+    Run run = runPlan(&station, 1);
+    uint64_t wrong = 0;
+    uint64_t random = 0;
+    for (size_t i=0; i<station.spiFrames.size(); i++){
+        uint8_t expected[16];
+        kostal::SyntheticSPISource::makeFrame("COUNTER", station.spiFrames.sequence(i), frameRate, &random, expected);
+        // frames refused by the full ring leave gaps in the sequence, never a wrong frame
+        bool ordered = i == 0 || station.spiFrames.sequence(i) > station.spiFrames.sequence(i - 1);
+        if (!ordered || std::memcmp(expected, station.spiFrames.frame(i), 16) != 0){
+            wrong++;
+        }
+    }
+    double achieved = station.spiFrames.size() / run.seconds;
+    log->info("synthetic " + std::to_string(static_cast<int>(frameRate)) + " frames/s: stored "
+              + std::to_string(static_cast<int>(achieved)) + " frames/s, " + std::to_string(run.overruns)
+              + " overruns, " + std::to_string(wrong) + " wrong frames");
+    // the supervision task empties the ring every 5 ms, up to this rate nothing may be lost
+    bool fits = frameRate * g_supervisionInterval / 1000 < g_spiRingFrames / 2;
+    bool passed = wrong == 0 && (!fits || (run.overruns == 0 && std::abs(achieved - frameRate) < frameRate * 0.05));
+    if (!passed){
+        log->error("The synthetic frames were not stored as generated");
+    }
+    return passed;
+}
+
+bool checkPatterns(kostal::Log* log)
+{
+    uint64_t random = 1;
+    uint8_t frame[16];
+    kostal::SyntheticSPISource::makeFrame("WALKING", 77, 1000, &random, frame);
+    int ones = 0;
+    for (int i=0; i<16; i++){
+        ones += __builtin_popcount(frame[i]);
+    }
+    bool walking = ones == 1 && frame[9] == (1 << 5);
+    uint8_t open[16], switched[16];
+    kostal::SyntheticSPISource::makeFrame("LEVER", 499, 1000, &random, open);
+    kostal::SyntheticSPISource::makeFrame("LEVER", 500, 1000, &random, switched);
+    bool lever = open[0] == 0 && switched[0] == 1;
+    kostal::StationContext station;
+    station.spiConfig.source = "SYNTHETIC";
+    station.spiConfig.pattern = "SQUARE";
+    kostal::SPIOperationHandler spiHandler;
+    bool unknownRefused = spiHandler.buildSPIConnection(&station) == SPI && station.spiSource == nullptr;
+    station.spiConfig.source = "USB";
+    unknownRefused &= spiHandler.buildSPIConnection(&station) == SPI;
+    bool passed = walking && lever && unknownRefused;
+    (passed ? log->info("The synthetic patterns are right and unknown sources are refused")
+            : log->error("Wrong synthetic pattern or an unknown source was accepted"));
+    return passed;
+}
+
+/** A result as writeDataToExcel writes it, 1 kHz samples and a frame every 2 ms */
+std::string writeRecording(size_t frames)
+{
+    std::string path = "/tmp/test_spi_sources_recording.csv";
+    std::ofstream file(path);
+    file << "NodeName,";
+    for (int s=0; s<2; s++){
+        for (int i=0; i<8; i++){
+            file << "SPI" << s << "-" << i << ",";
+        }
+    }
+    file << "Time_us,SPI_Offset_us,SPI_Seq," << std::endl;
+    for (size_t row=0; row<frames * 2; row++){
+        file << "Start,";
+        size_t frame = row / 2;
+        for (int i=0; i<16; i++){
+            file << std::setfill('0') << std::setw(2) << std::hex << (frame * 16 + i) % 256 << ",";
+        }
+        // the frame was read 300 us before its first sample
+        int64_t offset = (row % 2 == 0) ? -300 : -1300;
+        file << std::dec << row * 1000 << "," << offset << "," << frame << "," << std::endl;
+    }
+    return path;
+}
+
+bool checkReplay(kostal::Log* log)
+{
+    const size_t frames = 500;
+    kostal::StationContext station;
+    station.spiConfig.source = "REPLAY";
+    station.spiConfig.replayFile = writeRecording(frames);
+    kostal::SPIOperationHandler spiHandler;
+    bool passed = true;
+    for (double speed : {1.0, 10.0, 0.0}){
+        station.spiConfig.replaySpeed = speed;
+        if (spiHandler.buildSPIConnection(&station) != SUCCESS){
+            log->error("The recording can not be replayed");
+            return false;
+        }
+        Run run = runPlan(&station, 5, frames);
+        bool same = station.spiFrames.size() == frames;
+        for (size_t i=0; same && i<frames; i++){
+            same = station.spiFrames.frame(i)[3] == static_cast<uint8_t>((i * 16 + 3) % 256);
+        }
+        // the frames span 998 ms, the run ends with the supervision cycle after the last one
+        double expected = (speed == 0) ? 0 : 0.998 / speed;
+        bool timed = std::abs(run.seconds - expected) < 0.02 + expected * 0.02;
+        log->info("replay at " + (speed == 0 ? std::string("full speed") : std::to_string(static_cast<int>(speed)) + "x")
+                  + ": " + std::to_string(station.spiFrames.size()) + " frames in "
+                  + std::to_string(static_cast<int>(run.seconds * 1000)) + " ms");
+        if (!same || !timed){
+            log->error("The replayed frames or their timing differ from the recording");
+            passed = false;
+        }
+    }
+    std::remove(station.spiConfig.replayFile.c_str());
+    return passed;
+}
+
+}
+
+int main()
+{
+    kostal::Log log;
+    bool passed = checkPatterns(&log);
+    try {
+        for (double rate : {1000.0, 10000.0, 50000.0, 200000.0}){
+            passed &= checkSynthetic(rate, &log);
+        }
+        passed &= checkReplay(&log);
+    } catch (const flexiv::Exception& e) {
+        log.error(e.what());
+        passed = false;
+    }
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,184 @@
+/**
+ * @test test_state_poller.cpp
+ * Check the kostal::StatePoller that shares the robot states of a station.
+ * First one thread publishes numbered snapshots as fast as it can while
+ * several consumers read their StateTripleBuffer: a snapshot must never be
+ * torn and the versions seen must only rise. Then consumers at 1 kHz follow a
+ * kostal::SimulatedRobot running a plan:
+ * - before, every consumer calls getPlanInfo and getRobotStates itself,
+ * - after, one poller calls the robot and the consumers subscribe.
+ * The robot calls are reported for a rising number of consumers.
+ * @copyright Copyright (C) 2016-2022 Flexiv Ltd. All Rights Reserved.
+ * @author lcc@Flexiv
+ */
+
+// Kostal header files
+#include <kostal/KostalLogger.hpp>
+#include <kostal/SimulatedRobot.hpp>
+#include <kostal/StatePoller.hpp>
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+/** How long the consumers follow the robot */
+const std::chrono::milliseconds g_followTime(500);
+
+/** Whether every field of a snapshot belongs to the same publish */
+bool consistent(const kostal::RobotSnapshot& snapshot)
+{
+    double value = static_cast<double>(snapshot.version);
+    for (const auto* field : {&snapshot.q, &snapshot.tau, &snapshot.tcpPose, &snapshot.flangePose}){
+        for (double element : *field){
+            if (element != value){
+                return false;
+            }
+        }
+    }
+    for (double element : snapshot.rawExtForceInTcpFrame){
+        if (element != value){
+            return false;
+        }
+    }
+    return std::to_string(snapshot.version) == snapshot.node();
+}
+
+bool checkConsistency(kostal::Log* log)
+{
+    const auto publishTime = std::chrono::milliseconds(300);
+    const int consumers = 3;
+    kostal::StatePoller poller;
+    std::vector<kostal::StateTripleBuffer*> buffers;
+    for (int i=0; i<consumers; i++){
+        buffers.push_back(poller.subscribe());
+    }
+    std::atomic<bool> done = {false};
+    std::atomic<uint64_t> torn = {0};
+    std::atomic<uint64_t> reordered = {0};
+    std::atomic<uint64_t> seen = {0};
+    std::vector<std::thread> readers;
+    for (kostal::StateTripleBuffer* buffer : buffers){
+        readers.emplace_back([&, buffer]{
+            uint64_t last = 0;
+            while (!done){
+                if (!buffer->update()){
+                    continue;
+                }
+                const kostal::RobotSnapshot& snapshot = buffer->latest();
+                torn += !consistent(snapshot);
+                reordered += snapshot.version <= last;
+                last = snapshot.version;
+                seen++;
+            }
+        });
+    }
+    kostal::RobotSnapshot snapshot;
+    uint64_t publishes = 0;
+    auto end = Clock::now() + publishTime;
+    for (uint64_t n=1; Clock::now() < end; n++){
+        publishes = n;
+        snapshot.version = n;
+        double value = static_cast<double>(n);
+        snapshot.q.fill(value);
+        snapshot.tau.fill(value);
+        snapshot.tcpPose.fill(value);
+        snapshot.flangePose.fill(value);
+        snapshot.rawExtForceInTcpFrame.fill(value);
+        std::string node = std::to_string(n);
+        std::memcpy(snapshot.nodeName, node.c_str(), node.size() + 1);
+        poller.publish(snapshot);
+        // lets the consumers run when they share a core with the publisher
+        if (n % 64 == 0){
+            std::this_thread::yield();
+        }
+    }
+    done = true;
+    for (std::thread& reader : readers){
+        reader.join();
+    }
+    // every consumer ends with the last snapshot
+    bool latest = true;
+    for (kostal::StateTripleBuffer* buffer : buffers){
+        buffer->update();
+        latest &= buffer->latest().version == publishes;
+    }
+    bool full = poller.subscribe() != nullptr;
+    for (size_t i=consumers + 1; i<g_stateSubscribers; i++){
+        poller.subscribe();
+    }
+    full = full && poller.subscribe() == nullptr;
+    bool passed = torn == 0 && reordered == 0 && latest && full;
+    (passed ? log->info(std::to_string(seen) + " of " + std::to_string(publishes) + " snapshots read by " + std::to_string(consumers)
+                        + " consumers, none torn or out of order")
+            : log->error("Torn or reordered snapshots: " + std::to_string(torn) + " torn, "
+                         + std::to_string(reordered) + " reordered"));
+    return passed;
+}
+
+/**
+ * Let consumers follow a running plan at 1 kHz
+ * @param[in] shared whether they subscribe to one poller instead of calling the robot
+ * @return the robot calls per second
+ */
+double follow(int consumers, bool shared)
+{
+    kostal::SimulatedRobot robot;
+    robot.addPlan(kostal::SimulatedRobot::kostalPlan("Kostal-MainPlan-NORMAL", 1.0));
+    robot.setMode(flexiv::MODE_PLAN_EXECUTION);
+    robot.executePlanByName("Kostal-MainPlan-NORMAL");
+    uint64_t before = robot.calls();
+    kostal::StatePoller poller;
+    std::atomic<bool> running = {true};
+    std::vector<std::thread> threads;
+    auto cycle = [&running](const std::function<void()>& work){
+        auto next = Clock::now();
+        while (running){
+            work();
+            next += std::chrono::milliseconds(1);
+            std::this_thread::sleep_until(next);
+        }
+    };
+    if (shared){
+        threads.emplace_back(cycle, [&]{ poller.poll(&robot); });
+    }
+    for (int i=0; i<consumers; i++){
+        if (shared){
+            kostal::StateTripleBuffer* buffer = poller.subscribe();
+            threads.emplace_back(cycle, [buffer]{ buffer->update(); });
+        }else{
+            auto planInfo = std::make_shared<flexiv::PlanInfo>();
+            auto robotStates = std::make_shared<flexiv::RobotStates>();
+            threads.emplace_back(cycle, [&robot, planInfo, robotStates]{
+                robot.getPlanInfo(planInfo.get());
+                robot.getRobotStates(robotStates.get());
+            });
+        }
+    }
+    std::this_thread::sleep_for(g_followTime);
+    running = false;
+    for (std::thread& thread : threads){
+        thread.join();
+    }
+    return (robot.calls() - before) / std::chrono::duration<double>(g_followTime).count();
+}
+
+}
+
+int main()
+{
+    kostal::Log log;
+    bool passed = checkConsistency(&log);
+    for (int consumers : {1, 4, 8}){
+        double before = follow(consumers, false);
+        double after = follow(consumers, true);
+        log.info(std::to_string(consumers) + " consumers at 1 kHz: " + std::to_string(static_cast<int>(before))
+                 + " robot calls/s each calling the robot, " + std::to_string(static_cast<int>(after))
+                 + " calls/s through the poller");
+        // one poll is two calls per cycle, whatever the number of consumers
+        if (after > 2200 || (consumers > 1 && after >= before)){
+            log.error("The robot calls grow with the consumers of the poller");
+            passed = false;
+        }
+    }
+    return passed ? 0 : 1;
+}
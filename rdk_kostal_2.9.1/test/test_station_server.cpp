@@ -0,0 +1,81 @@
+/**
+ * @test test_station_server.cpp
+ * Serve several lever test cells from one process. Every station has its own
+ * Rizon and USB-SPI adapter, Testman picks one with the STATION key of its
+ * handshake.
+ * Usage: test_station_server [robot_address spi_device_index]...
+ * Without arguments one station is served with ROBOTADDRESS and SPI device 0.
+ * A robot address "sim" or "sim:plans.json" serves the station with a
+ * kostal::SimulatedRobot instead, running 1 s plans for Kostal-MainPlan with
+ * the types NORMAL, BIAS and DUMMY or the plans of the json file.
+ * @copyright Copyright (C) 2016-2022 Flexiv Ltd. All Rights Reserved.
+ * @author lcc@Flexiv
+ */
+
+// Kostal header files
+#include <kostal/Communication.hpp>
+#include <kostal/SimulatedRobot.hpp>
+
+namespace {
+
+std::unique_ptr<kostal::RobotClient> makeRobot(const std::string& address, flexiv::Log* log)
+{
+    if (address.compare(0, 3, "sim") != 0){
+        return std::make_unique<kostal::FlexivRobotClient>(address, LOCALADDRESS);
+    }
+    auto robot = std::make_unique<kostal::SimulatedRobot>();
+    if (address.size() > 4 && address[3] == ':'){
+        if (robot->loadPlans(address.substr(4), log) != SUCCESS){
+            return nullptr;
+        }
+    }else{
+        for (const char* type : {"NORMAL", "BIAS", "DUMMY"}){
+            robot->addPlan(kostal::SimulatedRobot::kostalPlan(std::string("Kostal-MainPlan-") + type, 1.0));
+        }
+    }
+    return robot;
+}
+
+}
+
+int main(int argc, char* argv[]){
+    flexiv::Log log;
+    std::vector<std::pair<std::string, int>> stationArgs;
+    for (int i=1; i+1<argc; i+=2){
+        stationArgs.emplace_back(argv[i], std::stoi(argv[i+1]));
+    }
+    if (stationArgs.empty()){
+        stationArgs.emplace_back(ROBOTADDRESS, 0);
+    }
+    try{
+        std::vector<std::unique_ptr<kostal::RobotClient>> robots;
+        // one handler per station, kept across client sessions
+        std::vector<std::unique_ptr<kostal::CommHandler>> handlers;
+        kostal::StationServer server;
+        for (auto& stationArg : stationArgs){
+            robots.push_back(makeRobot(stationArg.first, &log));
+            if (robots.back() == nullptr){
+                return 1;
+            }
+            auto station = std::make_unique<kostal::StationContext>();
+            station->robotPtr = robots.back().get();
+            station->spiDeviceIndex = stationArg.second;
+            handlers.push_back(std::make_unique<kostal::CommHandler>(station.get()));
+            kostal::CommHandler* com = handlers.back().get();
+            server.addStation(std::move(station),
+                [com](std::shared_ptr<kostal::Server> session, kostal::StationContext*){
+                    com->serveSession(session);
+                });
+        }
+        if (server.start() != SUCCESS){
+            return 1;
+        }
+        // the stations are served by their own workers until the process is killed
+        while (true){
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+        }
+    } catch(const flexiv::Exception& e){
+        log.error(e.what());
+    }
+    return 0;
+}
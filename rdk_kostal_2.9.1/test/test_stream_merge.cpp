@@ -0,0 +1,161 @@
+/**
+ * @test test_stream_merge.cpp
+ * Check how kostal::SPIAligner pairs timestamped robot samples with spi
+ * frames, both stamped on their own. Checked for both align modes against a
+ * search over all frames, with 250 us frames and a 10 ms gap in the spi stream:
+ * - every sample gets the right frame,
+ * - a frame outside the tolerance is left out,
+ * - PREVIOUS never pairs a sample with a frame from its future.
+ * Then, with both streams at 1 ms and a random phase, it measures how
+ * precisely a lever switch is located:
+ * - from the first row that shows it, as the old sample-and-hold pairing did,
+ * - from the time offset of that row's frame.
+ * @copyright Copyright (C) 2016-2022 Flexiv Ltd. All Rights Reserved.
+ * @author lcc@Flexiv
+ */
+
+// Kostal header files
+#include <kostal/KostalLogger.hpp>
+#include <kostal/StreamAligner.hpp>
+
+#include <random>
+
+namespace {
+
+const int64_t g_samplePeriodNs = 1000000;
+// spi frames are read with the same 1 ms interval as the robot samples
+const int64_t g_framePeriodNs = 1000000;
+const int64_t g_sampleCount = 2000;
+
+/** Robot samples at 1 kHz, phase shifted against the frames */
+void fillSamples(kostal::CaptureStore* capture, int64_t phaseNs, int64_t count = g_sampleCount)
+{
+    const double pose[7] = {0};
+    for (int64_t i=0; i<count; i++){
+        capture->append(pose, pose, pose, capture->internNode("Start"), phaseNs + i * g_samplePeriodNs);
+    }
+}
+
+/** Periodic frames, the first byte is 1 once the lever switched, a gap leaves frames out */
+void fillFrames(kostal::SPIFrameStore* frames, int64_t periodNs, int64_t switchNs,
+                int64_t gapBeginNs = -1, int64_t gapEndNs = -1)
+{
+    int64_t end = g_sampleCount * g_samplePeriodNs + g_samplePeriodNs;
+    for (int64_t t=0; t<end; t+=periodNs){
+        if (t >= gapBeginNs && t < gapEndNs){
+            continue;
+        }
+        uint8_t frame[16] = {0};
+        frame[0] = (t >= switchNs) ? 1 : 0;
+        frame[1] = static_cast<uint8_t>(t / periodNs);
+        frames->append(frame, t, t / periodNs);
+    }
+}
+
+/** The frame a sample should get, searched over all frames */
+bool expectedFrame(const kostal::SPIFrameStore& frames, int64_t t, AlignMode mode, int64_t toleranceNs, size_t* index)
+{
+    int64_t best = -1;
+    for (size_t i=0; i<frames.size(); i++){
+        int64_t distance = t - frames.timestamp(i);
+        if (mode == NEAREST){
+            distance = std::abs(distance);
+        }
+        if (distance >= 0 && (best < 0 || distance < best)){
+            best = distance;
+            *index = i;
+        }
+    }
+    return best >= 0 && best <= toleranceNs;
+}
+
+bool checkAlignment(AlignMode mode, kostal::Log* log)
+{
+    kostal::CaptureStore capture;
+    kostal::SPIFrameStore frames;
+    fillSamples(&capture, 90000, g_sampleCount / 4);
+    // no frames between 200 ms and 210 ms
+    fillFrames(&frames, 250000, 0, 200000000, 210000000);
+    kostal::SPIAligner aligner(frames, mode, 2000);
+    int wrong = 0;
+    int unaligned = 0;
+    for (size_t row=0; row<capture.size(); row++){
+        int64_t t = capture.timestamp(row);
+        size_t frame = 0, expected = 0;
+        bool aligned = aligner.align(t, &frame);
+        if (aligned != expectedFrame(frames, t, mode, 2000000, &expected) || (aligned && frame != expected)){
+            wrong++;
+        }
+        if (mode == PREVIOUS && aligned && frames.timestamp(frame) > t){
+            wrong++;
+        }
+        unaligned += aligned ? 0 : 1;
+    }
+    // samples deeper than 2 ms into the gap get no frame
+    int expectedUnaligned = (mode == NEAREST) ? 6 : 8;
+    bool passed = wrong == 0 && unaligned == expectedUnaligned;
+    std::string name = (mode == NEAREST) ? "NEAREST" : "PREVIOUS";
+    (passed ? log->info(name + ": every sample got its frame, " + std::to_string(unaligned) + " samples in the gap got none")
+            : log->error(name + ": " + std::to_string(wrong) + " wrong frames and " + std::to_string(unaligned)
+                         + " samples without frame"));
+    return passed;
+}
+
+/**
+ * Locate a lever switch from the merged rows
+ * @return the error of the old and the new estimate [us]
+ */
+std::pair<double, double> locateSwitch(int64_t switchNs, int64_t phaseNs)
+{
+    kostal::CaptureStore capture;
+    kostal::SPIFrameStore frames;
+    fillSamples(&capture, phaseNs);
+    fillFrames(&frames, g_framePeriodNs, switchNs);
+    kostal::SPIAligner aligner(frames, PREVIOUS, 2000);
+    for (size_t row=0; row<capture.size(); row++){
+        size_t frame;
+        if (aligner.align(capture.timestamp(row), &frame) && frames.frame(frame)[0] == 1){
+            // the old csv only has the row, the new one also tells when its frame was read
+            double rowError = (capture.timestamp(row) - switchNs) / 1000.0;
+            double frameError = (frames.timestamp(frame) - switchNs) / 1000.0;
+            return {rowError, frameError};
+        }
+    }
+    return {-1, -1};
+}
+
+}
+
+int main()
+{
+    kostal::Log log;
+    bool passed = true;
+    passed &= checkAlignment(NEAREST, &log);
+    passed &= checkAlignment(PREVIOUS, &log);
+
+    std::mt19937_64 random(7);
+    std::uniform_int_distribution<int64_t> switchTime(100000000, 1900000000);
+    std::uniform_int_distribution<int64_t> phase(0, g_samplePeriodNs - 1);
+    double rowError = 0, frameError = 0, worstRow = 0, worstFrame = 0;
+    const int trials = 500;
+    for (int i=0; i<trials; i++){
+        auto errors = locateSwitch(switchTime(random), phase(random));
+        if (errors.first < 0 || errors.second < 0){
+            log.error("The switch was not found in the merged rows");
+            return 1;
+        }
+        rowError += errors.first;
+        frameError += errors.second;
+        worstRow = std::max(worstRow, errors.first);
+        worstFrame = std::max(worstFrame, errors.second);
+    }
+    log.info("lever switch located by row (mean | max) = " + std::to_string(static_cast<int>(rowError / trials))
+             + " | " + std::to_string(static_cast<int>(worstRow)) + " us");
+    log.info("lever switch located by frame offset (mean | max) = " + std::to_string(static_cast<int>(frameError / trials))
+             + " | " + std::to_string(static_cast<int>(worstFrame)) + " us");
+    if (worstFrame >= g_framePeriodNs / 1000.0 || frameError >= rowError){
+        log.error("The frame offset is less precise than one spi frame");
+        passed = false;
+    }
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,414 @@
+/**
+ * @test test_task_queue.cpp
+ * Benchmark station throughput with queued plans. A simulated station runs
+ * every plan for a fixed robot time plus a fixed export time, the way
+ * kostal::CommHandler drains its kostal::TaskQueue, and reports each result
+ * as a TASK_DONE event. Three Testman clients are compared: one task per
+ * request with status polls in between, one batch message listing all plans,
+ * and tasks queued with TASKENQUEUE while the station is BUSY. The queue is
+ * also stressed with concurrent pushes while the executor retires, and a
+ * kostal::CommHandler on a kostal::SimulatedRobot has to answer a polling
+ * client REJECTED for an enqueue it can not queue.
+ * @copyright Copyright (C) 2016-2022 Flexiv Ltd. All Rights Reserved.
+ * @author lcc@Flexiv
+ */
+
+// Kostal header files
+#include <kostal/SyncServer.hpp>
+#include <kostal/TaskQueue.hpp>
+#include <kostal/Communication.hpp>
+#include <kostal/SimulatedRobot.hpp>
+
+#include <filesystem>
+
+namespace {
+
+/** Port used by this test, so that a running station is not disturbed */
+const unsigned short g_testPort = 6120;
+
+/** Plans run by every client */
+const int g_planCount = 12;
+
+/** Robot time of one simulated plan */
+const std::chrono::milliseconds g_planDuration(40);
+
+/** Time to export the result of one plan */
+const std::chrono::milliseconds g_exportDuration(10);
+
+/** Status poll interval of the polling client, as Testman polls */
+const std::chrono::milliseconds g_pollInterval(10);
+
+typedef std::chrono::steady_clock Clock;
+
+/** A station that drains its task queue like CommHandler, with sleeps as robot and export */
+class SimulatedStation
+{
+public:
+    kostal::Server server;
+    kostal::TaskQueue taskQueue;
+    std::atomic<serverStatus> status = {IDLE};
+    std::thread executor;
+    std::vector<std::string> executed;
+
+    void executeTasks()
+    {
+        kostal::TaskRequest task;
+        while (taskQueue.pop(&task, [this]{ status = IDLE; })){
+            std::this_thread::sleep_for(g_planDuration + g_exportDuration);
+            executed.push_back(task.taskName);
+            taskQueue.report([&](size_t waiting){
+                server.publishTaskDone(waiting > 0 ? "BUSY" : "IDLE", task, UPLOADADDRESS + task.taskType + "/" + task.taskName + ".csv");
+            });
+        }
+    }
+
+    Status enqueue(std::string_view taskMsg, kostal::JSONMessageHandler* parser, kostal::Log* log)
+    {
+        std::vector<kostal::TaskRequest> tasks;
+        bool enqueueFlag;
+        if (parser->parseTasks(taskMsg, &tasks, &enqueueFlag, log) != SUCCESS){
+            return JSON;
+        }
+        bool startExecutor;
+        bool queued = taskQueue.push(tasks, &startExecutor, [this]{
+            if (status != BUSY){
+                status = BUSY;
+                server.publishStatus("BUSY");
+            }
+        });
+        if (!queued){
+            return SYSTEM;
+        }
+        if (startExecutor){
+            if (executor.joinable()){
+                executor.join();
+            }
+            executor = std::thread([this]{ executeTasks(); });
+        }
+        return SUCCESS;
+    }
+
+    /** The notify state machine of CommHandler without robot */
+    void serve()
+    {
+        kostal::JSONMessageHandler parser;
+        kostal::JSONMessageHandler requestParser;
+        kostal::Log log;
+        server.setPortNumber(g_testPort);
+        if (server.init() != SUCCESS){
+            return;
+        }
+        server.publishStatus("IDLE");
+        while (true){
+            Status result = server.monitor([&](std::string_view request){
+                std::string queryStatus;
+                if (status == BUSY){
+                    return requestParser.isEnqueueRequest(request);
+                }
+                return requestParser.parseJSON(request, &queryStatus, &log) == SUCCESS
+                       && kostal::JSONMessageHandler::isYes(queryStatus);
+            });
+            if (result != SUCCESS){
+                break;
+            }
+            result = enqueue(server.getRecvView(), &parser, &log);
+            server.send(result == SUCCESS ? "BUSY" : "REJECTED");
+        }
+        if (executor.joinable()){
+            executor.join();
+        }
+    }
+};
+
+class Client
+{
+public:
+    boost::asio::io_context ioContext;
+    boost::asio::ip::tcp::socket socket;
+    boost::asio::streambuf buffer;
+    std::vector<std::string> events;
+
+    /**
+     * @param[in] port the port of the station
+     * @param[in] notify whether the client asks for NOTIFY or polls
+     */
+    explicit Client(unsigned short port = g_testPort, bool notify = true)
+    : socket(ioContext)
+    {
+        boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::address_v4::loopback(), port);
+        boost::system::error_code ec;
+        for (int i=0; i<1000; i++){
+            socket.connect(endpoint, ec);
+            if (!ec) break;
+            socket.close();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        Json::Value config;
+        config[CPOL] = "0";
+        config[CPHA] = "1";
+        config[LSB] = "0";
+        config[SELP] = "0";
+        config[TOKEN] = g_TOKEN;
+        config[SPISOURCE] = "SYNTHETIC";
+        if (notify){
+            config[NOTIFY] = "yes";
+        }
+        send(config);
+        readFrame();
+    }
+
+    void send(const Json::Value& message)
+    {
+        boost::asio::write(socket, boost::asio::buffer(Json::FastWriter().write(message)));
+    }
+
+    static Json::Value task(int index, const std::string& queryStatus)
+    {
+        Json::Value message;
+        message[QUERYSTATUS] = queryStatus;
+        message[TASKTYPE] = "NORMAL";
+        message[TASKNAME] = "Variant" + std::to_string(index);
+        return message;
+    }
+
+    std::string readFrame()
+    {
+        size_t n = boost::asio::read_until(socket, buffer, '\n');
+        std::string frame(static_cast<const char*>(buffer.data().data()), n - 1);
+        buffer.consume(n);
+        return frame;
+    }
+
+    /** Read the reply of a request, pushed events are kept for later */
+    std::string readReply()
+    {
+        while (true){
+            std::string frame = readFrame();
+            if (frame.empty() || frame[0] != '{'){
+                return frame;
+            }
+            events.push_back(frame);
+        }
+    }
+
+    /** Wait for the next TASK_DONE event and return the name of the task */
+    std::string waitTaskDone()
+    {
+        while (true){
+            std::string event;
+            if (!events.empty()){
+                event = events.front();
+                events.erase(events.begin());
+            }else{
+                event = readFrame();
+            }
+            Json::Value value;
+            if (Json::Reader().parse(event, value) && value.isObject()
+                && value[SYSTEMEVENT].asString() == EVENTTASKDONE){
+                return value[TASKNAME].asString();
+            }
+        }
+    }
+};
+
+/** One task per request, the client polls until the station is IDLE again */
+void sequentialClient(Client* client, std::vector<std::string>* done)
+{
+    for (int i=0; i<g_planCount; i++){
+        client->send(Client::task(i, "yes"));
+        client->readReply();
+        while (true){
+            std::this_thread::sleep_for(g_pollInterval);
+            client->send(Client::task(i, "no"));
+            if (client->readReply() == "IDLE"){
+                break;
+            }
+        }
+        done->push_back(client->waitTaskDone());
+    }
+}
+
+/** All plans in one TASKLIST message */
+void batchClient(Client* client, std::vector<std::string>* done)
+{
+    Json::Value batch;
+    batch[QUERYSTATUS] = "yes";
+    for (int i=0; i<g_planCount; i++){
+        Json::Value task;
+        task[TASKTYPE] = "NORMAL";
+        task[TASKNAME] = "Variant" + std::to_string(i);
+        batch[TASKLIST].append(task);
+    }
+    client->send(batch);
+    client->readReply();
+    for (int i=0; i<g_planCount; i++){
+        done->push_back(client->waitTaskDone());
+    }
+}
+
+/** The next plan is queued with TASKENQUEUE as soon as the previous one starts */
+void enqueueClient(Client* client, std::vector<std::string>* done)
+{
+    for (int i=0; i<g_planCount; i++){
+        Json::Value task = Client::task(i, "yes");
+        task[TASKENQUEUE] = "yes";
+        client->send(task);
+        client->readReply();
+        if (i > 0){
+            done->push_back(client->waitTaskDone());
+        }
+    }
+    done->push_back(client->waitTaskDone());
+}
+
+bool benchmark(const std::string& name, void (*client)(Client*, std::vector<std::string>*), kostal::Log* log)
+{
+    SimulatedStation station;
+    spdlog::set_level(spdlog::level::off);
+    std::thread serving([&]{ station.serve(); });
+    std::vector<std::string> done;
+    auto tic = Clock::now();
+    {
+        Client testman;
+        client(&testman, &done);
+    }
+    auto toc = Clock::now();
+    serving.join();
+    spdlog::set_level(spdlog::level::info);
+
+    bool passed = static_cast<int>(done.size()) == g_planCount && done == station.executed;
+    for (int i=0; passed && i<g_planCount; i++){
+        passed = done[i] == "Variant" + std::to_string(i);
+    }
+    double seconds = std::chrono::duration<double>(toc - tic).count();
+    double ideal = g_planCount * std::chrono::duration<double>(g_planDuration + g_exportDuration).count();
+    log->info(name + ": " + std::to_string(static_cast<int64_t>(g_planCount / seconds * 3600))
+              + " parts per hour, station busy " + std::to_string(static_cast<int>(100 * ideal / seconds)) + "% of the time");
+    if (!passed){
+        log->error(name + ": the results did not arrive in plan order");
+    }
+    return passed;
+}
+
+/** A full queue rejects a batch as a whole */
+bool rejectWhenFull(kostal::Log* log)
+{
+    kostal::TaskQueue queue(4);
+    bool start = false;
+    std::vector<kostal::TaskRequest> three(3, kostal::TaskRequest{"NORMAL", "Variant"});
+    bool passed = queue.push(three, &start) && start;
+    passed &= !queue.push(three, &start) && queue.size() == 3;
+    passed &= queue.push({kostal::TaskRequest{"NORMAL", "Last"}}, &start) && !start;
+    (passed ? log->info("A full queue rejects the whole batch")
+            : log->error("The queue accepted more tasks than its capacity"));
+    return passed;
+}
+
+/** A polling client gets REJECTED for an enqueue the station can not queue, BUSY otherwise */
+bool rejectEnqueueWhenBusy(kostal::Log* log)
+{
+    const std::string directory = "/tmp/test_task_queue/";
+    std::filesystem::create_directories(directory + "NORMAL");
+    UPLOADADDRESS = directory;
+    kostal::SimulatedRobot robot;
+    robot.addPlan(kostal::SimulatedRobot::kostalPlan("Variant0-NORMAL", 1));
+    robot.addPlan(kostal::SimulatedRobot::kostalPlan("Variant1-NORMAL", 0.1));
+    kostal::CommHandler handler;
+    spdlog::set_level(spdlog::level::off);
+    std::thread station([&]{
+        if (handler.init(&robot) == SUCCESS){
+            handler.stateMachine(&robot);
+        }
+    });
+    std::vector<std::string> replies;
+    {
+        Client testman(g_COMMPORT, false);
+        // the task is answered with IDLE and queued after the next request is answered
+        testman.send(Client::task(0, "yes"));
+        replies.push_back(testman.readReply());
+        testman.send(Client::task(0, "no"));
+        replies.push_back(testman.readReply());
+        // more tasks than the queue holds
+        Json::Value batch;
+        batch[QUERYSTATUS] = "yes";
+        batch[TASKENQUEUE] = "yes";
+        for (size_t i=0; i<=g_taskQueueSize; i++){
+            batch[TASKLIST].append(Client::task(1, "yes"));
+        }
+        testman.send(batch);
+        replies.push_back(testman.readReply());
+        // no task in it
+        Json::Value empty;
+        empty[QUERYSTATUS] = "yes";
+        empty[TASKENQUEUE] = "yes";
+        testman.send(empty);
+        replies.push_back(testman.readReply());
+        Json::Value task = Client::task(1, "yes");
+        task[TASKENQUEUE] = "yes";
+        testman.send(task);
+        replies.push_back(testman.readReply());
+    }
+    station.join();
+    spdlog::set_level(spdlog::level::info);
+    std::filesystem::remove_all(directory);
+
+    std::vector<std::string> expected = {"IDLE", "BUSY", "REJECTED", "REJECTED", "BUSY"};
+    bool passed = replies == expected;
+    std::string answered;
+    for (const std::string& reply : replies){
+        answered += " " + reply;
+    }
+    (passed ? log->info("A polling client gets REJECTED for a full queue and a bad task:" + answered)
+            : log->error("A polling client was answered" + answered));
+    return passed;
+}
+
+/** Tasks pushed while the executor retires are never lost or run twice */
+bool stress(kostal::Log* log)
+{
+    kostal::TaskQueue queue(1000);
+    std::atomic<int> executed = {0};
+    std::atomic<int> executors = {0};
+    std::vector<std::thread> threads;
+    std::mutex threadsMutex;
+    const int pushes = 20000;
+    for (int i=0; i<pushes; i++){
+        bool start;
+        while (!queue.push({kostal::TaskRequest{"NORMAL", "Variant"}}, &start)){
+            std::this_thread::yield();
+        }
+        if (start){
+            executors++;
+            std::lock_guard<std::mutex> lock(threadsMutex);
+            threads.emplace_back([&]{
+                kostal::TaskRequest task;
+                while (queue.pop(&task)){
+                    executed++;
+                }
+                executors--;
+            });
+        }
+    }
+    for (auto& thread : threads){
+        thread.join();
+    }
+    bool passed = executed == pushes && executors == 0;
+    (passed ? log->info("Concurrent pushes ran every task once with " + std::to_string(threads.size()) + " executor starts")
+            : log->error("Concurrent pushes ran " + std::to_string(executed) + " of " + std::to_string(pushes) + " tasks"));
+    return passed;
+}
+
+}
+
+int main()
+{
+    kostal::Log log;
+    bool passed = true;
+    passed &= rejectWhenFull(&log);
+    passed &= stress(&log);
+    passed &= rejectEnqueueWhenBusy(&log);
+    passed &= benchmark("one task per request", sequentialClient, &log);
+    passed &= benchmark("batch message", batchClient, &log);
+    passed &= benchmark("queued while busy", enqueueClient, &log);
+    return passed ? 0 : 1;
+}